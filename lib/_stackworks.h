@@ -21,21 +21,29 @@ static const stack_content_t ___STACK_CONTENT_OR_POISON_IS_NOT_DEFINED___ = STAC
 //*   #include "stackworks.h"
 
 #include <stdalign.h>
+#include <stddef.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
 #include "util/dbg/debug.h"
 #include "util/dbg/logger.h"
+#include "util/dbg/tracer.h"
 #include "stackreports.h"
+#include "stackscanner.h"
+#include "stacktrimmer.h"
+#include "stackdump.h"
+#include "stackbudget.h"
+#include "stackframe.h"
 
-#ifndef NCANARY
-#define ON_CANARY(...) __VA_ARGS__
+//* Stacks of integers (STACK_INTEGER_CONTENT defined before the include) can keep cold elements compressed
+//* and track aggregates of their elements.
+#ifdef STACK_INTEGER_CONTENT
+#define ON_INTEGER(...) __VA_ARGS__
+#include "util/intpack.h"
+#include "util/vecscan.h"
 #else
-#define ON_CANARY(...)
-#endif
-
-#ifndef NHASH
-#define ON_HASH(...) __VA_ARGS__
-#else
-#define ON_HASH(...)
+#define ON_INTEGER(...)
 #endif
 
 // TODO: Make a separate structure for stack statuses.
@@ -47,26 +55,215 @@ static const char* const STACK_STATUS_DESCR[] = {
     "Stack right canary is corrupt.",
     "Stack buffer left canary is corrupt.",
     "Stack buffer right canary is corrupt.",
-    "Stack hash was wrong."
+    "Stack hash was wrong.",
+    "Stack aggregates do not match its elements."
 };
 
-#define STACK_CANARY_VALUE "CANARY"
-typedef char stack_canary_t[7];
 typedef hash_t stack_hash_t;
+typedef uintptr_t stack_mark_t;
 
 static const size_t STACK_BUFFER_INCREASE = 2;
 
-struct Stack {
-    ON_CANARY(stack_canary_t _canary_left = STACK_CANARY_VALUE;)
+static const size_t STACK_FORK_CAPACITY = 16;
+
+static const unsigned int STACK_SAVEPOINT_CAPACITY = 4;
+
+//* Number of elements compressed at once, the buffer of a packed stack holds up to two such blocks.
+#ifndef STACK_PACK_BLOCK
+#define STACK_PACK_BLOCK 1024
+#endif
+
+//* Buffers of at least this many bytes are mmap-ed, so that they are resized in place.
+#ifndef STACK_MMAP_THRESHOLD
+#define STACK_MMAP_THRESHOLD (1 << 20)
+#endif
+
+//* Mapped buffers move back to the heap once they shrink below this many bytes, the gap keeps a stack
+//* that oscillates around STACK_MMAP_THRESHOLD from moving back and forth.
+#ifndef STACK_UNMAP_THRESHOLD
+#define STACK_UNMAP_THRESHOLD (STACK_MMAP_THRESHOLD / 4)
+#endif
+
+//* Advice used to return pages of mapped buffers that are no longer used (MADV_DONTNEED or MADV_FREE).
+#ifndef STACK_MADVISE_ADVICE
+#define STACK_MADVISE_ADVICE MADV_DONTNEED
+#endif
+
+static const size_t STACK_CACHE_LINE = 64;
 
+enum STACK_TRIM_STATES {
+    STACK_TRIM_OFF = 0,     // Stack is not registered in the trimmer.
+    STACK_TRIM_FREE = 1,    // Stack is registered and nobody uses it.
+    STACK_TRIM_BUSY = 2,    // Stack is used by its owner or by the trimmer.
+};
+
+//* Alignment of the stack structure and of its groups of fields. Cache line size keeps stacks allocated next to each
+//* other (and the groups of fields of one stack) from sharing cache lines, 8 packs them tightly.
+#ifndef STACK_ALIGNMENT
+#define STACK_ALIGNMENT 64
+#endif
+
+#ifndef STACK_HASH_BLOCK
+#define STACK_HASH_BLOCK 256
+#endif
+
+//* Buffers of at least this many bytes are hashed by several threads.
+#ifndef STACK_PARALLEL_HASH_MIN
+#define STACK_PARALLEL_HASH_MIN (1 << 22)
+#endif
+
+#ifndef STACK_HASH_MAX_THREADS
+#define STACK_HASH_MAX_THREADS 16
+#endif
+
+/**
+ * @brief Part of the buffer hashed by one thread.
+ * 
+ * @param start first byte of the part
+ * @param end byte after the last one
+ * @param blocks array to put checksums of the blocks of the part into (NULL if they are not needed)
+ * @param part hash of the part without the seed
+ * @param thread thread the part is hashed by
+ * @param started true if the part is hashed by a separate thread
+ */
+struct StackHashTask {
+    const char* start = NULL;
+    const char* end = NULL;
+    stack_hash_t* blocks = NULL;
+    stack_hash_t part = 0;
+    pthread_t thread = {};
+    bool started = false;
+};
+
+/**
+ * @brief Minimum, maximum and sum of the elements of the stack.
+ * 
+ * @param min smallest element
+ * @param max biggest element
+ * @param sum sum of the elements (wraps around on overflow)
+ */
+struct StackAggregate {
+    stack_content_t min = {};
+    stack_content_t max = {};
+    stack_content_t sum = {};
+};
+
+/**
+ * @brief Frozen part of the stack shared between its forks.
+ * 
+ * @param buffer canary-framed buffer with the elements of the segment
+ * @param size number of elements in the segment
+ * @param capacity number of cells in the buffer
+ * @param depth number of elements in the segment and all segments below it
+ * @param mapped length of the mapping if the buffer is mmap-ed, 0 otherwise
+ * @param group budget group the buffer is charged to
+ * @param charged number of bytes charged to the budget for the buffer
+ * @param packed number of bytes of compressed elements, 0 if the elements are stored as is
+ * @param top last element of the segment (for compressed segments)
+ * @param hash hash of the buffer calculated when the segment was frozen
+ * @param aggregate aggregates of the elements of the segment and all segments below it (if they are tracked)
+ * @param refs number of stacks and segments referencing the segment
+ * @param parent segment lying below this one
+ */
+struct StackSegment {
     char* buffer = NULL;
     uintptr_t size = 0;
     uintptr_t capacity = 0;
+    uintptr_t depth = 0;
+    size_t mapped = 0;
+    int group = STACK_BUDGET_DEFAULT_GROUP;
+    size_t charged = 0;
+    size_t packed = 0;
+    stack_content_t top = {};
+    stack_hash_t hash = 0;
+    StackAggregate aggregate = {};
+    unsigned int refs = 0;
+    StackSegment* parent = NULL;
+};
 
+struct alignas(STACK_ALIGNMENT) Stack {
+    //* Fields read only by checks, or only by batches, reservations and savepoints, come first behind the left canary.
+    ON_CANARY(stack_canary_t _canary_left = STACK_CANARY_VALUE;)
     ON_HASH(stack_hash_t _hash = 0;)
+
+    uintptr_t _reserved = 0;        // Number of cells handed out by stack_reserve() and not published yet.
+    stack_mark_t* _savepoints = NULL;       // Held savepoints from the outermost one, there are _marks of them.
+    unsigned int _savepoint_capacity = 0;   // Number of savepoints _savepoints has room for.
+    ON_HASH(size_t _block_count = 0;)       // Number of allocated block checksums.
+    ON_HASH(size_t _dirty_first = 0;)       // Cells modified in the open batch whose checksums are not updated yet.
+    ON_HASH(size_t _dirty_last = 0;)
+
+    //* Fields used by each push and pop, including the incremental hashing state, share one cache line.
+    alignas(STACK_ALIGNMENT) char* buffer = NULL;
+    uintptr_t size = 0;
+    uintptr_t capacity = 0;
+
+    ON_HASH(stack_hash_t* _blocks = NULL;)  // Checksums of STACK_HASH_BLOCK-byte blocks of the buffer.
+    ON_HASH(stack_hash_t _digest = 0;)      // Hash of the buffer combined from block checksums.
+
+    StackAggregate* _aggregates = NULL;  // Running aggregates of each element of the buffer, NULL if not tracked.
+    unsigned int _seq = 0;          // Seqlock counter, odd while the stack is being modified.
+    bool _inline_checks = true;     // Check stack status before and after each operation.
+    bool _batch = false;            // Modifications are batched: they share one write section, one check and one rehash.
+    bool _packed = false;           // Elements below the two top blocks are compressed into segments.
+    unsigned char _trim = STACK_TRIM_OFF;  // Lock shared with the idle trimmer (one of STACK_TRIM_STATES).
+
+    //* Fields used when the stack is resized, forked, registered or checked.
+    //* Frozen elements shared with forks of the stack, lie below the buffer.
+    alignas(STACK_ALIGNMENT) StackSegment* _prefix = NULL;
+    size_t _mapped = 0;             // Length of the mapping if the buffer is mmap-ed, 0 if it is allocated by calloc().
+    size_t _charged = 0;            // Number of bytes charged to the budget for the buffer.
+    size_t _resizes = 0;            // Number of times the buffer was reallocated or remapped to change its capacity.
+    size_t _aggregate_capacity = 0; // Number of elements the aggregate array has room for.
+    int _group = STACK_BUDGET_DEFAULT_GROUP;  // Budget group the buffer is charged to.
+    unsigned int _marks = 0;        // Number of savepoints held, buffer is not shrunk while there are any.
+    unsigned int _oplog_id = 0;     // Id of the stack in the operation log, 0 until its first operation is logged.
+    bool _watched = false;          // Stack is registered in the background scanner.
+    bool _external = false;         // Buffer was provided by the caller and has no canaries.
+    bool _owned = true;             // Buffer is freed by the stack.
+
     ON_CANARY(stack_canary_t _canary_right = STACK_CANARY_VALUE;)
 };
 
+static_assert(offsetof(Stack, _trim) + sizeof(unsigned char) - offsetof(Stack, buffer) <= STACK_CACHE_LINE,
+              "Fields used by each operation do not fit into one cache line.");
+
+
+/**
+ * @brief Read-only view of the elements of the stack.
+ * Becomes stale as soon as the stack is modified.
+ * 
+ * @param stack stack the view belongs to
+ * @param begin deepest element
+ * @param end cell after the top element
+ * @param seq modification counter of the stack at the moment the view was taken
+ */
+struct StackView {
+    const Stack* stack = NULL;
+    const stack_content_t* begin = NULL;
+    const stack_content_t* end = NULL;
+    unsigned int seq = 0;
+};
+
+/**
+ * @brief Contiguous run of elements visited by _stack_next_chunk().
+ * 
+ * @param values elements of the chunk, from the deepest one
+ * @param count number of elements in the chunk
+ * @param above number of elements of the stack above the chunk
+ * @param segment segment the chunk belongs to (NULL for the buffer)
+ * @param started true after the first call of _stack_next_chunk()
+ * @param decoded elements of a compressed segment
+ */
+struct StackChunk {
+    const stack_content_t* values = NULL;
+    size_t count = 0;
+    uintptr_t above = 0;
+    const StackSegment* segment = NULL;
+    bool started = false;
+    ON_INTEGER(stack_content_t decoded[STACK_PACK_BLOCK];)
+};
+
 /**
  * @brief Initialize stack.
  * 
@@ -111,7 +308,141 @@ void stack_pop(Stack* const stack, int* const err_code = NULL);
 stack_content_t stack_get(Stack* const stack, int* const err_code = NULL);
 
 /**
- * @brief Return status of the stack.
+ * @brief Make a copy of the stack in O(1) by sharing its elements.
+ * Current elements of the source are frozen into a reference-counted segment both stacks continue from,
+ * the segment is copied only when one of them pops below it.
+ * Source that holds a savepoint, an open reservation or an open batch can not be forked (EBUSY).
+ * 
+ * @param source structure to copy
+ * @param fork uninitialized structure to fill
+ * @param err_code variable to fill with error code
+ */
+void stack_fork(Stack* const source, Stack* const fork, int* const err_code = NULL);
+
+/**
+ * @brief Get writable cells on top of the stack to fill without per-element calls.
+ * Stack is marked as being modified until stack_publish(), no other operation may be done on it until then.
+ * 
+ * @param stack structure to write into
+ * @param count number of cells to reserve
+ * @param err_code variable to fill with error code
+ * @return stack_content_t* first reserved cell
+ */
+stack_content_t* stack_reserve(Stack* const stack, const size_t count, int* const err_code = NULL);
+
+/**
+ * @brief Add the first written cells of the reservation to the stack with one hash update.
+ * Cells that were reserved but not published are poisoned back.
+ * 
+ * @param stack structure to modify
+ * @param written number of cells filled since stack_reserve()
+ * @param err_code variable to fill with error code
+ */
+void stack_publish(Stack* const stack, const size_t written, int* const err_code = NULL);
+
+/**
+ * @brief Validate the stack once and get read-only access to its top elements.
+ * Elements shared with forks of the stack are not accessible this way.
+ * 
+ * @param stack structure to read
+ * @param count number of top elements to read
+ * @param err_code variable to fill with error code
+ * @return const stack_content_t* pointer to the deepest of the requested elements (the top one is the last)
+ */
+const stack_content_t* stack_read_top(Stack* const stack, const size_t count, int* const err_code = NULL);
+
+/**
+ * @brief Get view of the elements of the stack for iteration from begin to end.
+ * Elements shared with forks of the stack are not included.
+ * 
+ * @param stack structure to look into
+ * @param err_code variable to fill with error code
+ * @return StackView 
+ */
+StackView stack_view(const Stack* const stack, int* const err_code = NULL);
+
+/**
+ * @brief Get element of the view, checking that it is in range and that the stack was not modified.
+ * 
+ * @param view 
+ * @param index index of the element counting from the bottom
+ * @param err_code variable to fill with error code (ERANGE or ESTALE)
+ * @return stack_content_t 
+ */
+stack_content_t stack_view_at(const StackView* const view, const size_t index, int* const err_code = NULL);
+
+/**
+ * @brief Initialize stack over the buffer provided by the caller without copying it.
+ * Cells in [size, capacity) are poisoned. The buffer has no canaries, 
+ * it is replaced by an own one when the stack needs to grow or shrink.
+ * 
+ * @param stack structure to initialize
+ * @param data buffer with the elements
+ * @param size number of elements in the buffer
+ * @param capacity number of cells in the buffer
+ * @param owned true to pass the buffer to the stack (it must be allocated by malloc()), 
+ *              false to only wrap it (the caller frees it after the stack is destroyed)
+ * @param err_code variable to fill with error code
+ */
+void stack_adopt(Stack* const stack, stack_content_t* const data, const size_t size, const size_t capacity,
+                 const bool owned, int* const err_code = NULL);
+
+/**
+ * @brief Take the elements out of the stack without copying and leave the stack destroyed.
+ * Fails with EBUSY if the stack shares elements with its forks or holds savepoints or reservations.
+ * 
+ * @param stack structure to release
+ * @param size variable to put number of elements into
+ * @param err_code variable to fill with error code
+ * @return stack_content_t* array of elements the caller has to free() if the buffer was owned by the stack, 
+ *                          the wrapped buffer otherwise
+ */
+stack_content_t* stack_release(Stack* const stack, size_t* const size, int* const err_code = NULL);
+
+/**
+ * @brief Get number of elements in the stack including the shared ones.
+ * 
+ * @param stack 
+ * @return uintptr_t 
+ */
+uintptr_t stack_size(const Stack* const stack);
+
+/**
+ * @brief Remember current stack size as a savepoint.
+ * Buffer is not shrunk and the stack can not be forked until the savepoint is released 
+ * by stack_rollback() or stack_commit(). Stack with an open reservation can not be marked (EBUSY).
+ * 
+ * @param stack structure to mark
+ * @param err_code variable to fill with error code
+ * @return stack_mark_t 
+ */
+stack_mark_t stack_mark(Stack* const stack, int* const err_code = NULL);
+
+/**
+ * @brief Remove all elements pushed after the savepoint and release it.
+ * Elements are poisoned in one pass and the hash is updated incrementally.
+ * Savepoints are nested, so only the innermost held one can be rolled back to (ERANGE otherwise).
+ * If the stack was popped below the savepoint, it is released without changing the stack and ERANGE is reported.
+ * 
+ * @param stack structure to modify
+ * @param mark savepoint returned by stack_mark()
+ * @param err_code variable to fill with error code
+ */
+void stack_rollback(Stack* const stack, const stack_mark_t mark, int* const err_code = NULL);
+
+/**
+ * @brief Release the savepoint keeping the elements pushed after it.
+ * Savepoints are nested, so only the innermost held one can be released (ERANGE otherwise).
+ * Savepoint can not be released while a reservation is open (EBUSY).
+ * 
+ * @param stack structure to modify
+ * @param mark savepoint returned by stack_mark()
+ * @param err_code variable to fill with error code
+ */
+void stack_commit(Stack* const stack, const stack_mark_t mark, int* const err_code = NULL);
+
+/**
+ * @brief Return status of the stack, including its shared segments.
  * 
  * @param stack structure to check
  * @return stack_report_t 
@@ -119,13 +450,272 @@ stack_content_t stack_get(Stack* const stack, int* const err_code = NULL);
 stack_report_t stack_status(const Stack* const stack);
 
 /**
- * @brief Check if variable stores canary value.
+ * @brief Return status of the stack if it is not being modified by another thread.
+ * Is safe to call concurrently with one writer if buffers of the stack are freed under stack_scanner_lock().
+ * 
+ * @param stack structure to check
+ * @param snapshot copy of the stack header the check was performed on
+ * @param consistent set to false if the stack was modified during the check
+ * @return stack_report_t 
+ */
+stack_report_t stack_scan_status(const Stack* const stack, Stack* const snapshot, bool* const consistent);
+
+/**
+ * @brief Copy buffers of the snapshot taken by stack_scan_status() and dump the copy if the stack was not modified.
+ * Is safe to call under the same conditions as stack_scan_status().
+ * 
+ * @param stack scanned stack
+ * @param snapshot copy of the stack header returned by stack_scan_status()
+ * @param importance importance of the dump
+ * @return true if the dump was written, false if the stack was modified or its buffers could not be copied
+ */
+bool stack_scan_dump(const Stack* const stack, const Stack* const snapshot, const int importance);
+
+/**
+ * @brief Enable or disable status checks before and after each operation.
+ * Hash is kept up to date either way, so the stack can still be checked by the background scanner.
+ * 
+ * @param stack structure to modify
+ * @param enabled true to check the stack on each operation
+ * @param err_code variable to fill with error code
+ */
+void stack_set_inline_checks(Stack* const stack, const bool enabled, int* const err_code = NULL);
+
+/**
+ * @brief Start a batch of modifications.
+ * Until stack_batch_end() the stack is checked and rehashed only once, and the scanner skips it as being modified.
+ * Only push, pop, get, reserve and publish may be used inside the batch.
+ * 
+ * @param stack structure to modify
+ * @param err_code variable to fill with error code
+ */
+void stack_batch_begin(Stack* const stack, int* const err_code = NULL);
+
+/**
+ * @brief Finish the batch: update the hash of cells modified in it and check the stack.
+ * 
+ * @param stack structure to modify
+ * @param err_code variable to fill with error code
+ */
+void stack_batch_end(Stack* const stack, int* const err_code = NULL);
+
+/**
+ * @brief Start a batch that is guarded by full checks, whether inline checks of the stack are enabled or not.
+ * The stack is dumped if it is invalid.
+ * 
+ * @param stack structure to modify
+ * @param err_code variable to fill with error code (EINVAL if the stack is invalid)
+ */
+void stack_scope_begin(Stack* const stack, int* const err_code = NULL);
+
+/**
+ * @brief Finish the batch started by stack_scope_begin() and check the whole stack, dumping it on failure.
+ * 
+ * @param stack structure to modify
+ * @param err_code variable to fill with error code (EAGAIN if the stack was corrupted inside the scope)
+ */
+void stack_scope_end(Stack* const stack, int* const err_code = NULL);
+
+/**
+ * @brief Block of code in which the stack is checked only on entry and on exit (see stack_scope_begin()).
+ * 
+ * @param stack guarded stack, NULL if the stack was invalid on entry
+ * @param status error code of the scope
+ */
+struct StackCheckScope {
+    Stack* stack;
+    int status;
+
+    explicit StackCheckScope(Stack* const guarded) : stack(guarded), status(0) {
+        stack_scope_begin(stack, &status);
+        if (status) stack = NULL;
+    }
+    ~StackCheckScope() { close(); }
+
+    /**
+     * @brief Finish the scope before the end of the block.
+     * 
+     * @return error code of the scope
+     */
+    int close() {
+        if (stack) stack_scope_end(stack, &status);
+        stack = NULL;
+        return status;
+    }
+
+    StackCheckScope(const StackCheckScope&) = delete;
+    StackCheckScope& operator=(const StackCheckScope&) = delete;
+};
+
+/**
+ * @brief Register stack in the background scanner.
  * 
- * @param value variable to check
- * @return true
- * @return false 
+ * @param stack structure to register
+ * @param scan function the scanner will check the stack with
+ * @param err_code variable to fill with error code
+ */
+void stack_watch(Stack* const stack, scan_function_t* scan, int* const err_code = NULL);
+
+/**
+ * @brief Remove stack from the background scanner registry.
+ * 
+ * @param stack structure to remove
+ * @param err_code variable to fill with error code
  */
-bool stack_check_canary(const stack_canary_t value);
+void stack_unwatch(Stack* const stack, int* const err_code = NULL);
+
+/**
+ * @brief Register stack in the idle trimmer, so that its buffer is shrunk when it is not modified for a while.
+ * From now on each operation on the stack should be done inside a StackAccess.
+ * 
+ * @param stack structure to register
+ * @param trim function the trimmer will trim the stack with
+ * @param err_code variable to fill with error code
+ */
+void stack_watch_idle(Stack* const stack, trim_function_t* trim, int* const err_code = NULL);
+
+/**
+ * @brief Remove stack from the idle trimmer registry.
+ * 
+ * @param stack structure to remove
+ * @param err_code variable to fill with error code
+ */
+void stack_unwatch_idle(Stack* const stack, int* const err_code = NULL);
+
+/**
+ * @brief Shrink the buffer to the stack size plus headroom.
+ * 
+ * @param stack structure to trim
+ * @param headroom number of free cells to leave
+ * @param err_code variable to fill with error code (EBUSY if there is an open batch, reservation or savepoint)
+ */
+void stack_trim(Stack* const stack, const size_t headroom, int* const err_code = NULL);
+
+/**
+ * @brief Take the trimmer lock of the stack if it is registered in the trimmer, waiting while the trimmer uses it.
+ * 
+ * @param stack stack to lock (can be NULL)
+ * @return true if the lock is taken
+ */
+bool _stack_access_begin(Stack* const stack);
+
+/**
+ * @brief Release the trimmer lock taken by _stack_access_begin().
+ * 
+ * @param stack locked stack
+ */
+void _stack_access_end(Stack* const stack);
+
+/**
+ * @brief Operation on the stack, the trimmer does not touch the stack while it lasts.
+ * Does nothing for stacks that are not registered in the trimmer.
+ * 
+ * @param stack stack in use
+ * @param locked true if the trimmer lock of the stack is taken
+ */
+struct StackAccess {
+    Stack* stack;
+    bool locked;
+
+    explicit StackAccess(Stack* const used) : stack(used), locked(_stack_access_begin(used)) {}
+    ~StackAccess() { if (locked) _stack_access_end(stack); }
+
+    StackAccess(const StackAccess&) = delete;
+    StackAccess& operator=(const StackAccess&) = delete;
+};
+
+/**
+ * @brief Enable or disable compression of cold elements.
+ * Only stacks of integers (STACK_INTEGER_CONTENT) can be compressed.
+ * 
+ * @param stack stack to modify
+ * @param enabled true to keep all but the two top blocks of elements compressed
+ * @param err_code variable to fill with error code
+ */
+void stack_set_packed(Stack* const stack, const bool enabled, int* const err_code = NULL);
+
+/**
+ * @brief Enable or disable tracking of the minimum, maximum and sum of the elements.
+ * Only stacks of integers (STACK_INTEGER_CONTENT) can track aggregates, tracking can only be enabled on empty stack.
+ * 
+ * @param stack stack to modify
+ * @param enabled true to keep running aggregates of the elements in an array next to the buffer
+ * @param err_code variable to fill with error code
+ */
+void stack_track_aggregates(Stack* const stack, const bool enabled, int* const err_code = NULL);
+
+/**
+ * @brief Get the minimum, maximum and sum of the elements in O(1).
+ * 
+ * @param stack stack to look into
+ * @param err_code variable to fill with error code (ENOENT if aggregates are not tracked, ENXIO if the stack is empty)
+ * @return StackAggregate
+ */
+StackAggregate stack_aggregate(const Stack* const stack, int* const err_code = NULL);
+
+/**
+ * @brief Find the occurrence of the value that is closest to the top.
+ * Only stacks of integers (STACK_INTEGER_CONTENT) can be searched.
+ * 
+ * @param stack stack to search in
+ * @param value value to find
+ * @param err_code variable to fill with error code
+ * @return intptr_t number of elements above the occurrence, -1 if the value is not in the stack
+ */
+intptr_t stack_find(const Stack* const stack, const stack_content_t value, int* const err_code = NULL);
+
+/**
+ * @brief Count occurrences of the value.
+ * Only stacks of integers (STACK_INTEGER_CONTENT) can be searched.
+ * 
+ * @param stack stack to search in
+ * @param value value to count
+ * @param err_code variable to fill with error code
+ * @return uintptr_t
+ */
+uintptr_t stack_count(const Stack* const stack, const stack_content_t value, int* const err_code = NULL);
+
+/**
+ * @brief Calculate the minimum, maximum and sum of the elements by scanning them.
+ * Unlike stack_aggregate() does not need aggregates to be tracked.
+ * 
+ * @param stack stack to look into
+ * @param err_code variable to fill with error code (ENXIO if the stack is empty)
+ * @return StackAggregate
+ */
+StackAggregate stack_reduce(const Stack* const stack, int* const err_code = NULL);
+
+/**
+ * @brief Calculate get_hash() of the elements from the deepest one to the top.
+ * Unlike the stack hash it does not depend on addresses and capacity of buffers,
+ * so stacks with equal elements have equal content hashes even in different processes.
+ * 
+ * @param stack stack to hash
+ * @param err_code variable to fill with error code
+ * @return stack_hash_t 
+ */
+stack_hash_t stack_content_hash(const Stack* const stack, int* const err_code = NULL);
+
+/**
+ * @brief Move the stack into another budget group.
+ * Buffers the stack allocates after that are limited by the budget of the group.
+ * 
+ * @param stack stack to move
+ * @param group index of the group
+ * @param err_code variable to fill with error code
+ */
+void stack_set_budget_group(Stack* const stack, const int group, int* const err_code = NULL);
+
+/**
+ * @brief Get amount of memory used by the stack.
+ * 
+ * @param stack structure to check
+ * @param resident variable to put number of bytes backed by physical memory into
+ * @param reserved variable to put number of allocated bytes into
+ * @param err_code variable to fill with error code
+ */
+void stack_memory_usage(const Stack* const stack, size_t* const resident, size_t* const reserved, 
+                        int* const err_code = NULL);
 
 #ifndef STACK_DUMP_MAX_LINES
 #define STACK_DUMP_MAX_LINES 64
@@ -143,6 +733,17 @@ bool stack_check_canary(const stack_canary_t value);
 #define stack_dump(stack, importance) _stack_dump(stack, importance, __PRETTY_FUNCTION__, __LINE__, __FILE__)
 void _stack_dump(Stack* const stack, int importance, const char* function, const size_t line, const char* file);
 
+/**
+ * @brief Dump the whole stack into the dedicated stream without line limits.
+ * 
+ * @param stack structure to dump
+ * @param stream stream to write into
+ * @param mode dump format (one of STACK_DUMP_MODES)
+ * @param err_code variable to fill with error code
+ */
+void stack_dump_stream(const Stack* const stack, StackDumpStream* const stream, const int mode = STACK_DUMP_TEXT,
+                       int* const err_code = NULL);
+
 /**
  * @brief Change the size of the stack.
  * 
@@ -161,6 +762,269 @@ void _stack_change_size(Stack* const stack, const size_t new_size, int* const er
  */
 char* _stack_alloc_space(const size_t count, int* const err_code = NULL);
 
+/**
+ * @brief Free stack buffer so that the background scanner does not read it after release.
+ * 
+ * @param stack owner of the buffer
+ * @param buffer buffer to free
+ * @param mapped length of the mapping if the buffer is mmap-ed
+ */
+void _stack_free_space(const Stack* const stack, char* const buffer, const size_t mapped = 0);
+
+/**
+ * @brief Update the budget charge of the stack to the new buffer length.
+ * 
+ * @param stack stack to charge
+ * @param bytes length of the buffer the stack is going to own
+ * @param force charge even if the budget is exceeded
+ * @return true if the charge was accepted
+ */
+bool _stack_charge(Stack* const stack, const size_t bytes, const bool force = false);
+
+/**
+ * @brief Resize mmap-ed buffer in place, moving the right canary and returning unused pages to the system.
+ * Buffer that is not mapped yet is copied into a new mapping.
+ * 
+ * @param stack structure to modify
+ * @param new_size new capacity of the stack
+ * @param err_code variable to fill with error code
+ */
+void _stack_remap(Stack* const stack, const size_t new_size, int* const err_code = NULL);
+
+/**
+ * @brief Freeze stack elements into a segment shared with its forks.
+ * 
+ * @param stack structure to modify
+ * @param err_code variable to fill with error code
+ */
+void _stack_freeze(Stack* const stack, int* const err_code = NULL);
+
+/**
+ * @brief Move the top shared segment into the buffer of the empty stack, copying it if it is still shared.
+ * 
+ * @param stack structure to modify
+ * @param err_code variable to fill with error code
+ */
+void _stack_unshare(Stack* const stack, int* const err_code = NULL);
+
+/**
+ * @brief Drop one reference to the segment and free segments that are no longer used.
+ * 
+ * @param segment 
+ */
+void _stack_release_segment(StackSegment* segment);
+
+/**
+ * @brief Compress the bottom STACK_PACK_BLOCK elements of the buffer into a new segment.
+ * 
+ * @param stack structure to modify
+ * @param err_code variable to fill with error code
+ */
+void _stack_pack(Stack* const stack, int* const err_code = NULL);
+
+/**
+ * @brief Decode compressed segment into a new buffer.
+ * 
+ * @param segment segment to decode
+ * @param capacity capacity of the buffer
+ * @param err_code variable to fill with error code
+ * @return char* canary-framed buffer
+ */
+char* _stack_unpack_segment(const StackSegment* const segment, const size_t capacity, int* const err_code = NULL);
+
+/**
+ * @brief Get length of the segment buffer in bytes.
+ * 
+ * @param segment 
+ * @return size_t 
+ */
+size_t _stack_segment_length(const StackSegment* const segment);
+
+/**
+ * @brief Move to the next run of elements, going from the top of the stack to the bottom.
+ * Compressed segments are decoded into the chunk.
+ * 
+ * @param stack stack to look into
+ * @param chunk default-constructed chunk before the first call
+ * @return true if there was one more chunk
+ */
+bool _stack_next_chunk(const Stack* const stack, StackChunk* const chunk);
+
+/**
+ * @brief Resize the aggregate array, keeping aggregates of the elements that fit into it.
+ * 
+ * @param stack structure to modify
+ * @param capacity number of elements the array should have room for
+ * @param err_code variable to fill with error code
+ */
+void _stack_aggregate_resize(Stack* const stack, const size_t capacity, int* const err_code = NULL);
+
+/**
+ * @brief Make sure the aggregate array has room for the given number of elements, growing it if needed.
+ * Is called before the write section the elements are added in.
+ * 
+ * @param stack structure to modify
+ * @param count number of elements
+ * @param err_code variable to fill with error code
+ */
+void _stack_aggregate_fit(Stack* const stack, const size_t count, int* const err_code = NULL);
+
+/**
+ * @brief Add the value to the aggregates of the elements below it.
+ * 
+ * @param below aggregates of the elements below the value, NULL if there are none
+ * @param value new element
+ * @return StackAggregate 
+ */
+StackAggregate _stack_aggregate_next(const StackAggregate* const below, const stack_content_t value);
+
+/**
+ * @brief Get aggregates of the elements lying below the buffer in the shared segments.
+ * 
+ * @param stack stack to look into
+ * @param base variable to put the aggregates into
+ * @return true if there are elements below the buffer
+ */
+bool _stack_aggregate_base(const Stack* const stack, StackAggregate* const base);
+
+/**
+ * @brief Get aggregates of all elements of the stack.
+ * 
+ * @param stack stack to look into
+ * @param base variable to put the aggregates into if they are not stored in the array
+ * @return const StackAggregate* aggregates, NULL if the stack is empty
+ */
+const StackAggregate* _stack_aggregate_top(const Stack* const stack, StackAggregate* const base);
+
+/**
+ * @brief Write running aggregates of the elements placed into the buffer starting from the given cell.
+ * The array should already have room for them.
+ * 
+ * @param stack stack the elements belong to
+ * @param first index of the first element
+ * @param values elements
+ * @param count number of elements
+ */
+void _stack_aggregate_write(Stack* const stack, const size_t first, const stack_content_t* const values, 
+                            const size_t count);
+
+/**
+ * @brief Recalculate running aggregates from the elements and compare them with the stored ones.
+ * 
+ * @param stack stack to check
+ * @return true if the stored aggregates are correct
+ */
+bool _stack_aggregate_match(const Stack* const stack);
+
+/**
+ * @brief Detach and free the aggregate array.
+ * 
+ * @param stack structure to modify
+ */
+void _stack_drop_aggregates(Stack* const stack);
+
+/**
+ * @brief Calculate hash of the segment buffer.
+ * 
+ * @param segment 
+ * @return stack_hash_t 
+ */
+stack_hash_t _stack_segment_hash(const StackSegment* const segment);
+
+/**
+ * @brief Check canaries and hash of one shared segment.
+ * 
+ * @param segment 
+ * @return stack_report_t 
+ */
+stack_report_t _stack_segment_status(const StackSegment* const segment);
+
+/**
+ * @brief Check canaries and hashes of the shared segments of the stack.
+ * 
+ * @param stack 
+ * @return stack_report_t 
+ */
+stack_report_t _stack_prefix_status(const Stack* const stack);
+
+/**
+ * @brief Gather elements of the shared segments and the buffer of the stack into one array for the dump.
+ * 
+ * @param stack structure to dump
+ * @param source description of the buffer, moved to the gathered array on success
+ * @return stack_content_t* gathered array to free after the dump, NULL if segments could not be read safely
+ */
+stack_content_t* _stack_dump_gather(const Stack* const stack, StackDumpSource* const source);
+
+/**
+ * @brief Number of cells of the buffer that can be read even if the capacity of the stack is corrupt.
+ * 
+ * @param stack 
+ * @return size_t 
+ */
+size_t _stack_readable_capacity(const Stack* const stack);
+
+/**
+ * @brief Return status of the stack.
+ * 
+ * @param stack structure to check
+ * @param segments true to also check the shared segments
+ * @return stack_report_t 
+ */
+stack_report_t _stack_status(const Stack* const stack, const bool segments);
+
+/**
+ * @brief Return status of the stack if its inline checks are enabled and 0 otherwise.
+ * Shared segments are not rehashed here: they can not change, so they are checked when they are moved back 
+ * into the buffer and by the full stack_status().
+ * 
+ * @param stack structure to check
+ * @return stack_report_t 
+ */
+stack_report_t _stack_inline_status(const Stack* const stack);
+
+/**
+ * @brief Mark the beginning of stack modification for concurrent readers.
+ * 
+ * @param stack structure to modify
+ */
+void _stack_write_begin(Stack* const stack);
+
+/**
+ * @brief Mark the end of stack modification for concurrent readers.
+ * 
+ * @param stack structure to modify
+ */
+void _stack_write_end(Stack* const stack);
+
+/**
+ * @brief Open the batch without checking the stack.
+ * 
+ * @param stack structure to modify
+ * @param err_code variable to fill with error code
+ */
+void _stack_batch_open(Stack* const stack, int* const err_code);
+
+/**
+ * @brief Close the batch and update the hash of cells modified in it without checking the stack.
+ * 
+ * @param stack structure to modify
+ * @param err_code variable to fill with error code
+ * @return true if the batch was closed
+ */
+bool _stack_batch_close(Stack* const stack, int* const err_code);
+
+/**
+ * @brief Trim the stack if nobody uses it and it was not modified for the idle time of the policy.
+ * Should only be called by the trimmer.
+ * 
+ * @param target registered stack
+ * @param config trimming policy
+ * @param now current time in nanoseconds
+ * @return number of bytes freed
+ */
+size_t _stack_trim_target(TrimTarget* const target, const TrimmerConfig* const config, const long long now);
+
 /**
  * @brief Get pointer to the first element stored in the stack.
  * 
@@ -173,8 +1037,87 @@ stack_content_t* _stack_content(const Stack* const stack);
  * @brief Calculate stack hash.
  * 
  * @param stack 
+ * @param check_buffer check if buffer is readable before hashing it 
+ *                     (can be skipped by operations that have just written to the buffer)
+ * @return stack_hash_t 
+ */
+stack_hash_t _stack_hash(const Stack* const  stack, const bool check_buffer = true);
+
+/**
+ * @brief Calculate hash of the fields of the stack header that describe its buffer and how it is checked 
+ * (pointer, size, capacity, ownership, mapping, shared segments, aggregates and inline checks).
+ * 
+ * @param stack 
+ * @return stack_hash_t 
+ */
+stack_hash_t _stack_header_hash(const Stack* const stack);
+
+#ifndef NHASH
+
+/**
+ * @brief Recalculate checksums of all blocks and the hash of the stack.
+ * 
+ * @param stack 
+ */
+void _stack_rehash(Stack* const stack);
+
+/**
+ * @brief Recalculate checksums of blocks covering the range of elements and the hash of the stack.
+ * 
+ * @param stack 
+ * @param first first modified element
+ * @param last element after the last modified one
+ */
+void _stack_update_hash(Stack* const stack, const size_t first, const size_t last);
+
+/**
+ * @brief Recalculate the hash of the stack after a change of the header fields that does not touch the buffer.
+ * 
+ * @param stack 
+ */
+void _stack_update_header_hash(Stack* const stack);
+
+#endif
+
+/**
+ * @brief Calculate get_hash() of the buffer, using several threads if it is big.
+ * 
+ * @param buffer 
+ * @param length number of bytes in the buffer
+ * @param blocks array to put checksums of STACK_HASH_BLOCK-byte blocks into (NULL if they are not needed)
  * @return stack_hash_t 
  */
-stack_hash_t _stack_hash(const Stack* const  stack);
+stack_hash_t _stack_hash_blocks(const char* buffer, const size_t length, stack_hash_t* const blocks);
+
+/**
+ * @brief Hash part of the buffer described by StackHashTask.
+ * 
+ * @param argument pointer to the task
+ * @return void* 
+ */
+void* _stack_hash_task(void* argument);
+
+/**
+ * @brief Get number of bytes in the buffer of the stack including canaries.
+ * 
+ * @param stack 
+ * @return size_t 
+ */
+size_t _stack_buffer_length(const Stack* const stack);
+
+/**
+ * @brief Get offset of the first element from the start of the buffer of the stack.
+ * 
+ * @param stack 
+ * @return size_t 
+ */
+size_t _stack_buffer_offset(const Stack* const stack);
+
+/**
+ * @brief Get offset of the first element from the start of the canary-framed buffer.
+ * 
+ * @return size_t 
+ */
+size_t _stack_prefix_size();
 
 #endif
\ No newline at end of file
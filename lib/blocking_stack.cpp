@@ -0,0 +1,275 @@
+#include "blocking_stack.h"
+
+#include <climits>
+#include <pthread.h>
+#include <time.h>
+
+#include "util/dbg/debug.h"
+
+static const int BL_STACK_SPIN_LIMIT = 1000;
+
+struct BlockingStack {
+    void* stack = NULL;
+    size_t limit = 0;
+    size_t size = 0;  // Copy of the stack size that can be read without the lock.
+    bool closed = false;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    unsigned int waiting_pushers = 0;
+    unsigned int waiting_poppers = 0;
+};
+
+/**
+ * @brief Lock the stack and wait until it can be pushed into or popped from.
+ *
+ * @param stack stack to wait on
+ * @param push true to wait for free space, false to wait for elements
+ * @param deadline absolute CLOCK_MONOTONIC time to stop waiting at (NULL to wait forever)
+ * @param wait false to return immediately if the stack is not ready
+ * @param err_code variable to use as errno
+ * @return true if the stack is ready and locked, false if it is unlocked
+ */
+static bool bl_stack_acquire(BlockingLLStack stack, const bool push, const struct timespec* deadline,
+                             const bool wait, int* const err_code);
+
+/**
+ * @brief Push element into the locked stack and unlock it.
+ *
+ * @param stack stack to push into
+ * @param value value to push
+ * @param err_code variable to use as errno
+ * @return true if the element was pushed
+ */
+static bool bl_stack_push_locked(BlockingLLStack stack, const ll_stack_content_t value, int* const err_code);
+
+/**
+ * @brief Pop element from the locked stack and unlock it.
+ *
+ * @param stack stack to pop from
+ * @param value variable to put removed element into
+ * @param err_code variable to use as errno
+ * @return true if the element was popped
+ */
+static bool bl_stack_pop_locked(BlockingLLStack stack, ll_stack_content_t* const value, int* const err_code);
+
+/**
+ * @brief Check if the stack can be pushed into or popped from.
+ *
+ * @param stack stack to check
+ * @param push true to check for free space, false to check for elements
+ * @return true if operation can be done
+ */
+static inline bool bl_stack_ready(const BlockingLLStack stack, const bool push);
+
+/**
+ * @brief Calculate absolute time that is timeout_ms milliseconds later than now.
+ *
+ * @param timeout_ms
+ * @param deadline variable to put the result into
+ * @return deadline or NULL if timeout is infinite (ULONG_MAX)
+ */
+static const struct timespec* bl_stack_deadline(const unsigned long timeout_ms, struct timespec* deadline);
+
+/**
+ * @brief Tell the processor that the thread is spinning.
+ *
+ */
+static inline void cpu_relax();
+
+BlockingLLStack bl_stack_ctor(const size_t limit, int* const err_code) {
+    _LOG_FAIL_CHECK_(limit > 0, "error", ERROR_REPORTS, return NULL, err_code, EINVAL);
+
+    BlockingStack* stack = (BlockingStack*) calloc(1, sizeof(BlockingStack));
+    _LOG_FAIL_CHECK_(stack, "error", ERROR_REPORTS, return NULL, err_code, ENOMEM);
+    *stack = (BlockingStack){};
+
+    stack->stack = ll_stack_ctor(limit, err_code);
+    _LOG_FAIL_CHECK_(stack->stack, "error", ERROR_REPORTS, {
+        free(stack);
+        return NULL;
+    }, err_code, ENOMEM);
+    stack->limit = limit;
+
+    pthread_condattr_t cond_attributes;
+    pthread_condattr_init(&cond_attributes);
+    pthread_condattr_setclock(&cond_attributes, CLOCK_MONOTONIC);
+
+    pthread_mutex_init(&stack->mutex, NULL);
+    pthread_cond_init(&stack->not_empty, &cond_attributes);
+    pthread_cond_init(&stack->not_full, &cond_attributes);
+
+    pthread_condattr_destroy(&cond_attributes);
+
+    return stack;
+}
+
+void bl_stack_dtor(BlockingLLStack stack) {
+    if (!stack) return;
+
+    ll_stack_dtor(stack->stack);
+
+    pthread_mutex_destroy(&stack->mutex);
+    pthread_cond_destroy(&stack->not_empty);
+    pthread_cond_destroy(&stack->not_full);
+
+    free(stack);
+}
+
+void bl_stack_push(BlockingLLStack stack, const ll_stack_content_t value, int* const err_code) {
+    bl_stack_timed_push(stack, value, ULONG_MAX, err_code);
+}
+
+bool bl_stack_try_push(BlockingLLStack stack, const ll_stack_content_t value, int* const err_code) {
+    _LOG_FAIL_CHECK_(stack, "error", ERROR_REPORTS, return false, err_code, EINVAL);
+    if (!bl_stack_acquire(stack, true, NULL, false, err_code)) return false;
+
+    return bl_stack_push_locked(stack, value, err_code);
+}
+
+bool bl_stack_timed_push(BlockingLLStack stack, const ll_stack_content_t value, const unsigned long timeout_ms,
+                         int* const err_code) {
+    _LOG_FAIL_CHECK_(stack, "error", ERROR_REPORTS, return false, err_code, EINVAL);
+
+    struct timespec deadline = {};
+    if (!bl_stack_acquire(stack, true, bl_stack_deadline(timeout_ms, &deadline), true, err_code)) return false;
+
+    return bl_stack_push_locked(stack, value, err_code);
+}
+
+ll_stack_content_t bl_stack_pop(BlockingLLStack stack, int* const err_code) {
+    ll_stack_content_t value = 0;
+    bl_stack_timed_pop(stack, &value, ULONG_MAX, err_code);
+    return value;
+}
+
+bool bl_stack_try_pop(BlockingLLStack stack, ll_stack_content_t* const value, int* const err_code) {
+    _LOG_FAIL_CHECK_(stack && value, "error", ERROR_REPORTS, return false, err_code, EINVAL);
+    if (!bl_stack_acquire(stack, false, NULL, false, err_code)) return false;
+
+    return bl_stack_pop_locked(stack, value, err_code);
+}
+
+bool bl_stack_timed_pop(BlockingLLStack stack, ll_stack_content_t* const value, const unsigned long timeout_ms,
+                        int* const err_code) {
+    _LOG_FAIL_CHECK_(stack && value, "error", ERROR_REPORTS, return false, err_code, EINVAL);
+
+    struct timespec deadline = {};
+    if (!bl_stack_acquire(stack, false, bl_stack_deadline(timeout_ms, &deadline), true, err_code)) return false;
+
+    return bl_stack_pop_locked(stack, value, err_code);
+}
+
+void bl_stack_close(BlockingLLStack stack) {
+    if (!stack) return;
+
+    pthread_mutex_lock(&stack->mutex);
+
+    __atomic_store_n(&stack->closed, true, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&stack->not_empty);
+    pthread_cond_broadcast(&stack->not_full);
+
+    pthread_mutex_unlock(&stack->mutex);
+}
+
+uintptr_t bl_stack_size(BlockingLLStack stack) {
+    if (!stack) return 0;
+    return __atomic_load_n(&stack->size, __ATOMIC_ACQUIRE);
+}
+
+static bool bl_stack_acquire(BlockingLLStack stack, const bool push, const struct timespec* deadline,
+                             const bool wait, int* const err_code) {
+    //* Most waits in a pipeline are short, so the thread spins for a while before going to sleep.
+    for (int spin_id = 0; wait && spin_id < BL_STACK_SPIN_LIMIT; ++spin_id) {
+        if (bl_stack_ready(stack, push) || __atomic_load_n(&stack->closed, __ATOMIC_ACQUIRE)) break;
+        cpu_relax();
+    }
+
+    pthread_mutex_lock(&stack->mutex);
+
+    unsigned int* waiting = push ? &stack->waiting_pushers : &stack->waiting_poppers;
+    pthread_cond_t* condition = push ? &stack->not_full : &stack->not_empty;
+
+    int error = 0;
+    while (!error) {
+        //* Closed stack still gives away elements that are left in it.
+        if (push && stack->closed)          error = EPIPE;
+        else if (bl_stack_ready(stack, push)) return true;
+        else if (stack->closed)             error = EPIPE;
+        else if (!wait)                     error = EAGAIN;
+        else {
+            ++*waiting;
+            error = deadline ? pthread_cond_timedwait(condition, &stack->mutex, deadline) :
+                               pthread_cond_wait(condition, &stack->mutex);
+            --*waiting;
+
+            if (error == ETIMEDOUT && bl_stack_ready(stack, push) && !(push && stack->closed)) return true;
+        }
+    }
+
+    pthread_mutex_unlock(&stack->mutex);
+    if (err_code) *err_code = error;
+    return false;
+}
+
+static bool bl_stack_push_locked(BlockingLLStack stack, const ll_stack_content_t value, int* const err_code) {
+    int push_status = 0;
+    ll_stack_push(stack->stack, value, &push_status);
+
+    if (push_status == 0) {
+        __atomic_store_n(&stack->size, stack->size + 1, __ATOMIC_RELEASE);
+        if (stack->waiting_poppers) pthread_cond_signal(&stack->not_empty);
+    }
+
+    pthread_mutex_unlock(&stack->mutex);
+
+    _LOG_FAIL_CHECK_(push_status == 0, "error", ERROR_REPORTS, return false, err_code, push_status);
+    return true;
+}
+
+static bool bl_stack_pop_locked(BlockingLLStack stack, ll_stack_content_t* const value, int* const err_code) {
+    int pop_status = 0;
+    ll_stack_content_t top = ll_stack_pull(stack->stack, &pop_status);
+    //* Element is removed only after it was read successfully, so a failed pull loses nothing.
+    if (pop_status == 0) ll_stack_pop(stack->stack, &pop_status);
+
+    if (pop_status == 0) {
+        *value = top;
+        __atomic_store_n(&stack->size, stack->size - 1, __ATOMIC_RELEASE);
+        if (stack->waiting_pushers) pthread_cond_signal(&stack->not_full);
+    }
+
+    pthread_mutex_unlock(&stack->mutex);
+
+    _LOG_FAIL_CHECK_(pop_status == 0, "error", ERROR_REPORTS, return false, err_code, pop_status);
+    return true;
+}
+
+static inline bool bl_stack_ready(const BlockingLLStack stack, const bool push) {
+    size_t size = __atomic_load_n(&stack->size, __ATOMIC_ACQUIRE);
+    return push ? size < stack->limit : size > 0;
+}
+
+static const struct timespec* bl_stack_deadline(const unsigned long timeout_ms, struct timespec* deadline) {
+    if (timeout_ms == ULONG_MAX) return NULL;
+
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+
+    deadline->tv_sec += timeout_ms / 1000;
+    deadline->tv_nsec += (timeout_ms % 1000) * 1000000;
+    if (deadline->tv_nsec >= 1000000000) {
+        ++deadline->tv_sec;
+        deadline->tv_nsec -= 1000000000;
+    }
+
+    return deadline;
+}
+
+static inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
\ No newline at end of file
@@ -0,0 +1,115 @@
+/**
+ * @file blocking_stack.h
+ * @author Ilya Kudryashov (kudriashov.it@phystech.edu)
+ * @brief Thread-safe bounded stack of long integers with blocking operations.
+ * @version 0.1
+ * @date 2022-10-09
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef BLOCKING_STACK_H
+#define BLOCKING_STACK_H
+
+#include <cstdlib>
+#include <cstdint>
+#include "ll_stack.h"
+
+typedef struct BlockingStack* BlockingLLStack;
+
+/**
+ * @brief Construct bounded stack.
+ *
+ * @param limit maximum number of elements in the stack
+ * @param err_code variable to use as errno
+ * @return BlockingLLStack
+ */
+BlockingLLStack bl_stack_ctor(const size_t limit, int* const err_code = NULL);
+
+/**
+ * @brief Destroy the stack. No thread should be waiting on it.
+ *
+ * @param stack stack to destroy
+ */
+void bl_stack_dtor(BlockingLLStack stack);
+
+/**
+ * @brief Push element to the stack, wait while the stack is full.
+ *
+ * @param stack stack to push into
+ * @param value value to push
+ * @param err_code variable to use as errno (EPIPE if the stack was closed)
+ */
+void bl_stack_push(BlockingLLStack stack, const ll_stack_content_t value, int* const err_code = NULL);
+
+/**
+ * @brief Push element to the stack if it is not full.
+ *
+ * @param stack stack to push into
+ * @param value value to push
+ * @param err_code variable to use as errno (EAGAIN if the stack was full)
+ * @return true if the value was pushed
+ */
+bool bl_stack_try_push(BlockingLLStack stack, const ll_stack_content_t value, int* const err_code = NULL);
+
+/**
+ * @brief Push element to the stack, wait at most timeout_ms milliseconds while the stack is full.
+ *
+ * @param stack stack to push into
+ * @param value value to push
+ * @param timeout_ms maximum waiting time
+ * @param err_code variable to use as errno (ETIMEDOUT if the time ran out)
+ * @return true if the value was pushed
+ */
+bool bl_stack_timed_push(BlockingLLStack stack, const ll_stack_content_t value, const unsigned long timeout_ms,
+                         int* const err_code = NULL);
+
+/**
+ * @brief Remove the last element of the stack, wait while the stack is empty.
+ *
+ * @param stack stack to pop from
+ * @param err_code variable to use as errno (EPIPE if the stack was closed and is empty)
+ * @return ll_stack_content_t removed element
+ */
+ll_stack_content_t bl_stack_pop(BlockingLLStack stack, int* const err_code = NULL);
+
+/**
+ * @brief Remove the last element of the stack if it is not empty.
+ *
+ * @param stack stack to pop from
+ * @param value variable to put removed element into
+ * @param err_code variable to use as errno (EAGAIN if the stack was empty)
+ * @return true if the element was removed
+ */
+bool bl_stack_try_pop(BlockingLLStack stack, ll_stack_content_t* const value, int* const err_code = NULL);
+
+/**
+ * @brief Remove the last element of the stack, wait at most timeout_ms milliseconds while the stack is empty.
+ *
+ * @param stack stack to pop from
+ * @param value variable to put removed element into
+ * @param timeout_ms maximum waiting time
+ * @param err_code variable to use as errno (ETIMEDOUT if the time ran out)
+ * @return true if the element was removed
+ */
+bool bl_stack_timed_pop(BlockingLLStack stack, ll_stack_content_t* const value, const unsigned long timeout_ms,
+                        int* const err_code = NULL);
+
+/**
+ * @brief Close the stack: wake up all waiting threads and forbid further pushes.
+ * Elements that are left in the stack can still be popped.
+ *
+ * @param stack stack to close
+ */
+void bl_stack_close(BlockingLLStack stack);
+
+/**
+ * @brief Get number of elements in the stack.
+ *
+ * @param stack
+ * @return uintptr_t
+ */
+uintptr_t bl_stack_size(BlockingLLStack stack);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,270 @@
+#include "combining_stack.h"
+
+#include <sched.h>
+
+#include "util/dbg/debug.h"
+
+static const int FC_STACK_SPIN_LIMIT = 1000;
+
+//* Maximum number of times the combiner scans the slots in one batch.
+static const int FC_STACK_COMBINE_PASSES = 4;
+
+static const size_t FC_STACK_CACHE_LINE = 64;
+
+enum FC_SLOT_STATES {
+    FC_SLOT_FREE = 0,
+    FC_SLOT_CLAIMED = 1,    // Thread is writing its operation into the slot.
+    FC_SLOT_PENDING = 2,    // Operation waits for the combiner.
+    FC_SLOT_SERVED = 3,     // Operation is applied, but the batch it belongs to is not finished yet.
+    FC_SLOT_DONE = 4,       // Result can be taken.
+};
+
+enum FC_OPERATIONS {
+    FC_PUSH = 0,
+    FC_POP = 1,
+    FC_PULL = 2,
+};
+
+/**
+ * @brief Operation published by a thread.
+ * Slots lie on separate cache lines, so waiting threads do not disturb each other.
+ *
+ * @param state state of the slot (one of FC_SLOT_STATES)
+ * @param operation operation to perform (one of FC_OPERATIONS)
+ * @param value pushed value or the result of pop and pull
+ * @param status error code of the operation
+ */
+struct alignas(FC_STACK_CACHE_LINE) CombiningSlot {
+    int state;
+    int operation;
+    ll_stack_content_t value;
+    int status;
+};
+
+struct CombiningStack {
+    void* stack = NULL;
+    size_t size = 0;  // Copy of the stack size that can be read without being the combiner.
+    size_t batches = 0;
+    size_t combined = 0;
+
+    alignas(FC_STACK_CACHE_LINE) bool combining = false;  // Some thread applies published operations.
+
+    CombiningSlot slots[FC_STACK_SLOT_COUNT] = {};
+};
+
+//* Slot each thread tries first, threads get different slots as long as there are fewer of them than slots.
+static __thread unsigned int fc_thread_id = 0;
+static unsigned int fc_last_thread_id = 0;
+
+/**
+ * @brief Publish the operation and wait until it is applied, applying operations of other threads if nobody does.
+ *
+ * @param stack stack to operate on
+ * @param operation operation to perform (one of FC_OPERATIONS)
+ * @param value pushed value, filled with the result of pop and pull
+ * @param err_code variable to use as errno
+ * @return true if the operation succeeded
+ */
+static bool fc_stack_perform(CombiningLLStack stack, const int operation, ll_stack_content_t* const value,
+                             int* const err_code);
+
+/**
+ * @brief Take a free slot.
+ *
+ * @param stack
+ * @return CombiningSlot*
+ */
+static CombiningSlot* fc_stack_claim(CombiningLLStack stack);
+
+/**
+ * @brief Apply all published operations in one batch of the underlying stack.
+ * Should only be called by the combiner.
+ *
+ * @param stack
+ */
+static void fc_stack_combine(CombiningLLStack stack);
+
+/**
+ * @brief Apply one operation to the underlying stack.
+ *
+ * @param stack
+ * @param slot slot of the operation
+ * @return int error code
+ */
+static int fc_stack_apply(CombiningLLStack stack, CombiningSlot* const slot);
+
+/**
+ * @brief Tell the processor that the thread is spinning.
+ *
+ */
+static inline void cpu_relax();
+
+CombiningLLStack fc_stack_ctor(LLStack stack, int* const err_code) {
+    _LOG_FAIL_CHECK_(stack, "error", ERROR_REPORTS, return NULL, err_code, EINVAL);
+
+    CombiningStack* combining = (CombiningStack*) aligned_alloc(alignof(CombiningStack), sizeof(CombiningStack));
+    _LOG_FAIL_CHECK_(combining, "error", ERROR_REPORTS, return NULL, err_code, ENOMEM);
+    *combining = (CombiningStack){};
+
+    combining->stack = stack;
+    combining->size = ll_stack_size(stack);
+
+    return combining;
+}
+
+void fc_stack_dtor(CombiningLLStack stack) {
+    if (!stack) return;
+
+    ll_stack_dtor(stack->stack);
+    free(stack);
+}
+
+void fc_stack_push(CombiningLLStack stack, const ll_stack_content_t value, int* const err_code) {
+    _LOG_FAIL_CHECK_(stack, "error", ERROR_REPORTS, return, err_code, EINVAL);
+
+    ll_stack_content_t argument = value;
+    fc_stack_perform(stack, FC_PUSH, &argument, err_code);
+}
+
+bool fc_stack_pop(CombiningLLStack stack, ll_stack_content_t* const value, int* const err_code) {
+    _LOG_FAIL_CHECK_(stack, "error", ERROR_REPORTS, return false, err_code, EINVAL);
+
+    ll_stack_content_t result = 0;
+    if (!fc_stack_perform(stack, FC_POP, &result, err_code)) return false;
+
+    if (value) *value = result;
+    return true;
+}
+
+bool fc_stack_pull(CombiningLLStack stack, ll_stack_content_t* const value, int* const err_code) {
+    _LOG_FAIL_CHECK_(stack && value, "error", ERROR_REPORTS, return false, err_code, EINVAL);
+
+    return fc_stack_perform(stack, FC_PULL, value, err_code);
+}
+
+uintptr_t fc_stack_size(CombiningLLStack stack) {
+    if (!stack) return 0;
+    return __atomic_load_n(&stack->size, __ATOMIC_ACQUIRE);
+}
+
+double fc_stack_mean_batch(CombiningLLStack stack) {
+    if (!stack) return 0;
+
+    size_t batches = __atomic_load_n(&stack->batches, __ATOMIC_RELAXED);
+    return batches ? (double)__atomic_load_n(&stack->combined, __ATOMIC_RELAXED) / (double)batches : 0;
+}
+
+static bool fc_stack_perform(CombiningLLStack stack, const int operation, ll_stack_content_t* const value,
+                             int* const err_code) {
+    CombiningSlot* slot = fc_stack_claim(stack);
+
+    slot->operation = operation;
+    slot->value = *value;
+    slot->status = 0;
+    __atomic_store_n(&slot->state, FC_SLOT_PENDING, __ATOMIC_RELEASE);
+
+    for (int spin_id = 0; __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) != FC_SLOT_DONE; ++spin_id) {
+        //* Combiner role is checked before it is taken, so waiting threads do not pull the cache line back and forth.
+        if (!__atomic_load_n(&stack->combining, __ATOMIC_RELAXED) &&
+            !__atomic_exchange_n(&stack->combining, true, __ATOMIC_ACQUIRE)) {
+            fc_stack_combine(stack);
+            __atomic_store_n(&stack->combining, false, __ATOMIC_RELEASE);
+            continue;
+        }
+
+        //* Combiner may have been preempted, spinning would only keep it from running.
+        if (spin_id < FC_STACK_SPIN_LIMIT) cpu_relax();
+        else                               sched_yield();
+    }
+
+    *value = slot->value;
+    int status = slot->status;
+
+    __atomic_store_n(&slot->state, FC_SLOT_FREE, __ATOMIC_RELEASE);
+
+    //* Failures of the underlying stack are already logged by it, and empty stack is not an error worth logging.
+    if (status && err_code) *err_code = status;
+    return status == 0;
+}
+
+static CombiningSlot* fc_stack_claim(CombiningLLStack stack) {
+    if (!fc_thread_id) fc_thread_id = __atomic_add_fetch(&fc_last_thread_id, 1, __ATOMIC_RELAXED);
+
+    for (unsigned int attempt = 0;; ++attempt) {
+        CombiningSlot* slot = stack->slots + (fc_thread_id + attempt) % FC_STACK_SLOT_COUNT;
+
+        int state = FC_SLOT_FREE;
+        if (__atomic_load_n(&slot->state, __ATOMIC_RELAXED) == FC_SLOT_FREE &&
+            __atomic_compare_exchange_n(&slot->state, &state, FC_SLOT_CLAIMED, false,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return slot;
+        }
+
+        if (attempt % FC_STACK_SLOT_COUNT == FC_STACK_SLOT_COUNT - 1) cpu_relax();
+    }
+}
+
+static void fc_stack_combine(CombiningLLStack stack) {
+    //* Served slots stay taken until the end of the batch, so each of them is served at most once.
+    CombiningSlot* served[FC_STACK_SLOT_COUNT] = {};
+    size_t served_count = 0;
+
+    int batch_status = 0;
+    ll_stack_batch_begin(stack->stack, &batch_status);
+
+    //* Threads keep publishing while the batch is applied, so the slots are scanned until a pass finds nothing.
+    for (int pass_id = 0; pass_id < FC_STACK_COMBINE_PASSES; ++pass_id) {
+        size_t pass_start = served_count;
+
+        for (size_t slot_id = 0; slot_id < FC_STACK_SLOT_COUNT; ++slot_id) {
+            CombiningSlot* slot = stack->slots + slot_id;
+            if (__atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) != FC_SLOT_PENDING) continue;
+
+            slot->status = batch_status ? batch_status : fc_stack_apply(stack, slot);
+            __atomic_store_n(&slot->state, FC_SLOT_SERVED, __ATOMIC_RELAXED);
+
+            served[served_count++] = slot;
+        }
+
+        if (served_count == pass_start) break;
+    }
+
+    int end_status = 0;
+    if (!batch_status) ll_stack_batch_end(stack->stack, &end_status);
+
+    //* Results are given away only after the stack is checked, so operations on a corrupted stack do not succeed.
+    for (size_t served_id = 0; served_id < served_count; ++served_id) {
+        if (!served[served_id]->status) served[served_id]->status = end_status;
+        __atomic_store_n(&served[served_id]->state, FC_SLOT_DONE, __ATOMIC_RELEASE);
+    }
+
+    __atomic_store_n(&stack->batches, stack->batches + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&stack->combined, stack->combined + served_count, __ATOMIC_RELAXED);
+}
+
+static int fc_stack_apply(CombiningLLStack stack, CombiningSlot* const slot) {
+    int status = 0;
+
+    if (slot->operation == FC_PUSH) {
+        ll_stack_push(stack->stack, slot->value, &status);
+        if (!status) __atomic_store_n(&stack->size, stack->size + 1, __ATOMIC_RELEASE);
+        return status;
+    }
+
+    if (!stack->size) return ENXIO;
+
+    slot->value = ll_stack_pull(stack->stack, &status);
+    if (status || slot->operation == FC_PULL) return status;
+
+    ll_stack_pop(stack->stack, &status);
+    if (!status) __atomic_store_n(&stack->size, stack->size - 1, __ATOMIC_RELEASE);
+    return status;
+}
+
+static inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
\ No newline at end of file
@@ -0,0 +1,89 @@
+/**
+ * @file combining_stack.h
+ * @author Ilya Kudryashov (kudriashov.it@phystech.edu)
+ * @brief Thread-safe stack of long integers for highly contended workloads (flat combining).
+ * Threads publish their operations in slots, and whoever holds the combiner role applies all of them in one batch.
+ * @version 0.1
+ * @date 2022-10-16
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef COMBINING_STACK_H
+#define COMBINING_STACK_H
+
+#include <cstdlib>
+#include <cstdint>
+#include "ll_stack.h"
+
+//* Number of operations that can wait for the combiner at once, more threads wait for a free slot.
+#ifndef FC_STACK_SLOT_COUNT
+#define FC_STACK_SLOT_COUNT 64
+#endif
+
+typedef struct CombiningStack* CombiningLLStack;
+
+/**
+ * @brief Make the stack shared through flat combining.
+ * From now on the stack must only be accessed through the combining stack, fc_stack_dtor() destroys it.
+ *
+ * @param stack encrypted pointer to the stack
+ * @param err_code variable to use as errno
+ * @return CombiningLLStack
+ */
+CombiningLLStack fc_stack_ctor(LLStack stack, int* const err_code = NULL);
+
+/**
+ * @brief Destroy the stack. No thread should be operating on it.
+ *
+ * @param stack stack to destroy
+ */
+void fc_stack_dtor(CombiningLLStack stack);
+
+/**
+ * @brief Push element to the stack.
+ *
+ * @param stack stack to push into
+ * @param value value to push
+ * @param err_code variable to use as errno
+ */
+void fc_stack_push(CombiningLLStack stack, const ll_stack_content_t value, int* const err_code = NULL);
+
+/**
+ * @brief Remove the last element of the stack.
+ *
+ * @param stack stack to pop from
+ * @param value variable to put removed element into (can be NULL)
+ * @param err_code variable to use as errno (ENXIO if the stack was empty)
+ * @return true if the element was removed
+ */
+bool fc_stack_pop(CombiningLLStack stack, ll_stack_content_t* const value, int* const err_code = NULL);
+
+/**
+ * @brief Get the last element of the stack.
+ *
+ * @param stack stack to read from
+ * @param value variable to put the element into
+ * @param err_code variable to use as errno (ENXIO if the stack was empty)
+ * @return true if the element was read
+ */
+bool fc_stack_pull(CombiningLLStack stack, ll_stack_content_t* const value, int* const err_code = NULL);
+
+/**
+ * @brief Get number of elements in the stack.
+ *
+ * @param stack
+ * @return uintptr_t
+ */
+uintptr_t fc_stack_size(CombiningLLStack stack);
+
+/**
+ * @brief Get average number of operations applied in one batch.
+ *
+ * @param stack
+ * @return double
+ */
+double fc_stack_mean_batch(CombiningLLStack stack);
+
+#endif
\ No newline at end of file
@@ -2,9 +2,13 @@
 
 #include <cstdint>
 
+#include "stackframe.h"
+
 typedef long long stack_content_t;
-stack_content_t STACK_CONTENT_POISON = 0xDEADBABEC0FEBEEF;
+stack_content_t STACK_CONTENT_POISON = STACK_INTEGER_POISON;
+#define STACK_INTEGER_CONTENT
 #include "stackworks.h"
+#include "stackoplog.h"
 
 typedef uintptr_t secure_key_t;
 
@@ -52,6 +56,10 @@ static const long long RNG_ATTEMPT_LIMIT = 10000;
 
 static secure_key_t CRYPTO_KEY = generate_key(&errno);
 
+//* Stacks registered in the idle trimmer are locked for the time of each call, so the trimmer does not resize them
+//* under the caller.
+#define _LL_STACK_ACCESS_(stack) StackAccess _ll_stack_access((stack) ? (Stack*)decrypt_ptr(stack) : NULL)
+
 /**
  * @brief XORed garbage goes in, pointer goes out.
  * 
@@ -68,53 +76,383 @@ static void* decrypt_ptr(void* ptr);
  */
 static void* encrypt_ptr(void* ptr);
 
+/**
+ * @brief Check the stack from the background scanner thread.
+ * 
+ * @param stack decrypted pointer to the stack
+ * @param importance importance of the dump
+ * @param consistent set to false if stack was being modified during the check
+ * @return stack_report_t 
+ */
+static stack_report_t ll_stack_scan(const void* stack, int importance, bool* consistent);
+
+/**
+ * @brief Trim the stack from the idle trimmer thread.
+ * 
+ * @param target registered stack (decrypted pointer)
+ * @param config trimming policy
+ * @param now current time in nanoseconds
+ * @return size_t number of bytes freed
+ */
+static size_t ll_stack_trim_idle(TrimTarget* target, const TrimmerConfig* config, long long now);
+
+/**
+ * @brief Append the operation to the operation log if it is active.
+ * 
+ * @param stack encrypted pointer to the stack
+ * @param op operation (one of STACK_OPS)
+ * @param argument argument of the operation
+ * @param values elements the operation adds
+ */
+static inline void ll_stack_log(LLStack stack, const int op, const long long argument = 0, 
+                                const long long* const values = NULL);
+
 LLStack ll_stack_ctor(size_t size, int* const err_code) {
-    Stack* stack = (Stack*) calloc(1, sizeof(Stack));
+    Stack* stack = (Stack*) aligned_alloc(alignof(Stack), sizeof(Stack));
+    _LOG_FAIL_CHECK_(stack, "error", ERROR_REPORTS, return NULL, err_code, ENOMEM);
     *stack = (Stack){};
+
     int stack_init_status = 0;
     stack_init(stack, size, &stack_init_status);
-    _LOG_FAIL_CHECK_(stack_init_status == 0, "error", ERROR_REPORTS, return NULL, err_code, ENOMEM);
+    _LOG_FAIL_CHECK_(stack_init_status == 0, "error", ERROR_REPORTS, {
+        free(stack);
+        return NULL;
+    }, err_code, stack_init_status);
+
+    ll_stack_log(encrypt_ptr(stack), STACK_OP_CTOR, (long long)size);
     return encrypt_ptr(stack);
 }
 
 void ll_stack_dtor(LLStack stack) {
-    stack_destroy((Stack*)decrypt_ptr(stack));
+    int destroy_status = 0;
+    {
+        _LL_STACK_ACCESS_(stack);
+        stack_destroy((Stack*)decrypt_ptr(stack), &destroy_status);
+    }
+
+    //* Operations are logged only after they succeed, the id of the stack is still readable until it is freed.
+    if (!destroy_status) ll_stack_log(stack, STACK_OP_DTOR);
     free(decrypt_ptr(stack));
 }
 
 void ll_stack_push(LLStack stack, const ll_stack_content_t value, int* const err_code) {
-    stack_push((Stack*)decrypt_ptr(stack), value, err_code);
+    _LL_STACK_ACCESS_(stack);
+    int push_status = 0;
+    stack_push((Stack*)decrypt_ptr(stack), value, &push_status);
+    _LOG_FAIL_CHECK_(push_status == 0, "error", ERROR_REPORTS, return, err_code, push_status);
+
+    ll_stack_log(stack, STACK_OP_PUSH, value);
 }
 
 ll_stack_content_t ll_stack_pull(LLStack stack, int* const err_code) {
-    return stack_get((Stack*)decrypt_ptr(stack), err_code);
+    _LL_STACK_ACCESS_(stack);
+    int get_status = 0;
+    ll_stack_content_t value = stack_get((Stack*)decrypt_ptr(stack), &get_status);
+    _LOG_FAIL_CHECK_(get_status == 0, "error", ERROR_REPORTS, return value, err_code, get_status);
+
+    ll_stack_log(stack, STACK_OP_PULL);
+    return value;
 }
 
 void ll_stack_pop(LLStack stack, int* const err_code) {
-    stack_pop((Stack*)decrypt_ptr(stack), err_code);
+    _LL_STACK_ACCESS_(stack);
+    int pop_status = 0;
+    stack_pop((Stack*)decrypt_ptr(stack), &pop_status);
+    _LOG_FAIL_CHECK_(pop_status == 0, "error", ERROR_REPORTS, return, err_code, pop_status);
+
+    ll_stack_log(stack, STACK_OP_POP);
 }
 
 stack_report_t ll_stack_status(LLStack stack) {
+    _LL_STACK_ACCESS_(stack);
     if (stack == NULL) return STACK_NULL;
     return stack_status((Stack*)decrypt_ptr(stack));
 }
 
 void _ll_stack_dump(LLStack stack, int importance, const char* function, const size_t line, const char* file) {
+    _LL_STACK_ACCESS_(stack);
     _stack_dump((Stack*)decrypt_ptr(stack), importance, function, line, file);
 }
 
+void ll_stack_dump_stream(LLStack stack, StackDumpStream* const stream, const int mode, int* const err_code) {
+    _LL_STACK_ACCESS_(stack);
+    stack_dump_stream((Stack*)decrypt_ptr(stack), stream, mode, err_code);
+}
+
 uintptr_t ll_stack_size(LLStack stack, int* const err_code) {
     _LOG_FAIL_CHECK_(check_ptr(stack) == false, "error", ERROR_REPORTS, return (uintptr_t)NULL, err_code, EINVAL);
-    uintptr_t size = ((Stack*)decrypt_ptr(stack))->size;
+    _LL_STACK_ACCESS_(stack);
+    uintptr_t size = stack_size((Stack*)decrypt_ptr(stack));
     return size;
 }
 
 uintptr_t ll_stack_capacity(LLStack stack, int* const err_code) {
     _LOG_FAIL_CHECK_(check_ptr(stack) == false, "error", ERROR_REPORTS, return (uintptr_t)NULL, err_code, EINVAL);
+    _LL_STACK_ACCESS_(stack);
     uintptr_t size = ((Stack*)decrypt_ptr(stack))->capacity;
     return size;
 }
 
+size_t ll_stack_resize_count(LLStack stack) {
+    if (stack == NULL) return 0;
+    return ((Stack*)decrypt_ptr(stack))->_resizes;
+}
+
+void ll_stack_watch(LLStack stack, int* const err_code) {
+    _LL_STACK_ACCESS_(stack);
+    stack_watch((Stack*)decrypt_ptr(stack), ll_stack_scan, err_code);
+}
+
+void ll_stack_unwatch(LLStack stack, int* const err_code) {
+    _LL_STACK_ACCESS_(stack);
+    stack_unwatch((Stack*)decrypt_ptr(stack), err_code);
+}
+
+void ll_stack_watch_idle(LLStack stack, int* const err_code) {
+    _LL_STACK_ACCESS_(stack);
+    stack_watch_idle((Stack*)decrypt_ptr(stack), ll_stack_trim_idle, err_code);
+}
+
+void ll_stack_unwatch_idle(LLStack stack, int* const err_code) {
+    _LL_STACK_ACCESS_(stack);
+    stack_unwatch_idle((Stack*)decrypt_ptr(stack), err_code);
+}
+
+void ll_stack_trim(LLStack stack, const size_t headroom, int* const err_code) {
+    _LL_STACK_ACCESS_(stack);
+    stack_trim((Stack*)decrypt_ptr(stack), headroom, err_code);
+}
+
+void ll_stack_set_inline_checks(LLStack stack, const bool enabled, int* const err_code) {
+    _LL_STACK_ACCESS_(stack);
+    stack_set_inline_checks((Stack*)decrypt_ptr(stack), enabled, err_code);
+}
+
+void ll_stack_batch_begin(LLStack stack, int* const err_code) {
+    _LL_STACK_ACCESS_(stack);
+    stack_batch_begin((Stack*)decrypt_ptr(stack), err_code);
+}
+
+void ll_stack_batch_end(LLStack stack, int* const err_code) {
+    _LL_STACK_ACCESS_(stack);
+    stack_batch_end((Stack*)decrypt_ptr(stack), err_code);
+}
+
+void ll_stack_scope_begin(LLStack stack, int* const err_code) {
+    _LL_STACK_ACCESS_(stack);
+    stack_scope_begin((Stack*)decrypt_ptr(stack), err_code);
+}
+
+void ll_stack_scope_end(LLStack stack, int* const err_code) {
+    _LL_STACK_ACCESS_(stack);
+    stack_scope_end((Stack*)decrypt_ptr(stack), err_code);
+}
+
+LLStack ll_stack_fork(LLStack stack, int* const err_code) {
+    _LL_STACK_ACCESS_(stack);
+    Stack* fork = (Stack*) aligned_alloc(alignof(Stack), sizeof(Stack));
+    _LOG_FAIL_CHECK_(fork, "error", ERROR_REPORTS, return NULL, err_code, ENOMEM);
+    *fork = (Stack){};
+
+    int fork_status = 0;
+    stack_fork((Stack*)decrypt_ptr(stack), fork, &fork_status);
+    _LOG_FAIL_CHECK_(fork_status == 0, "error", ERROR_REPORTS, {
+        free(fork);
+        return NULL;
+    }, err_code, fork_status);
+
+    if (stack_oplog_active()) ll_stack_log(stack, STACK_OP_FORK, stack_oplog_handle(&fork->_oplog_id));
+    return encrypt_ptr(fork);
+}
+
+ll_stack_content_t* ll_stack_reserve(LLStack stack, const size_t count, int* const err_code) {
+    _LL_STACK_ACCESS_(stack);
+    ll_stack_content_t* cells = stack_reserve((Stack*)decrypt_ptr(stack), count, err_code);
+    if (cells) ll_stack_log(stack, STACK_OP_RESERVE, (long long)count);
+    return cells;
+}
+
+void ll_stack_publish(LLStack stack, const size_t written, int* const err_code) {
+    _LL_STACK_ACCESS_(stack);
+    Stack* decrypted = (Stack*)decrypt_ptr(stack);
+    int publish_status = 0;
+    stack_publish(decrypted, written, &publish_status);
+    _LOG_FAIL_CHECK_(publish_status == 0, "error", ERROR_REPORTS, return, err_code, publish_status);
+
+    //* Published values are logged, so that the replayed stack holds the same elements.
+    if (stack_oplog_active()) {
+        const ll_stack_content_t* values = _stack_content(decrypted) + decrypted->size - written;
+        ll_stack_log(stack, STACK_OP_PUBLISH, (long long)written, values);
+    }
+}
+
+const ll_stack_content_t* ll_stack_read_top(LLStack stack, const size_t count, int* const err_code) {
+    _LL_STACK_ACCESS_(stack);
+    return stack_read_top((Stack*)decrypt_ptr(stack), count, err_code);
+}
+
+LLStackView ll_stack_view(LLStack stack, int* const err_code) {
+    _LL_STACK_ACCESS_(stack);
+    StackView view = stack_view((Stack*)decrypt_ptr(stack), err_code);
+    //* View keeps the handle encrypted like any other pointer to the stack given out by the library.
+    return (LLStackView){ .stack = view.stack ? stack : NULL, .begin = view.begin, .end = view.end, .seq = view.seq };
+}
+
+ll_stack_content_t ll_stack_view_at(const LLStackView* const view, const size_t index, int* const err_code) {
+    _LOG_FAIL_CHECK_(view, "error", ERROR_REPORTS, return STACK_CONTENT_POISON, err_code, EFAULT);
+    _LL_STACK_ACCESS_(view->stack);
+
+    StackView stack_view = { .stack = view->stack ? (const Stack*)decrypt_ptr(view->stack) : NULL, 
+                             .begin = view->begin, .end = view->end, .seq = view->seq };
+    return stack_view_at(&stack_view, index, err_code);
+}
+
+LLStack ll_stack_adopt(ll_stack_content_t* const data, const size_t size, const size_t capacity, const bool owned,
+                       int* const err_code) {
+    Stack* stack = (Stack*) aligned_alloc(alignof(Stack), sizeof(Stack));
+    _LOG_FAIL_CHECK_(stack, "error", ERROR_REPORTS, return NULL, err_code, ENOMEM);
+    *stack = (Stack){};
+
+    int adopt_status = 0;
+    stack_adopt(stack, data, size, capacity, owned, &adopt_status);
+    _LOG_FAIL_CHECK_(adopt_status == 0, "error", ERROR_REPORTS, {
+        free(stack);
+        return NULL;
+    }, err_code, adopt_status);
+
+    ll_stack_log(encrypt_ptr(stack), STACK_OP_ADOPT, (long long)size, data);
+    return encrypt_ptr(stack);
+}
+
+ll_stack_content_t* ll_stack_release(LLStack stack, size_t* const size, int* const err_code) {
+    int release_status = 0;
+    ll_stack_content_t* data = NULL;
+    {
+        _LL_STACK_ACCESS_(stack);
+        data = stack_release((Stack*)decrypt_ptr(stack), size, &release_status);
+    }
+    _LOG_FAIL_CHECK_(release_status == 0, "error", ERROR_REPORTS, return NULL, err_code, release_status);
+
+    ll_stack_log(stack, STACK_OP_RELEASE);
+    free(decrypt_ptr(stack));
+    return data;
+}
+
+ll_stack_mark_t ll_stack_mark(LLStack stack, int* const err_code) {
+    _LL_STACK_ACCESS_(stack);
+    int mark_status = 0;
+    ll_stack_mark_t mark = stack_mark((Stack*)decrypt_ptr(stack), &mark_status);
+    _LOG_FAIL_CHECK_(mark_status == 0, "error", ERROR_REPORTS, return mark, err_code, mark_status);
+
+    ll_stack_log(stack, STACK_OP_MARK);
+    return mark;
+}
+
+void ll_stack_rollback(LLStack stack, const ll_stack_mark_t mark, int* const err_code) {
+    _LL_STACK_ACCESS_(stack);
+    Stack* target = (Stack*)decrypt_ptr(stack);
+    unsigned int marks = check_ptr(target) ? target->_marks : 0;
+
+    int rollback_status = 0;
+    stack_rollback(target, mark, &rollback_status);
+
+    //* Savepoint the stack was popped below is released by the failed rollback, the replay has to release it too.
+    if (marks && target->_marks != marks) ll_stack_log(stack, STACK_OP_ROLLBACK, (long long)mark);
+    _LOG_FAIL_CHECK_(rollback_status == 0, "error", ERROR_REPORTS, return, err_code, rollback_status);
+}
+
+void ll_stack_commit(LLStack stack, const ll_stack_mark_t mark, int* const err_code) {
+    _LL_STACK_ACCESS_(stack);
+    int commit_status = 0;
+    stack_commit((Stack*)decrypt_ptr(stack), mark, &commit_status);
+    _LOG_FAIL_CHECK_(commit_status == 0, "error", ERROR_REPORTS, return, err_code, commit_status);
+
+    ll_stack_log(stack, STACK_OP_COMMIT, (long long)mark);
+}
+
+void ll_stack_set_packed(LLStack stack, const bool enabled, int* const err_code) {
+    _LL_STACK_ACCESS_(stack);
+    stack_set_packed((Stack*)decrypt_ptr(stack), enabled, err_code);
+}
+
+void ll_stack_track_aggregates(LLStack stack, const bool enabled, int* const err_code) {
+    _LL_STACK_ACCESS_(stack);
+    stack_track_aggregates((Stack*)decrypt_ptr(stack), enabled, err_code);
+}
+
+LLStackAggregate ll_stack_aggregate(LLStack stack, int* const err_code) {
+    _LL_STACK_ACCESS_(stack);
+    StackAggregate aggregate = stack_aggregate((Stack*)decrypt_ptr(stack), err_code);
+    return (LLStackAggregate){ .min = aggregate.min, .max = aggregate.max, .sum = aggregate.sum };
+}
+
+bool ll_stack_contains(LLStack stack, const ll_stack_content_t value, int* const err_code) {
+    _LL_STACK_ACCESS_(stack);
+    return stack_find((Stack*)decrypt_ptr(stack), value, err_code) >= 0;
+}
+
+intptr_t ll_stack_find(LLStack stack, const ll_stack_content_t value, int* const err_code) {
+    _LL_STACK_ACCESS_(stack);
+    return stack_find((Stack*)decrypt_ptr(stack), value, err_code);
+}
+
+uintptr_t ll_stack_count(LLStack stack, const ll_stack_content_t value, int* const err_code) {
+    _LL_STACK_ACCESS_(stack);
+    return stack_count((Stack*)decrypt_ptr(stack), value, err_code);
+}
+
+LLStackAggregate ll_stack_reduce(LLStack stack, int* const err_code) {
+    _LL_STACK_ACCESS_(stack);
+    StackAggregate aggregate = stack_reduce((Stack*)decrypt_ptr(stack), err_code);
+    return (LLStackAggregate){ .min = aggregate.min, .max = aggregate.max, .sum = aggregate.sum };
+}
+
+ll_stack_hash_t ll_stack_content_hash(LLStack stack, int* const err_code) {
+    _LL_STACK_ACCESS_(stack);
+    return stack_content_hash((Stack*)decrypt_ptr(stack), err_code);
+}
+
+void ll_stack_checkpoint(LLStack stack, int* const err_code) {
+    if (!stack_oplog_active()) return;
+
+    _LL_STACK_ACCESS_(stack);
+    int hash_status = 0;
+    stack_hash_t hash = stack_content_hash((Stack*)decrypt_ptr(stack), &hash_status);
+    _LOG_FAIL_CHECK_(hash_status == 0, "error", ERROR_REPORTS, return, err_code, hash_status);
+
+    ll_stack_log(stack, STACK_OP_CHECK, (long long)hash);
+}
+
+void ll_stack_set_budget_group(LLStack stack, const int group, int* const err_code) {
+    _LL_STACK_ACCESS_(stack);
+    stack_set_budget_group((Stack*)decrypt_ptr(stack), group, err_code);
+}
+
+void ll_stack_memory_usage(LLStack stack, size_t* const resident, size_t* const reserved, int* const err_code) {
+    _LL_STACK_ACCESS_(stack);
+    stack_memory_usage((Stack*)decrypt_ptr(stack), resident, reserved, err_code);
+}
+
+static stack_report_t ll_stack_scan(const void* stack, int importance, bool* consistent) {
+    Stack snapshot = {};
+    stack_report_t status = stack_scan_status((const Stack*)stack, &snapshot, consistent);
+
+    //* Stack modified while its buffers were copied for the dump is checked again.
+    if (status && *consistent) *consistent = stack_scan_dump((const Stack*)stack, &snapshot, importance);
+
+    return status;
+}
+
+static size_t ll_stack_trim_idle(TrimTarget* target, const TrimmerConfig* config, long long now) {
+    return _stack_trim_target(target, config, now);
+}
+
+static inline void ll_stack_log(LLStack stack, const int op, const long long argument, 
+                                const long long* const values) {
+    if (!stack || !stack_oplog_active()) return;
+    stack_oplog_record(op, &((Stack*)decrypt_ptr(stack))->_oplog_id, argument, values);
+}
+
 static void* decrypt_ptr(void* ptr) {
     return (void*)((uintptr_t)ptr ^ (uintptr_t)CRYPTO_KEY);
 }
@@ -15,9 +15,40 @@
 #include <cstdlib>
 #include <cstdint>
 #include "stackreports.h"
+#include "stackdump.h"
 
 typedef long long ll_stack_content_t;
 typedef void* const LLStack;
+typedef uintptr_t ll_stack_mark_t;
+typedef unsigned long long ll_stack_hash_t;
+
+/**
+ * @brief Read-only view of the stack elements, iterate from begin to end.
+ * 
+ * @param stack encrypted pointer to the stack the view belongs to
+ * @param begin deepest element
+ * @param end cell after the top element
+ * @param seq modification counter of the stack at the moment the view was taken
+ */
+struct LLStackView {
+    void* stack = NULL;
+    const ll_stack_content_t* begin = NULL;
+    const ll_stack_content_t* end = NULL;
+    unsigned int seq = 0;
+};
+
+/**
+ * @brief Minimum, maximum and sum of the stack elements.
+ * 
+ * @param min smallest element
+ * @param max biggest element
+ * @param sum sum of the elements (wraps around on overflow)
+ */
+struct LLStackAggregate {
+    ll_stack_content_t min = 0;
+    ll_stack_content_t max = 0;
+    ll_stack_content_t sum = 0;
+};
 
 /**
  * @brief Construct stack and return its encrypted address.
@@ -78,6 +109,17 @@ stack_report_t ll_stack_status(LLStack stack);
 #define ll_stack_dump(stack, importance) _ll_stack_dump(stack, importance, __PRETTY_FUNCTION__, __LINE__, __FILE__)
 void _ll_stack_dump(LLStack stack, int importance, const char* function, const size_t line, const char* file);
 
+/**
+ * @brief Dump the whole stack into the dedicated stream.
+ * 
+ * @param stack encrypted pointer to the stack
+ * @param stream stream opened with dump_stream_open()
+ * @param mode dump format (one of STACK_DUMP_MODES)
+ * @param err_code variable to use as errno
+ */
+void ll_stack_dump_stream(LLStack stack, StackDumpStream* const stream, const int mode = STACK_DUMP_TEXT,
+                          int* const err_code = NULL);
+
 /**
  * @brief Get stack size.
  * 
@@ -96,4 +138,346 @@ uintptr_t ll_stack_size(LLStack stack, int* const err_code = NULL);
  */
 uintptr_t ll_stack_capacity(LLStack stack, int* const err_code = NULL);
 
+/**
+ * @brief Get number of times the buffer of the stack changed its capacity.
+ * 
+ * @param stack encrypted pointer to the stack
+ * @return size_t 
+ */
+size_t ll_stack_resize_count(LLStack stack);
+
+/**
+ * @brief Register the stack in the background integrity scanner.
+ * 
+ * @param stack encrypted pointer to the stack
+ * @param err_code variable to use as errno
+ */
+void ll_stack_watch(LLStack stack, int* const err_code = NULL);
+
+/**
+ * @brief Remove the stack from the background integrity scanner.
+ * 
+ * @param stack encrypted pointer to the stack
+ * @param err_code variable to use as errno
+ */
+void ll_stack_unwatch(LLStack stack, int* const err_code = NULL);
+
+/**
+ * @brief Register stack in the idle trimmer (see stacktrimmer.h).
+ * When the stack is not modified for the idle time of the trimmer policy, its buffer is shrunk to the size of the
+ * stack plus headroom. Pointers returned by ll_stack_read_top() and views become stale when the stack is trimmed.
+ * 
+ * @param stack encrypted pointer to the stack
+ * @param err_code variable to use as errno
+ */
+void ll_stack_watch_idle(LLStack stack, int* const err_code = NULL);
+
+/**
+ * @brief Remove stack from the idle trimmer.
+ * 
+ * @param stack encrypted pointer to the stack
+ * @param err_code variable to use as errno
+ */
+void ll_stack_unwatch_idle(LLStack stack, int* const err_code = NULL);
+
+/**
+ * @brief Shrink the buffer to the stack size plus headroom.
+ * 
+ * @param stack encrypted pointer to the stack
+ * @param headroom number of free cells to leave
+ * @param err_code variable to use as errno (EBUSY if there is an open batch, reservation or savepoint)
+ */
+void ll_stack_trim(LLStack stack, const size_t headroom, int* const err_code = NULL);
+
+/**
+ * @brief Enable or disable status checks on each operation.
+ * 
+ * @param stack encrypted pointer to the stack
+ * @param enabled true to check the stack on each operation
+ * @param err_code variable to use as errno
+ */
+void ll_stack_set_inline_checks(LLStack stack, const bool enabled, int* const err_code = NULL);
+
+/**
+ * @brief Start a batch of pushes, pops and pulls that is checked and rehashed once, at ll_stack_batch_end().
+ * 
+ * @param stack encrypted pointer to the stack
+ * @param err_code variable to use as errno
+ */
+void ll_stack_batch_begin(LLStack stack, int* const err_code = NULL);
+
+/**
+ * @brief Finish the batch and check the stack.
+ * 
+ * @param stack encrypted pointer to the stack
+ * @param err_code variable to use as errno (EAGAIN if the stack was corrupted during the batch)
+ */
+void ll_stack_batch_end(LLStack stack, int* const err_code = NULL);
+
+/**
+ * @brief Check the whole stack and start a batch that is checked the same way at ll_stack_scope_end().
+ * Unlike ll_stack_batch_begin(), the checks are done even if inline checks are disabled, and failures are dumped.
+ * 
+ * @param stack encrypted pointer to the stack
+ * @param err_code variable to use as errno (EINVAL if the stack is invalid)
+ */
+void ll_stack_scope_begin(LLStack stack, int* const err_code = NULL);
+
+/**
+ * @brief Finish the batch started by ll_stack_scope_begin() and check the whole stack.
+ * 
+ * @param stack encrypted pointer to the stack
+ * @param err_code variable to use as errno (EAGAIN if the stack was corrupted inside the scope)
+ */
+void ll_stack_scope_end(LLStack stack, int* const err_code = NULL);
+
+/**
+ * @brief Block of code in which the stack is checked only on entry and on exit (see ll_stack_scope_begin()).
+ * 
+ * @param stack guarded stack, NULL if the stack was invalid on entry
+ * @param status error code of the scope
+ */
+struct LLStackCheckScope {
+    void* stack;
+    int status;
+
+    explicit LLStackCheckScope(LLStack guarded) : stack(guarded), status(0) {
+        ll_stack_scope_begin(stack, &status);
+        if (status) stack = NULL;
+    }
+    ~LLStackCheckScope() { close(); }
+
+    /**
+     * @brief Finish the scope before the end of the block.
+     * 
+     * @return error code of the scope
+     */
+    int close() {
+        if (stack) ll_stack_scope_end(stack, &status);
+        stack = NULL;
+        return status;
+    }
+
+    LLStackCheckScope(const LLStackCheckScope&) = delete;
+    LLStackCheckScope& operator=(const LLStackCheckScope&) = delete;
+};
+
+/**
+ * @brief Make a copy of the stack in O(1), elements are shared until one of the stacks pops below them.
+ * 
+ * @param stack encrypted pointer to the stack
+ * @param err_code variable to use as errno (EBUSY if there is an open batch, reservation or savepoint)
+ * @return LLStack encrypted pointer to the copy
+ */
+LLStack ll_stack_fork(LLStack stack, int* const err_code = NULL);
+
+/**
+ * @brief Get writable cells on top of the stack, no other operation may be done on it until ll_stack_publish().
+ * 
+ * @param stack encrypted pointer to the stack
+ * @param count number of cells to reserve
+ * @param err_code variable to use as errno
+ * @return ll_stack_content_t* first reserved cell
+ */
+ll_stack_content_t* ll_stack_reserve(LLStack stack, const size_t count, int* const err_code = NULL);
+
+/**
+ * @brief Push the first written cells of the reservation at once.
+ * 
+ * @param stack encrypted pointer to the stack
+ * @param written number of cells filled since ll_stack_reserve()
+ * @param err_code variable to use as errno
+ */
+void ll_stack_publish(LLStack stack, const size_t written, int* const err_code = NULL);
+
+/**
+ * @brief Get read-only access to the top elements of the stack (the top one is the last).
+ * 
+ * @param stack encrypted pointer to the stack
+ * @param count number of elements to read
+ * @param err_code variable to use as errno
+ * @return const ll_stack_content_t* 
+ */
+const ll_stack_content_t* ll_stack_read_top(LLStack stack, const size_t count, int* const err_code = NULL);
+
+/**
+ * @brief Get view of the stack elements that becomes stale on the next modification of the stack.
+ * 
+ * @param stack encrypted pointer to the stack
+ * @param err_code variable to use as errno
+ * @return LLStackView 
+ */
+LLStackView ll_stack_view(LLStack stack, int* const err_code = NULL);
+
+/**
+ * @brief Get element of the view with range and staleness checks.
+ * 
+ * @param view 
+ * @param index index of the element counting from the bottom
+ * @param err_code variable to use as errno (ERANGE or ESTALE)
+ * @return ll_stack_content_t 
+ */
+ll_stack_content_t ll_stack_view_at(const LLStackView* const view, const size_t index, int* const err_code = NULL);
+
+/**
+ * @brief Construct stack over the existing array without copying it.
+ * 
+ * @param data array of elements
+ * @param size number of elements in the array
+ * @param capacity number of cells in the array
+ * @param owned true to pass malloc()-ed array to the stack, false to only wrap it
+ * @param err_code variable to use as errno
+ * @return LLStack 
+ */
+LLStack ll_stack_adopt(ll_stack_content_t* const data, const size_t size, const size_t capacity, const bool owned,
+                       int* const err_code = NULL);
+
+/**
+ * @brief Destroy the stack and take its elements out without copying.
+ * 
+ * @param stack encrypted pointer to the stack
+ * @param size variable to put number of elements into
+ * @param err_code variable to use as errno
+ * @return ll_stack_content_t* array to free() (or the wrapped array if the stack has never been resized)
+ */
+ll_stack_content_t* ll_stack_release(LLStack stack, size_t* const size, int* const err_code = NULL);
+
+/**
+ * @brief Remember current stack size as a savepoint.
+ * 
+ * @param stack encrypted pointer to the stack
+ * @param err_code variable to use as errno
+ * @return ll_stack_mark_t 
+ */
+ll_stack_mark_t ll_stack_mark(LLStack stack, int* const err_code = NULL);
+
+/**
+ * @brief Erase all elements pushed after the savepoint at once and release it.
+ * Only the innermost held savepoint can be rolled back to. If the stack was popped below it, 
+ * the savepoint is released without changing the stack and ERANGE is reported.
+ * 
+ * @param stack encrypted pointer to the stack
+ * @param mark savepoint returned by ll_stack_mark()
+ * @param err_code variable to use as errno
+ */
+void ll_stack_rollback(LLStack stack, const ll_stack_mark_t mark, int* const err_code = NULL);
+
+/**
+ * @brief Release the savepoint keeping the elements pushed after it.
+ * Only the innermost held savepoint can be released.
+ * 
+ * @param stack encrypted pointer to the stack
+ * @param mark savepoint returned by ll_stack_mark()
+ * @param err_code variable to use as errno
+ */
+void ll_stack_commit(LLStack stack, const ll_stack_mark_t mark, int* const err_code = NULL);
+
+/**
+ * @brief Keep cold elements of the stack compressed.
+ * Only two top blocks of STACK_PACK_BLOCK elements are stored as is, blocks below them are delta-encoded
+ * and bit-packed, so stacks of small or nearly monotonic values take a fraction of their memory.
+ * 
+ * @param stack encrypted pointer to the stack
+ * @param enabled true to compress blocks that get below the two top ones
+ * @param err_code variable to use as errno
+ */
+void ll_stack_set_packed(LLStack stack, const bool enabled, int* const err_code = NULL);
+
+/**
+ * @brief Keep running minimum, maximum and sum next to each element, so that they are read in O(1).
+ * Tracking can only be enabled while the stack is empty, aggregates take three extra cells per element.
+ * 
+ * @param stack encrypted pointer to the stack
+ * @param enabled true to track aggregates, false to drop them
+ * @param err_code variable to use as errno
+ */
+void ll_stack_track_aggregates(LLStack stack, const bool enabled, int* const err_code = NULL);
+
+/**
+ * @brief Get minimum, maximum and sum of the stack elements.
+ * 
+ * @param stack encrypted pointer to the stack
+ * @param err_code variable to use as errno (ENOENT if aggregates are not tracked, ENXIO if the stack is empty)
+ * @return LLStackAggregate 
+ */
+LLStackAggregate ll_stack_aggregate(LLStack stack, int* const err_code = NULL);
+
+/**
+ * @brief Check if the value is in the stack.
+ * 
+ * @param stack encrypted pointer to the stack
+ * @param value value to find
+ * @param err_code variable to use as errno
+ * @return bool
+ */
+bool ll_stack_contains(LLStack stack, const ll_stack_content_t value, int* const err_code = NULL);
+
+/**
+ * @brief Find the occurrence of the value that is closest to the top.
+ * 
+ * @param stack encrypted pointer to the stack
+ * @param value value to find
+ * @param err_code variable to use as errno
+ * @return intptr_t number of elements above the occurrence (0 for the top element), -1 if there is none
+ */
+intptr_t ll_stack_find(LLStack stack, const ll_stack_content_t value, int* const err_code = NULL);
+
+/**
+ * @brief Count occurrences of the value in the stack.
+ * 
+ * @param stack encrypted pointer to the stack
+ * @param value value to count
+ * @param err_code variable to use as errno
+ * @return uintptr_t
+ */
+uintptr_t ll_stack_count(LLStack stack, const ll_stack_content_t value, int* const err_code = NULL);
+
+/**
+ * @brief Calculate minimum, maximum and sum of the stack elements by scanning them (with AVX2 if it is available).
+ * 
+ * @param stack encrypted pointer to the stack
+ * @param err_code variable to use as errno (ENXIO if the stack is empty)
+ * @return LLStackAggregate 
+ */
+LLStackAggregate ll_stack_reduce(LLStack stack, int* const err_code = NULL);
+
+/**
+ * @brief Calculate hash of the stack elements that does not depend on where and how they are stored.
+ * 
+ * @param stack encrypted pointer to the stack
+ * @param err_code variable to use as errno
+ * @return ll_stack_hash_t 
+ */
+ll_stack_hash_t ll_stack_content_hash(LLStack stack, int* const err_code = NULL);
+
+/**
+ * @brief Record the content hash of the stack into the operation log (see stackoplog.h),
+ * so that replicas and replays can confirm they have the same elements at this point.
+ * A replica receives the operations logged before the checkpoint without waiting for the rest of their group.
+ * Does nothing if operations are not being logged.
+ * 
+ * @param stack encrypted pointer to the stack
+ * @param err_code variable to use as errno
+ */
+void ll_stack_checkpoint(LLStack stack, int* const err_code = NULL);
+
+/**
+ * @brief Move the stack into another memory budget group (see stackbudget.h).
+ * 
+ * @param stack encrypted pointer to the stack
+ * @param group index of the group
+ * @param err_code variable to use as errno
+ */
+void ll_stack_set_budget_group(LLStack stack, const int group, int* const err_code = NULL);
+
+/**
+ * @brief Get amount of memory used by the stack.
+ * 
+ * @param stack encrypted pointer to the stack
+ * @param resident variable to put number of bytes backed by physical memory into
+ * @param reserved variable to put number of allocated bytes into
+ * @param err_code variable to use as errno
+ */
+void ll_stack_memory_usage(LLStack stack, size_t* const resident, size_t* const reserved, int* const err_code = NULL);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,388 @@
+#include "loadgen.h"
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "ll_stack.h"
+#include "combining_stack.h"
+#include "stackscanner.h"
+#include "util/clock.h"
+#include "util/histogram.h"
+#include "util/dbg/debug.h"
+
+static const size_t LOAD_STARTING_CAPACITY = 16;
+
+/**
+ * @brief Stack under load.
+ *
+ * @param stack encrypted pointer to the stack
+ * @param size number of elements in the stack
+ * @param shared true if the stack is used by several threads
+ * @param mutex lock of the shared stack
+ * @param combining the stack wrapped into a flat combining stack (NULL if the stack is shared through the mutex)
+ */
+struct LoadStack {
+    void* stack = NULL;
+    size_t size = 0;
+    bool shared = false;
+    pthread_mutex_t mutex;
+    CombiningLLStack combining = NULL;
+};
+
+/**
+ * @brief Gate workers wait at until all of them are created.
+ *
+ * @param mutex lock of the gate
+ * @param opened condition signalled when the gate is opened
+ * @param open true once the gate is opened
+ * @param cancelled true if the workers should exit without running the load
+ */
+struct LoadGate {
+    pthread_mutex_t mutex;
+    pthread_cond_t opened;
+    bool open;
+    bool cancelled;
+};
+
+/**
+ * @brief Worker thread state.
+ *
+ * @param config load settings
+ * @param target stack the worker operates on
+ * @param start_gate gate all workers start from
+ * @param random_state state of the random generator
+ * @param histograms latencies of each operation
+ */
+struct LoadWorker {
+    pthread_t thread;
+    const LoadConfig* config;
+    LoadStack* target;
+    LoadGate* start_gate;
+    uint64_t random_state;
+    Histogram* histograms;
+};
+
+/**
+ * @brief Run workload at one integrity level.
+ *
+ * @param config load settings
+ * @param integrity integrity level
+ * @param output stream to print the report into
+ * @param err_code variable to use as errno
+ */
+static void load_run_level(const LoadConfig* const config, const int integrity, FILE* output, int* const err_code);
+
+/**
+ * @brief Destroy the stacks under load.
+ *
+ * @param stacks stacks to destroy
+ * @param stack_count number of stacks
+ */
+static void load_free_stacks(LoadStack* const stacks, const int stack_count);
+
+/**
+ * @brief Let the workers waiting at the gate go.
+ *
+ * @param gate gate to open
+ * @param cancelled true to make the workers exit without running the load
+ */
+static void load_gate_open(LoadGate* const gate, const bool cancelled);
+
+/**
+ * @brief Wait until the gate is opened.
+ *
+ * @param gate gate to wait at
+ * @return true if the load should be run, false if it was cancelled
+ */
+static bool load_gate_wait(LoadGate* const gate);
+
+/**
+ * @brief Main function of the worker thread.
+ *
+ * @param argument worker state
+ * @return void*
+ */
+static void* load_worker(void* argument);
+
+/**
+ * @brief Perform the operation on the flat combining stack.
+ *
+ * @param stack stack to operate on
+ * @param operation operation to perform (one of LOAD_OPERATIONS)
+ * @param value value to push
+ * @return int operation that was actually performed
+ */
+static inline int load_combined(CombiningLLStack stack, const int operation, ll_stack_content_t value);
+
+/**
+ * @brief Generate next pseudo-random number.
+ *
+ * @param state generator state
+ * @return uint64_t
+ */
+static inline uint64_t load_random(uint64_t* state);
+
+/**
+ * @brief Print latencies of each operation.
+ *
+ * @param histograms merged latencies
+ * @param output stream to print into
+ */
+static void load_report(const Histogram* const histograms, FILE* output);
+
+void load_run(const LoadConfig* const config, FILE* output, int* const err_code) {
+    _LOG_FAIL_CHECK_(config && output, "error", ERROR_REPORTS, return, err_code, EFAULT);
+    _LOG_FAIL_CHECK_(config->threads > 0 && config->operations > 0 && config->stacks >= 0,
+                     "error", ERROR_REPORTS, return, err_code, EINVAL);
+    _LOG_FAIL_CHECK_(config->push_percent >= 0 && config->pull_percent >= 0 &&
+                     config->push_percent + config->pull_percent <= 100,
+                     "error", ERROR_REPORTS, return, err_code, EINVAL);
+    _LOG_FAIL_CHECK_(config->integrity < LOAD_INTEGRITY_COUNT, "error", ERROR_REPORTS, return, err_code, EINVAL);
+
+    if (config->integrity >= 0) {
+        load_run_level(config, config->integrity, output, err_code);
+        return;
+    }
+
+    for (int integrity = 0; integrity < LOAD_INTEGRITY_COUNT; ++integrity) {
+        load_run_level(config, integrity, output, err_code);
+    }
+}
+
+static void load_run_level(const LoadConfig* const config, const int integrity, FILE* output, int* const err_code) {
+    int stack_count = config->stacks ? config->stacks : config->threads;
+
+    LoadStack* stacks = (LoadStack*) calloc((size_t)stack_count, sizeof(*stacks));
+    LoadWorker* workers = (LoadWorker*) calloc((size_t)config->threads, sizeof(*workers));
+    Histogram* histograms = (Histogram*) calloc((size_t)(config->threads + 1) * LOAD_OPERATION_COUNT,
+                                                sizeof(*histograms));
+    _LOG_FAIL_CHECK_(stacks && workers && histograms, "error", ERROR_REPORTS, {
+        free(stacks);
+        free(workers);
+        free(histograms);
+        return;
+    }, err_code, ENOMEM);
+
+    for (int histogram_id = 0; histogram_id < (config->threads + 1) * LOAD_OPERATION_COUNT; ++histogram_id) {
+        histograms[histogram_id] = (Histogram){};
+    }
+
+    for (int stack_id = 0; stack_id < stack_count; ++stack_id) {
+        stacks[stack_id].stack = ll_stack_ctor(LOAD_STARTING_CAPACITY, err_code);
+        _LOG_FAIL_CHECK_(stacks[stack_id].stack, "error", ERROR_REPORTS, {
+            load_free_stacks(stacks, stack_id);
+            free(stacks);
+            free(workers);
+            free(histograms);
+            return;
+        }, err_code, ENOMEM);
+
+        stacks[stack_id].shared = config->stacks != 0 && config->threads > stack_count;
+        pthread_mutex_init(&stacks[stack_id].mutex, NULL);
+
+        ll_stack_set_inline_checks(stacks[stack_id].stack, integrity == LOAD_INTEGRITY_INLINE, err_code);
+        if (integrity == LOAD_INTEGRITY_SCANNER) ll_stack_watch(stacks[stack_id].stack, err_code);
+
+        if (config->combining && stacks[stack_id].shared) {
+            stacks[stack_id].combining = fc_stack_ctor(stacks[stack_id].stack, err_code);
+        }
+    }
+
+    if (integrity == LOAD_INTEGRITY_SCANNER) stack_scanner_start(ScannerConfig{}, err_code);
+
+    LoadGate start_gate = {};
+    pthread_mutex_init(&start_gate.mutex, NULL);
+    pthread_cond_init(&start_gate.opened, NULL);
+
+    int create_status = 0;
+    int started = 0;
+    while (started < config->threads) {
+        workers[started] = (LoadWorker){
+            .thread = 0,
+            .config = config,
+            .target = stacks + started % stack_count,
+            .start_gate = &start_gate,
+            .random_state = 0x9E3779B97F4A7C15ull * (uint64_t)(started + 1),
+            .histograms = histograms + (started + 1) * LOAD_OPERATION_COUNT,
+        };
+        create_status = pthread_create(&workers[started].thread, NULL, load_worker, workers + started);
+        if (create_status) break;
+        ++started;
+    }
+
+    //* Workers that were created are released without running the load, so a failed start does not hang them.
+    if (create_status) {
+        load_gate_open(&start_gate, true);
+        for (int worker_id = 0; worker_id < started; ++worker_id) pthread_join(workers[worker_id].thread, NULL);
+        if (integrity == LOAD_INTEGRITY_SCANNER) stack_scanner_stop();
+    }
+
+    _LOG_FAIL_CHECK_(!create_status, "error", ERROR_REPORTS, {
+        load_free_stacks(stacks, stack_count);
+        pthread_mutex_destroy(&start_gate.mutex);
+        pthread_cond_destroy(&start_gate.opened);
+        free(stacks);
+        free(workers);
+        free(histograms);
+        return;
+    }, err_code, create_status);
+
+    load_gate_open(&start_gate, false);
+    uint64_t start_time = clock_ns();
+
+    for (int worker_id = 0; worker_id < config->threads; ++worker_id) {
+        pthread_join(workers[worker_id].thread, NULL);
+        for (int operation = 0; operation < LOAD_OPERATION_COUNT; ++operation) {
+            histogram_merge(histograms + operation, workers[worker_id].histograms + operation);
+        }
+    }
+
+    double elapsed = (double)(clock_ns() - start_time) / 1e9;
+    double total = (double)config->threads * config->operations;
+
+    if (integrity == LOAD_INTEGRITY_SCANNER) stack_scanner_stop(err_code);
+
+    fprintf(output, "\nIntegrity level: %s\n", LOAD_INTEGRITY_DESCR[integrity]);
+    const char* sharing = stacks->combining ? "flat combining" : stacks->shared ? "shared" : "one per thread";
+
+    fprintf(output, "Threads: %d, stacks: %d (%s), operations: %.0lf in %.3lf s, throughput: %.0lf ops/s\n",
+            config->threads, stack_count, sharing, total, elapsed, total / elapsed);
+    if (stacks->combining) fprintf(output, "Operations per batch: %.1lf\n", fc_stack_mean_batch(stacks->combining));
+    load_report(histograms, output);
+
+    load_free_stacks(stacks, stack_count);
+
+    pthread_mutex_destroy(&start_gate.mutex);
+    pthread_cond_destroy(&start_gate.opened);
+
+    free(stacks);
+    free(workers);
+    free(histograms);
+}
+
+static void load_free_stacks(LoadStack* const stacks, const int stack_count) {
+    for (int stack_id = 0; stack_id < stack_count; ++stack_id) {
+        if (stacks[stack_id].combining) fc_stack_dtor(stacks[stack_id].combining);
+        else                            ll_stack_dtor(stacks[stack_id].stack);
+        pthread_mutex_destroy(&stacks[stack_id].mutex);
+    }
+}
+
+static void load_gate_open(LoadGate* const gate, const bool cancelled) {
+    pthread_mutex_lock(&gate->mutex);
+
+    gate->open = true;
+    gate->cancelled = cancelled;
+    pthread_cond_broadcast(&gate->opened);
+
+    pthread_mutex_unlock(&gate->mutex);
+}
+
+static bool load_gate_wait(LoadGate* const gate) {
+    pthread_mutex_lock(&gate->mutex);
+
+    while (!gate->open) pthread_cond_wait(&gate->opened, &gate->mutex);
+    bool cancelled = gate->cancelled;
+
+    pthread_mutex_unlock(&gate->mutex);
+    return !cancelled;
+}
+
+static void* load_worker(void* argument) {
+    LoadWorker* worker = (LoadWorker*)argument;
+    const LoadConfig* config = worker->config;
+    LoadStack* target = worker->target;
+
+    uint64_t sequence = 0;
+
+    if (!load_gate_wait(worker->start_gate)) return NULL;
+
+    for (int operation_id = 0; operation_id < config->operations; ++operation_id) {
+        int roll = (int)(load_random(&worker->random_state) % 100);
+        int operation = roll < config->push_percent ? LOAD_PUSH :
+                        roll < config->push_percent + config->pull_percent ? LOAD_PULL : LOAD_POP;
+
+        ll_stack_content_t value = 0;
+        switch (config->distribution) {
+            case LOAD_SEQUENTIAL: value = (ll_stack_content_t)sequence++; break;
+            case LOAD_SMALL:      value = (ll_stack_content_t)(load_random(&worker->random_state) & 0xFF); break;
+            default:              value = (ll_stack_content_t)load_random(&worker->random_state); break;
+        }
+
+        uint64_t start_time = clock_ns();
+
+        if (target->combining) {
+            operation = load_combined(target->combining, operation, value);
+            histogram_record(worker->histograms + operation, clock_ns() - start_time);
+            continue;
+        }
+
+        if (target->shared) pthread_mutex_lock(&target->mutex);
+
+        //* Empty stack can not be popped, so the operation turns into a push.
+        if (!target->size) operation = LOAD_PUSH;
+
+        //* Size mirrors the stack only while operations succeed, a failed one leaves it as it was.
+        int operation_status = 0;
+        switch (operation) {
+            case LOAD_PUSH:
+                ll_stack_push(target->stack, value, &operation_status);
+                if (!operation_status) ++target->size;
+                break;
+            case LOAD_POP:
+                ll_stack_pop(target->stack, &operation_status);
+                if (!operation_status) --target->size;
+                break;
+            default:
+                ll_stack_pull(target->stack);
+                break;
+        }
+
+        if (target->shared) pthread_mutex_unlock(&target->mutex);
+
+        histogram_record(worker->histograms + operation, clock_ns() - start_time);
+    }
+
+    return NULL;
+}
+
+static inline int load_combined(CombiningLLStack stack, const int operation, ll_stack_content_t value) {
+    //* Size may change before the operation is applied, so an empty stack is detected by the failed operation.
+    int status = 0;
+    if (operation == LOAD_POP  && fc_stack_pop(stack, NULL, &status))    return LOAD_POP;
+    if (operation == LOAD_PULL && fc_stack_pull(stack, &value, &status)) return LOAD_PULL;
+
+    fc_stack_push(stack, value);
+    return LOAD_PUSH;
+}
+
+static inline uint64_t load_random(uint64_t* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static void load_report(const Histogram* const histograms, FILE* output) {
+    static const double PERCENTILES[] = {50, 90, 99, 99.9, 99.99};
+
+    fprintf(output, "%-10s %12s %10s", "operation", "count", "mean");
+    for (size_t percentile_id = 0; percentile_id < sizeof(PERCENTILES) / sizeof(*PERCENTILES); ++percentile_id) {
+        char title[16] = "";
+        snprintf(title, sizeof(title), "p%g", PERCENTILES[percentile_id]);
+        fprintf(output, " %10s", title);
+    }
+    fprintf(output, " %10s   (latency in ns)\n", "max");
+
+    for (int operation = 0; operation < LOAD_OPERATION_COUNT; ++operation) {
+        const Histogram* histogram = histograms + operation;
+
+        fprintf(output, "%-10s %12lu %10.0lf", LOAD_OPERATION_NAMES[operation],
+                (unsigned long)histogram->total, histogram_mean(histogram));
+        for (size_t percentile_id = 0; percentile_id < sizeof(PERCENTILES) / sizeof(*PERCENTILES); ++percentile_id) {
+            fprintf(output, " %10lu", (unsigned long)histogram_percentile(histogram, PERCENTILES[percentile_id]));
+        }
+        fprintf(output, " %10lu\n", (unsigned long)histogram->max);
+    }
+}
\ No newline at end of file
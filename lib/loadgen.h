@@ -0,0 +1,77 @@
+/**
+ * @file loadgen.h
+ * @author Ilya Kudryashov (kudriashov.it@phystech.edu)
+ * @brief Multi-threaded synthetic load generator for LLStack.
+ * @version 0.1
+ * @date 2022-10-12
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef LOADGEN_H
+#define LOADGEN_H
+
+#include <stdio.h>
+
+enum LOAD_DISTRIBUTIONS {
+    LOAD_SEQUENTIAL = 0,  // Values 0, 1, 2, ... in each thread.
+    LOAD_UNIFORM = 1,     // Random values from the whole range of long long.
+    LOAD_SMALL = 2,       // Random values from [0, 256).
+};
+
+enum LOAD_INTEGRITY_LEVELS {
+    LOAD_INTEGRITY_NONE = 0,      // No inline checks.
+    LOAD_INTEGRITY_SCANNER = 1,   // No inline checks, stacks are checked by the background scanner.
+    LOAD_INTEGRITY_INLINE = 2,    // Full check before and after every operation.
+    LOAD_INTEGRITY_COUNT,
+};
+
+static const char* const LOAD_INTEGRITY_DESCR[] = {
+    "no checks",
+    "background scanner",
+    "inline checks",
+};
+
+enum LOAD_OPERATIONS {
+    LOAD_PUSH = 0,
+    LOAD_POP = 1,
+    LOAD_PULL = 2,
+    LOAD_OPERATION_COUNT,
+};
+
+static const char* const LOAD_OPERATION_NAMES[] = {"push", "pop", "pull"};
+
+/**
+ * @brief Load generator settings.
+ *
+ * @param threads number of worker threads
+ * @param operations number of operations each thread performs
+ * @param push_percent percentage of pushes
+ * @param pull_percent percentage of pulls (the rest of operations are pops)
+ * @param stacks number of stacks shared between threads (0 to give each thread its own stack)
+ * @param distribution distribution of pushed values (one of LOAD_DISTRIBUTIONS)
+ * @param integrity integrity level (one of LOAD_INTEGRITY_LEVELS, -1 to compare all of them)
+ * @param combining true to share stacks through flat combining instead of a mutex
+ */
+struct LoadConfig {
+    int threads = 1;
+    int operations = 100000;
+    int push_percent = 50;
+    int pull_percent = 10;
+    int stacks = 0;
+    int distribution = LOAD_UNIFORM;
+    int integrity = -1;
+    bool combining = false;
+};
+
+/**
+ * @brief Run the workload and print throughput and latency percentiles of each operation.
+ *
+ * @param config load settings
+ * @param output stream to print the report into
+ * @param err_code variable to use as errno
+ */
+void load_run(const LoadConfig* const config, FILE* output, int* const err_code = NULL);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,379 @@
+#include "record_stack.h"
+
+#include <cstring>
+#include <stdalign.h>
+
+#include "stackdump.h"
+#include "util/dbg/debug.h"
+#include "util/dbg/logger.h"
+#include "stackframe.h"
+
+static const char REC_POISON = '\0';
+static const size_t REC_BUFFER_INCREASE = 2;
+
+#ifndef REC_DUMP_MAX_RECORDS
+#define REC_DUMP_MAX_RECORDS 16
+#endif
+
+#ifndef REC_DUMP_MAX_BITES
+#define REC_DUMP_MAX_BITES 16
+#endif
+
+/**
+ * @brief Stored right after the bytes of each record, so the top record can be found from the end of the data.
+ *
+ * @param length number of bytes in the record
+ * @param chain hash of all records below this one
+ */
+struct RecordFooter {
+    size_t length;
+    hash_t chain;
+};
+
+//* Records are padded so that every footer is aligned.
+static const size_t REC_ALIGNMENT = alignof(RecordFooter);
+static const size_t REC_PREFIX_SIZE = (sizeof(stack_canary_t) + REC_ALIGNMENT - 1) / REC_ALIGNMENT * REC_ALIGNMENT;
+
+struct RecordStack {
+    ON_CANARY(stack_canary_t _canary_left = STACK_CANARY_VALUE;)
+
+    char* buffer = NULL;
+    size_t size = 0;        // Number of occupied bytes.
+    size_t capacity = 0;    // Number of bytes between buffer canaries.
+    size_t count = 0;
+    hash_t chain = 0;       // Hash of all records in the stack.
+
+    ON_HASH(hash_t _hash = 0;)
+
+    ON_CANARY(stack_canary_t _canary_right = STACK_CANARY_VALUE;)
+};
+
+/**
+ * @brief Check header, canaries and the top record of the stack.
+ *
+ * @param stack stack to check
+ * @return stack_report_t
+ */
+static stack_report_t rec_stack_quick_status(const RecStack stack);
+
+/**
+ * @brief Change the size of the buffer.
+ *
+ * @param stack stack to modify
+ * @param capacity new size of the buffer in bytes
+ * @param err_code variable to use as errno
+ */
+static void rec_stack_resize(RecStack stack, const size_t capacity, int* const err_code);
+
+/**
+ * @brief Allocate poisoned buffer surrounded by canaries.
+ *
+ * @param capacity number of bytes between canaries
+ * @return char*
+ */
+static char* rec_alloc_space(const size_t capacity);
+
+/**
+ * @brief Get pointer to the first byte after the left buffer canary.
+ *
+ * @param stack
+ * @return char*
+ */
+static inline char* rec_content(const RecStack stack);
+
+/**
+ * @brief Get footer of the record that ends at the specified offset.
+ *
+ * @param stack
+ * @param end offset of the end of the record
+ * @return RecordFooter*
+ */
+static inline RecordFooter* rec_footer(const RecStack stack, const size_t end);
+
+/**
+ * @brief Get number of bytes the record occupies with its footer and padding.
+ *
+ * @param length number of bytes in the record
+ * @return size_t
+ */
+static inline size_t rec_full_size(const size_t length);
+
+/**
+ * @brief Calculate hash of the stack after a record is pushed on top of records with the specified hash.
+ *
+ * @param chain hash of the records below
+ * @param record first byte of the record
+ * @param full_size size of the record with its footer and padding
+ * @return hash_t
+ */
+static inline hash_t rec_chain(const hash_t chain, const char* record, const size_t full_size);
+
+#ifndef NHASH
+/**
+ * @brief Calculate hash of the stack header.
+ *
+ * @param stack
+ * @return hash_t
+ */
+static hash_t rec_stack_hash(const RecStack stack);
+#endif
+
+RecStack rec_stack_ctor(const size_t capacity, int* const err_code) {
+    RecordStack* stack = (RecordStack*) calloc(1, sizeof(RecordStack));
+    _LOG_FAIL_CHECK_(stack, "error", ERROR_REPORTS, return NULL, err_code, ENOMEM);
+    *stack = (RecordStack){};
+
+    size_t aligned_capacity = (capacity + REC_ALIGNMENT - 1) / REC_ALIGNMENT * REC_ALIGNMENT;
+
+    stack->buffer = rec_alloc_space(aligned_capacity);
+    _LOG_FAIL_CHECK_(stack->buffer, "error", ERROR_REPORTS, {
+        free(stack);
+        return NULL;
+    }, err_code, ENOMEM);
+
+    stack->capacity = aligned_capacity;
+    stack->chain = HASH_SEED;
+
+    ON_HASH(stack->_hash = rec_stack_hash(stack));
+
+    return stack;
+}
+
+void rec_stack_dtor(RecStack stack) {
+    if (!stack) return;
+
+    free(stack->buffer);
+    free(stack);
+}
+
+void rec_stack_push(RecStack stack, const void* data, const size_t length, int* const err_code) {
+    _LOG_FAIL_CHECK_(!rec_stack_quick_status(stack), "error", ERROR_REPORTS, return, err_code, EINVAL);
+    _LOG_FAIL_CHECK_(data || !length, "error", ERROR_REPORTS, return, err_code, EFAULT);
+
+    size_t full_size = rec_full_size(length);
+
+    if (stack->capacity < stack->size + full_size) {
+        size_t new_capacity = stack->capacity * REC_BUFFER_INCREASE;
+        if (new_capacity < stack->size + full_size) new_capacity = stack->size + full_size;
+
+        int resize_status = 0;
+        rec_stack_resize(stack, new_capacity, &resize_status);
+        _LOG_FAIL_CHECK_(resize_status == 0, "error", ERROR_REPORTS, return, err_code, resize_status);
+    }
+
+    char* record = rec_content(stack) + stack->size;
+    memcpy(record, data, length);
+
+    RecordFooter* footer = rec_footer(stack, stack->size + full_size);
+    footer->length = length;
+    footer->chain = stack->chain;
+
+    stack->chain = rec_chain(stack->chain, record, full_size);
+    stack->size += full_size;
+    ++stack->count;
+
+    ON_HASH(stack->_hash = rec_stack_hash(stack));
+
+    _LOG_FAIL_CHECK_(!rec_stack_quick_status(stack), "error", ERROR_REPORTS, {
+        log_printf(ERROR_REPORTS, "error", "Record stack %p was invalid after push.\n", stack);
+        rec_stack_dump(stack, ERROR_REPORTS);
+        return;
+    }, err_code, EAGAIN);
+}
+
+RecordSpan rec_stack_peek(RecStack stack, int* const err_code) {
+    _LOG_FAIL_CHECK_(!rec_stack_quick_status(stack), "error", ERROR_REPORTS, return RecordSpan{}, err_code, EINVAL);
+    _LOG_FAIL_CHECK_(stack->count, "error", ERROR_REPORTS, return RecordSpan{}, err_code, ENXIO);
+
+    const RecordFooter* footer = rec_footer(stack, stack->size);
+    return (RecordSpan){ .data = rec_content(stack) + stack->size - rec_full_size(footer->length),
+                         .length = footer->length };
+}
+
+void rec_stack_pop(RecStack stack, int* const err_code) {
+    _LOG_FAIL_CHECK_(!rec_stack_quick_status(stack), "error", ERROR_REPORTS, return, err_code, EINVAL);
+    _LOG_FAIL_CHECK_(stack->count, "error", ERROR_REPORTS, return, err_code, ENXIO);
+
+    const RecordFooter* footer = rec_footer(stack, stack->size);
+    size_t full_size = rec_full_size(footer->length);
+
+    stack->chain = footer->chain;
+    stack->size -= full_size;
+    --stack->count;
+
+    memset(rec_content(stack) + stack->size, REC_POISON, full_size);
+
+    ON_HASH(stack->_hash = rec_stack_hash(stack));
+
+    if (stack->size * REC_BUFFER_INCREASE * REC_BUFFER_INCREASE < stack->capacity) {
+        rec_stack_resize(stack, stack->capacity / REC_BUFFER_INCREASE, err_code);
+    }
+
+    _LOG_FAIL_CHECK_(!rec_stack_quick_status(stack), "error", ERROR_REPORTS, {
+        log_printf(ERROR_REPORTS, "error", "Record stack %p was invalid after pop.\n", stack);
+        rec_stack_dump(stack, ERROR_REPORTS);
+        return;
+    }, err_code, EAGAIN);
+}
+
+size_t rec_stack_count(RecStack stack) {
+    return stack ? stack->count : 0;
+}
+
+size_t rec_stack_bytes(RecStack stack) {
+    return stack ? stack->size : 0;
+}
+
+stack_report_t rec_stack_status(RecStack stack) {
+    stack_report_t status = rec_stack_quick_status(stack);
+    if (status & (STACK_NULL | STACK_NULL_CONTENT | STACK_BIG_SIZE)) return status;
+
+    //* Records are walked from the top, each footer stores the hash the stack had before the record was pushed.
+    hash_t expected_chain = stack->chain;
+    size_t end = stack->size;
+    for (size_t record_id = 0; record_id < stack->count; ++record_id) {
+        if (end < sizeof(RecordFooter)) return status | STACK_BIG_SIZE;
+
+        const RecordFooter* footer = rec_footer(stack, end);
+        if (footer->length > end - sizeof(RecordFooter)) return status | STACK_BIG_SIZE;
+
+        size_t full_size = rec_full_size(footer->length);
+        if (full_size > end) return status | STACK_BIG_SIZE;
+
+        end -= full_size;
+        if (rec_chain(footer->chain, rec_content(stack) + end, full_size) != expected_chain) {
+            status |= STACK_HASH_FAILURE;
+        }
+        expected_chain = footer->chain;
+    }
+
+    if (end != 0) status |= STACK_BIG_SIZE;
+    if (expected_chain != HASH_SEED) status |= STACK_HASH_FAILURE;
+
+    return status;
+}
+
+void _rec_stack_dump(RecStack stack, int importance, const char* function, const size_t line, const char* file) {
+    _log_printf(importance, "dump", " ----- Record stack dump in function %s of file %s (%ld): ----- \n",
+                function, file, line);
+
+    stack_report_t status = rec_stack_status(stack);
+    _log_printf(importance, "dump", "\tStatus: %s (%d)\n", status ? "CORRUPT" : "OK", status);
+
+    _log_printf(importance, "dump", "\tRecord stack at %p:\n", stack);
+    if (status & STACK_NULL) return;
+
+    ON_CANARY(_log_printf(importance, "dump", "\t\tLeft canary  = \"%6s\"\n", stack->_canary_left));
+    ON_CANARY(_log_printf(importance, "dump", "\t\tRight canary = \"%6s\"\n", stack->_canary_right));
+    _log_printf(importance, "dump", "\t\tCapacity     = %ld bytes\n", stack->capacity);
+    _log_printf(importance, "dump", "\t\tSize         = %ld bytes\n", stack->size);
+    _log_printf(importance, "dump", "\t\tCount        = %ld\n", stack->count);
+    _log_printf(importance, "dump", "\t\tBuffer       = %p\n", stack->buffer);
+    ON_HASH(_log_printf(importance, "dump", "\t\tHash      = %llu\n", stack->_hash));
+    ON_HASH(_log_printf(importance, "dump", "\t\tEst. hash = %llu\n", rec_stack_hash(stack)));
+
+    if (status & (STACK_NULL_CONTENT | STACK_BIG_SIZE)) return;
+
+    size_t end = stack->size;
+    for (size_t record_id = 0; record_id < stack->count && record_id < REC_DUMP_MAX_RECORDS; ++record_id) {
+        const RecordFooter* footer = rec_footer(stack, end);
+        const char* record = rec_content(stack) + end - rec_full_size(footer->length);
+        size_t shown = footer->length < REC_DUMP_MAX_BITES ? footer->length : REC_DUMP_MAX_BITES;
+
+        char biteline[REC_DUMP_MAX_BITES * 7 + 1] = "";
+        size_t end_index = 0;
+        end_index += dump_format_hex(biteline + end_index, record, shown, true);
+        end_index += dump_format_ascii(biteline + end_index, record, shown, true);
+        biteline[end_index] = '\0';
+
+        _log_printf(importance, "dump", "\t\t\t[top-%02ld] length %5ld at %p: %s%s\n", record_id, footer->length,
+                    record, biteline, shown < footer->length ? "..." : "");
+
+        end -= rec_full_size(footer->length);
+    }
+}
+
+static stack_report_t rec_stack_quick_status(const RecStack stack) {
+    stack_report_t status = 0;
+
+    if (check_ptr(stack) == false) return STACK_NULL;
+
+    if (stack->size > stack->capacity) status |= STACK_BIG_SIZE;
+    if (check_ptr(stack->buffer) == false) return status | STACK_NULL_CONTENT;
+
+    ON_CANARY({
+        if (!stack_check_canary(stack->_canary_left))  status |= STACK_L_CANARY_FAIL;
+        if (!stack_check_canary(stack->_canary_right)) status |= STACK_R_CANARY_FAIL;
+        if (!stack_check_canary(stack->buffer))        status |= STACK_BL_CANARY_FAIL;
+        if (!(status & STACK_BIG_SIZE) && !stack_check_canary(rec_content(stack) + stack->capacity))
+            status |= STACK_BR_CANARY_FAIL;
+    })
+
+    ON_HASH(if (stack->_hash != rec_stack_hash(stack)) status |= STACK_HASH_FAILURE);
+
+    //* Only the top record is verified here, rec_stack_status() walks through all of them.
+    if (!status && stack->count) {
+        const RecordFooter* footer = rec_footer(stack, stack->size);
+        size_t full_size = footer->length <= stack->size ? rec_full_size(footer->length) : stack->size + 1;
+
+        if (full_size > stack->size) {
+            status |= STACK_BIG_SIZE;
+        } else if (rec_chain(footer->chain, rec_content(stack) + stack->size - full_size, full_size) != stack->chain) {
+            status |= STACK_HASH_FAILURE;
+        }
+    }
+
+    return status;
+}
+
+static void rec_stack_resize(RecStack stack, const size_t capacity, int* const err_code) {
+    size_t aligned_capacity = (capacity + REC_ALIGNMENT - 1) / REC_ALIGNMENT * REC_ALIGNMENT;
+
+    char* new_buffer = rec_alloc_space(aligned_capacity);
+    _LOG_FAIL_CHECK_(new_buffer, "error", ERROR_REPORTS, return, err_code, ENOMEM);
+
+    memcpy(new_buffer + REC_PREFIX_SIZE, rec_content(stack), stack->size);
+
+    free(stack->buffer);
+    stack->buffer = new_buffer;
+    stack->capacity = aligned_capacity;
+
+    ON_HASH(stack->_hash = rec_stack_hash(stack));
+}
+
+static char* rec_alloc_space(const size_t capacity) {
+    char* buffer = (char*)calloc(REC_PREFIX_SIZE * 2 + capacity, sizeof(char));
+    if (!buffer) return NULL;
+
+    memset(buffer + REC_PREFIX_SIZE, REC_POISON, capacity);
+    strncpy(buffer,                              STACK_CANARY_VALUE, sizeof(stack_canary_t));
+    strncpy(buffer + REC_PREFIX_SIZE + capacity, STACK_CANARY_VALUE, sizeof(stack_canary_t));
+
+    return buffer;
+}
+
+static inline char* rec_content(const RecStack stack) {
+    return stack->buffer + REC_PREFIX_SIZE;
+}
+
+static inline RecordFooter* rec_footer(const RecStack stack, const size_t end) {
+    return (RecordFooter*)(rec_content(stack) + end - sizeof(RecordFooter));
+}
+
+static inline size_t rec_full_size(const size_t length) {
+    return (length + REC_ALIGNMENT - 1) / REC_ALIGNMENT * REC_ALIGNMENT + sizeof(RecordFooter);
+}
+
+static inline hash_t rec_chain(const hash_t chain, const char* record, const size_t full_size) {
+    return (chain ^ get_hash(record, record + full_size)) * HASH_MULTIPLIER;
+}
+
+#ifndef NHASH
+static hash_t rec_stack_hash(const RecStack stack) {
+    //* Fields are copied, so the hash does not depend on the canary and on padding between the fields.
+    const hash_t fields[] = {
+        (hash_t)(uintptr_t)stack->buffer, stack->size, stack->capacity, stack->count, stack->chain,
+    };
+    return get_hash(fields, fields + sizeof(fields) / sizeof(*fields));
+}
+#endif
\ No newline at end of file
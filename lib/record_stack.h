@@ -0,0 +1,109 @@
+/**
+ * @file record_stack.h
+ * @author Ilya Kudryashov (kudriashov.it@phystech.edu)
+ * @brief Stack of variable-length byte records packed into one protected buffer.
+ * @version 0.1
+ * @date 2022-10-13
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef RECORD_STACK_H
+#define RECORD_STACK_H
+
+#include <cstdlib>
+#include <cstdint>
+#include "stackreports.h"
+
+typedef struct RecordStack* RecStack;
+
+/**
+ * @brief View of the record stored in the stack.
+ * Stays valid until the next modification of the stack.
+ *
+ * @param data pointer to the first byte of the record
+ * @param length number of bytes in the record
+ */
+struct RecordSpan {
+    const void* data = NULL;
+    size_t length = 0;
+};
+
+/**
+ * @brief Construct record stack.
+ *
+ * @param capacity starting size of the buffer in bytes
+ * @param err_code variable to use as errno
+ * @return RecStack
+ */
+RecStack rec_stack_ctor(const size_t capacity, int* const err_code = NULL);
+
+/**
+ * @brief Destroy the stack.
+ *
+ * @param stack stack to destroy
+ */
+void rec_stack_dtor(RecStack stack);
+
+/**
+ * @brief Copy the record to the top of the stack.
+ *
+ * @param stack stack to push into
+ * @param data bytes of the record
+ * @param length number of bytes in the record
+ * @param err_code variable to use as errno
+ */
+void rec_stack_push(RecStack stack, const void* data, const size_t length, int* const err_code = NULL);
+
+/**
+ * @brief Get the top record without copying it.
+ *
+ * @param stack stack to look into
+ * @param err_code variable to use as errno (ENXIO if the stack is empty)
+ * @return RecordSpan
+ */
+RecordSpan rec_stack_peek(RecStack stack, int* const err_code = NULL);
+
+/**
+ * @brief Remove the top record.
+ *
+ * @param stack stack to pop from
+ * @param err_code variable to use as errno (ENXIO if the stack is empty)
+ */
+void rec_stack_pop(RecStack stack, int* const err_code = NULL);
+
+/**
+ * @brief Get number of records in the stack.
+ *
+ * @param stack
+ * @return size_t
+ */
+size_t rec_stack_count(RecStack stack);
+
+/**
+ * @brief Get number of buffer bytes occupied by records and their headers.
+ *
+ * @param stack
+ * @return size_t
+ */
+size_t rec_stack_bytes(RecStack stack);
+
+/**
+ * @brief Check the stack and every record in it.
+ *
+ * @param stack stack to check
+ * @return stack_report_t
+ */
+stack_report_t rec_stack_status(RecStack stack);
+
+/**
+ * @brief Dump the stack into logs.
+ *
+ * @param stack stack to dump
+ * @param importance importance of the message
+ */
+#define rec_stack_dump(stack, importance) _rec_stack_dump(stack, importance, __PRETTY_FUNCTION__, __LINE__, __FILE__)
+void _rec_stack_dump(RecStack stack, int importance, const char* function, const size_t line, const char* file);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,474 @@
+#include "shared_stack.h"
+
+#include <cstring>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "util/dbg/debug.h"
+#include "util/dbg/logger.h"
+#include "stackframe.h"
+
+//* Written into the header after everything else, so attaching processes never see a half-initialized stack.
+static const uint32_t SH_STACK_READY = 0x53484B31;
+
+#ifndef SH_DUMP_MAX_ELEMENTS
+#define SH_DUMP_MAX_ELEMENTS 16
+#endif
+
+/**
+ * @brief Beginning of the shared memory object.
+ * Processes map the object at different addresses, so the header stores offsets instead of pointers.
+ *
+ * @param ready SH_STACK_READY once the stack is initialized
+ * @param broken failures found when a process died holding the lock, reported by every later check
+ * @param size number of elements in the stack
+ * @param capacity maximum number of elements
+ * @param content_offset offset of the first element from the beginning of the object
+ * @param length length of the object in bytes
+ * @param content_hash sum of hashes of the elements, each multiplied by HASH_MULTIPLIER to the power of its index
+ * @param mutex process-shared robust lock of the stack
+ */
+struct SharedStackHeader {
+    ON_CANARY(stack_canary_t canary_left;)
+
+    uint32_t ready;
+    stack_report_t broken;
+    uint64_t size;
+    uint64_t capacity;
+    uint64_t content_offset;
+    uint64_t length;
+    hash_t content_hash;
+
+    ON_HASH(hash_t hash;)
+
+    pthread_mutex_t mutex;
+
+    ON_CANARY(stack_canary_t canary_right;)
+};
+
+//* Canaries around the elements take whole cells, so the elements stay aligned.
+static const size_t SH_ALIGNMENT = sizeof(long long);
+static const size_t SH_PREFIX_SIZE = (sizeof(stack_canary_t) + SH_ALIGNMENT - 1) / SH_ALIGNMENT * SH_ALIGNMENT;
+static const size_t SH_CONTENT_OFFSET =
+    (sizeof(SharedStackHeader) + SH_ALIGNMENT - 1) / SH_ALIGNMENT * SH_ALIGNMENT + SH_PREFIX_SIZE;
+
+struct SharedStack {
+    SharedStackHeader* header = NULL;
+    size_t length = 0;  // Length of the mapping in this process.
+};
+
+/**
+ * @brief Lock the stack, checking it if the previous owner of the lock died.
+ *
+ * @param stack stack to lock
+ * @param err_code variable to use as errno
+ * @return true if the stack is locked
+ */
+static bool sh_stack_lock(ShStack stack, int* const err_code);
+
+/**
+ * @brief Unlock the stack.
+ *
+ * @param stack
+ */
+static inline void sh_stack_unlock(ShStack stack);
+
+/**
+ * @brief Check the header and canaries of the stack.
+ *
+ * @param stack stack to check
+ * @return stack_report_t
+ */
+static stack_report_t sh_stack_quick_status(const ShStack stack);
+
+/**
+ * @brief Check the stack and recalculate hash of all its elements. Should be called with the stack locked.
+ *
+ * @param stack stack to check
+ * @return stack_report_t
+ */
+static stack_report_t sh_stack_full_status(const ShStack stack);
+
+/**
+ * @brief Map the shared memory object.
+ *
+ * @param descriptor descriptor of the object
+ * @param length length of the object
+ * @param err_code variable to use as errno
+ * @return ShStack
+ */
+static ShStack sh_stack_map(const int descriptor, const size_t length, int* const err_code);
+
+/**
+ * @brief Get pointer to the first element.
+ *
+ * @param stack
+ * @return long long*
+ */
+static inline long long* sh_content(const ShStack stack);
+
+/**
+ * @brief Calculate contribution of the element to the hash of the elements.
+ *
+ * @param value element
+ * @param index index of the element
+ * @return hash_t
+ */
+static inline hash_t sh_element_hash(const long long value, const size_t index);
+
+#ifndef NHASH
+/**
+ * @brief Calculate hash of the header fields describing the stack.
+ *
+ * @param stack
+ * @return hash_t
+ */
+static hash_t sh_stack_hash(const ShStack stack);
+#endif
+
+ShStack sh_stack_create(const char* name, const size_t capacity, int* const err_code) {
+    _LOG_FAIL_CHECK_(name, "error", ERROR_REPORTS, return NULL, err_code, EFAULT);
+    _LOG_FAIL_CHECK_(capacity > 0 && capacity < (SIZE_MAX - SH_CONTENT_OFFSET - SH_PREFIX_SIZE) / sizeof(long long),
+                     "error", ERROR_REPORTS, return NULL, err_code, EINVAL);
+
+    size_t length = SH_CONTENT_OFFSET + capacity * sizeof(long long) + SH_PREFIX_SIZE;
+
+    int descriptor = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    int open_error = descriptor < 0 ? errno : 0;
+    _LOG_FAIL_CHECK_(descriptor >= 0, "error", ERROR_REPORTS, return NULL, err_code, open_error);
+
+    int truncate_error = ftruncate(descriptor, (off_t)length) ? errno : 0;
+    _LOG_FAIL_CHECK_(!truncate_error, "error", ERROR_REPORTS, {
+        close(descriptor);
+        shm_unlink(name);
+        return NULL;
+    }, err_code, truncate_error);
+
+    ShStack stack = sh_stack_map(descriptor, length, err_code);
+    close(descriptor);
+    _LOG_FAIL_CHECK_(stack, "error", ERROR_REPORTS, {
+        shm_unlink(name);
+        return NULL;
+    }, err_code, ENOMEM);
+
+    //* Fresh object is filled with zeros, so only non-zero fields are set.
+    SharedStackHeader* header = stack->header;
+    ON_CANARY(strncpy(header->canary_left, STACK_CANARY_VALUE, sizeof(stack_canary_t)));
+    ON_CANARY(strncpy(header->canary_right, STACK_CANARY_VALUE, sizeof(stack_canary_t)));
+
+    header->capacity = capacity;
+    header->content_offset = SH_CONTENT_OFFSET;
+    header->length = length;
+
+    char* content = (char*)sh_content(stack);
+    strncpy(content - SH_PREFIX_SIZE,               STACK_CANARY_VALUE, sizeof(stack_canary_t));
+    strncpy(content + capacity * sizeof(long long), STACK_CANARY_VALUE, sizeof(stack_canary_t));
+    for (size_t index = 0; index < capacity; ++index) sh_content(stack)[index] = STACK_INTEGER_POISON;
+
+    ON_HASH(header->hash = sh_stack_hash(stack));
+
+    //* Lock is released by the system if its owner dies, and the next owner checks the stack.
+    pthread_mutexattr_t attributes;
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&header->mutex, &attributes);
+    pthread_mutexattr_destroy(&attributes);
+
+    __atomic_store_n(&header->ready, SH_STACK_READY, __ATOMIC_RELEASE);
+
+    return stack;
+}
+
+ShStack sh_stack_attach(const char* name, int* const err_code) {
+    _LOG_FAIL_CHECK_(name, "error", ERROR_REPORTS, return NULL, err_code, EFAULT);
+
+    int descriptor = shm_open(name, O_RDWR, 0);
+    int open_error = descriptor < 0 ? errno : 0;
+    _LOG_FAIL_CHECK_(descriptor >= 0, "error", ERROR_REPORTS, return NULL, err_code, open_error);
+
+    struct stat object = {};
+    bool sized = !fstat(descriptor, &object) && (size_t)object.st_size >= SH_CONTENT_OFFSET;
+
+    //* Creator may not have set the size of the object yet.
+    _LOG_FAIL_CHECK_(sized, "error", ERROR_REPORTS, {
+        close(descriptor);
+        return NULL;
+    }, err_code, EAGAIN);
+
+    ShStack stack = sh_stack_map(descriptor, (size_t)object.st_size, err_code);
+    close(descriptor);
+    _LOG_FAIL_CHECK_(stack, "error", ERROR_REPORTS, return NULL, err_code, ENOMEM);
+
+    _LOG_FAIL_CHECK_(__atomic_load_n(&stack->header->ready, __ATOMIC_ACQUIRE) == SH_STACK_READY,
+                     "error", ERROR_REPORTS, {
+        sh_stack_detach(stack);
+        return NULL;
+    }, err_code, EAGAIN);
+
+    _LOG_FAIL_CHECK_(!sh_stack_quick_status(stack), "error", ERROR_REPORTS, {
+        sh_stack_dump(stack, ERROR_REPORTS);
+        sh_stack_detach(stack);
+        return NULL;
+    }, err_code, EINVAL);
+
+    return stack;
+}
+
+void sh_stack_detach(ShStack stack) {
+    if (!stack) return;
+
+    munmap(stack->header, stack->length);
+    free(stack);
+}
+
+void sh_stack_unlink(const char* name, int* const err_code) {
+    _LOG_FAIL_CHECK_(name, "error", ERROR_REPORTS, return, err_code, EFAULT);
+
+    int unlink_error = shm_unlink(name) ? errno : 0;
+    _LOG_FAIL_CHECK_(!unlink_error, "error", ERROR_REPORTS, return, err_code, unlink_error);
+}
+
+void sh_stack_push(ShStack stack, const long long value, int* const err_code) {
+    _LOG_FAIL_CHECK_(stack, "error", ERROR_REPORTS, return, err_code, EINVAL);
+    if (!sh_stack_lock(stack, err_code)) return;
+
+    SharedStackHeader* header = stack->header;
+
+    _LOG_FAIL_CHECK_(!sh_stack_quick_status(stack), "error", ERROR_REPORTS, {
+        sh_stack_unlock(stack);
+        return;
+    }, err_code, EINVAL);
+    _LOG_FAIL_CHECK_(header->size < header->capacity, "error", ERROR_REPORTS, {
+        sh_stack_unlock(stack);
+        return;
+    }, err_code, ENOSPC);
+
+    sh_content(stack)[header->size] = value;
+
+    header->content_hash += sh_element_hash(value, header->size);
+    ++header->size;
+
+    ON_HASH(header->hash = sh_stack_hash(stack));
+
+    _LOG_FAIL_CHECK_(!sh_stack_quick_status(stack), "error", ERROR_REPORTS, {
+        log_printf(ERROR_REPORTS, "error", "Shared stack %p was invalid after push.\n", stack);
+        sh_stack_dump(stack, ERROR_REPORTS);
+        sh_stack_unlock(stack);
+        return;
+    }, err_code, EAGAIN);
+
+    sh_stack_unlock(stack);
+}
+
+bool sh_stack_pop(ShStack stack, long long* const value, int* const err_code) {
+    _LOG_FAIL_CHECK_(stack, "error", ERROR_REPORTS, return false, err_code, EINVAL);
+    if (!sh_stack_lock(stack, err_code)) return false;
+
+    SharedStackHeader* header = stack->header;
+
+    _LOG_FAIL_CHECK_(!sh_stack_quick_status(stack), "error", ERROR_REPORTS, {
+        sh_stack_unlock(stack);
+        return false;
+    }, err_code, EINVAL);
+
+    //* Empty stack is a normal situation for consumers, so it is not logged.
+    if (!header->size) {
+        sh_stack_unlock(stack);
+        if (err_code) *err_code = ENXIO;
+        return false;
+    }
+
+    long long* top = sh_content(stack) + header->size - 1;
+    if (value) *value = *top;
+
+    --header->size;
+    header->content_hash -= sh_element_hash(*top, header->size);
+    *top = STACK_INTEGER_POISON;
+
+    ON_HASH(header->hash = sh_stack_hash(stack));
+
+    _LOG_FAIL_CHECK_(!sh_stack_quick_status(stack), "error", ERROR_REPORTS, {
+        log_printf(ERROR_REPORTS, "error", "Shared stack %p was invalid after pop.\n", stack);
+        sh_stack_dump(stack, ERROR_REPORTS);
+        sh_stack_unlock(stack);
+        return false;
+    }, err_code, EAGAIN);
+
+    sh_stack_unlock(stack);
+    return true;
+}
+
+bool sh_stack_pull(ShStack stack, long long* const value, int* const err_code) {
+    _LOG_FAIL_CHECK_(stack && value, "error", ERROR_REPORTS, return false, err_code, EINVAL);
+    if (!sh_stack_lock(stack, err_code)) return false;
+
+    SharedStackHeader* header = stack->header;
+
+    _LOG_FAIL_CHECK_(!sh_stack_quick_status(stack), "error", ERROR_REPORTS, {
+        sh_stack_unlock(stack);
+        return false;
+    }, err_code, EINVAL);
+
+    bool found = header->size > 0;
+    if (found) *value = sh_content(stack)[header->size - 1];
+    else if (err_code) *err_code = ENXIO;
+
+    sh_stack_unlock(stack);
+    return found;
+}
+
+size_t sh_stack_size(ShStack stack) {
+    if (!stack) return 0;
+    return (size_t)__atomic_load_n(&stack->header->size, __ATOMIC_ACQUIRE);
+}
+
+stack_report_t sh_stack_status(ShStack stack) {
+    if (!stack) return STACK_NULL;
+    if (!sh_stack_lock(stack, NULL)) return STACK_NULL_CONTENT;
+
+    stack_report_t status = sh_stack_full_status(stack);
+
+    sh_stack_unlock(stack);
+    return status;
+}
+
+void _sh_stack_dump(ShStack stack, int importance, const char* function, const size_t line, const char* file) {
+    _log_printf(importance, "dump", " ----- Shared stack dump in function %s of file %s (%ld): ----- \n",
+                function, file, line);
+
+    stack_report_t status = sh_stack_full_status(stack);
+    _log_printf(importance, "dump", "\tStatus: %s (%d)\n", status ? "CORRUPT" : "OK", status);
+
+    _log_printf(importance, "dump", "\tShared stack at %p:\n", stack);
+    if (status & (STACK_NULL | STACK_NULL_CONTENT)) return;
+
+    const SharedStackHeader* header = stack->header;
+
+    ON_CANARY(_log_printf(importance, "dump", "\t\tLeft canary  = \"%6s\"\n", header->canary_left));
+    ON_CANARY(_log_printf(importance, "dump", "\t\tRight canary = \"%6s\"\n", header->canary_right));
+    _log_printf(importance, "dump", "\t\tMapping      = %p (%lu bytes)\n", header, (unsigned long)stack->length);
+    _log_printf(importance, "dump", "\t\tCapacity     = %lu\n", (unsigned long)header->capacity);
+    _log_printf(importance, "dump", "\t\tSize         = %lu\n", (unsigned long)header->size);
+    _log_printf(importance, "dump", "\t\tOffset       = %lu\n", (unsigned long)header->content_offset);
+    _log_printf(importance, "dump", "\t\tBroken       = %d\n", header->broken);
+    ON_HASH(_log_printf(importance, "dump", "\t\tHash      = %llu\n", (unsigned long long)header->hash));
+    ON_HASH(_log_printf(importance, "dump", "\t\tEst. hash = %llu\n", (unsigned long long)sh_stack_hash(stack)));
+
+    if (status & STACK_BIG_SIZE) return;
+
+    for (size_t index = 0; index < header->size && index < SH_DUMP_MAX_ELEMENTS; ++index) {
+        _log_printf(importance, "dump", "\t\t\t[top-%02lu] %lld\n", (unsigned long)index,
+                    sh_content(stack)[header->size - 1 - index]);
+    }
+}
+
+static bool sh_stack_lock(ShStack stack, int* const err_code) {
+    int error = pthread_mutex_lock(&stack->header->mutex);
+
+    if (error == EOWNERDEAD) {
+        //* Peer died holding the lock, so its last operation may be unfinished.
+        log_printf(WARNINGS, "warning", "Owner of shared stack %p died, checking the stack.\n", stack);
+        pthread_mutex_consistent(&stack->header->mutex);
+
+        //* Lock is usable again, so the failure is kept in the header for the processes that lock the stack later.
+        stack_report_t status = sh_stack_full_status(stack);
+        stack->header->broken |= status;
+
+        _LOG_FAIL_CHECK_(!status, "error", ERROR_REPORTS, {
+            sh_stack_dump(stack, ERROR_REPORTS);
+            sh_stack_unlock(stack);
+            return false;
+        }, err_code, EOWNERDEAD);
+
+        error = 0;
+    }
+
+    _LOG_FAIL_CHECK_(error == 0, "error", ERROR_REPORTS, return false, err_code, error);
+    return true;
+}
+
+static inline void sh_stack_unlock(ShStack stack) {
+    pthread_mutex_unlock(&stack->header->mutex);
+}
+
+static stack_report_t sh_stack_quick_status(const ShStack stack) {
+    stack_report_t status = 0;
+
+    //* Handle is local to the process, pointer checks are not worth three system calls on every operation.
+    if (!stack) return STACK_NULL;
+    if (!stack->header) return STACK_NULL_CONTENT;
+
+    const SharedStackHeader* header = stack->header;
+
+    //* Offsets come from memory other processes write to, so they are checked before being used.
+    if (header->content_offset != SH_CONTENT_OFFSET || header->length != stack->length ||
+        header->capacity > (stack->length - SH_CONTENT_OFFSET - SH_PREFIX_SIZE) / sizeof(long long))
+        return status | STACK_NULL_CONTENT;
+
+    status |= header->broken;
+    if (header->size > header->capacity) status |= STACK_BIG_SIZE;
+
+    ON_CANARY({
+        if (!stack_check_canary(header->canary_left))  status |= STACK_L_CANARY_FAIL;
+        if (!stack_check_canary(header->canary_right)) status |= STACK_R_CANARY_FAIL;
+
+        const char* content = (const char*)sh_content(stack);
+        if (!stack_check_canary(content - SH_PREFIX_SIZE))                       status |= STACK_BL_CANARY_FAIL;
+        if (!stack_check_canary(content + header->capacity * sizeof(long long))) status |= STACK_BR_CANARY_FAIL;
+    })
+
+    ON_HASH(if (header->hash != sh_stack_hash(stack)) status |= STACK_HASH_FAILURE);
+
+    return status;
+}
+
+static stack_report_t sh_stack_full_status(const ShStack stack) {
+    stack_report_t status = sh_stack_quick_status(stack);
+    if (status & (STACK_NULL | STACK_NULL_CONTENT | STACK_BIG_SIZE)) return status;
+
+    const SharedStackHeader* header = stack->header;
+
+    hash_t content_hash = 0;
+    for (size_t index = 0; index < header->size; ++index) {
+        content_hash += sh_element_hash(sh_content(stack)[index], index);
+    }
+    if (content_hash != header->content_hash) status |= STACK_HASH_FAILURE;
+
+    return status;
+}
+
+static ShStack sh_stack_map(const int descriptor, const size_t length, int* const err_code) {
+    SharedStack* stack = (SharedStack*) calloc(1, sizeof(SharedStack));
+    _LOG_FAIL_CHECK_(stack, "error", ERROR_REPORTS, return NULL, err_code, ENOMEM);
+    *stack = (SharedStack){};
+
+    void* mapping = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+    _LOG_FAIL_CHECK_(mapping != MAP_FAILED, "error", ERROR_REPORTS, {
+        free(stack);
+        return NULL;
+    }, err_code, ENOMEM);
+
+    stack->header = (SharedStackHeader*)mapping;
+    stack->length = length;
+
+    return stack;
+}
+
+static inline long long* sh_content(const ShStack stack) {
+    return (long long*)((char*)stack->header + stack->header->content_offset);
+}
+
+static inline hash_t sh_element_hash(const long long value, const size_t index) {
+    return get_hash_part(&value, &value + 1) * get_hash_power(index);
+}
+
+#ifndef NHASH
+static hash_t sh_stack_hash(const ShStack stack) {
+    const SharedStackHeader* header = stack->header;
+    return get_hash(&header->size, &header->content_hash + 1);
+}
+#endif
\ No newline at end of file
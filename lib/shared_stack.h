@@ -0,0 +1,109 @@
+/**
+ * @file shared_stack.h
+ * @author Ilya Kudryashov (kudriashov.it@phystech.edu)
+ * @brief Bounded stack of long integers in POSIX shared memory that several processes can work with.
+ * @version 0.1
+ * @date 2022-10-16
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef SHARED_STACK_H
+#define SHARED_STACK_H
+
+#include <cstdlib>
+#include <cstdint>
+#include "stackreports.h"
+
+typedef struct SharedStack* ShStack;
+
+/**
+ * @brief Create shared memory object with an empty stack and attach to it.
+ *
+ * @param name name of the object ("/name", see shm_open())
+ * @param capacity maximum number of elements in the stack
+ * @param err_code variable to use as errno (EEXIST if the object already exists)
+ * @return ShStack
+ */
+ShStack sh_stack_create(const char* name, const size_t capacity, int* const err_code = NULL);
+
+/**
+ * @brief Attach to the stack created by another process.
+ *
+ * @param name name of the object
+ * @param err_code variable to use as errno (EAGAIN if the creator has not initialized the stack yet)
+ * @return ShStack
+ */
+ShStack sh_stack_attach(const char* name, int* const err_code = NULL);
+
+/**
+ * @brief Detach from the stack. The stack stays in shared memory until sh_stack_unlink().
+ *
+ * @param stack stack to detach from
+ */
+void sh_stack_detach(ShStack stack);
+
+/**
+ * @brief Remove the name of the shared memory object, the memory is freed when every process detaches.
+ *
+ * @param name name of the object
+ * @param err_code variable to use as errno
+ */
+void sh_stack_unlink(const char* name, int* const err_code = NULL);
+
+/**
+ * @brief Push element to the stack.
+ *
+ * @param stack stack to push into
+ * @param value value to push
+ * @param err_code variable to use as errno (ENOSPC if the stack is full)
+ */
+void sh_stack_push(ShStack stack, const long long value, int* const err_code = NULL);
+
+/**
+ * @brief Remove the last element of the stack.
+ *
+ * @param stack stack to pop from
+ * @param value variable to put removed element into (can be NULL)
+ * @param err_code variable to use as errno (ENXIO if the stack is empty)
+ * @return true if the element was removed
+ */
+bool sh_stack_pop(ShStack stack, long long* const value, int* const err_code = NULL);
+
+/**
+ * @brief Get the last element of the stack.
+ *
+ * @param stack stack to read from
+ * @param value variable to put the element into
+ * @param err_code variable to use as errno (ENXIO if the stack is empty)
+ * @return true if the element was read
+ */
+bool sh_stack_pull(ShStack stack, long long* const value, int* const err_code = NULL);
+
+/**
+ * @brief Get number of elements in the stack.
+ *
+ * @param stack
+ * @return size_t
+ */
+size_t sh_stack_size(ShStack stack);
+
+/**
+ * @brief Check the stack and every element in it.
+ *
+ * @param stack stack to check
+ * @return stack_report_t
+ */
+stack_report_t sh_stack_status(ShStack stack);
+
+/**
+ * @brief Dump the stack into logs. Does not lock the stack.
+ *
+ * @param stack stack to dump
+ * @param importance importance of the message
+ */
+#define sh_stack_dump(stack, importance) _sh_stack_dump(stack, importance, __PRETTY_FUNCTION__, __LINE__, __FILE__)
+void _sh_stack_dump(ShStack stack, int importance, const char* function, const size_t line, const char* file);
+
+#endif
\ No newline at end of file
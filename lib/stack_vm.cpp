@@ -0,0 +1,537 @@
+#include "stack_vm.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <climits>
+
+#include "util/dbg/debug.h"
+
+static const size_t VM_LABEL_LENGTH = 64;
+static const size_t VM_LINE_LENGTH = 256;
+
+static const char* const VM_MNEMONICS[VM_OPCODE_COUNT] = {
+    "halt", "push", "pop",  "dup",  "swap", "over",
+    "add",  "sub",  "mul",  "div",  "mod",  "neg",
+    "eq",   "lt",   "gt",   "jmp",  "jz",   "jnz",
+    "call", "ret",  "out",
+};
+
+/**
+ * @brief Label of the program.
+ *
+ * @param name label name
+ * @param address index of the instruction the label points to
+ */
+struct VMLabel {
+    char name[VM_LABEL_LENGTH] = "";
+    size_t address = 0;
+};
+
+/**
+ * @brief Check if instruction takes an argument.
+ *
+ * @param opcode
+ * @return true if it does
+ */
+static inline bool vm_has_argument(const int opcode);
+
+/**
+ * @brief Check if instruction argument is an instruction address.
+ *
+ * @param opcode
+ * @return true if it is
+ */
+static inline bool vm_is_jump(const int opcode);
+
+/**
+ * @brief Find opcode by its mnemonic.
+ *
+ * @param mnemonic
+ * @return int opcode or -1 if mnemonic is unknown
+ */
+static int vm_find_opcode(const char* mnemonic);
+
+/**
+ * @brief Get status of the program that could not push a value.
+ *
+ * @param push_status error code of the push
+ * @return vm_status_t
+ */
+static inline vm_status_t vm_push_failure(const int push_status);
+
+/**
+ * @brief Assembler pass over the program text.
+ * First pass (with code == NULL) counts instructions and collects labels, second pass fills the code.
+ *
+ * @param source program text
+ * @param labels labels of the program
+ * @param label_count number of labels
+ * @param label_capacity size of the label array
+ * @param code array to put instructions into (NULL on the first pass)
+ * @param err_code variable to use as errno
+ * @return size_t number of instructions
+ */
+static size_t vm_assembler_pass(const char* source, VMLabel** labels, size_t* label_count, size_t* label_capacity,
+                                VMInstruction* code, int* const err_code);
+
+void vm_assemble(const char* source, VMProgram* const program, int* const err_code) {
+    _LOG_FAIL_CHECK_(source && program, "error", ERROR_REPORTS, return, err_code, EFAULT);
+
+    VMLabel* labels = NULL;
+    size_t label_count = 0, label_capacity = 0;
+    int status = 0;
+
+    size_t length = vm_assembler_pass(source, &labels, &label_count, &label_capacity, NULL, &status);
+    _LOG_FAIL_CHECK_(status == 0, "error", ERROR_REPORTS, {
+        free(labels);
+        return;
+    }, err_code, status);
+
+    //* Additional halt protects the machine from running past the end of the code.
+    VMInstruction* code = (VMInstruction*) calloc(length + 1, sizeof(*code));
+    _LOG_FAIL_CHECK_(code, "error", ERROR_REPORTS, {
+        free(labels);
+        return;
+    }, err_code, ENOMEM);
+
+    vm_assembler_pass(source, &labels, &label_count, &label_capacity, code, &status);
+    free(labels);
+    _LOG_FAIL_CHECK_(status == 0, "error", ERROR_REPORTS, {
+        free(code);
+        return;
+    }, err_code, status);
+
+    code[length] = (VMInstruction){ .opcode = VM_HALT, .argument = 0 };
+
+    program->code = code;
+    program->length = length + 1;
+    program->verified = false;
+
+    _LOG_FAIL_CHECK_(vm_verify(program) == VM_OK, "error", ERROR_REPORTS, vm_program_dtor(program), err_code, EINVAL);
+}
+
+void vm_assemble_file(const char* filename, VMProgram* const program, int* const err_code) {
+    _LOG_FAIL_CHECK_(filename && program, "error", ERROR_REPORTS, return, err_code, EFAULT);
+
+    FILE* file = fopen(filename, "r");
+    _LOG_FAIL_CHECK_(file, "error", ERROR_REPORTS, return, err_code, FILE_ERROR);
+
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char* source = (char*) calloc((size_t)file_size + 1, sizeof(*source));
+    _LOG_FAIL_CHECK_(source, "error", ERROR_REPORTS, {
+        fclose(file);
+        return;
+    }, err_code, ENOMEM);
+
+    source[fread(source, sizeof(*source), (size_t)file_size, file)] = '\0';
+    fclose(file);
+
+    vm_assemble(source, program, err_code);
+    free(source);
+}
+
+vm_status_t vm_verify(VMProgram* const program) {
+    if (!program || !program->code || !program->length) return VM_BAD_INSTRUCTION;
+
+    for (size_t index = 0; index < program->length; ++index) {
+        const VMInstruction* instruction = program->code + index;
+
+        if (instruction->opcode < 0 || instruction->opcode >= VM_OPCODE_COUNT) return VM_BAD_INSTRUCTION;
+        if (vm_is_jump(instruction->opcode) &&
+            (instruction->argument < 0 || (size_t)instruction->argument >= program->length)) return VM_BAD_JUMP;
+    }
+
+    //* Verified program can not run past its end, so the machine does not check the instruction pointer.
+    if (program->code[program->length - 1].opcode != VM_HALT &&
+        program->code[program->length - 1].opcode != VM_JMP &&
+        program->code[program->length - 1].opcode != VM_RET) return VM_BAD_JUMP;
+
+    program->verified = true;
+    return VM_OK;
+}
+
+void vm_program_dtor(VMProgram* const program) {
+    if (!program) return;
+    free(program->code);
+    *program = (VMProgram){};
+}
+
+#if defined(__GNUC__)
+    //* Each handler jumps straight to the next one, so every handler gets its own branch prediction slot.
+    #define _VM_HANDLER_(opcode) case opcode: _vm_label_##opcode
+    #define _VM_DISPATCH_() goto *DISPATCH_TABLE[(instruction = ip++)->opcode]
+#else
+    #define _VM_HANDLER_(opcode) case opcode
+    #define _VM_DISPATCH_() goto dispatch
+#endif
+
+#define _VM_REQUIRE_(count) do {                \
+    if (depth < (count)) {                      \
+        status = VM_STACK_UNDERFLOW;            \
+        goto finish;                            \
+    }                                           \
+} while (0)
+
+//* Stack that can not give away a value it holds is broken, the local top is not pushed back over it.
+#define _VM_PULL_(target, variable) do {        \
+    int error = 0;                              \
+    variable = ll_stack_pull(target, &error);   \
+    if (error) {                                \
+        status = VM_STACK_CORRUPT;              \
+        goto finish;                            \
+    }                                           \
+} while (0)
+
+#define _VM_DROP_(target) do {                  \
+    int error = 0;                              \
+    ll_stack_pop(target, &error);               \
+    if (error) {                                \
+        status = VM_STACK_CORRUPT;              \
+        goto finish;                            \
+    }                                           \
+} while (0)
+
+#define _VM_TAKE_SECOND_(variable) do {         \
+    _VM_PULL_(stack, variable);                 \
+    _VM_DROP_(stack);                           \
+} while (0)
+
+#define _VM_PUSH_(target, value) do {           \
+    int error = 0;                              \
+    ll_stack_push(target, value, &error);       \
+    if (error) {                                \
+        status = vm_push_failure(error);        \
+        goto finish;                            \
+    }                                           \
+} while (0)
+
+#define _VM_BINARY_(operation) do {             \
+    _VM_REQUIRE_(2);                            \
+    ll_stack_content_t second = 0;              \
+    _VM_TAKE_SECOND_(second);                   \
+    tos = operation;                            \
+    --depth;                                    \
+} while (0)
+
+//* Arithmetic that does not fit into the element traps and leaves both operands in the stack.
+#define _VM_CHECKED_(overflow, operation) do {  \
+    _VM_REQUIRE_(2);                            \
+    ll_stack_content_t second = 0;              \
+    _VM_PULL_(stack, second);                   \
+    if (overflow) {                             \
+        status = VM_OVERFLOW;                   \
+        goto finish;                            \
+    }                                           \
+    _VM_DROP_(stack);                           \
+    tos = operation;                            \
+    --depth;                                    \
+} while (0)
+
+vm_status_t vm_run(VMProgram* const program, LLStack stack, const int mode, ll_stack_content_t* const result) {
+    _LOG_FAIL_CHECK_(program && program->code, "error", ERROR_REPORTS, return VM_BAD_INSTRUCTION, NULL, 0);
+    _LOG_FAIL_CHECK_(!ll_stack_status(stack), "error", ERROR_REPORTS, return VM_STACK_CORRUPT, NULL, 0);
+
+    if (!program->verified) {
+        vm_status_t verification = vm_verify(program);
+        if (verification != VM_OK) return verification;
+    }
+
+#if defined(__GNUC__)
+    static const void* const DISPATCH_TABLE[] = {
+        &&_vm_label_VM_HALT, &&_vm_label_VM_PUSH, &&_vm_label_VM_POP,  &&_vm_label_VM_DUP,
+        &&_vm_label_VM_SWAP, &&_vm_label_VM_OVER, &&_vm_label_VM_ADD,  &&_vm_label_VM_SUB,
+        &&_vm_label_VM_MUL,  &&_vm_label_VM_DIV,  &&_vm_label_VM_MOD,  &&_vm_label_VM_NEG,
+        &&_vm_label_VM_EQ,   &&_vm_label_VM_LT,   &&_vm_label_VM_GT,   &&_vm_label_VM_JMP,
+        &&_vm_label_VM_JZ,   &&_vm_label_VM_JNZ,  &&_vm_label_VM_CALL, &&_vm_label_VM_RET,
+        &&_vm_label_VM_OUT,
+    };
+    static_assert(sizeof(DISPATCH_TABLE) / sizeof(*DISPATCH_TABLE) == VM_OPCODE_COUNT,
+                  "Dispatch table does not match the list of opcodes.");
+#endif
+
+    //* Checks and rehashing of each operation are replaced by the checks of the scope around the whole program.
+    if (mode == VM_FAST) {
+        int scope_status = 0;
+        ll_stack_scope_begin(stack, &scope_status);
+        if (scope_status) return VM_STACK_CORRUPT;
+    }
+
+    const VMInstruction* const code = program->code;
+    const VMInstruction* ip = code;
+    const VMInstruction* instruction = NULL;
+
+    vm_status_t status = VM_OK;
+
+    //* The top of the stack is kept in a local variable, so most instructions do not touch the stack at all.
+    size_t depth = ll_stack_size(stack);
+    ll_stack_content_t tos = 0;
+    ll_stack_content_t value = 0;
+
+    void* calls = NULL;
+    size_t call_depth = 0;
+
+    if (depth) _VM_TAKE_SECOND_(tos);
+
+#if !defined(__GNUC__)
+dispatch:
+#endif
+    instruction = ip++;
+    switch (instruction->opcode) {
+        _VM_HANDLER_(VM_HALT): goto finish;
+
+        _VM_HANDLER_(VM_PUSH):
+            if (depth) _VM_PUSH_(stack, tos);
+            tos = instruction->argument;
+            ++depth;
+            _VM_DISPATCH_();
+
+        _VM_HANDLER_(VM_POP):
+            _VM_REQUIRE_(1);
+            if (--depth) _VM_TAKE_SECOND_(tos);
+            _VM_DISPATCH_();
+
+        _VM_HANDLER_(VM_DUP):
+            _VM_REQUIRE_(1);
+            _VM_PUSH_(stack, tos);
+            ++depth;
+            _VM_DISPATCH_();
+
+        _VM_HANDLER_(VM_SWAP): {
+            _VM_REQUIRE_(2);
+            ll_stack_content_t second = 0;
+            _VM_TAKE_SECOND_(second);
+            _VM_PUSH_(stack, tos);
+            tos = second;
+            _VM_DISPATCH_();
+        }
+
+        _VM_HANDLER_(VM_OVER): {
+            _VM_REQUIRE_(2);
+            ll_stack_content_t second = 0;
+            _VM_PULL_(stack, second);
+            _VM_PUSH_(stack, tos);
+            tos = second;
+            ++depth;
+            _VM_DISPATCH_();
+        }
+
+        _VM_HANDLER_(VM_ADD): _VM_CHECKED_(__builtin_add_overflow(second, tos, &value), value); _VM_DISPATCH_();
+        _VM_HANDLER_(VM_SUB): _VM_CHECKED_(__builtin_sub_overflow(second, tos, &value), value); _VM_DISPATCH_();
+        _VM_HANDLER_(VM_MUL): _VM_CHECKED_(__builtin_mul_overflow(second, tos, &value), value); _VM_DISPATCH_();
+
+        _VM_HANDLER_(VM_DIV):
+            if (depth && tos == 0) {
+                status = VM_DIVISION_BY_ZERO;
+                goto finish;
+            }
+            _VM_CHECKED_(second == LLONG_MIN && tos == -1, second / tos);
+            _VM_DISPATCH_();
+
+        _VM_HANDLER_(VM_MOD):
+            if (depth && tos == 0) {
+                status = VM_DIVISION_BY_ZERO;
+                goto finish;
+            }
+            _VM_BINARY_(tos == -1 ? 0 : second % tos);
+            _VM_DISPATCH_();
+
+        _VM_HANDLER_(VM_NEG):
+            _VM_REQUIRE_(1);
+            if (tos == LLONG_MIN) {
+                status = VM_OVERFLOW;
+                goto finish;
+            }
+            tos = -tos;
+            _VM_DISPATCH_();
+
+        _VM_HANDLER_(VM_EQ): _VM_BINARY_(second == tos); _VM_DISPATCH_();
+        _VM_HANDLER_(VM_LT): _VM_BINARY_(second < tos);  _VM_DISPATCH_();
+        _VM_HANDLER_(VM_GT): _VM_BINARY_(second > tos);  _VM_DISPATCH_();
+
+        _VM_HANDLER_(VM_JMP):
+            ip = code + instruction->argument;
+            _VM_DISPATCH_();
+
+        _VM_HANDLER_(VM_JZ):
+        _VM_HANDLER_(VM_JNZ): {
+            _VM_REQUIRE_(1);
+            bool condition = tos != 0;
+            if (--depth) _VM_TAKE_SECOND_(tos);
+            if (condition == (instruction->opcode == VM_JNZ)) ip = code + instruction->argument;
+            _VM_DISPATCH_();
+        }
+
+        _VM_HANDLER_(VM_CALL):
+            if (call_depth >= VM_CALL_DEPTH_LIMIT) {
+                status = VM_CALL_OVERFLOW;
+                goto finish;
+            }
+            if (!calls) calls = ll_stack_ctor(1);
+            if (!calls) {
+                status = VM_NO_MEMORY;
+                goto finish;
+            }
+            _VM_PUSH_(calls, ip - code);
+            ++call_depth;
+            ip = code + instruction->argument;
+            _VM_DISPATCH_();
+
+        _VM_HANDLER_(VM_RET):
+            //* Return from the outermost procedure ends the program.
+            if (!call_depth) goto finish;
+            _VM_PULL_(calls, value);
+            _VM_DROP_(calls);
+            ip = code + value;
+            --call_depth;
+            _VM_DISPATCH_();
+
+        _VM_HANDLER_(VM_OUT):
+            _VM_REQUIRE_(1);
+            printf("%lld\n", tos);
+            if (--depth) _VM_TAKE_SECOND_(tos);
+            _VM_DISPATCH_();
+
+        default:
+            status = VM_BAD_INSTRUCTION;
+            goto finish;
+    }
+
+finish:
+    //* Top is returned to the stack even after a failure, the program stops with the first error it met.
+    int finish_status = 0;
+    if (depth && status != VM_STACK_CORRUPT) ll_stack_push(stack, tos, &finish_status);
+    if (finish_status && status == VM_OK) status = vm_push_failure(finish_status);
+    if (result) *result = depth ? tos : 0;
+
+    if (calls) ll_stack_dtor(calls);
+
+    int scope_status = 0;
+    if (mode == VM_FAST) ll_stack_scope_end(stack, &scope_status);
+    else if (ll_stack_status(stack)) {
+        ll_stack_dump(stack, ERROR_REPORTS);
+        scope_status = EAGAIN;
+    }
+
+    if (scope_status) {
+        log_printf(ERROR_REPORTS, "error", "Stack was corrupted during execution of instruction %ld.\n",
+                   (long)(instruction - code));
+        status = VM_STACK_CORRUPT;
+    }
+
+    if (status != VM_OK) {
+        log_printf(WARNINGS, "warning", "Program stopped at instruction %ld: %s\n",
+                   (long)(instruction - code), VM_STATUS_DESCR[status]);
+    }
+
+    return status;
+}
+
+#undef _VM_HANDLER_
+#undef _VM_DISPATCH_
+#undef _VM_REQUIRE_
+#undef _VM_PULL_
+#undef _VM_DROP_
+#undef _VM_TAKE_SECOND_
+#undef _VM_PUSH_
+#undef _VM_BINARY_
+#undef _VM_CHECKED_
+
+static inline bool vm_has_argument(const int opcode) {
+    return opcode == VM_PUSH || vm_is_jump(opcode);
+}
+
+static inline bool vm_is_jump(const int opcode) {
+    return opcode == VM_JMP || opcode == VM_JZ || opcode == VM_JNZ || opcode == VM_CALL;
+}
+
+static inline vm_status_t vm_push_failure(const int push_status) {
+    //* Invalid stack is reported as corruption, anything else means the stack could not grow.
+    return push_status == EINVAL || push_status == EAGAIN ? VM_STACK_CORRUPT : VM_NO_MEMORY;
+}
+
+static int vm_find_opcode(const char* mnemonic) {
+    for (int opcode = 0; opcode < VM_OPCODE_COUNT; ++opcode) {
+        if (strcasecmp(mnemonic, VM_MNEMONICS[opcode]) == 0) return opcode;
+    }
+    return -1;
+}
+
+static size_t vm_assembler_pass(const char* source, VMLabel** labels, size_t* label_count, size_t* label_capacity,
+                                VMInstruction* code, int* const err_code) {
+    size_t length = 0;
+    size_t line_id = 0;
+
+    for (const char* line_start = source; *line_start; ++line_id) {
+        const char* line_end = strchr(line_start, '\n');
+        if (!line_end) line_end = line_start + strlen(line_start);
+
+        char line[VM_LINE_LENGTH] = "";
+        size_t line_length = (size_t)(line_end - line_start) < VM_LINE_LENGTH - 1 ?
+                             (size_t)(line_end - line_start) : VM_LINE_LENGTH - 1;
+        memcpy(line, line_start, line_length);
+        line_start = *line_end ? line_end + 1 : line_end;
+
+        char* comment = strchr(line, ';');
+        if (comment) *comment = '\0';
+
+        char word[VM_LABEL_LENGTH] = "";
+        char argument[VM_LABEL_LENGTH] = "";
+        int word_count = sscanf(line, "%63s %63s", word, argument);
+        if (word_count <= 0) continue;
+
+        size_t word_length = strlen(word);
+        if (word[word_length - 1] == ':') {
+            if (code) continue;
+            word[word_length - 1] = '\0';
+
+            if (*label_count == *label_capacity) {
+                *label_capacity = *label_capacity * 2 + 1;
+                VMLabel* new_labels = (VMLabel*) realloc(*labels, *label_capacity * sizeof(**labels));
+                _LOG_FAIL_CHECK_(new_labels, "error", ERROR_REPORTS, return 0, err_code, ENOMEM);
+                *labels = new_labels;
+            }
+
+            strcpy((*labels)[*label_count].name, word);
+            (*labels)[(*label_count)++].address = length;
+            continue;
+        }
+
+        int opcode = vm_find_opcode(word);
+        if (opcode < 0 || vm_has_argument(opcode) != (word_count == 2)) {
+            log_printf(ERROR_REPORTS, "error", "Failed to assemble line %ld: \"%s\".\n", (long)line_id + 1, line);
+            if (err_code) *err_code = EINVAL;
+            return 0;
+        }
+
+        if (code) {
+            code[length].opcode = opcode;
+
+            if (word_count == 2) {
+                char* number_end = NULL;
+                code[length].argument = strtoll(argument, &number_end, 0);
+
+                if (*number_end != '\0') {
+                    size_t label_id = 0;
+                    while (label_id < *label_count && strcmp((*labels)[label_id].name, argument)) ++label_id;
+
+                    if (label_id == *label_count) {
+                        log_printf(ERROR_REPORTS, "error", "Unknown label \"%s\" at line %ld.\n",
+                                   argument, (long)line_id + 1);
+                        if (err_code) *err_code = EINVAL;
+                        return 0;
+                    }
+
+                    code[length].argument = (ll_stack_content_t)(*labels)[label_id].address;
+                }
+            }
+        }
+
+        ++length;
+    }
+
+    return length;
+}
\ No newline at end of file
@@ -0,0 +1,148 @@
+/**
+ * @file stack_vm.h
+ * @author Ilya Kudryashov (kudriashov.it@phystech.edu)
+ * @brief Bytecode stack machine running on top of LLStack.
+ * @version 0.1
+ * @date 2022-10-10
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef STACK_VM_H
+#define STACK_VM_H
+
+#include <cstdlib>
+#include "ll_stack.h"
+
+//* Order of the opcodes should match the order of handlers in the dispatch table of vm_run().
+enum VM_OPCODES {
+    VM_HALT = 0,
+    VM_PUSH = 1,
+    VM_POP  = 2,
+    VM_DUP  = 3,
+    VM_SWAP = 4,
+    VM_OVER = 5,
+    VM_ADD  = 6,
+    VM_SUB  = 7,
+    VM_MUL  = 8,
+    VM_DIV  = 9,
+    VM_MOD  = 10,
+    VM_NEG  = 11,
+    VM_EQ   = 12,
+    VM_LT   = 13,
+    VM_GT   = 14,
+    VM_JMP  = 15,
+    VM_JZ   = 16,
+    VM_JNZ  = 17,
+    VM_CALL = 18,
+    VM_RET  = 19,
+    VM_OUT  = 20,
+    VM_OPCODE_COUNT,
+};
+
+typedef int vm_status_t;
+enum VM_STATUSES {
+    VM_OK = 0,
+    VM_STACK_UNDERFLOW = 1,
+    VM_DIVISION_BY_ZERO = 2,
+    VM_BAD_INSTRUCTION = 3,
+    VM_BAD_JUMP = 4,
+    VM_CALL_OVERFLOW = 5,
+    VM_STACK_CORRUPT = 6,
+    VM_OVERFLOW = 7,
+    VM_NO_MEMORY = 8,
+};
+
+static const char* const VM_STATUS_DESCR[] = {
+    "Program finished.",
+    "Instruction needs more values than there are in the stack.",
+    "Division by zero.",
+    "Unknown instruction.",
+    "Jump or call outside of the program.",
+    "Call stack is too deep.",
+    "Stack was corrupted during execution.",
+    "Result of the arithmetic does not fit into the stack element.",
+    "Stack could not grow to hold one more value.",
+};
+
+/**
+ * @brief Validation modes of the machine.
+ *
+ * @param VM_CHECKED check the stack on each instruction
+ * @param VM_FAST check the stack once when the program ends
+ */
+enum VM_MODES {
+    VM_CHECKED = 0,
+    VM_FAST = 1,
+};
+
+struct VMInstruction {
+    int opcode = VM_HALT;
+    ll_stack_content_t argument = 0;
+};
+
+/**
+ * @brief Assembled program.
+ *
+ * @param code instructions
+ * @param length number of instructions
+ * @param verified true if opcodes and jump targets were checked
+ */
+struct VMProgram {
+    VMInstruction* code = NULL;
+    size_t length = 0;
+    bool verified = false;
+};
+
+static const size_t VM_CALL_DEPTH_LIMIT = 1 << 16;
+
+/**
+ * @brief Translate program text into bytecode.
+ * Each line contains one instruction (with a numeric or label argument for push, jumps and calls),
+ * a label ("name:") or a comment (starting with ';').
+ *
+ * @param source program text
+ * @param program program to fill
+ * @param err_code variable to use as errno
+ */
+void vm_assemble(const char* source, VMProgram* const program, int* const err_code = NULL);
+
+/**
+ * @brief Read program text from the file and translate it into bytecode.
+ *
+ * @param filename name of the file
+ * @param program program to fill
+ * @param err_code variable to use as errno
+ */
+void vm_assemble_file(const char* filename, VMProgram* const program, int* const err_code = NULL);
+
+/**
+ * @brief Check opcodes and jump targets of the program.
+ *
+ * @param program program to check
+ * @return vm_status_t
+ */
+vm_status_t vm_verify(VMProgram* const program);
+
+/**
+ * @brief Free program memory.
+ *
+ * @param program program to destroy
+ */
+void vm_program_dtor(VMProgram* const program);
+
+/**
+ * @brief Execute the program.
+ * In VM_FAST mode the stack is checked and rehashed only on entry and on exit (see ll_stack_scope_begin()).
+ *
+ * @param program program to execute
+ * @param stack operand stack
+ * @param mode validation mode
+ * @param result (optional) variable to put the top of the stack into
+ * @return vm_status_t
+ */
+vm_status_t vm_run(VMProgram* const program, LLStack stack, const int mode = VM_FAST,
+                   ll_stack_content_t* const result = NULL);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,124 @@
+#include "stackbudget.h"
+
+#include "stacktrimmer.h"
+#include "util/dbg/debug.h"
+
+/**
+ * @brief Memory used by stacks and its limit.
+ *
+ * @param usage number of charged bytes
+ * @param limit maximum number of bytes (0 if there is no limit)
+ */
+struct BudgetCounter {
+    size_t usage = 0;
+    size_t limit = 0;
+};
+
+static BudgetCounter budget_total = {};
+static BudgetCounter budget_groups[STACK_BUDGET_GROUP_COUNT] = {};
+
+//* Idle stacks registered in the trimmer are trimmed by default, the call is cheap if there are none.
+static stack_budget_reclaim_t* budget_reclaim = stack_trimmer_reclaim;
+
+//* Memory freed by the reclaim function should not trigger reclaim again.
+static __thread bool budget_reclaiming = false;
+
+/**
+ * @brief Add bytes to the counter if they fit into its limit.
+ *
+ * @param counter counter to charge
+ * @param bytes number of bytes
+ * @param force ignore the limit
+ * @return true if the counter was charged
+ */
+static bool budget_charge(BudgetCounter* const counter, const size_t bytes, const bool force);
+
+/**
+ * @brief Charge the process and the group counters.
+ *
+ * @param group group index
+ * @param bytes number of bytes
+ * @param force ignore the limits
+ * @return true if both counters were charged
+ */
+static bool budget_try_acquire(const int group, const size_t bytes, const bool force);
+
+void stack_budget_set_limit(const size_t limit) {
+    __atomic_store_n(&budget_total.limit, limit, __ATOMIC_RELAXED);
+}
+
+void stack_budget_set_group_limit(const int group, const size_t limit, int* const err_code) {
+    _LOG_FAIL_CHECK_(0 <= group && group < STACK_BUDGET_GROUP_COUNT, "error", ERROR_REPORTS, return, err_code, EINVAL);
+
+    __atomic_store_n(&budget_groups[group].limit, limit, __ATOMIC_RELAXED);
+}
+
+void stack_budget_set_reclaim(stack_budget_reclaim_t* reclaim) {
+    __atomic_store_n(&budget_reclaim, reclaim, __ATOMIC_RELEASE);
+}
+
+bool stack_budget_acquire(const int group, const size_t bytes, const bool force) {
+    if (!bytes) return true;
+    if (budget_try_acquire(group, bytes, force)) return true;
+
+    stack_budget_reclaim_t* reclaim = __atomic_load_n(&budget_reclaim, __ATOMIC_ACQUIRE);
+    if (!reclaim || budget_reclaiming) return false;
+
+    budget_reclaiming = true;
+    size_t freed = reclaim(group, bytes);
+    budget_reclaiming = false;
+
+    log_printf(WARNINGS, "warning", "Stack memory budget was exceeded by a request for %lu bytes in group %d, "
+                                    "reclaim freed %lu bytes.\n", (unsigned long)bytes, group, (unsigned long)freed);
+
+    //* Usage of other threads could have dropped meanwhile, but a reclaim that freed nothing is not worth a retry.
+    return freed && budget_try_acquire(group, bytes, false);
+}
+
+void stack_budget_release(const int group, const size_t bytes) {
+    if (!bytes) return;
+
+    __atomic_sub_fetch(&budget_total.usage, bytes, __ATOMIC_RELAXED);
+    if (0 <= group && group < STACK_BUDGET_GROUP_COUNT) {
+        __atomic_sub_fetch(&budget_groups[group].usage, bytes, __ATOMIC_RELAXED);
+    }
+}
+
+size_t stack_budget_usage(const int group) {
+    if (0 <= group && group < STACK_BUDGET_GROUP_COUNT) {
+        return __atomic_load_n(&budget_groups[group].usage, __ATOMIC_RELAXED);
+    }
+    return __atomic_load_n(&budget_total.usage, __ATOMIC_RELAXED);
+}
+
+size_t stack_budget_limit(const int group) {
+    if (0 <= group && group < STACK_BUDGET_GROUP_COUNT) {
+        return __atomic_load_n(&budget_groups[group].limit, __ATOMIC_RELAXED);
+    }
+    return __atomic_load_n(&budget_total.limit, __ATOMIC_RELAXED);
+}
+
+static bool budget_charge(BudgetCounter* const counter, const size_t bytes, const bool force) {
+    size_t usage = __atomic_load_n(&counter->usage, __ATOMIC_RELAXED);
+
+    do {
+        size_t limit = __atomic_load_n(&counter->limit, __ATOMIC_RELAXED);
+        if (!force && limit && usage + bytes > limit) return false;
+    } while (!__atomic_compare_exchange_n(&counter->usage, &usage, usage + bytes, true,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    return true;
+}
+
+static bool budget_try_acquire(const int group, const size_t bytes, const bool force) {
+    BudgetCounter* group_counter = 0 <= group && group < STACK_BUDGET_GROUP_COUNT ? budget_groups + group : NULL;
+
+    if (!budget_charge(&budget_total, bytes, force)) return false;
+
+    if (group_counter && !budget_charge(group_counter, bytes, force)) {
+        __atomic_sub_fetch(&budget_total.usage, bytes, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    return true;
+}
\ No newline at end of file
@@ -0,0 +1,92 @@
+/**
+ * @file stackbudget.h
+ * @author Ilya Kudryashov (kudriashov.it@phystech.edu)
+ * @brief Process-wide accounting and limits of memory used by stack buffers.
+ * @version 0.1
+ * @date 2022-10-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef STACK_BUDGET_H
+#define STACK_BUDGET_H
+
+#include <cstddef>
+
+//* Number of budget groups, stacks are put into group 0 by default.
+#ifndef STACK_BUDGET_GROUP_COUNT
+#define STACK_BUDGET_GROUP_COUNT 16
+#endif
+
+static const int STACK_BUDGET_DEFAULT_GROUP = 0;
+
+/**
+ * @brief Function to call when allocation does not fit into the budget.
+ * It is called in the thread that allocates memory, so it must not modify stacks that thread is using.
+ *
+ * @param group group the memory is requested for
+ * @param needed number of bytes that do not fit into the budget
+ * @return size_t number of bytes the function has freed
+ */
+typedef size_t stack_budget_reclaim_t(const int group, const size_t needed);
+
+/**
+ * @brief Set the limit of memory used by all stacks of the process.
+ *
+ * @param limit limit in bytes (0 removes the limit)
+ */
+void stack_budget_set_limit(const size_t limit);
+
+/**
+ * @brief Set the limit of memory used by stacks of the group.
+ *
+ * @param group group index
+ * @param limit limit in bytes (0 removes the limit)
+ * @param err_code variable to use as errno
+ */
+void stack_budget_set_group_limit(const int group, const size_t limit, int* const err_code = NULL);
+
+/**
+ * @brief Set the function to call when allocation does not fit into the budget.
+ * By default idle stacks registered in the trimmer are trimmed (stack_trimmer_reclaim()).
+ *
+ * @param reclaim function to call (NULL to fail such allocations immediately)
+ */
+void stack_budget_set_reclaim(stack_budget_reclaim_t* reclaim);
+
+/**
+ * @brief Charge the group for the allocated memory.
+ *
+ * @param group group index
+ * @param bytes number of bytes
+ * @param force charge even if the limit is exceeded (for memory that is already allocated)
+ * @return true if the memory fits into the budget
+ */
+bool stack_budget_acquire(const int group, const size_t bytes, const bool force = false);
+
+/**
+ * @brief Return freed memory to the budget of the group.
+ *
+ * @param group group index
+ * @param bytes number of bytes
+ */
+void stack_budget_release(const int group, const size_t bytes);
+
+/**
+ * @brief Get number of bytes used by stacks of the group.
+ *
+ * @param group group index (-1 for all stacks of the process)
+ * @return size_t
+ */
+size_t stack_budget_usage(const int group = -1);
+
+/**
+ * @brief Get limit of the group.
+ *
+ * @param group group index (-1 for the limit of the process)
+ * @return size_t limit in bytes (0 if there is no limit)
+ */
+size_t stack_budget_limit(const int group = -1);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,416 @@
+#include "stackdump.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "util/dbg/debug.h"
+
+static const size_t STACK_DUMP_LINE_BYTES = 32;
+static const size_t STACK_DUMP_INDEX_WIDTH = 10;
+static const size_t STACK_DUMP_LINE_LENGTH = 64 + STACK_DUMP_LINE_BYTES * 4;
+
+/**
+ * @brief Lookup tables for byte formatting.
+ *
+ * @param hex two hex digits of each byte
+ * @param ascii printable representation of each byte
+ */
+struct DumpTables {
+    char hex[256][2];
+    char ascii[256];
+};
+
+/**
+ * @brief Fill lookup tables.
+ *
+ * @return DumpTables
+ */
+static DumpTables build_tables();
+
+static const DumpTables TABLES = build_tables();
+
+/**
+ * @brief Get pointer to the free space of the stream buffer, flush the buffer if there is not enough space.
+ *
+ * @param stream stream to write into
+ * @param length number of bytes to reserve (no more than STACK_DUMP_BUFFER_SIZE)
+ * @param err_code variable to use as errno
+ * @return char* free space or NULL on failure
+ */
+static char* stream_reserve(StackDumpStream* const stream, const size_t length, int* const err_code);
+
+/**
+ * @brief Write formatted line into the stream.
+ *
+ * @param stream stream to write into
+ * @param err_code variable to use as errno
+ * @param format format string for printf()
+ * @param ... arguments for printf()
+ */
+static void stream_printf(StackDumpStream* const stream, int* const err_code, const char* format, ...);
+
+/**
+ * @brief Write data directly into the file.
+ *
+ * @param fd file descriptor
+ * @param data data to write
+ * @param length number of bytes
+ * @return true on success
+ */
+static bool write_all(const int fd, const void* data, size_t length);
+
+/**
+ * @brief Write one slot of the stack as a text line.
+ *
+ * @param stream stream to write into
+ * @param source stack description
+ * @param index index of the slot
+ * @param tag slot tag
+ * @param err_code variable to use as errno
+ */
+static void write_slot(StackDumpStream* const stream, const StackDumpSource* const source, const size_t index,
+                       const char* tag, int* const err_code);
+
+/**
+ * @brief Write a range of slots as one text line.
+ *
+ * @param stream stream to write into
+ * @param first index of the first slot
+ * @param last index of the last slot
+ * @param tag range tag
+ * @param err_code variable to use as errno
+ */
+static void write_range(StackDumpStream* const stream, const size_t first, const size_t last, const char* tag,
+                        int* const err_code);
+
+/**
+ * @brief Print index padded with zeros.
+ *
+ * @param out buffer of at least 21 characters
+ * @param index
+ * @return size_t number of printed characters
+ */
+static size_t format_index(char* out, size_t index);
+
+/**
+ * @brief Check if slot of the stack contains poison.
+ *
+ * @param source stack description
+ * @param index index of the slot
+ * @return true if it does
+ */
+static inline bool is_poison(const StackDumpSource* const source, const size_t index);
+
+/**
+ * @brief Write dump in text format.
+ *
+ * @param stream stream to write into
+ * @param source stack description
+ * @param count number of slots to dump
+ * @param err_code variable to use as errno
+ */
+static void write_text(StackDumpStream* const stream, const StackDumpSource* const source, const size_t count,
+                       int* const err_code);
+
+/**
+ * @brief Write only slots that changed since the previous dump.
+ *
+ * @param stream stream to write into
+ * @param source stack description
+ * @param count number of live slots
+ * @param err_code variable to use as errno
+ */
+static void write_diff(StackDumpStream* const stream, const StackDumpSource* const source, const size_t count,
+                       int* const err_code);
+
+/**
+ * @brief Write dump in binary format.
+ *
+ * @param stream stream to write into
+ * @param source stack description
+ * @param count number of live slots
+ * @param err_code variable to use as errno
+ */
+static void write_binary(StackDumpStream* const stream, const StackDumpSource* const source, const size_t count,
+                         int* const err_code);
+
+/**
+ * @brief Remember live contents of the stack for the next diff.
+ *
+ * @param stream stream to save contents into
+ * @param source stack description
+ * @param count number of live slots
+ * @param err_code variable to use as errno
+ */
+static void save_snapshot(StackDumpStream* const stream, const StackDumpSource* const source, const size_t count,
+                          int* const err_code);
+
+void dump_stream_open(StackDumpStream* const stream, const char* filename, int* const err_code) {
+    _LOG_FAIL_CHECK_(stream && filename, "error", ERROR_REPORTS, return, err_code, EFAULT);
+
+    *stream = (StackDumpStream){};
+
+    stream->buffer = (char*) calloc(STACK_DUMP_BUFFER_SIZE, sizeof(*stream->buffer));
+    _LOG_FAIL_CHECK_(stream->buffer, "error", ERROR_REPORTS, return, err_code, ENOMEM);
+
+    stream->fd = open(filename, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    _LOG_FAIL_CHECK_(stream->fd >= 0, "error", ERROR_REPORTS, {
+        free(stream->buffer);
+        stream->buffer = NULL;
+        return;
+    }, err_code, FILE_ERROR);
+}
+
+void dump_stream_close(StackDumpStream* const stream, int* const err_code) {
+    _LOG_FAIL_CHECK_(stream && stream->fd >= 0, "error", ERROR_REPORTS, return, err_code, EBADF);
+
+    dump_stream_flush(stream, err_code);
+    close(stream->fd);
+
+    free(stream->buffer);
+    free(stream->previous);
+    *stream = (StackDumpStream){};
+}
+
+void dump_stream_flush(StackDumpStream* const stream, int* const err_code) {
+    _LOG_FAIL_CHECK_(stream && stream->fd >= 0, "error", ERROR_REPORTS, return, err_code, EBADF);
+
+    bool written = write_all(stream->fd, stream->buffer, stream->used);
+    stream->used = 0;
+
+    _LOG_FAIL_CHECK_(written, "error", ERROR_REPORTS, return, err_code, FILE_ERROR);
+}
+
+void dump_stream_write(StackDumpStream* const stream, const StackDumpSource* const source, const int mode,
+                       int* const err_code) {
+    _LOG_FAIL_CHECK_(stream && stream->fd >= 0 && source, "error", ERROR_REPORTS, return, err_code, EFAULT);
+    _LOG_FAIL_CHECK_(source->element_size, "error", ERROR_REPORTS, return, err_code, EINVAL);
+
+    //* Corrupt stacks are dumped as far as it is safe to read them.
+    size_t count = source->content ? source->capacity : 0;
+    size_t live_count = source->size < count ? source->size : count;
+
+    if (mode == STACK_DUMP_BINARY) {
+        write_binary(stream, source, live_count, err_code);
+    } else {
+        stream_printf(stream, err_code, " ----- Stack dump #%lu of stack %p%s ----- \n",
+                      (unsigned long)stream->dump_count, source->address,
+                      mode == STACK_DUMP_DIFF ? " (changes since previous dump)" : "");
+        stream_printf(stream, err_code, "Status: %s (%d)\nSize: %lu\nCapacity: %lu\nElement size: %lu\nHash: %lu\n",
+                      source->status ? "CORRUPT" : "OK", source->status,
+                      (unsigned long)source->size, (unsigned long)source->capacity,
+                      (unsigned long)source->element_size, (unsigned long)source->hash);
+
+        if (mode == STACK_DUMP_DIFF) write_diff(stream, source, live_count, err_code);
+        else                         write_text(stream, source, count, err_code);
+    }
+
+    save_snapshot(stream, source, live_count, err_code);
+    ++stream->dump_count;
+
+    dump_stream_flush(stream, err_code);
+}
+
+size_t dump_format_hex(char* out, const void* bytes, const size_t count, const bool prefixed) {
+    char* start = out;
+    for (size_t byte_id = 0; byte_id < count; ++byte_id) {
+        const char* pair = TABLES.hex[((const unsigned char*)bytes)[byte_id]];
+        if (prefixed) {
+            *out++ = '0';
+            *out++ = 'x';
+        }
+        *out++ = pair[0];
+        *out++ = pair[1];
+        *out++ = ' ';
+    }
+    return (size_t)(out - start);
+}
+
+size_t dump_format_ascii(char* out, const void* bytes, const size_t count, const bool spaced) {
+    char* start = out;
+    for (size_t byte_id = 0; byte_id < count; ++byte_id) {
+        *out++ = TABLES.ascii[((const unsigned char*)bytes)[byte_id]];
+        if (spaced) *out++ = ' ';
+    }
+    return (size_t)(out - start);
+}
+
+static DumpTables build_tables() {
+    static const char HEX_DIGITS[] = "0123456789ABCDEF";
+
+    DumpTables tables = {};
+    for (int byte = 0; byte < 256; ++byte) {
+        tables.hex[byte][0] = HEX_DIGITS[byte >> 4];
+        tables.hex[byte][1] = HEX_DIGITS[byte & 0xF];
+        tables.ascii[byte] = isprint(byte) ? (char)byte : '.';
+    }
+    return tables;
+}
+
+static char* stream_reserve(StackDumpStream* const stream, const size_t length, int* const err_code) {
+    if (stream->used + length > STACK_DUMP_BUFFER_SIZE) {
+        dump_stream_flush(stream, err_code);
+    }
+    return stream->buffer + stream->used;
+}
+
+static void stream_printf(StackDumpStream* const stream, int* const err_code, const char* format, ...) {
+    char* out = stream_reserve(stream, STACK_DUMP_LINE_LENGTH * 2, err_code);
+
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(out, STACK_DUMP_LINE_LENGTH * 2, format, args);
+    va_end(args);
+
+    if (length > 0) stream->used += (size_t)length < STACK_DUMP_LINE_LENGTH * 2 ?
+                                    (size_t)length : STACK_DUMP_LINE_LENGTH * 2 - 1;
+}
+
+static bool write_all(const int fd, const void* data, size_t length) {
+    const char* pointer = (const char*)data;
+    while (length) {
+        ssize_t written = write(fd, pointer, length);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+        pointer += written;
+        length -= (size_t)written;
+    }
+    return true;
+}
+
+static void write_slot(StackDumpStream* const stream, const StackDumpSource* const source, const size_t index,
+                       const char* tag, int* const err_code) {
+    char* out = stream_reserve(stream, STACK_DUMP_LINE_LENGTH, err_code);
+    char* start = out;
+
+    const char* slot = source->content + index * source->element_size;
+    size_t byte_count = source->element_size < STACK_DUMP_LINE_BYTES ? source->element_size : STACK_DUMP_LINE_BYTES;
+
+    *out++ = '[';
+    out += format_index(out, index);
+    *out++ = ']';
+    *out++ = ' ';
+    for (size_t char_id = 0; char_id < 8; ++char_id) *out++ = *tag ? *tag++ : ' ';
+    out += dump_format_hex(out, slot, byte_count);
+    *out++ = '|';
+    *out++ = ' ';
+    out += dump_format_ascii(out, slot, byte_count);
+    *out++ = '\n';
+
+    stream->used += (size_t)(out - start);
+}
+
+static void write_range(StackDumpStream* const stream, const size_t first, const size_t last, const char* tag,
+                        int* const err_code) {
+    char* out = stream_reserve(stream, STACK_DUMP_LINE_LENGTH, err_code);
+    char* start = out;
+
+    *out++ = '[';
+    out += format_index(out, first);
+    *out++ = '.';
+    *out++ = '.';
+    out += format_index(out, last);
+    *out++ = ']';
+    *out++ = ' ';
+    while (*tag) *out++ = *tag++;
+    *out++ = ' ';
+    *out++ = 'x';
+    out += sprintf(out, "%lu", (unsigned long)(last - first + 1));
+    *out++ = '\n';
+
+    stream->used += (size_t)(out - start);
+}
+
+static size_t format_index(char* out, size_t index) {
+    char digits[24] = "";
+    size_t length = 0;
+    do {
+        digits[length++] = (char)('0' + index % 10);
+        index /= 10;
+    } while (index);
+
+    size_t printed = 0;
+    for (; printed + length < STACK_DUMP_INDEX_WIDTH; ++printed) out[printed] = '0';
+    while (length) out[printed++] = digits[--length];
+
+    return printed;
+}
+
+static inline bool is_poison(const StackDumpSource* const source, const size_t index) {
+    return source->poison &&
+           !memcmp(source->content + index * source->element_size, source->poison, source->element_size);
+}
+
+static void write_text(StackDumpStream* const stream, const StackDumpSource* const source, const size_t count,
+                       int* const err_code) {
+    for (size_t index = 0; index < count;) {
+        if (!is_poison(source, index)) {
+            write_slot(stream, source, index, index < source->size ? "VALUE" : "STRAY", err_code);
+            ++index;
+            continue;
+        }
+
+        size_t run_end = index;
+        while (run_end + 1 < count && is_poison(source, run_end + 1)) ++run_end;
+
+        write_range(stream, index, run_end, "POISON", err_code);
+        index = run_end + 1;
+    }
+}
+
+static void write_diff(StackDumpStream* const stream, const StackDumpSource* const source, const size_t count,
+                       int* const err_code) {
+    size_t previous_count = stream->previous_size / source->element_size;
+
+    for (size_t index = 0; index < count; ++index) {
+        if (index >= previous_count) {
+            write_slot(stream, source, index, "ADDED", err_code);
+        } else if (memcmp(source->content + index * source->element_size,
+                          stream->previous + index * source->element_size, source->element_size)) {
+            write_slot(stream, source, index, "CHANGED", err_code);
+        }
+    }
+
+    if (count < previous_count) write_range(stream, count, previous_count - 1, "REMOVED", err_code);
+}
+
+static void write_binary(StackDumpStream* const stream, const StackDumpSource* const source, const size_t count,
+                         int* const err_code) {
+    StackDumpHeader header = {};
+    header.element_size = (uint32_t)source->element_size;
+    header.size = count;
+    header.capacity = source->capacity;
+    header.hash = source->hash;
+    header.status = source->status;
+
+    char* out = stream_reserve(stream, sizeof(header), err_code);
+    memcpy(out, &header, sizeof(header));
+    stream->used += sizeof(header);
+
+    //* Contents go straight from the stack buffer into the file without copying.
+    dump_stream_flush(stream, err_code);
+    _LOG_FAIL_CHECK_(write_all(stream->fd, source->content, count * source->element_size),
+                     "error", ERROR_REPORTS, return, err_code, FILE_ERROR);
+}
+
+static void save_snapshot(StackDumpStream* const stream, const StackDumpSource* const source, const size_t count,
+                          int* const err_code) {
+    size_t snapshot_size = count * source->element_size;
+
+    if (snapshot_size > stream->previous_size) {
+        char* snapshot = (char*) realloc(stream->previous, snapshot_size);
+        _LOG_FAIL_CHECK_(snapshot, "error", ERROR_REPORTS, {
+            stream->previous_size = 0;
+            return;
+        }, err_code, ENOMEM);
+        stream->previous = snapshot;
+    }
+
+    if (snapshot_size) memcpy(stream->previous, source->content, snapshot_size);
+    stream->previous_size = snapshot_size;
+}
\ No newline at end of file
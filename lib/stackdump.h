@@ -0,0 +1,150 @@
+/**
+ * @file stackdump.h
+ * @author Ilya Kudryashov (kudriashov.it@phystech.edu)
+ * @brief Buffered streaming dumps of stack contents into dedicated files.
+ * @version 0.1
+ * @date 2022-10-11
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef STACK_DUMP_H
+#define STACK_DUMP_H
+
+#include <cstddef>
+#include <cstdint>
+#include "stackreports.h"
+
+/**
+ * @brief Dump formats.
+ *
+ * @param STACK_DUMP_TEXT every slot of the stack as hex and ASCII, runs of poisoned slots are collapsed
+ * @param STACK_DUMP_BINARY fixed header followed by raw contents of the stack
+ * @param STACK_DUMP_DIFF text lines only for slots that changed since the previous dump into the stream
+ */
+enum STACK_DUMP_MODES {
+    STACK_DUMP_TEXT = 0,
+    STACK_DUMP_BINARY = 1,
+    STACK_DUMP_DIFF = 2,
+};
+
+#define STACK_DUMP_MAGIC "STKDUMP"
+
+/**
+ * @brief Header of the binary dump.
+ */
+struct StackDumpHeader {
+    char magic[8] = STACK_DUMP_MAGIC;
+    uint32_t version = 1;
+    uint32_t element_size = 0;
+    uint64_t size = 0;
+    uint64_t capacity = 0;
+    uint64_t hash = 0;
+    int32_t status = 0;
+    uint32_t reserved = 0;
+};
+
+/**
+ * @brief Description of the stack to dump.
+ *
+ * @param address address of the stack structure
+ * @param content pointer to the first element of the stack
+ * @param element_size size of one element in bytes
+ * @param size number of elements in the stack
+ * @param capacity number of allocated elements
+ * @param poison pointer to the poison value
+ * @param hash stored hash of the stack
+ * @param status status of the stack
+ */
+struct StackDumpSource {
+    const void* address = NULL;
+    const char* content = NULL;
+    size_t element_size = 0;
+    size_t size = 0;
+    size_t capacity = 0;
+    const void* poison = NULL;
+    uint64_t hash = 0;
+    stack_report_t status = 0;
+};
+
+/**
+ * @brief File dumps are streamed into.
+ *
+ * @param fd file descriptor
+ * @param buffer output buffer
+ * @param used number of bytes in the buffer
+ * @param previous contents of the stack at the moment of the previous dump (diff mode)
+ * @param previous_size size of the previous contents in bytes
+ * @param dump_count number of dumps written into the stream
+ */
+struct StackDumpStream {
+    int fd = -1;
+    char* buffer = NULL;
+    size_t used = 0;
+    char* previous = NULL;
+    size_t previous_size = 0;
+    size_t dump_count = 0;
+};
+
+static const size_t STACK_DUMP_BUFFER_SIZE = 1 << 16;
+
+/**
+ * @brief Open dump stream. Dumps are appended to the end of the file.
+ *
+ * @param stream stream to initialize
+ * @param filename name of the file
+ * @param err_code variable to use as errno
+ */
+void dump_stream_open(StackDumpStream* const stream, const char* filename, int* const err_code = NULL);
+
+/**
+ * @brief Flush and close dump stream.
+ *
+ * @param stream stream to close
+ * @param err_code variable to use as errno
+ */
+void dump_stream_close(StackDumpStream* const stream, int* const err_code = NULL);
+
+/**
+ * @brief Write buffered data into the file.
+ *
+ * @param stream stream to flush
+ * @param err_code variable to use as errno
+ */
+void dump_stream_flush(StackDumpStream* const stream, int* const err_code = NULL);
+
+/**
+ * @brief Dump the stack into the stream.
+ *
+ * @param stream stream to write into
+ * @param source stack description
+ * @param mode dump format (one of STACK_DUMP_MODES)
+ * @param err_code variable to use as errno
+ */
+void dump_stream_write(StackDumpStream* const stream, const StackDumpSource* const source, const int mode,
+                       int* const err_code = NULL);
+
+/**
+ * @brief Print bytes as hex pairs separated by spaces ("AB " or "0xAB ").
+ *
+ * @param out buffer of at least count * 5 characters
+ * @param bytes bytes to print
+ * @param count number of bytes
+ * @param prefixed true to print "0x" before each byte
+ * @return size_t number of printed characters
+ */
+size_t dump_format_hex(char* out, const void* bytes, const size_t count, const bool prefixed = false);
+
+/**
+ * @brief Print bytes as characters replacing unprintable ones with '.'.
+ *
+ * @param out buffer of at least count * 2 characters
+ * @param bytes bytes to print
+ * @param count number of bytes
+ * @param spaced true to put a space after each character
+ * @return size_t number of printed characters
+ */
+size_t dump_format_ascii(char* out, const void* bytes, const size_t count, const bool spaced = false);
+
+#endif
\ No newline at end of file
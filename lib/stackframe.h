@@ -0,0 +1,46 @@
+/**
+ * @file stackframe.h
+ * @author Ilya Kudryashov (kudriashov.it@phystech.edu)
+ * @brief Canaries, poison and protection switches shared by the stack implementations.
+ * @version 0.1
+ * @date 2022-10-18
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef STACK_FRAME_H
+#define STACK_FRAME_H
+
+#include <string.h>
+
+#ifndef NCANARY
+#define ON_CANARY(...) __VA_ARGS__
+#else
+#define ON_CANARY(...)
+#endif
+
+#ifndef NHASH
+#define ON_HASH(...) __VA_ARGS__
+#else
+#define ON_HASH(...)
+#endif
+
+#define STACK_CANARY_VALUE "CANARY"
+typedef char stack_canary_t[7];
+
+//* Value put into empty cells of stacks of integers.
+static const long long STACK_INTEGER_POISON = (long long)0xDEADBABEC0FEBEEF;
+
+/**
+ * @brief Check if variable stores canary value.
+ *
+ * @param value variable to check
+ * @return true
+ * @return false
+ */
+static inline bool stack_check_canary(const char* value) {
+    return !memcmp(value, STACK_CANARY_VALUE, sizeof(stack_canary_t));
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,491 @@
+#include "stackoplog.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "util/clock.h"
+#include "util/intpack.h"
+#include "util/dbg/debug.h"
+
+//* Operations that are logged with an argument.
+static const bool OPLOG_HAS_ARGUMENT[] = {
+    true, false, true, false, false, true, true, true, false, true, true, true, false, true,
+};
+
+static pthread_mutex_t oplog_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+//* Read without the lock by every logged operation, written under the lock.
+static bool oplog_active = false;
+static FILE* oplog_output = NULL;
+static bool oplog_failed = false;
+
+//* Checked without the lock by reads, which are not streamed.
+static int oplog_stream = -1;
+static bool oplog_socket = false;
+static uint64_t oplog_group_time = 0;
+
+static pthread_t oplog_flusher;
+static bool oplog_flusher_running = false;
+static pthread_cond_t oplog_group_started = PTHREAD_COND_INITIALIZER;
+
+static unsigned char oplog_buffer[STACK_OPLOG_BUFFER_SIZE] = {};
+static size_t oplog_length = 0;
+
+static uint64_t oplog_start_time = 0;
+static uint64_t oplog_last_time = 0;
+
+//* Ids are never reused, so stacks keep their ids between logging sessions.
+static unsigned int oplog_last_handle = 0;
+
+/**
+ * @brief Start logging into the file or the stream with the magic of the log.
+ *
+ * @param output file to write into (NULL when streaming)
+ * @param stream descriptor to stream into (-1 when writing into the file)
+ */
+static void oplog_begin(FILE* output, const int stream);
+
+/**
+ * @brief Write buffered bytes into the file or the stream.
+ */
+static void oplog_flush();
+
+/**
+ * @brief Main function of the thread that writes streamed groups which are not filled up in time.
+ *
+ * @param argument unused
+ * @return void*
+ */
+static void* oplog_flush_loop(void* argument);
+
+/**
+ * @brief Write bytes into the stream, dropping the stream if the follower is gone.
+ *
+ * @param data bytes to write
+ * @param length number of bytes
+ */
+static void oplog_send(const unsigned char* data, size_t length);
+
+/**
+ * @brief Fill the address of the Unix socket.
+ *
+ * @param address variable to put the address into
+ * @param path path of the socket
+ * @return true if the path fits into the address
+ */
+static bool oplog_socket_address(struct sockaddr_un* const address, const char* path);
+
+/**
+ * @brief Append number to the buffer in LEB128 encoding, flushing the buffer if it is full.
+ *
+ * @param value
+ */
+static inline void oplog_put(uint64_t value);
+
+/**
+ * @brief Read number in LEB128 encoding.
+ *
+ * @param input file to read from
+ * @param value variable to put the number into
+ * @return true if the number was read
+ */
+static bool oplog_get(FILE* input, uint64_t* const value);
+
+void stack_oplog_start(const char* filename, int* const err_code) {
+    _LOG_FAIL_CHECK_(filename, "error", ERROR_REPORTS, return, err_code, EFAULT);
+
+    stack_oplog_stop(err_code);
+
+    FILE* output = fopen(filename, "wb");
+    _LOG_FAIL_CHECK_(output, "error", ERROR_REPORTS, return, err_code, FILE_ERROR);
+
+    oplog_begin(output, -1);
+}
+
+void stack_oplog_stream(const int output, int* const err_code) {
+    _LOG_FAIL_CHECK_(output >= 0, "error", ERROR_REPORTS, return, err_code, EBADF);
+
+    stack_oplog_stop(err_code);
+
+    oplog_begin(NULL, output);
+
+    pthread_mutex_lock(&oplog_mutex);
+    oplog_flusher_running = true;
+    int create_status = pthread_create(&oplog_flusher, NULL, oplog_flush_loop, NULL);
+    if (create_status) oplog_flusher_running = false;
+    pthread_mutex_unlock(&oplog_mutex);
+
+    //* Without the flusher groups are still written by the operations that find them old enough.
+    _LOG_FAIL_CHECK_(create_status == 0, "warning", WARNINGS, {}, err_code, create_status);
+
+    log_printf(STATUS_REPORTS, "status", "Streaming stack operations into descriptor %d.\n", output);
+}
+
+void stack_oplog_connect(const char* path, int* const err_code) {
+    _LOG_FAIL_CHECK_(path, "error", ERROR_REPORTS, return, err_code, EFAULT);
+
+    struct sockaddr_un address = {};
+    _LOG_FAIL_CHECK_(oplog_socket_address(&address, path), "error", ERROR_REPORTS, return, err_code, ENAMETOOLONG);
+
+    int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    int socket_error = connection < 0 ? errno : 0;
+    _LOG_FAIL_CHECK_(connection >= 0, "error", ERROR_REPORTS, return, err_code, socket_error);
+
+    int connect_error = connect(connection, (const struct sockaddr*)&address, sizeof(address)) ? errno : 0;
+    _LOG_FAIL_CHECK_(!connect_error, "error", ERROR_REPORTS, {
+        close(connection);
+        return;
+    }, err_code, connect_error);
+
+    stack_oplog_stream(connection, err_code);
+}
+
+int stack_oplog_accept(const char* path, int* const err_code) {
+    _LOG_FAIL_CHECK_(path, "error", ERROR_REPORTS, return -1, err_code, EFAULT);
+
+    struct sockaddr_un address = {};
+    _LOG_FAIL_CHECK_(oplog_socket_address(&address, path), "error", ERROR_REPORTS, return -1, err_code, ENAMETOOLONG);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    int socket_error = listener < 0 ? errno : 0;
+    _LOG_FAIL_CHECK_(listener >= 0, "error", ERROR_REPORTS, return -1, err_code, socket_error);
+
+    bool listening = !bind(listener, (const struct sockaddr*)&address, sizeof(address)) && !listen(listener, 1);
+    int bind_error = listening ? 0 : errno;
+    _LOG_FAIL_CHECK_(!bind_error, "error", ERROR_REPORTS, {
+        close(listener);
+        return -1;
+    }, err_code, bind_error);
+
+    log_printf(STATUS_REPORTS, "status", "Waiting for the leader on %s.\n", path);
+
+    int connection = -1;
+    while ((connection = accept(listener, NULL, NULL)) < 0 && errno == EINTR) {}
+    int accept_error = connection < 0 ? errno : 0;
+
+    close(listener);
+    unlink(path);
+
+    _LOG_FAIL_CHECK_(connection >= 0, "error", ERROR_REPORTS, return -1, err_code, accept_error);
+
+    return connection;
+}
+
+void stack_oplog_sync(int* const err_code) {
+    pthread_mutex_lock(&oplog_mutex);
+
+    bool failed = false;
+    if (oplog_active) {
+        oplog_flush();
+        if (oplog_output && fflush(oplog_output)) oplog_failed = true;
+        failed = oplog_failed;
+    }
+    int sync_error = oplog_stream >= 0 ? EPIPE : FILE_ERROR;
+
+    pthread_mutex_unlock(&oplog_mutex);
+
+    _LOG_FAIL_CHECK_(!failed, "error", ERROR_REPORTS, return, err_code, sync_error);
+}
+
+void stack_oplog_stop(int* const err_code) {
+    pthread_mutex_lock(&oplog_mutex);
+
+    if (!oplog_active) {
+        pthread_mutex_unlock(&oplog_mutex);
+        return;
+    }
+
+    __atomic_store_n(&oplog_active, false, __ATOMIC_RELEASE);
+
+    oplog_flush();
+    if (oplog_output && fclose(oplog_output)) oplog_failed = true;
+    if (oplog_stream >= 0 && close(oplog_stream)) oplog_failed = true;
+    oplog_output = NULL;
+    __atomic_store_n(&oplog_stream, -1, __ATOMIC_RELAXED);
+
+    bool failed = oplog_failed;
+
+    bool flusher = oplog_flusher_running;
+    oplog_flusher_running = false;
+    pthread_cond_signal(&oplog_group_started);
+
+    pthread_mutex_unlock(&oplog_mutex);
+
+    if (flusher) pthread_join(oplog_flusher, NULL);
+
+    _LOG_FAIL_CHECK_(!failed, "error", ERROR_REPORTS, return, err_code, FILE_ERROR);
+}
+
+void stack_oplog_end_program() {
+    stack_oplog_stop();
+}
+
+bool stack_oplog_active() {
+    return __atomic_load_n(&oplog_active, __ATOMIC_ACQUIRE);
+}
+
+unsigned int stack_oplog_handle(unsigned int* const handle) {
+    unsigned int current = __atomic_load_n(handle, __ATOMIC_ACQUIRE);
+    if (current) return current;
+
+    unsigned int assigned = __atomic_add_fetch(&oplog_last_handle, 1, __ATOMIC_RELAXED);
+
+    //* Another thread may have assigned the id first, its id wins.
+    if (__atomic_compare_exchange_n(handle, &current, assigned, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return assigned;
+    return current;
+}
+
+void stack_oplog_record(const int op, unsigned int* const handle, const long long argument,
+                        const long long* const values) {
+    if (!__atomic_load_n(&oplog_active, __ATOMIC_ACQUIRE)) return;
+
+    //* Follower only applies operations that change stacks, so reads are not streamed.
+    if (op == STACK_OP_PULL && __atomic_load_n(&oplog_stream, __ATOMIC_RELAXED) >= 0) return;
+
+    unsigned int id = stack_oplog_handle(handle);
+
+    pthread_mutex_lock(&oplog_mutex);
+
+    //* Logging could have been stopped while the lock was being taken.
+    if (!oplog_active) {
+        pthread_mutex_unlock(&oplog_mutex);
+        return;
+    }
+
+    //* Time is taken under the lock, so deltas between consecutive operations are never negative.
+    uint64_t time = clock_ns() - oplog_start_time;
+
+    if (!oplog_length) {
+        oplog_group_time = time;
+        if (oplog_flusher_running) pthread_cond_signal(&oplog_group_started);
+    }
+
+    oplog_put((uint64_t)op);
+    oplog_put(id);
+    oplog_put(time - oplog_last_time);
+    if (OPLOG_HAS_ARGUMENT[op]) oplog_put(intpack_zigzag(argument));
+
+    if ((op == STACK_OP_PUBLISH || op == STACK_OP_ADOPT) && argument > 0) {
+        for (long long index = 0; index < argument; ++index) {
+            oplog_put(values ? intpack_zigzag(values[index]) : 0);
+        }
+    }
+
+    oplog_last_time = time;
+
+    //* Streamed operations are written in groups, so they share one system call (group commit).
+    //* Checkpoints are written at once, the follower confirms its state at each of them.
+    if (oplog_stream >= 0 && (op == STACK_OP_CHECK || oplog_length >= STACK_OPLOG_GROUP_SIZE ||
+                              time - oplog_group_time >= STACK_OPLOG_GROUP_DELAY)) oplog_flush();
+
+    pthread_mutex_unlock(&oplog_mutex);
+}
+
+void stack_oplog_open(StackOplogReader* const reader, const char* filename, int* const err_code) {
+    _LOG_FAIL_CHECK_(reader && filename, "error", ERROR_REPORTS, return, err_code, EFAULT);
+
+    *reader = (StackOplogReader){};
+
+    reader->input = fopen(filename, "rb");
+    _LOG_FAIL_CHECK_(reader->input, "error", ERROR_REPORTS, return, err_code, FILE_ERROR);
+
+    char magic[sizeof(STACK_OPLOG_MAGIC) - 1] = "";
+    size_t magic_length = fread(magic, 1, sizeof(magic), reader->input);
+    _LOG_FAIL_CHECK_(magic_length == sizeof(magic) && !memcmp(magic, STACK_OPLOG_MAGIC, sizeof(magic)),
+                     "error", ERROR_REPORTS, {
+        stack_oplog_close(reader);
+        return;
+    }, err_code, EINVAL);
+}
+
+void stack_oplog_attach(StackOplogReader* const reader, const int input, int* const err_code) {
+    _LOG_FAIL_CHECK_(reader, "error", ERROR_REPORTS, return, err_code, EFAULT);
+
+    *reader = (StackOplogReader){};
+
+    reader->input = fdopen(input, "rb");
+    _LOG_FAIL_CHECK_(reader->input, "error", ERROR_REPORTS, return, err_code, EBADF);
+
+    char magic[sizeof(STACK_OPLOG_MAGIC) - 1] = "";
+    size_t magic_length = fread(magic, 1, sizeof(magic), reader->input);
+    _LOG_FAIL_CHECK_(magic_length == sizeof(magic) && !memcmp(magic, STACK_OPLOG_MAGIC, sizeof(magic)),
+                     "error", ERROR_REPORTS, {
+        stack_oplog_close(reader);
+        return;
+    }, err_code, EINVAL);
+}
+
+bool stack_oplog_next(StackOplogReader* const reader, StackOp* const op, int* const err_code) {
+    _LOG_FAIL_CHECK_(reader && reader->input && op, "error", ERROR_REPORTS, return false, err_code, EFAULT);
+
+    uint64_t code = 0, handle = 0, delta = 0, argument = 0;
+
+    //* Log ends cleanly only between operations, anything else means it was cut short.
+    if (!oplog_get(reader->input, &code)) return false;
+
+    bool complete = code < STACK_OP_COUNT && oplog_get(reader->input, &handle) && oplog_get(reader->input, &delta);
+    if (complete && OPLOG_HAS_ARGUMENT[code]) complete = oplog_get(reader->input, &argument);
+    _LOG_FAIL_CHECK_(complete, "error", ERROR_REPORTS, return false, err_code, EILSEQ);
+
+    reader->time += delta;
+
+    *op = (StackOp){
+        .op = (int)code,
+        .handle = (unsigned int)handle,
+        .argument = intpack_unzigzag(argument),
+        .time = reader->time,
+        .values = NULL,
+    };
+
+    if ((op->op == STACK_OP_PUBLISH || op->op == STACK_OP_ADOPT) && op->argument > 0) {
+        size_t count = (size_t)op->argument;
+
+        if (reader->values_capacity < count) {
+            long long* values = (long long*)realloc(reader->values, count * sizeof(*values));
+            _LOG_FAIL_CHECK_(values, "error", ERROR_REPORTS, return false, err_code, ENOMEM);
+            reader->values = values;
+            reader->values_capacity = count;
+        }
+
+        for (size_t index = 0; index < count; ++index) {
+            uint64_t value = 0;
+            _LOG_FAIL_CHECK_(oplog_get(reader->input, &value), "error", ERROR_REPORTS, return false, err_code, EILSEQ);
+            reader->values[index] = intpack_unzigzag(value);
+        }
+
+        op->values = reader->values;
+    }
+
+    return true;
+}
+
+void stack_oplog_close(StackOplogReader* const reader) {
+    if (!reader) return;
+
+    if (reader->input) fclose(reader->input);
+    free(reader->values);
+
+    *reader = (StackOplogReader){};
+}
+
+static void oplog_begin(FILE* output, const int stream) {
+    struct stat stream_status = {};
+    bool socket = stream >= 0 && !fstat(stream, &stream_status) && S_ISSOCK(stream_status.st_mode);
+
+    pthread_mutex_lock(&oplog_mutex);
+
+    oplog_output = output;
+    __atomic_store_n(&oplog_stream, stream, __ATOMIC_RELAXED);
+    oplog_socket = socket;
+    oplog_failed = false;
+    oplog_length = 0;
+    oplog_start_time = clock_ns();
+    oplog_last_time = 0;
+
+    memcpy(oplog_buffer, STACK_OPLOG_MAGIC, sizeof(STACK_OPLOG_MAGIC) - 1);
+    oplog_length = sizeof(STACK_OPLOG_MAGIC) - 1;
+
+    //* Follower waits for the magic, so it is sent without waiting for the first group.
+    if (stream >= 0) oplog_flush();
+
+    __atomic_store_n(&oplog_active, true, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(&oplog_mutex);
+}
+
+static void oplog_flush() {
+    if (oplog_stream >= 0) {
+        if (!oplog_failed) oplog_send(oplog_buffer, oplog_length);
+    } else if (oplog_length && fwrite(oplog_buffer, 1, oplog_length, oplog_output) != oplog_length) {
+        oplog_failed = true;
+    }
+    oplog_length = 0;
+}
+
+static void* oplog_flush_loop(void* argument) {
+    pthread_mutex_lock(&oplog_mutex);
+
+    while (oplog_flusher_running) {
+        if (!oplog_length) {
+            pthread_cond_wait(&oplog_group_started, &oplog_mutex);
+            continue;
+        }
+
+        uint64_t age = clock_ns() - oplog_start_time - oplog_group_time;
+        if (age >= STACK_OPLOG_GROUP_DELAY) {
+            oplog_flush();
+            continue;
+        }
+
+        //* Condition variable waits by the realtime clock, so the rest of the delay is added to its current value.
+        struct timespec deadline = {};
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        uint64_t nanoseconds = (uint64_t)deadline.tv_nsec + (STACK_OPLOG_GROUP_DELAY - age);
+        deadline.tv_sec += (time_t)(nanoseconds / 1000000000);
+        deadline.tv_nsec = (long)(nanoseconds % 1000000000);
+
+        pthread_cond_timedwait(&oplog_group_started, &oplog_mutex, &deadline);
+    }
+
+    pthread_mutex_unlock(&oplog_mutex);
+
+    return argument;
+}
+
+static void oplog_send(const unsigned char* data, size_t length) {
+    //* Callers use errno as their error variable, so a lost follower must not change it.
+    int saved_errno = errno;
+
+    while (length) {
+        //* send() does not raise SIGPIPE when the follower is gone, but pipes can only be written with write().
+        ssize_t written = oplog_socket ? send(oplog_stream, data, length, MSG_NOSIGNAL) :
+                                         write(oplog_stream, data, length);
+        if (written < 0 && errno == EINTR) continue;
+
+        if (written <= 0) {
+            oplog_failed = true;
+            log_printf(WARNINGS, "warning", "Follower is gone, stack operations are not streamed anymore.\n");
+            break;
+        }
+
+        data += written;
+        length -= (size_t)written;
+    }
+
+    errno = saved_errno;
+}
+
+static bool oplog_socket_address(struct sockaddr_un* const address, const char* path) {
+    if (strlen(path) >= sizeof(address->sun_path)) return false;
+
+    address->sun_family = AF_UNIX;
+    strcpy(address->sun_path, path);
+    return true;
+}
+
+static inline void oplog_put(uint64_t value) {
+    if (oplog_length + INTPACK_VARINT_MAX > STACK_OPLOG_BUFFER_SIZE) oplog_flush();
+
+    oplog_length += intpack_put_varint(value, oplog_buffer + oplog_length);
+}
+
+static bool oplog_get(FILE* input, uint64_t* const value) {
+    unsigned char bytes[INTPACK_VARINT_MAX] = {};
+
+    for (size_t length = 0; length < INTPACK_VARINT_MAX;) {
+        int byte = getc_unlocked(input);
+        if (byte == EOF) return false;
+
+        bytes[length++] = (unsigned char)byte;
+        if (!(byte & 0x80)) return intpack_get_varint(bytes, length, value) == length;
+    }
+
+    return false;
+}
\ No newline at end of file
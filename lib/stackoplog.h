@@ -0,0 +1,213 @@
+/**
+ * @file stackoplog.h
+ * @author Ilya Kudryashov (kudriashov.it@phystech.edu)
+ * @brief Compact binary log of operations performed on stacks, and its reader.
+ * @version 0.1
+ * @date 2022-10-15
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef STACK_OPLOG_H
+#define STACK_OPLOG_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+//* Number of bytes collected in memory before they are written into the file.
+#ifndef STACK_OPLOG_BUFFER_SIZE
+#define STACK_OPLOG_BUFFER_SIZE (1 << 16)
+#endif
+
+//* Operations streamed to a replica are sent in groups of at least this many bytes...
+#ifndef STACK_OPLOG_GROUP_SIZE
+#define STACK_OPLOG_GROUP_SIZE (1 << 12)
+#endif
+
+//* ...or as soon as the group is this many nanoseconds old.
+#ifndef STACK_OPLOG_GROUP_DELAY
+#define STACK_OPLOG_GROUP_DELAY 1000000
+#endif
+
+#define STACK_OPLOG_MAGIC "STKOPLG1"
+
+enum STACK_OPS {
+    STACK_OP_CTOR = 0,      // Argument is the starting capacity.
+    STACK_OP_DTOR = 1,
+    STACK_OP_PUSH = 2,      // Argument is the pushed value.
+    STACK_OP_POP = 3,
+    STACK_OP_PULL = 4,
+    STACK_OP_FORK = 5,      // Argument is the handle of the fork.
+    STACK_OP_RESERVE = 6,   // Argument is the number of reserved cells.
+    STACK_OP_PUBLISH = 7,   // Argument is the number of published elements, followed by their values.
+    STACK_OP_MARK = 8,
+    STACK_OP_ROLLBACK = 9,  // Argument is the savepoint.
+    STACK_OP_COMMIT = 10,   // Argument is the savepoint.
+    STACK_OP_ADOPT = 11,    // Argument is the number of adopted elements, followed by their values.
+    STACK_OP_RELEASE = 12,
+    STACK_OP_CHECK = 13,    // Argument is the content hash of the stack.
+    STACK_OP_COUNT,
+};
+
+static const char* const STACK_OP_NAMES[] = {
+    "ctor", "dtor", "push", "pop", "pull", "fork", "reserve", "publish", "mark", "rollback", "commit", "adopt",
+    "release", "check",
+};
+
+/**
+ * @brief Logged operation.
+ *
+ * @param op operation (one of STACK_OPS)
+ * @param handle id of the stack the operation was performed on
+ * @param argument argument of the operation (see STACK_OPS)
+ * @param time time since the start of the log in nanoseconds
+ * @param values elements the operation added (for STACK_OP_PUBLISH and STACK_OP_ADOPT, argument is their number)
+ */
+struct StackOp {
+    int op = 0;
+    unsigned int handle = 0;
+    long long argument = 0;
+    uint64_t time = 0;
+    const long long* values = NULL;
+};
+
+/**
+ * @brief State of the log being read.
+ *
+ * @param input file to read from
+ * @param time time of the last read operation
+ * @param values buffer for elements of the last read operation
+ * @param values_capacity number of elements the buffer can hold
+ */
+struct StackOplogReader {
+    FILE* input = NULL;
+    uint64_t time = 0;
+    long long* values = NULL;
+    size_t values_capacity = 0;
+};
+
+/**
+ * @brief Start logging operations into the file, the file is truncated.
+ *
+ * @param filename name of the file
+ * @param err_code variable to use as errno
+ */
+void stack_oplog_start(const char* filename, int* const err_code = NULL);
+
+/**
+ * @brief Start streaming operations into the pipe or socket, a follower can apply them to its own stacks
+ * (see replay_follow()). Operations are written in groups (see STACK_OPLOG_GROUP_SIZE and
+ * STACK_OPLOG_GROUP_DELAY), a group is also written at each checkpoint and by stack_oplog_sync().
+ * A background thread writes groups that do not fill up within the delay, even if no more operations come.
+ * Reads (STACK_OP_PULL) do not change stacks, so they are not streamed.
+ * The descriptor is closed when logging stops, so the follower sees the end of the log.
+ * If the follower disconnects, the stream is dropped and the program goes on without it.
+ *
+ * @param output file descriptor to write into (SIGPIPE should be ignored if it is a pipe)
+ * @param err_code variable to use as errno
+ */
+void stack_oplog_stream(const int output, int* const err_code = NULL);
+
+/**
+ * @brief Connect to the follower listening on the Unix socket (see stack_oplog_accept()) and stream operations to it.
+ *
+ * @param path path of the socket
+ * @param err_code variable to use as errno
+ */
+void stack_oplog_connect(const char* path, int* const err_code = NULL);
+
+/**
+ * @brief Listen on the Unix socket and wait for the leader to connect. The socket file is removed after that.
+ *
+ * @param path path of the socket
+ * @param err_code variable to use as errno
+ * @return descriptor of the connection to read the log from, -1 on error
+ */
+int stack_oplog_accept(const char* path, int* const err_code = NULL);
+
+/**
+ * @brief Write the operations collected into the current group without waiting for the group to fill up.
+ *
+ * @param err_code variable to use as errno (EPIPE if the stream was dropped)
+ */
+void stack_oplog_sync(int* const err_code = NULL);
+
+/**
+ * @brief Write buffered operations into the file and stop logging.
+ *
+ * @param err_code variable to use as errno
+ */
+void stack_oplog_stop(int* const err_code = NULL);
+
+/**
+ * @brief Stop logging at exit (for atexit()).
+ */
+void stack_oplog_end_program();
+
+/**
+ * @brief Check if operations are being logged.
+ *
+ * @return bool
+ */
+bool stack_oplog_active();
+
+/**
+ * @brief Get id of the stack in the log, assigning a new one on the first call.
+ *
+ * @param handle variable the stack keeps its id in (0 if the id is not assigned yet)
+ * @return unsigned int
+ */
+unsigned int stack_oplog_handle(unsigned int* const handle);
+
+/**
+ * @brief Append the operation to the log if logging is active.
+ * Should be called after the operation succeeded, so that the log only holds operations that can be replayed.
+ *
+ * @param op operation (one of STACK_OPS)
+ * @param handle variable the stack keeps its id in
+ * @param argument argument of the operation
+ * @param values elements the operation added (NULL if there are none)
+ */
+void stack_oplog_record(const int op, unsigned int* const handle, const long long argument = 0,
+                        const long long* const values = NULL);
+
+/**
+ * @brief Open the log for reading.
+ *
+ * @param reader reader to initialize
+ * @param filename name of the log file
+ * @param err_code variable to use as errno
+ */
+void stack_oplog_open(StackOplogReader* const reader, const char* filename, int* const err_code = NULL);
+
+/**
+ * @brief Start reading the log streamed into the descriptor (see stack_oplog_stream()).
+ * Waits for the start of the log. The descriptor is closed by stack_oplog_close().
+ *
+ * @param reader reader to initialize
+ * @param input file descriptor to read from
+ * @param err_code variable to use as errno
+ */
+void stack_oplog_attach(StackOplogReader* const reader, const int input, int* const err_code = NULL);
+
+/**
+ * @brief Read the next operation.
+ * Values of the operation stay valid until the next call.
+ *
+ * @param reader reader of the log
+ * @param op variable to put the operation into
+ * @param err_code variable to use as errno
+ * @return true if the operation was read, false at the end of the log or on error
+ */
+bool stack_oplog_next(StackOplogReader* const reader, StackOp* const op, int* const err_code = NULL);
+
+/**
+ * @brief Close the log and free the reader.
+ *
+ * @param reader reader of the log
+ */
+void stack_oplog_close(StackOplogReader* const reader);
+
+#endif
\ No newline at end of file
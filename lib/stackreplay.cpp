@@ -0,0 +1,492 @@
+#include "stackreplay.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ll_stack.h"
+#include "stackoplog.h"
+#include "util/clock.h"
+#include "util/histogram.h"
+#include "util/dbg/debug.h"
+
+static const size_t REPLAY_ATTACH_CAPACITY = 16;
+
+/**
+ * @brief Stack of the replayed log.
+ *
+ * @param stack encrypted pointer to the stack (NULL if the stack does not exist)
+ * @param size number of elements in the stack
+ * @param marks number of savepoints held
+ * @param reserved cells handed out by the last reserve (NULL if there are none)
+ * @param reserved_count number of the reserved cells
+ * @param attached true if the stack was created before the log was started, so its deeper elements are unknown
+ */
+struct ReplayStack {
+    void* stack;
+    size_t size;
+    size_t marks;
+    ll_stack_content_t* reserved;
+    size_t reserved_count;
+    bool attached;
+};
+
+/**
+ * @brief State of the replay.
+ *
+ * @param config replay settings
+ * @param stacks stacks indexed by their handles in the log
+ * @param stack_count number of elements in the stacks array
+ * @param histograms latencies of each operation
+ * @param operations number of replayed operations
+ * @param skipped number of operations that could not be replayed
+ * @param attached number of stacks created before the log was started
+ * @param resizes number of times buffers of the stacks changed their capacity
+ * @param max_lag biggest delay of an operation behind the original timing in nanoseconds
+ * @param checks number of checkpoints the stacks were compared at
+ * @param mismatches number of checkpoints at which elements of the stack differed from the recorded ones
+ */
+struct ReplayState {
+    const ReplayConfig* config;
+    ReplayStack* stacks;
+    size_t stack_count;
+    Histogram* histograms;
+    uint64_t operations;
+    uint64_t skipped;
+    uint64_t attached;
+    uint64_t resizes;
+    uint64_t max_lag;
+    uint64_t checks;
+    uint64_t mismatches;
+};
+
+/**
+ * @brief Prepare the state for the replay.
+ *
+ * @param state state to initialize
+ * @param config replay settings
+ * @return true if the state was initialized
+ */
+static bool replay_state_init(ReplayState* const state, const ReplayConfig* const config);
+
+/**
+ * @brief Destroy stacks left in the replay and free the state.
+ *
+ * @param state state of the replay
+ */
+static void replay_state_destroy(ReplayState* const state);
+
+/**
+ * @brief Hand the stacks over to the caller, dropping their unpublished reservations.
+ *
+ * @param state state of the replay
+ * @param stacks variable to put the array of taken over stacks into
+ * @return size_t number of taken over stacks
+ */
+static size_t replay_take_over(ReplayState* const state, ReplicaStack** const stacks);
+
+/**
+ * @brief Make sure the stacks array has the slot for the handle.
+ *
+ * @param state state of the replay
+ * @param handle handle of the stack
+ * @return true if the slot exists
+ */
+static bool replay_reserve_slot(ReplayState* const state, const unsigned int handle);
+
+/**
+ * @brief Replay one operation.
+ *
+ * @param state state of the replay
+ * @param op operation to replay
+ */
+static void replay_apply(ReplayState* const state, const StackOp* const op);
+
+/**
+ * @brief Check if the operation can be performed on the replayed stacks.
+ * Elements of stacks created before the log was started are unknown, so some operations can not be repeated.
+ *
+ * @param state state of the replay
+ * @param op operation to check
+ * @return bool
+ */
+static bool replay_is_valid(const ReplayState* const state, const StackOp* const op);
+
+/**
+ * @brief Sleep until the moment the operation was originally performed.
+ *
+ * @param state state of the replay
+ * @param deadline moment of the operation in nanoseconds of the monotonic clock
+ */
+static void replay_wait(ReplayState* const state, const uint64_t deadline);
+
+/**
+ * @brief Print totals and latencies of each operation.
+ *
+ * @param state state of the replay
+ * @param elapsed duration of the replay in seconds
+ * @param output stream to print into
+ */
+static void replay_report(const ReplayState* const state, const double elapsed, FILE* output);
+
+void replay_run(const ReplayConfig* const config, FILE* output, int* const err_code) {
+    _LOG_FAIL_CHECK_(config && config->filename && output, "error", ERROR_REPORTS, return, err_code, EFAULT);
+
+    StackOplogReader reader = {};
+    int open_status = 0;
+    stack_oplog_open(&reader, config->filename, &open_status);
+    _LOG_FAIL_CHECK_(open_status == 0, "error", ERROR_REPORTS, return, err_code, open_status);
+
+    ReplayState state = {};
+    _LOG_FAIL_CHECK_(replay_state_init(&state, config), "error", ERROR_REPORTS, {
+        stack_oplog_close(&reader);
+        return;
+    }, err_code, ENOMEM);
+
+    uint64_t start_time = clock_ns();
+
+    StackOp op = {};
+    int read_status = 0;
+    while (stack_oplog_next(&reader, &op, &read_status)) {
+        if (config->timed) replay_wait(&state, start_time + op.time);
+        replay_apply(&state, &op);
+    }
+
+    double elapsed = (double)(clock_ns() - start_time) / 1e9;
+
+    replay_report(&state, elapsed, output);
+
+    uint64_t mismatches = state.mismatches;
+
+    replay_state_destroy(&state);
+    stack_oplog_close(&reader);
+
+    _LOG_FAIL_CHECK_(read_status == 0, "error", ERROR_REPORTS, return, err_code, read_status);
+    _LOG_FAIL_CHECK_(mismatches == 0, "error", ERROR_REPORTS, return, err_code, EINVAL);
+}
+
+size_t replay_follow(const ReplayConfig* const config, const int input, ReplicaStack** const stacks, FILE* output,
+                     int* const err_code) {
+    _LOG_FAIL_CHECK_(config && stacks && output, "error", ERROR_REPORTS, return 0, err_code, EFAULT);
+
+    *stacks = NULL;
+
+    StackOplogReader reader = {};
+    int attach_status = 0;
+    stack_oplog_attach(&reader, input, &attach_status);
+    _LOG_FAIL_CHECK_(attach_status == 0, "error", ERROR_REPORTS, return 0, err_code, attach_status);
+
+    ReplayState state = {};
+    _LOG_FAIL_CHECK_(replay_state_init(&state, config), "error", ERROR_REPORTS, {
+        stack_oplog_close(&reader);
+        return 0;
+    }, err_code, ENOMEM);
+
+    //* Operations are applied as soon as they arrive, the loop ends when the leader closes the stream or dies.
+    StackOp op = {};
+    int read_status = 0;
+    while (stack_oplog_next(&reader, &op, &read_status)) replay_apply(&state, &op);
+
+    stack_oplog_close(&reader);
+
+    //* Leader that dies while writing a group leaves its last operation incomplete, the operation is dropped.
+    if (read_status) log_printf(WARNINGS, "warning", "Log of the leader was cut short, taking over anyway.\n");
+
+    size_t count = replay_take_over(&state, stacks);
+
+    fprintf(output, "\nFollowed the leader until its log %s.\n", read_status ? "was cut short" : "ended");
+    fprintf(output, "Operations: %lu applied, %lu skipped, stacks attached: %lu\n",
+            (unsigned long)state.operations, (unsigned long)state.skipped, (unsigned long)state.attached);
+    fprintf(output, "Checkpoints: %lu confirmed, %lu mismatched\n",
+            (unsigned long)(state.checks - state.mismatches), (unsigned long)state.mismatches);
+    fprintf(output, "Took over %zu stacks.\n", count);
+
+    uint64_t mismatches = state.mismatches;
+
+    replay_state_destroy(&state);
+
+    _LOG_FAIL_CHECK_(mismatches == 0, "error", ERROR_REPORTS, return count, err_code, EINVAL);
+
+    return count;
+}
+
+static bool replay_state_init(ReplayState* const state, const ReplayConfig* const config) {
+    *state = (ReplayState){};
+    state->config = config;
+
+    state->histograms = (Histogram*) calloc(STACK_OP_COUNT, sizeof(*state->histograms));
+    if (!state->histograms) return false;
+
+    for (int operation = 0; operation < STACK_OP_COUNT; ++operation) {
+        state->histograms[operation] = (Histogram){};
+    }
+
+    return true;
+}
+
+static void replay_state_destroy(ReplayState* const state) {
+    for (size_t handle = 0; handle < state->stack_count; ++handle) {
+        if (state->stacks[handle].stack) ll_stack_dtor(state->stacks[handle].stack);
+    }
+
+    free(state->stacks);
+    free(state->histograms);
+
+    *state = (ReplayState){};
+}
+
+static size_t replay_take_over(ReplayState* const state, ReplicaStack** const stacks) {
+    size_t count = 0;
+    for (size_t handle = 0; handle < state->stack_count; ++handle) {
+        if (state->stacks[handle].stack && !state->stacks[handle].attached) ++count;
+    }
+
+    //* Stacks that are not handed over are destroyed with the state.
+    *stacks = (ReplicaStack*) calloc(count ? count : 1, sizeof(**stacks));
+    if (!*stacks) return 0;
+
+    size_t taken = 0;
+    for (size_t handle = 0; handle < state->stack_count; ++handle) {
+        ReplayStack* stack = state->stacks + handle;
+        if (!stack->stack || stack->attached) continue;
+
+        if (stack->reserved) ll_stack_publish(stack->stack, 0);
+
+        (*stacks)[taken++] = (ReplicaStack){ .handle = (unsigned int)handle, .stack = stack->stack };
+        *stack = (ReplayStack){};
+    }
+
+    return taken;
+}
+
+static bool replay_reserve_slot(ReplayState* const state, const unsigned int handle) {
+    if (handle < state->stack_count) return true;
+
+    size_t new_count = state->stack_count ? state->stack_count : REPLAY_ATTACH_CAPACITY;
+    while (new_count <= handle) new_count *= 2;
+
+    ReplayStack* stacks = (ReplayStack*) realloc(state->stacks, new_count * sizeof(*stacks));
+    if (!stacks) return false;
+
+    memset(stacks + state->stack_count, 0, (new_count - state->stack_count) * sizeof(*stacks));
+    state->stacks = stacks;
+    state->stack_count = new_count;
+    return true;
+}
+
+static void replay_apply(ReplayState* const state, const StackOp* const op) {
+    unsigned int fork_handle = op->op == STACK_OP_FORK ? (unsigned int)op->argument : 0;
+    if (!replay_reserve_slot(state, op->handle) || !replay_reserve_slot(state, fork_handle)) {
+        ++state->skipped;
+        return;
+    }
+
+    ReplayStack* target = state->stacks + op->handle;
+    ReplayStack* fork = state->stacks + fork_handle;
+
+    //* Stacks created before the log was started appear on their first operation.
+    if (!target->stack && op->op != STACK_OP_CTOR && op->op != STACK_OP_ADOPT) {
+        target->stack = ll_stack_ctor(REPLAY_ATTACH_CAPACITY);
+        if (target->stack) ll_stack_set_inline_checks(target->stack, state->config->inline_checks);
+        target->attached = true;
+        ++state->attached;
+    }
+
+    if (!replay_is_valid(state, op)) {
+        ++state->skipped;
+        return;
+    }
+
+    size_t resizes = ll_stack_resize_count(target->stack);
+    ll_stack_content_t* released = NULL;
+
+    uint64_t start_time = clock_ns();
+
+    switch (op->op) {
+        case STACK_OP_CTOR:
+            target->stack = ll_stack_ctor((size_t)op->argument);
+            break;
+        case STACK_OP_DTOR:
+            ll_stack_dtor(target->stack);
+            break;
+        case STACK_OP_PUSH:
+            ll_stack_push(target->stack, op->argument);
+            break;
+        case STACK_OP_POP:
+            ll_stack_pop(target->stack);
+            break;
+        case STACK_OP_PULL:
+            ll_stack_pull(target->stack);
+            break;
+        case STACK_OP_FORK:
+            fork->stack = ll_stack_fork(target->stack);
+            break;
+        case STACK_OP_RESERVE:
+            target->reserved = ll_stack_reserve(target->stack, (size_t)op->argument);
+            target->reserved_count = target->reserved ? (size_t)op->argument : 0;
+            break;
+        case STACK_OP_PUBLISH:
+            if (op->argument) memcpy(target->reserved, op->values, (size_t)op->argument * sizeof(*op->values));
+            ll_stack_publish(target->stack, (size_t)op->argument);
+            break;
+        case STACK_OP_MARK:
+            ll_stack_mark(target->stack);
+            break;
+        case STACK_OP_ROLLBACK:
+            ll_stack_rollback(target->stack, (ll_stack_mark_t)op->argument);
+            break;
+        case STACK_OP_COMMIT:
+            ll_stack_commit(target->stack, (ll_stack_mark_t)op->argument);
+            break;
+        case STACK_OP_ADOPT: {
+            size_t size = (size_t)op->argument;
+            ll_stack_content_t* data = (ll_stack_content_t*) calloc(size ? size : 1, sizeof(*data));
+            if (data && size) memcpy(data, op->values, size * sizeof(*data));
+            target->stack = data ? ll_stack_adopt(data, size, size, true) : NULL;
+            if (!target->stack) free(data);
+            break;
+        }
+        case STACK_OP_RELEASE:
+            released = ll_stack_release(target->stack, NULL);
+            break;
+        case STACK_OP_CHECK:
+            if (ll_stack_content_hash(target->stack) != (ll_stack_hash_t)op->argument) {
+                log_printf(ERROR_REPORTS, "error", "Stack %u differs from the recorded one at its checkpoint.\n",
+                           op->handle);
+                ll_stack_dump(target->stack, ERROR_REPORTS);
+                ++state->mismatches;
+            }
+            ++state->checks;
+            break;
+        default:
+            break;
+    }
+
+    histogram_record(state->histograms + op->op, clock_ns() - start_time);
+    ++state->operations;
+
+    switch (op->op) {
+        case STACK_OP_CTOR:
+        case STACK_OP_ADOPT:
+            if (target->stack) ll_stack_set_inline_checks(target->stack, state->config->inline_checks);
+            target->size = op->op == STACK_OP_ADOPT ? (size_t)op->argument : 0;
+            return;
+        case STACK_OP_RELEASE:
+            //* Shared stacks can not be released, they are destroyed instead.
+            if (released) free(released);
+            else          ll_stack_dtor(target->stack);
+            *target = (ReplayStack){};
+            return;
+        case STACK_OP_DTOR:
+            *target = (ReplayStack){};
+            return;
+        case STACK_OP_FORK:
+            fork->size = fork->stack ? target->size : 0;
+            fork->attached = target->attached;
+            return;
+        case STACK_OP_PUSH:     ++target->size;                       break;
+        case STACK_OP_POP:      --target->size;                       break;
+        case STACK_OP_MARK:     ++target->marks;                      break;
+        case STACK_OP_COMMIT:   --target->marks;                      break;
+        case STACK_OP_ROLLBACK:
+            //* Rollback to a savepoint the stack was popped below fails, but still releases the savepoint.
+            if ((size_t)op->argument <= target->size) target->size = (size_t)op->argument;
+            --target->marks;
+            break;
+        case STACK_OP_PUBLISH:
+            target->size += (size_t)op->argument;
+            target->reserved = NULL;
+            target->reserved_count = 0;
+            break;
+        default:
+            break;
+    }
+
+    state->resizes += ll_stack_resize_count(target->stack) - resizes;
+}
+
+static bool replay_is_valid(const ReplayState* const state, const StackOp* const op) {
+    const ReplayStack* target = state->stacks + op->handle;
+
+    switch (op->op) {
+        case STACK_OP_CTOR:
+        case STACK_OP_ADOPT:
+            return !target->stack && op->argument >= 0;
+        case STACK_OP_POP:
+        case STACK_OP_PULL:
+            return target->stack && target->size;
+        case STACK_OP_FORK:
+            return target->stack && !target->marks && op->argument > 0 &&
+                   !state->stacks[op->argument].stack;
+        case STACK_OP_RESERVE:
+            return target->stack && !target->reserved && op->argument > 0;
+        case STACK_OP_PUBLISH:
+            //* Recorded values are copied into the reserved cells, so there can not be more of them than cells.
+            return target->stack && target->reserved && op->argument >= 0 &&
+                   (size_t)op->argument <= target->reserved_count;
+        case STACK_OP_ROLLBACK:
+            return target->stack && target->marks && 0 <= op->argument;
+        case STACK_OP_COMMIT:
+            return target->stack && target->marks;
+        case STACK_OP_CHECK:
+            return target->stack && !target->attached;
+        default:
+            return target->stack != NULL;
+    }
+}
+
+static void replay_wait(ReplayState* const state, const uint64_t deadline) {
+    uint64_t now = clock_ns();
+
+    if (now >= deadline) {
+        if (now - deadline > state->max_lag) state->max_lag = now - deadline;
+        return;
+    }
+
+    struct timespec wake_time = {
+        .tv_sec = (time_t)(deadline / 1000000000),
+        .tv_nsec = (long)(deadline % 1000000000),
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake_time, NULL) == EINTR) {}
+}
+
+static void replay_report(const ReplayState* const state, const double elapsed, FILE* output) {
+    static const double PERCENTILES[] = {50, 90, 99, 99.9, 99.99};
+
+    uint64_t busy_time = 0;
+    for (int operation = 0; operation < STACK_OP_COUNT; ++operation) {
+        busy_time += state->histograms[operation].sum;
+    }
+
+    fprintf(output, "\nReplayed %s (%s).\n", state->config->filename,
+            state->config->timed ? "original timing" : "full speed");
+    fprintf(output, "Operations: %lu in %.3lf s, throughput: %.0lf ops/s, %.3lf s spent in stack operations\n",
+            (unsigned long)state->operations, elapsed, (double)state->operations / elapsed, (double)busy_time / 1e9);
+    fprintf(output, "Buffer resizes: %lu, stacks attached: %lu, operations skipped: %lu\n",
+            (unsigned long)state->resizes, (unsigned long)state->attached, (unsigned long)state->skipped);
+    if (state->config->timed)
+        fprintf(output, "Biggest lag behind the original timing: %lu ns\n", (unsigned long)state->max_lag);
+    if (state->checks)
+        fprintf(output, "Checkpoints: %lu confirmed, %lu mismatched\n",
+                (unsigned long)(state->checks - state->mismatches), (unsigned long)state->mismatches);
+
+    fprintf(output, "%-10s %12s %10s", "operation", "count", "mean");
+    for (size_t percentile_id = 0; percentile_id < sizeof(PERCENTILES) / sizeof(*PERCENTILES); ++percentile_id) {
+        char title[16] = "";
+        snprintf(title, sizeof(title), "p%g", PERCENTILES[percentile_id]);
+        fprintf(output, " %10s", title);
+    }
+    fprintf(output, " %10s   (latency in ns)\n", "max");
+
+    for (int operation = 0; operation < STACK_OP_COUNT; ++operation) {
+        const Histogram* histogram = state->histograms + operation;
+        if (!histogram->total) continue;
+
+        fprintf(output, "%-10s %12lu %10.0lf", STACK_OP_NAMES[operation],
+                (unsigned long)histogram->total, histogram_mean(histogram));
+        for (size_t percentile_id = 0; percentile_id < sizeof(PERCENTILES) / sizeof(*PERCENTILES); ++percentile_id) {
+            fprintf(output, " %10lu", (unsigned long)histogram_percentile(histogram, PERCENTILES[percentile_id]));
+        }
+        fprintf(output, " %10lu\n", (unsigned long)histogram->max);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,67 @@
+/**
+ * @file stackreplay.h
+ * @author Ilya Kudryashov (kudriashov.it@phystech.edu)
+ * @brief Deterministic replay of operation logs recorded by stackoplog.h and hot-standby replicas following them.
+ * @version 0.1
+ * @date 2022-10-15
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef STACK_REPLAY_H
+#define STACK_REPLAY_H
+
+#include <stdio.h>
+
+/**
+ * @brief Replay settings.
+ *
+ * @param filename name of the operation log
+ * @param timed true to keep the original intervals between operations, false to run at full speed
+ * @param inline_checks true to check stacks before and after every operation
+ */
+struct ReplayConfig {
+    const char* filename = NULL;
+    bool timed = false;
+    bool inline_checks = true;
+};
+
+/**
+ * @brief Re-execute all operations of the log in one thread and print throughput,
+ * number of buffer resizes and latency percentiles of each operation.
+ *
+ * @param config replay settings
+ * @param output stream to print the report into
+ * @param err_code variable to use as errno
+ */
+void replay_run(const ReplayConfig* const config, FILE* output, int* const err_code = NULL);
+
+/**
+ * @brief Stack the follower took over from the leader.
+ *
+ * @param handle id of the stack in the log of the leader
+ * @param stack encrypted pointer to the stack (LLStack), the caller destroys it
+ */
+struct ReplicaStack {
+    unsigned int handle = 0;
+    void* stack = NULL;
+};
+
+/**
+ * @brief Apply operations streamed by the leader (see stack_oplog_stream()) to stacks of this process
+ * until the leader stops or dies, then take the stacks over without any snapshot.
+ * Elements of the stacks are compared with the leader at each of its checkpoints (see ll_stack_checkpoint()).
+ * Reservations the leader did not publish are dropped, stacks created before the stream was started are destroyed.
+ *
+ * @param config replay settings (filename and timed are ignored)
+ * @param input descriptor the log is streamed into, it is closed
+ * @param stacks variable to put the array of taken over stacks into (free() it after destroying the stacks)
+ * @param output stream to print the report into
+ * @param err_code variable to use as errno (EINVAL if a checkpoint did not match)
+ * @return size_t number of taken over stacks
+ */
+size_t replay_follow(const ReplayConfig* const config, const int input, ReplicaStack** const stacks, FILE* output,
+                     int* const err_code = NULL);
+
+#endif
\ No newline at end of file
@@ -22,6 +22,7 @@ enum STACK_STATUSES {
     STACK_BL_CANARY_FAIL = 1 << 5,
     STACK_BR_CANARY_FAIL = 1 << 6,
     STACK_HASH_FAILURE = 1 << 7,
+    STACK_AGGREGATE_FAILURE = 1 << 8,
 };
 
 #endif
\ No newline at end of file
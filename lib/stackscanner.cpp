@@ -0,0 +1,241 @@
+#include "stackscanner.h"
+
+#include <cstdlib>
+#include <pthread.h>
+#include <time.h>
+
+#include "util/clock.h"
+#include "util/dbg/debug.h"
+
+static const size_t SCANNER_RETRY_LIMIT = 8;
+static const size_t REGISTRY_INCREASE = 2;
+
+/**
+ * @brief Element of the registry.
+ *
+ * @param target registered stack
+ * @param pins number of checks of the stack in progress, the stack is not unregistered and its buffers are not
+ * freed while there are any
+ */
+struct RegistryEntry {
+    ScanTarget target = {};
+    unsigned int pins = 0;
+};
+
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t scan_finished = PTHREAD_COND_INITIALIZER;
+static RegistryEntry* registry = NULL;
+static size_t registry_size = 0;
+static size_t registry_capacity = 0;
+static size_t scans_running = 0;
+
+static pthread_t scanner_thread;
+static bool scanner_running = false;
+static ScannerConfig scanner_config = {};
+
+/**
+ * @brief Main function of the scanner thread.
+ *
+ * @param argument unused
+ * @return void*
+ */
+static void* scanner_loop(void* argument);
+
+/**
+ * @brief Check registry element with the specified index.
+ *
+ * @param index index of the element
+ * @param config scanner settings
+ * @param status variable to put stack status into
+ * @return false if index is out of registry bounds
+ */
+static bool scan_target(const size_t index, const ScannerConfig* config, stack_report_t* status);
+
+/**
+ * @brief Find registry element of the stack, should be called under the registry lock.
+ *
+ * @param stack stack address
+ * @return RegistryEntry* element, NULL if the stack is not registered
+ */
+static RegistryEntry* find_entry(const void* stack);
+
+/**
+ * @brief Sleep for the specified number of nanoseconds or until the scanner is stopped.
+ *
+ * @param duration sleep duration
+ */
+static void scanner_sleep(long long duration);
+
+void stack_scanner_register(const ScanTarget target, int* const err_code) {
+    _LOG_FAIL_CHECK_(target.stack && target.scan, "error", ERROR_REPORTS, return, err_code, EINVAL);
+
+    pthread_mutex_lock(&registry_mutex);
+
+    if (registry_size == registry_capacity) {
+        size_t new_capacity = registry_capacity * REGISTRY_INCREASE + 1;
+        RegistryEntry* new_registry = (RegistryEntry*) realloc(registry, new_capacity * sizeof(*registry));
+        _LOG_FAIL_CHECK_(new_registry, "error", ERROR_REPORTS, {
+            pthread_mutex_unlock(&registry_mutex);
+            return;
+        }, err_code, ENOMEM);
+
+        registry = new_registry;
+        registry_capacity = new_capacity;
+    }
+
+    registry[registry_size++] = (RegistryEntry){ .target = target, .pins = 0 };
+
+    pthread_mutex_unlock(&registry_mutex);
+}
+
+void stack_scanner_unregister(const void* stack, int* const err_code) {
+    pthread_mutex_lock(&registry_mutex);
+
+    RegistryEntry* entry = find_entry(stack);
+    while (entry && entry->pins) {
+        pthread_cond_wait(&scan_finished, &registry_mutex);
+        entry = find_entry(stack);
+    }
+
+    bool found = entry != NULL;
+    if (found) *entry = registry[--registry_size];
+
+    pthread_mutex_unlock(&registry_mutex);
+
+    _LOG_FAIL_CHECK_(found, "error", ERROR_REPORTS, return, err_code, ENOENT);
+}
+
+void stack_scanner_start(const ScannerConfig config, int* const err_code) {
+    _LOG_FAIL_CHECK_(!scanner_running, "error", ERROR_REPORTS, return, err_code, EALREADY);
+    _LOG_FAIL_CHECK_(config.cpu_budget > 0 && config.cpu_budget <= 1, "error", ERROR_REPORTS, return, err_code, EINVAL);
+
+    scanner_config = config;
+    __atomic_store_n(&scanner_running, true, __ATOMIC_RELEASE);
+
+    int create_status = pthread_create(&scanner_thread, NULL, scanner_loop, NULL);
+    _LOG_FAIL_CHECK_(create_status == 0, "error", ERROR_REPORTS, {
+        __atomic_store_n(&scanner_running, false, __ATOMIC_RELEASE);
+        return;
+    }, err_code, create_status);
+
+    log_printf(STATUS_REPORTS, "status", "Stack scanner started with CPU budget of %.1lf%%.\n",
+               config.cpu_budget * 100);
+}
+
+void stack_scanner_stop(int* const err_code) {
+    _LOG_FAIL_CHECK_(scanner_running, "error", ERROR_REPORTS, return, err_code, ESRCH);
+
+    __atomic_store_n(&scanner_running, false, __ATOMIC_RELEASE);
+    pthread_join(scanner_thread, NULL);
+
+    log_printf(STATUS_REPORTS, "status", "Stack scanner stopped.\n");
+}
+
+size_t stack_scanner_pass(const ScannerConfig config) {
+    size_t failures = 0;
+    stack_report_t status = 0;
+
+    for (size_t index = 0; scan_target(index, &config, &status); ++index) {
+        if (status) ++failures;
+    }
+
+    return failures;
+}
+
+void stack_scanner_lock(const void* stack) {
+    pthread_mutex_lock(&registry_mutex);
+
+    while (scans_running) {
+        const RegistryEntry* entry = stack ? find_entry(stack) : NULL;
+        if (stack && (!entry || !entry->pins)) break;
+
+        pthread_cond_wait(&scan_finished, &registry_mutex);
+    }
+}
+
+void stack_scanner_unlock() {
+    pthread_mutex_unlock(&registry_mutex);
+}
+
+static void* scanner_loop(void* argument) {
+    while (__atomic_load_n(&scanner_running, __ATOMIC_ACQUIRE)) {
+        stack_report_t status = 0;
+
+        for (size_t index = 0; __atomic_load_n(&scanner_running, __ATOMIC_ACQUIRE); ++index) {
+            long long start_time = (long long)clock_ns(CLOCK_THREAD_CPUTIME_ID);
+            if (!scan_target(index, &scanner_config, &status)) break;
+            long long busy_time = (long long)clock_ns(CLOCK_THREAD_CPUTIME_ID) - start_time;
+
+            //* Scanner works for busy_time and rests for the rest of the period, so it spends cpu_budget of the core.
+            scanner_sleep((long long)((double)busy_time * (1.0 / scanner_config.cpu_budget - 1.0)));
+        }
+
+        scanner_sleep((long long)scanner_config.period_ms * 1000000);
+    }
+
+    return NULL;
+}
+
+static bool scan_target(const size_t index, const ScannerConfig* config, stack_report_t* status) {
+    pthread_mutex_lock(&registry_mutex);
+
+    if (index >= registry_size) {
+        pthread_mutex_unlock(&registry_mutex);
+        return false;
+    }
+
+    //* Pinned stack keeps its buffers until the check ends, so other stacks are not blocked during it.
+    ScanTarget target = registry[index].target;
+    ++registry[index].pins;
+    ++scans_running;
+
+    pthread_mutex_unlock(&registry_mutex);
+
+    bool consistent = false;
+    *status = 0;
+    for (size_t attempt = 0; attempt < SCANNER_RETRY_LIMIT && !consistent; ++attempt) {
+        *status = target.scan(target.stack, config->importance, &consistent);
+    }
+
+    pthread_mutex_lock(&registry_mutex);
+
+    //* Other stacks could be unregistered during the check, moving this one to another index.
+    --find_entry(target.stack)->pins;
+    --scans_running;
+    pthread_cond_broadcast(&scan_finished);
+
+    pthread_mutex_unlock(&registry_mutex);
+
+    if (!consistent) {
+        log_printf(STATUS_REPORTS, "status", "Stack %p was busy, skipping the check.\n", target.stack);
+        *status = 0;
+        return true;
+    }
+
+    if (*status) {
+        log_printf(config->importance, "error", "Scanner detected corruption of the stack %p (status %d).\n",
+                   target.stack, *status);
+        if (config->on_failure) config->on_failure(target.stack, *status);
+    }
+
+    return true;
+}
+
+static RegistryEntry* find_entry(const void* stack) {
+    for (size_t index = 0; index < registry_size; ++index) {
+        if (registry[index].target.stack == stack) return registry + index;
+    }
+
+    return NULL;
+}
+
+static void scanner_sleep(long long duration) {
+    static const long long SLEEP_QUANTUM = 10000000;
+
+    while (duration > 0 && __atomic_load_n(&scanner_running, __ATOMIC_ACQUIRE)) {
+        long long quantum = duration < SLEEP_QUANTUM ? duration : SLEEP_QUANTUM;
+        struct timespec pause = { .tv_sec = 0, .tv_nsec = quantum };
+        nanosleep(&pause, NULL);
+        duration -= quantum;
+    }
+}
\ No newline at end of file
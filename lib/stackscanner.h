@@ -0,0 +1,118 @@
+/**
+ * @file stackscanner.h
+ * @author Ilya Kudryashov (kudriashov.it@phystech.edu)
+ * @brief Background integrity scanner for registered stacks.
+ * @version 0.1
+ * @date 2022-10-08
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef STACK_SCANNER_H
+#define STACK_SCANNER_H
+
+#include <cstddef>
+#include "stackreports.h"
+#include "util/dbg/logger.h"
+
+/**
+ * @brief Check stack integrity and dump it on failure.
+ *
+ * @param stack stack to check
+ * @param importance importance of the dump
+ * @param consistent set to false if stack was being modified during the check
+ * @return stack_report_t
+ */
+typedef stack_report_t scan_function_t(const void* stack, int importance, bool* consistent);
+
+/**
+ * @brief Function to call when scanner detects corrupted stack.
+ *
+ * @param stack corrupted stack
+ * @param status stack status at the moment of the check
+ */
+typedef void scan_failure_callback_t(const void* stack, stack_report_t status);
+
+/**
+ * @brief Stack registered in the scanner.
+ *
+ * @param stack stack address
+ * @param scan function to check the stack with
+ */
+struct ScanTarget {
+    const void* stack = NULL;
+    scan_function_t* scan = NULL;
+};
+
+/**
+ * @brief Scanner settings.
+ *
+ * @param cpu_budget part of one core the scanner is allowed to spend on checks
+ * @param period_ms pause between two full passes over the registry
+ * @param importance importance of failure reports
+ * @param on_failure (optional) function to call on each detected failure
+ */
+struct ScannerConfig {
+    double cpu_budget = 0.05;
+    unsigned int period_ms = 100;
+    int importance = ERROR_REPORTS;
+    scan_failure_callback_t* on_failure = NULL;
+};
+
+/**
+ * @brief Add stack to the scanner registry.
+ *
+ * @param target stack and its check function
+ * @param err_code variable to use as errno
+ */
+void stack_scanner_register(const ScanTarget target, int* const err_code = NULL);
+
+/**
+ * @brief Remove stack from the scanner registry.
+ * Waits for the scanner to finish checking the stack if it is being checked.
+ *
+ * @param stack stack address
+ * @param err_code variable to use as errno
+ */
+void stack_scanner_unregister(const void* stack, int* const err_code = NULL);
+
+/**
+ * @brief Start background scanner thread.
+ *
+ * @param config scanner settings
+ * @param err_code variable to use as errno
+ */
+void stack_scanner_start(const ScannerConfig config = {}, int* const err_code = NULL);
+
+/**
+ * @brief Stop background scanner thread and wait for it to exit.
+ *
+ * @param err_code variable to use as errno
+ */
+void stack_scanner_stop(int* const err_code = NULL);
+
+/**
+ * @brief Check every registered stack once in the calling thread.
+ *
+ * @param config scanner settings
+ * @return size_t number of corrupted stacks
+ */
+size_t stack_scanner_pass(const ScannerConfig config = {});
+
+/**
+ * @brief Lock the registry, waiting until the scanner finishes checking the stack.
+ * Buffers of registered stacks should only be freed under this lock.
+ * The stack is not locked while other stacks are checked, so it can still be modified.
+ *
+ * @param stack stack the freed buffer belongs to, NULL for buffers shared between stacks (waits for all checks)
+ */
+void stack_scanner_lock(const void* stack = NULL);
+
+/**
+ * @brief Unlock the registry.
+ *
+ */
+void stack_scanner_unlock();
+
+#endif
\ No newline at end of file
@@ -0,0 +1,151 @@
+#include "stacktrimmer.h"
+
+#include <cstdlib>
+#include <pthread.h>
+#include <time.h>
+
+#include "util/clock.h"
+#include "util/dbg/debug.h"
+
+static const size_t TRIMMER_REGISTRY_INCREASE = 2;
+
+static pthread_mutex_t trimmer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static TrimTarget* trimmer_registry = NULL;
+static size_t trimmer_registry_size = 0;
+static size_t trimmer_registry_capacity = 0;
+
+static pthread_t trimmer_thread;
+static bool trimmer_running = false;
+static TrimmerConfig trimmer_config = {};
+
+/**
+ * @brief Main function of the trimmer thread.
+ *
+ * @param argument unused
+ * @return void*
+ */
+static void* trimmer_loop(void* argument);
+
+/**
+ * @brief Sleep for the specified number of nanoseconds or until the trimmer is stopped.
+ *
+ * @param duration sleep duration
+ */
+static void trimmer_sleep(long long duration);
+
+void stack_trimmer_register(const TrimTarget target, int* const err_code) {
+    _LOG_FAIL_CHECK_(target.stack && target.trim, "error", ERROR_REPORTS, return, err_code, EINVAL);
+
+    pthread_mutex_lock(&trimmer_mutex);
+
+    if (trimmer_registry_size == trimmer_registry_capacity) {
+        size_t new_capacity = trimmer_registry_capacity * TRIMMER_REGISTRY_INCREASE + 1;
+        TrimTarget* new_registry = (TrimTarget*) realloc(trimmer_registry, new_capacity * sizeof(*trimmer_registry));
+        _LOG_FAIL_CHECK_(new_registry, "error", ERROR_REPORTS, {
+            pthread_mutex_unlock(&trimmer_mutex);
+            return;
+        }, err_code, ENOMEM);
+
+        trimmer_registry = new_registry;
+        trimmer_registry_capacity = new_capacity;
+    }
+
+    trimmer_registry[trimmer_registry_size++] = target;
+
+    pthread_mutex_unlock(&trimmer_mutex);
+}
+
+void stack_trimmer_unregister(const void* stack, int* const err_code) {
+    pthread_mutex_lock(&trimmer_mutex);
+
+    size_t index = 0;
+    while (index < trimmer_registry_size && trimmer_registry[index].stack != stack) ++index;
+
+    bool found = index < trimmer_registry_size;
+    if (found) trimmer_registry[index] = trimmer_registry[--trimmer_registry_size];
+
+    pthread_mutex_unlock(&trimmer_mutex);
+
+    _LOG_FAIL_CHECK_(found, "error", ERROR_REPORTS, return, err_code, ENOENT);
+}
+
+void stack_trimmer_start(const TrimmerConfig config, int* const err_code) {
+    _LOG_FAIL_CHECK_(!trimmer_running, "error", ERROR_REPORTS, return, err_code, EALREADY);
+    _LOG_FAIL_CHECK_(config.headroom >= 0, "error", ERROR_REPORTS, return, err_code, EINVAL);
+
+    trimmer_config = config;
+    __atomic_store_n(&trimmer_running, true, __ATOMIC_RELEASE);
+
+    int create_status = pthread_create(&trimmer_thread, NULL, trimmer_loop, NULL);
+    _LOG_FAIL_CHECK_(create_status == 0, "error", ERROR_REPORTS, {
+        __atomic_store_n(&trimmer_running, false, __ATOMIC_RELEASE);
+        return;
+    }, err_code, create_status);
+
+    log_printf(STATUS_REPORTS, "status", "Stack trimmer started, stacks idle for %u ms are trimmed.\n",
+               config.idle_ms);
+}
+
+void stack_trimmer_stop(int* const err_code) {
+    _LOG_FAIL_CHECK_(trimmer_running, "error", ERROR_REPORTS, return, err_code, ESRCH);
+
+    __atomic_store_n(&trimmer_running, false, __ATOMIC_RELEASE);
+    pthread_join(trimmer_thread, NULL);
+
+    log_printf(STATUS_REPORTS, "status", "Stack trimmer stopped.\n");
+}
+
+size_t stack_trimmer_pass(const TrimmerConfig config) {
+    size_t freed = 0;
+
+    //* Stacks are trimmed under the registry lock, so they can not be unregistered and destroyed meanwhile.
+    pthread_mutex_lock(&trimmer_mutex);
+
+    long long now = (long long)clock_ns();
+    for (size_t index = 0; index < trimmer_registry_size; ++index) {
+        TrimTarget* target = trimmer_registry + index;
+
+        size_t target_freed = target->trim(target, &config, now);
+        if (target_freed) {
+            log_printf(STATUS_REPORTS, "status", "Trimmed idle stack %p, %zu bytes freed.\n",
+                       target->stack, target_freed);
+        }
+        freed += target_freed;
+    }
+
+    pthread_mutex_unlock(&trimmer_mutex);
+
+    return freed;
+}
+
+size_t stack_trimmer_reclaim(const int group, const size_t needed) {
+    //* Memory is needed right now, so stacks are not required to stay idle for the usual time.
+    TrimmerConfig config = trimmer_config;
+    config.idle_ms = 0;
+
+    size_t freed = stack_trimmer_pass(config);
+
+    log_printf(STATUS_REPORTS, "status", "Trimmer reclaimed %zu of %zu bytes requested for group %d.\n",
+               freed, needed, group);
+    return freed;
+}
+
+static void* trimmer_loop(void* argument) {
+    while (__atomic_load_n(&trimmer_running, __ATOMIC_ACQUIRE)) {
+        stack_trimmer_pass(trimmer_config);
+        trimmer_sleep((long long)trimmer_config.period_ms * 1000000);
+    }
+
+    return NULL;
+}
+
+static void trimmer_sleep(long long duration) {
+    static const long long SLEEP_QUANTUM = 10000000;
+
+    while (duration > 0 && __atomic_load_n(&trimmer_running, __ATOMIC_ACQUIRE)) {
+        long long quantum = duration < SLEEP_QUANTUM ? duration : SLEEP_QUANTUM;
+        struct timespec pause = { .tv_sec = 0, .tv_nsec = quantum };
+        nanosleep(&pause, NULL);
+        duration -= quantum;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,110 @@
+/**
+ * @file stacktrimmer.h
+ * @author Ilya Kudryashov (kudriashov.it@phystech.edu)
+ * @brief Background service that shrinks buffers of stacks that have not been modified for a while.
+ * @version 0.1
+ * @date 2022-10-16
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef STACK_TRIMMER_H
+#define STACK_TRIMMER_H
+
+#include <cstddef>
+
+/**
+ * @brief Trimming policy.
+ *
+ * @param idle_ms time a stack should stay unmodified to be trimmed
+ * @param headroom part of the stack size left as free cells after trimming
+ * @param min_headroom minimum number of free cells left after trimming
+ * @param period_ms pause between two passes over the registry
+ */
+struct TrimmerConfig {
+    unsigned int idle_ms = 1000;
+    double headroom = 0.25;
+    size_t min_headroom = 16;
+    unsigned int period_ms = 100;
+};
+
+struct TrimTarget;
+
+/**
+ * @brief Trim the stack if it has been idle for long enough, skipping it if it is in use.
+ *
+ * @param target registered stack
+ * @param config trimming policy
+ * @param now current time in nanoseconds (CLOCK_MONOTONIC)
+ * @return number of bytes freed
+ */
+typedef size_t trim_function_t(TrimTarget* target, const TrimmerConfig* config, long long now);
+
+/**
+ * @brief Stack registered in the trimmer.
+ *
+ * @param stack stack address
+ * @param trim function to trim the stack with
+ * @param seq modification counter of the stack when the trimmer last looked at it
+ * @param accessed time the stack was last seen in use or modified, 0 if it was not seen yet
+ */
+struct TrimTarget {
+    void* stack = NULL;
+    trim_function_t* trim = NULL;
+    unsigned int seq = 0;
+    long long accessed = 0;
+};
+
+/**
+ * @brief Add stack to the trimmer registry.
+ *
+ * @param target stack and its trim function
+ * @param err_code variable to use as errno
+ */
+void stack_trimmer_register(const TrimTarget target, int* const err_code = NULL);
+
+/**
+ * @brief Remove stack from the trimmer registry.
+ * Waits for the trimmer to finish trimming the stack if it is being trimmed.
+ *
+ * @param stack stack address
+ * @param err_code variable to use as errno
+ */
+void stack_trimmer_unregister(const void* stack, int* const err_code = NULL);
+
+/**
+ * @brief Start background trimmer thread.
+ *
+ * @param config trimming policy
+ * @param err_code variable to use as errno
+ */
+void stack_trimmer_start(const TrimmerConfig config = {}, int* const err_code = NULL);
+
+/**
+ * @brief Stop background trimmer thread and wait for it to exit.
+ *
+ * @param err_code variable to use as errno
+ */
+void stack_trimmer_stop(int* const err_code = NULL);
+
+/**
+ * @brief Look at every registered stack once in the calling thread, trimming idle ones.
+ *
+ * @param config trimming policy
+ * @return size_t number of bytes freed
+ */
+size_t stack_trimmer_pass(const TrimmerConfig config = {});
+
+/**
+ * @brief Trim every registered stack that was not modified since the trimmer last looked at it.
+ * It is the default reclaim function of the memory budget (see stack_budget_set_reclaim()).
+ * Memory of all groups is reclaimed, because trimming any stack also lowers the process-wide usage.
+ *
+ * @param group group the memory is requested for
+ * @param needed number of bytes that do not fit into the budget
+ * @return size_t number of bytes freed
+ */
+size_t stack_trimmer_reclaim(const int group, const size_t needed);
+
+#endif
\ No newline at end of file
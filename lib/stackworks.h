@@ -17,18 +17,32 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <cstring>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include "_stackworks.h"
 
 void stack_init(Stack* const stack, const size_t size, int* const err_code) {
     stack_report_t status = stack_status(stack);
     _LOG_FAIL_CHECK_(!(status & ~(STACK_NULL_CONTENT|STACK_HASH_FAILURE)), "error", ERROR_REPORTS, return, err_code, EINVAL);
 
+    _LOG_FAIL_CHECK_(_stack_charge(stack, _stack_prefix_size() * 2 + size * sizeof(stack_content_t)),
+                     "error", ERROR_REPORTS, return, err_code, MEMORY_BUDGET_ERROR);
+
+    _stack_write_begin(stack);
+
     stack->buffer = _stack_alloc_space(size, err_code);
-    _LOG_FAIL_CHECK_(stack->buffer, "error", ERROR_REPORTS, return, err_code, ENOMEM);
+    _LOG_FAIL_CHECK_(stack->buffer, "error", ERROR_REPORTS, {
+        _stack_charge(stack, 0);
+        _stack_write_end(stack);
+        return;
+    }, err_code, ENOMEM);
     
     stack->capacity = size;
 
-    ON_HASH(stack->_hash = _stack_hash(stack));
+    ON_HASH(_stack_rehash(stack));
+
+    _stack_write_end(stack);
 
     _LOG_FAIL_CHECK_(!stack_status(stack), "error", ERROR_REPORTS, {
         log_printf(ERROR_REPORTS, "error", "Stack %p was invalid after initialization.\n", stack);
@@ -40,29 +54,77 @@ void stack_init(Stack* const stack, const size_t size, int* const err_code) {
 void stack_destroy(Stack* const stack, int* const err_code) {
     _LOG_FAIL_CHECK_(!stack_status(stack), "error", ERROR_REPORTS, return, err_code, EINVAL);
 
-    free(stack->buffer);
+    if (stack->_watched) stack_unwatch(stack);
+    if (stack->_trim) stack_unwatch_idle(stack);
+    if (stack->_aggregates) _stack_drop_aggregates(stack);
+
+    free(stack->_savepoints);
+    stack->_savepoints = NULL;
+    stack->_savepoint_capacity = 0;
+    stack->_marks = 0;
+
+    _stack_write_begin(stack);
+
+    if (stack->_owned) _stack_free_space(stack, stack->buffer, stack->_mapped);
+    _stack_charge(stack, 0);
     stack->buffer = NULL;
+    stack->_mapped = 0;
+    stack->_external = false;
+    stack->_owned = true;
+
+    _stack_release_segment(stack->_prefix);
+    stack->_prefix = NULL;
 
     stack->size = 0;
     stack->capacity = 0;
 
-    ON_HASH(stack->_hash = 0);
+    ON_HASH({
+        _stack_free_space(stack, (char*)stack->_blocks);
+        stack->_blocks = NULL;
+        stack->_block_count = 0;
+        stack->_digest = 0;
+        stack->_hash = 0;
+    })
+
+    _stack_write_end(stack);
 }
 
 void stack_push(Stack* const stack, const stack_content_t value, int* const err_code) {
-    _LOG_FAIL_CHECK_(!stack_status(stack), "error", ERROR_REPORTS, return, err_code, EINVAL);
+    TRACE_SCOPE("stack_push");
+
+    _LOG_FAIL_CHECK_(!_stack_inline_status(stack), "error", ERROR_REPORTS, return, err_code, EINVAL);
 
+    //* Full packed stack compresses its bottom block instead of growing, the push succeeds even if that fails.
+    ON_INTEGER(if (stack->_packed && stack->size >= 2 * STACK_PACK_BLOCK && !stack->_marks && !stack->_reserved)
+                   _stack_pack(stack);)
+
+    //* Element must not be written if the buffer could not grow (out of memory or over the budget).
     if (stack->capacity < stack->size + 1) {
-        _stack_change_size(stack, stack->capacity * STACK_BUFFER_INCREASE + 1, err_code);
+        int resize_status = 0;
+        _stack_change_size(stack, stack->capacity * STACK_BUFFER_INCREASE + 1, &resize_status);
+        _LOG_FAIL_CHECK_(stack->capacity >= stack->size + 1, "error", ERROR_REPORTS, return, err_code, resize_status);
+    }
+
+    //* Same for the aggregate array.
+    if (stack->_aggregates) {
+        int aggregate_status = 0;
+        _stack_aggregate_fit(stack, stack->size + 1, &aggregate_status);
+        _LOG_FAIL_CHECK_(aggregate_status == 0, "error", ERROR_REPORTS, return, err_code, aggregate_status);
     }
 
+    _stack_write_begin(stack);
+
+    if (stack->_aggregates) _stack_aggregate_write(stack, stack->size, &value, 1);
+
     _stack_content(stack)[stack->size] = value;
 
     ++stack->size;
 
-    ON_HASH(stack->_hash = _stack_hash(stack));
+    ON_HASH(_stack_update_hash(stack, stack->size - 1, stack->size));
 
-    _LOG_FAIL_CHECK_(!stack_status(stack), "error", ERROR_REPORTS, {
+    _stack_write_end(stack);
+
+    _LOG_FAIL_CHECK_(!_stack_inline_status(stack), "error", ERROR_REPORTS, {
         log_printf(ERROR_REPORTS, "error", "Stack %p was invalid after push.\n", stack);
         stack_dump(stack, ERROR_REPORTS);
         return;
@@ -70,59 +132,569 @@ void stack_push(Stack* const stack, const stack_content_t value, int* const err_
 }
 
 void stack_pop(Stack* const stack, int* const err_code) {
-    _LOG_FAIL_CHECK_(!stack_status(stack), "error", ERROR_REPORTS, return, err_code, EINVAL);
+    TRACE_SCOPE("stack_pop");
+
+    _LOG_FAIL_CHECK_(!_stack_inline_status(stack), "error", ERROR_REPORTS, return, err_code, EINVAL);
+
+    if (!stack->size && stack->_prefix) {
+        int unshare_status = 0;
+        _stack_unshare(stack, &unshare_status);
+        _LOG_FAIL_CHECK_(unshare_status == 0, "error", ERROR_REPORTS, return, err_code, unshare_status);
+    }
+
     _LOG_FAIL_CHECK_(stack->size, "error", ERROR_REPORTS, return, err_code, ENXIO);
 
-    if (stack->size * STACK_BUFFER_INCREASE * STACK_BUFFER_INCREASE < stack->capacity) {
+    if (!stack->_marks && stack->size * STACK_BUFFER_INCREASE * STACK_BUFFER_INCREASE < stack->capacity) {
         _stack_change_size(stack, stack->capacity / STACK_BUFFER_INCREASE + 1, err_code);
     }
 
+    _stack_write_begin(stack);
+
     _stack_content(stack)[stack->size - 1] = STACK_CONTENT_POISON;
     --stack->size;
 
-    ON_HASH(stack->_hash = _stack_hash(stack));
+    ON_HASH(_stack_update_hash(stack, stack->size, stack->size + 1));
 
-    _LOG_FAIL_CHECK_(!stack_status(stack), "error", ERROR_REPORTS, {
+    _stack_write_end(stack);
+
+    _LOG_FAIL_CHECK_(!_stack_inline_status(stack), "error", ERROR_REPORTS, {
         log_printf(ERROR_REPORTS, "error", "Stack %p was invalid after pop.\n", stack);
         stack_dump(stack, ERROR_REPORTS);
         return;
     }, err_code, EAGAIN);
 }
 
+void stack_fork(Stack* const source, Stack* const fork, int* const err_code) {
+    _LOG_FAIL_CHECK_(!_stack_inline_status(source), "error", ERROR_REPORTS, return, err_code, EINVAL);
+    //* Reserved cells are still written by the caller and an open batch has not rehashed its cells yet,
+    //* so neither can be frozen into a shared segment.
+    _LOG_FAIL_CHECK_(!source->_batch && !source->_marks && !source->_reserved,
+                     "error", ERROR_REPORTS, return, err_code, EBUSY);
+
+    if (source->size) {
+        int freeze_status = 0;
+        _stack_freeze(source, &freeze_status);
+        _LOG_FAIL_CHECK_(freeze_status == 0, "error", ERROR_REPORTS, return, err_code, freeze_status);
+    }
+
+    fork->_group = source->_group;
+
+    int init_status = 0;
+    stack_init(fork, STACK_FORK_CAPACITY, &init_status);
+    _LOG_FAIL_CHECK_(init_status == 0, "error", ERROR_REPORTS, return, err_code, init_status);
+
+    if (source->_prefix) __atomic_add_fetch(&source->_prefix->refs, 1, __ATOMIC_RELAXED);
+
+    _stack_write_begin(fork);
+
+    fork->_prefix = source->_prefix;
+    fork->_inline_checks = source->_inline_checks;
+    fork->_packed = source->_packed;
+
+    ON_HASH(_stack_update_header_hash(fork));
+
+    _stack_write_end(fork);
+
+    //* Aggregates of the shared elements are kept in the segment, the fork only needs room for its own ones.
+    if (source->_aggregates) {
+        int aggregate_status = 0;
+        _stack_aggregate_resize(fork, STACK_FORK_CAPACITY, &aggregate_status);
+        _LOG_FAIL_CHECK_(aggregate_status == 0, "error", ERROR_REPORTS, {
+            stack_destroy(fork);
+            return;
+        }, err_code, aggregate_status);
+    }
+}
+
+stack_content_t* stack_reserve(Stack* const stack, const size_t count, int* const err_code) {
+    _LOG_FAIL_CHECK_(!_stack_inline_status(stack), "error", ERROR_REPORTS, return NULL, err_code, EINVAL);
+    _LOG_FAIL_CHECK_(!stack->_reserved, "error", ERROR_REPORTS, return NULL, err_code, EBUSY);
+    _LOG_FAIL_CHECK_(count, "error", ERROR_REPORTS, return NULL, err_code, EINVAL);
+
+    if (stack->capacity < stack->size + count) {
+        size_t new_capacity = stack->capacity * STACK_BUFFER_INCREASE + 1;
+        if (new_capacity < stack->size + count) new_capacity = stack->size + count;
+
+        int resize_status = 0;
+        _stack_change_size(stack, new_capacity, &resize_status);
+        _LOG_FAIL_CHECK_(resize_status == 0, "error", ERROR_REPORTS, return NULL, err_code, resize_status);
+    }
+
+    //* Room for aggregates of the reserved cells is made now, so publishing them can not fail.
+    if (stack->_aggregates) {
+        int aggregate_status = 0;
+        _stack_aggregate_fit(stack, stack->size + count, &aggregate_status);
+        _LOG_FAIL_CHECK_(aggregate_status == 0, "error", ERROR_REPORTS, return NULL, err_code, aggregate_status);
+    }
+
+    //* The write section stays open until publish, so the scanner does not see half-written cells.
+    _stack_write_begin(stack);
+
+    stack->_reserved = count;
+    return _stack_content(stack) + stack->size;
+}
+
+void stack_publish(Stack* const stack, const size_t written, int* const err_code) {
+    _LOG_FAIL_CHECK_(check_ptr(stack), "error", ERROR_REPORTS, return, err_code, EINVAL);
+    _LOG_FAIL_CHECK_(stack->_reserved, "error", ERROR_REPORTS, return, err_code, ENOENT);
+    _LOG_FAIL_CHECK_(written <= stack->_reserved, "error", ERROR_REPORTS, return, err_code, ERANGE);
+
+    stack_content_t* content = _stack_content(stack);
+    ON_HASH(size_t old_size = stack->size;)
+
+    if (stack->_aggregates) _stack_aggregate_write(stack, stack->size, content + stack->size, written);
+
+    for (size_t index = stack->size + written; index < stack->size + stack->_reserved; ++index) {
+        content[index] = STACK_CONTENT_POISON;
+    }
+    stack->size += written;
+
+    //* Only blocks covering the reservation are rehashed.
+    ON_HASH(_stack_update_hash(stack, old_size, old_size + stack->_reserved));
+
+    stack->_reserved = 0;
+
+    _stack_write_end(stack);
+
+    _LOG_FAIL_CHECK_(!_stack_inline_status(stack), "error", ERROR_REPORTS, {
+        log_printf(ERROR_REPORTS, "error", "Stack %p was invalid after publish.\n", stack);
+        stack_dump(stack, ERROR_REPORTS);
+        return;
+    }, err_code, EAGAIN);
+}
+
+const stack_content_t* stack_read_top(Stack* const stack, const size_t count, int* const err_code) {
+    _LOG_FAIL_CHECK_(!_stack_inline_status(stack), "error", ERROR_REPORTS, return NULL, err_code, EINVAL);
+    _LOG_FAIL_CHECK_(count <= stack->size, "error", ERROR_REPORTS, return NULL, err_code, ERANGE);
+
+    return _stack_content(stack) + stack->size - count;
+}
+
+StackView stack_view(const Stack* const stack, int* const err_code) {
+    _LOG_FAIL_CHECK_(!_stack_inline_status(stack), "error", ERROR_REPORTS, return StackView{}, err_code, EINVAL);
+
+    return (StackView){
+        .stack = stack,
+        .begin = _stack_content(stack),
+        .end = _stack_content(stack) + stack->size,
+        .seq = __atomic_load_n(&stack->_seq, __ATOMIC_ACQUIRE),
+    };
+}
+
+stack_content_t stack_view_at(const StackView* const view, const size_t index, int* const err_code) {
+    _LOG_FAIL_CHECK_(view && view->stack, "error", ERROR_REPORTS, return STACK_CONTENT_POISON, err_code, EFAULT);
+    _LOG_FAIL_CHECK_(__atomic_load_n(&view->stack->_seq, __ATOMIC_ACQUIRE) == view->seq,
+                     "error", ERROR_REPORTS, return STACK_CONTENT_POISON, err_code, ESTALE);
+    _LOG_FAIL_CHECK_(index < (size_t)(view->end - view->begin), 
+                     "error", ERROR_REPORTS, return STACK_CONTENT_POISON, err_code, ERANGE);
+
+    return view->begin[index];
+}
+
+void stack_adopt(Stack* const stack, stack_content_t* const data, const size_t size, const size_t capacity,
+                 const bool owned, int* const err_code) {
+    stack_report_t status = stack_status(stack);
+    _LOG_FAIL_CHECK_(!(status & ~(STACK_NULL_CONTENT|STACK_HASH_FAILURE)), "error", ERROR_REPORTS, return, err_code, EINVAL);
+    _LOG_FAIL_CHECK_(data && size <= capacity, "error", ERROR_REPORTS, return, err_code, EINVAL);
+
+    //* Free cells have to be poisoned for the hash to be the same as for a buffer filled by pushes.
+    for (size_t index = size; index < capacity; ++index) {
+        data[index] = STACK_CONTENT_POISON;
+    }
+
+    _stack_write_begin(stack);
+
+    stack->buffer = (char*)data;
+    stack->size = size;
+    stack->capacity = capacity;
+    stack->_external = true;
+    stack->_owned = owned;
+
+    ON_HASH(_stack_rehash(stack));
+
+    _stack_write_end(stack);
+
+    _LOG_FAIL_CHECK_(!stack_status(stack), "error", ERROR_REPORTS, {
+        log_printf(ERROR_REPORTS, "error", "Stack %p was invalid after adoption.\n", stack);
+        stack_dump(stack, ERROR_REPORTS);
+        return;
+    }, err_code, EAGAIN);
+}
+
+stack_content_t* stack_release(Stack* const stack, size_t* const size, int* const err_code) {
+    _LOG_FAIL_CHECK_(!stack_status(stack), "error", ERROR_REPORTS, return NULL, err_code, EINVAL);
+    _LOG_FAIL_CHECK_(!stack->_prefix && !stack->_marks && !stack->_reserved, 
+                     "error", ERROR_REPORTS, return NULL, err_code, EBUSY);
+
+    if (stack->_watched) stack_unwatch(stack);
+    if (stack->_trim) stack_unwatch_idle(stack);
+    if (stack->_aggregates) _stack_drop_aggregates(stack);
+
+    stack_content_t* data = _stack_content(stack);
+    if (size) *size = stack->size;
+
+    _stack_write_begin(stack);
+
+    //* Own buffer is returned without the left canary, so the caller can free() it.
+    //* Mapped buffers can not be passed to free(), so their elements are copied.
+    if (stack->_mapped) {
+        stack_content_t* copy = (stack_content_t*)calloc(stack->size ? stack->size : 1, sizeof(stack_content_t));
+        _LOG_FAIL_CHECK_(copy, "error", ERROR_REPORTS, {
+            _stack_write_end(stack);
+            return NULL;
+        }, err_code, ENOMEM);
+
+        memcpy(copy, data, stack->size * sizeof(stack_content_t));
+        _stack_free_space(stack, stack->buffer, stack->_mapped);
+        data = copy;
+    } else if (!stack->_external) {
+        memmove(stack->buffer, data, stack->size * sizeof(stack_content_t));
+        data = (stack_content_t*)stack->buffer;
+    }
+
+    stack->buffer = NULL;
+    stack->size = 0;
+    stack->capacity = 0;
+    stack->_external = false;
+    stack->_owned = true;
+    stack->_mapped = 0;
+
+    //* Released elements belong to the caller now.
+    _stack_charge(stack, 0);
+
+    ON_HASH({
+        _stack_free_space(stack, (char*)stack->_blocks);
+        stack->_blocks = NULL;
+        stack->_block_count = 0;
+        stack->_digest = 0;
+        stack->_hash = 0;
+    })
+
+    _stack_write_end(stack);
+
+    return data;
+}
+
+uintptr_t stack_size(const Stack* const stack) {
+    return stack->size + (stack->_prefix ? stack->_prefix->depth : 0);
+}
+
+stack_mark_t stack_mark(Stack* const stack, int* const err_code) {
+    _LOG_FAIL_CHECK_(!_stack_inline_status(stack), "error", ERROR_REPORTS, return 0, err_code, EINVAL);
+    _LOG_FAIL_CHECK_(!stack->_reserved, "error", ERROR_REPORTS, return 0, err_code, EBUSY);
+
+    if (stack->_marks == stack->_savepoint_capacity) {
+        unsigned int capacity = stack->_savepoint_capacity ? stack->_savepoint_capacity * 2 : STACK_SAVEPOINT_CAPACITY;
+
+        stack_mark_t* savepoints = (stack_mark_t*) realloc(stack->_savepoints, capacity * sizeof(*savepoints));
+        _LOG_FAIL_CHECK_(savepoints, "error", ERROR_REPORTS, return 0, err_code, ENOMEM);
+
+        stack->_savepoints = savepoints;
+        stack->_savepoint_capacity = capacity;
+    }
+
+    stack_mark_t mark = stack_size(stack);
+    stack->_savepoints[stack->_marks++] = mark;
+    return mark;
+}
+
+void stack_rollback(Stack* const stack, const stack_mark_t mark, int* const err_code) {
+    _LOG_FAIL_CHECK_(!_stack_inline_status(stack), "error", ERROR_REPORTS, return, err_code, EINVAL);
+    _LOG_FAIL_CHECK_(stack->_marks, "error", ERROR_REPORTS, return, err_code, ENOENT);
+    _LOG_FAIL_CHECK_(mark == stack->_savepoints[stack->_marks - 1], "error", ERROR_REPORTS, return, err_code, ERANGE);
+
+    //* Forking is forbidden while marks are held, so savepoints never point into shared segments.
+    //* Savepoint the stack was popped below can not be rolled back to, but it is still released.
+    uintptr_t depth = stack->_prefix ? stack->_prefix->depth : 0;
+    _LOG_FAIL_CHECK_(depth <= mark && mark - depth <= stack->size, "error", ERROR_REPORTS, {
+        --stack->_marks;
+        return;
+    }, err_code, ERANGE);
+    size_t new_size = mark - depth;
+
+    _stack_write_begin(stack);
+
+    stack_content_t* content = _stack_content(stack);
+    ON_HASH(size_t old_size = stack->size;)
+
+    for (size_t index = new_size; index < stack->size; ++index) {
+        content[index] = STACK_CONTENT_POISON;
+    }
+    stack->size = new_size;
+
+    //* Only blocks covering the discarded range are rehashed instead of the whole buffer.
+    ON_HASH(_stack_update_hash(stack, new_size, old_size));
+
+    --stack->_marks;
+
+    _stack_write_end(stack);
+
+    _LOG_FAIL_CHECK_(!_stack_inline_status(stack), "error", ERROR_REPORTS, {
+        log_printf(ERROR_REPORTS, "error", "Stack %p was invalid after rollback.\n", stack);
+        stack_dump(stack, ERROR_REPORTS);
+        return;
+    }, err_code, EAGAIN);
+}
+
+void stack_commit(Stack* const stack, const stack_mark_t mark, int* const err_code) {
+    _LOG_FAIL_CHECK_(!_stack_inline_status(stack), "error", ERROR_REPORTS, return, err_code, EINVAL);
+    _LOG_FAIL_CHECK_(!stack->_reserved, "error", ERROR_REPORTS, return, err_code, EBUSY);
+    _LOG_FAIL_CHECK_(stack->_marks, "error", ERROR_REPORTS, return, err_code, ENOENT);
+    _LOG_FAIL_CHECK_(mark == stack->_savepoints[stack->_marks - 1], "error", ERROR_REPORTS, return, err_code, ERANGE);
+
+    --stack->_marks;
+}
+
 stack_content_t stack_get(Stack* const stack, int* const err_code) {
-    _LOG_FAIL_CHECK_(!stack_status(stack), "error", ERROR_REPORTS, return STACK_CONTENT_POISON, err_code, EINVAL);
+    _LOG_FAIL_CHECK_(!_stack_inline_status(stack), "error", ERROR_REPORTS, return STACK_CONTENT_POISON, err_code, EINVAL);
+
+    if (!stack->size && stack->_prefix) {
+        const StackSegment* segment = stack->_prefix;
+        if (segment->packed) return segment->top;
+        return ((const stack_content_t*)(segment->buffer + _stack_prefix_size()))[segment->size - 1];
+    }
+
     return _stack_content(stack)[stack->size - 1];
 }
 
 stack_report_t stack_status(const Stack* const stack) {
+    return _stack_status(stack, true);
+}
+
+stack_report_t _stack_status(const Stack* const stack, const bool segments) {
+    TRACE_SCOPE("stack_status");
+
     stack_report_t status = 0;
 
     if (check_ptr(stack) == false) return STACK_NULL;
 
     ON_CANARY(if (stack->size > stack->capacity) status |= STACK_BIG_SIZE);
 
-    if (check_ptr(stack->buffer) == false) status |= STACK_NULL_CONTENT;
+    bool readable = check_ptr(stack->buffer);
+    if (!readable) status |= STACK_NULL_CONTENT;
 
     ON_CANARY({
         if (!stack_check_canary(stack->_canary_left))  status |= STACK_L_CANARY_FAIL;
         if (!stack_check_canary(stack->_canary_right)) status |= STACK_R_CANARY_FAIL;
 
-        if (check_ptr(stack->buffer) && !stack_check_canary(stack->buffer))
+        //* Buffers provided by the caller have no room for canaries.
+        bool framed = !stack->_external && readable;
+        if (framed && !stack_check_canary(stack->buffer))
             status |= STACK_BL_CANARY_FAIL;
-        if (check_ptr(stack->buffer) && !stack_check_canary((char*)(_stack_content(stack) + stack->capacity)))
+        if (framed && !stack_check_canary((char*)(_stack_content(stack) + stack->capacity)))
             status |= STACK_BR_CANARY_FAIL;
     })
 
     ON_HASH(if (stack->_hash != _stack_hash(stack)) status |= STACK_HASH_FAILURE);
 
+    if (stack->_prefix && segments) status |= _stack_prefix_status(stack);
+
+    //* Aggregates are recalculated from the elements, which are themselves covered by the hash.
+    if (stack->_aggregates && readable && stack->size <= stack->capacity && !_stack_aggregate_match(stack))
+        status |= STACK_AGGREGATE_FAILURE;
+
+    return status;
+}
+
+stack_report_t stack_scan_status(const Stack* const stack, Stack* const snapshot, bool* const consistent) {
+    *consistent = false;
+
+    if (check_ptr(stack) == false) {
+        *consistent = true;
+        return STACK_NULL;
+    }
+
+    unsigned int seq_start = __atomic_load_n(&stack->_seq, __ATOMIC_ACQUIRE);
+    if (seq_start & 1) return 0;
+
+    //* Header is copied first, so the buffer pointer and the capacity used for the check belong to the same buffer.
+    memcpy((void*)snapshot, stack, sizeof(*snapshot));
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&stack->_seq, __ATOMIC_RELAXED) != seq_start) return 0;
+
+    stack_report_t status = stack_status(snapshot);
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    *consistent = __atomic_load_n(&stack->_seq, __ATOMIC_RELAXED) == seq_start;
+
     return status;
 }
 
-bool stack_check_canary(const stack_canary_t value) {
-    return !memcmp(value, STACK_CANARY_VALUE, sizeof(stack_canary_t));
+bool stack_scan_dump(const Stack* const stack, const Stack* const snapshot, const int importance) {
+    Stack copy = *snapshot;
+    bool copied = true;
+
+    //* Cells behind the allocation are not copied, the same way stack_dump_stream() does not read them.
+    if (check_ptr(snapshot->buffer)) {
+        if (!snapshot->_external) copy.capacity = _stack_readable_capacity(snapshot);
+
+        size_t length = _stack_buffer_length(&copy);
+        copy.buffer = (char*) malloc(length);
+        if (copy.buffer) memcpy(copy.buffer, snapshot->buffer, length);
+        copied &= copy.buffer || !length;
+    }
+
+    if (check_ptr(snapshot->_aggregates)) {
+        size_t length = snapshot->_aggregate_capacity * sizeof(*copy._aggregates);
+        copy._aggregates = (StackAggregate*) malloc(length);
+        if (copy._aggregates) memcpy(copy._aggregates, snapshot->_aggregates, length);
+        copied &= copy._aggregates || !length;
+    }
+
+    ON_HASH(if (check_ptr(snapshot->_blocks)) {
+        size_t length = snapshot->_block_count * sizeof(*copy._blocks);
+        copy._blocks = (stack_hash_t*) malloc(length);
+        if (copy._blocks) memcpy(copy._blocks, snapshot->_blocks, length);
+        copied &= copy._blocks || !length;
+    })
+
+    //* Buffers could be reused by the writer while they were copied, then the copy is thrown away.
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    bool consistent = __atomic_load_n(&stack->_seq, __ATOMIC_RELAXED) == snapshot->_seq;
+
+    if (consistent && !copied)
+        _log_printf(importance, "dump", "Buffers of the stack %p are too large to copy, it is not dumped.\n", stack);
+    if (consistent && copied) {
+        _log_printf(importance, "dump", "Stack %p failed background check, dumping its snapshot.\n", stack);
+        stack_dump(&copy, importance);
+    }
+
+    if (copy.buffer != snapshot->buffer) free(copy.buffer);
+    if (copy._aggregates != snapshot->_aggregates) free(copy._aggregates);
+    ON_HASH(if (copy._blocks != snapshot->_blocks) free(copy._blocks));
+
+    return consistent;
+}
+
+void stack_set_inline_checks(Stack* const stack, const bool enabled, int* const err_code) {
+    _LOG_FAIL_CHECK_(!stack_status(stack), "error", ERROR_REPORTS, return, err_code, EINVAL);
+    _stack_write_begin(stack);
+    stack->_inline_checks = enabled;
+    ON_HASH(_stack_update_header_hash(stack));
+    _stack_write_end(stack);
+}
+
+void stack_batch_begin(Stack* const stack, int* const err_code) {
+    _LOG_FAIL_CHECK_(!_stack_inline_status(stack), "error", ERROR_REPORTS, return, err_code, EINVAL);
+    _stack_batch_open(stack, err_code);
+}
+
+void stack_batch_end(Stack* const stack, int* const err_code) {
+    if (!_stack_batch_close(stack, err_code)) return;
+
+    _LOG_FAIL_CHECK_(!_stack_inline_status(stack), "error", ERROR_REPORTS, {
+        log_printf(ERROR_REPORTS, "error", "Stack %p was invalid after batch.\n", stack);
+        stack_dump(stack, ERROR_REPORTS);
+        return;
+    }, err_code, EAGAIN);
+}
+
+void stack_scope_begin(Stack* const stack, int* const err_code) {
+    _LOG_FAIL_CHECK_(!stack_status(stack), "error", ERROR_REPORTS, {
+        log_printf(ERROR_REPORTS, "error", "Stack %p was invalid on entry to the checked scope.\n", stack);
+        stack_dump(stack, ERROR_REPORTS);
+        return;
+    }, err_code, EINVAL);
+
+    _stack_batch_open(stack, err_code);
+}
+
+void stack_scope_end(Stack* const stack, int* const err_code) {
+    if (!_stack_batch_close(stack, err_code)) return;
+
+    _LOG_FAIL_CHECK_(!stack_status(stack), "error", ERROR_REPORTS, {
+        log_printf(ERROR_REPORTS, "error", "Stack %p was invalid on exit from the checked scope.\n", stack);
+        stack_dump(stack, ERROR_REPORTS);
+        return;
+    }, err_code, EAGAIN);
+}
+
+void _stack_batch_open(Stack* const stack, int* const err_code) {
+    _LOG_FAIL_CHECK_(!stack->_batch, "error", ERROR_REPORTS, return, err_code, EALREADY);
+    _LOG_FAIL_CHECK_(!stack->_reserved, "error", ERROR_REPORTS, return, err_code, EBUSY);
+
+    //* The write section stays open for the whole batch, so the scanner does not see the hash lagging behind.
+    _stack_write_begin(stack);
+
+    stack->_batch = true;
+    ON_HASH(stack->_dirty_first = stack->_dirty_last = 0);
+}
+
+bool _stack_batch_close(Stack* const stack, int* const err_code) {
+    _LOG_FAIL_CHECK_(stack, "error", ERROR_REPORTS, return false, err_code, EINVAL);
+    _LOG_FAIL_CHECK_(stack->_batch, "error", ERROR_REPORTS, return false, err_code, ENOENT);
+    _LOG_FAIL_CHECK_(!stack->_reserved, "error", ERROR_REPORTS, return false, err_code, EBUSY);
+
+    stack->_batch = false;
+
+    ON_HASH(if (stack->_dirty_first < stack->_dirty_last) {
+        _stack_update_hash(stack, stack->_dirty_first, stack->_dirty_last);
+    })
+
+    _stack_write_end(stack);
+
+    return true;
+}
+
+void stack_watch(Stack* const stack, scan_function_t* scan, int* const err_code) {
+    _LOG_FAIL_CHECK_(!stack_status(stack), "error", ERROR_REPORTS, return, err_code, EINVAL);
+    _LOG_FAIL_CHECK_(!stack->_watched, "error", ERROR_REPORTS, return, err_code, EALREADY);
+
+    int register_status = 0;
+    stack_scanner_register((ScanTarget){ .stack = stack, .scan = scan }, &register_status);
+    _LOG_FAIL_CHECK_(register_status == 0, "error", ERROR_REPORTS, return, err_code, register_status);
+
+    stack->_watched = true;
+}
+
+void stack_unwatch(Stack* const stack, int* const err_code) {
+    _LOG_FAIL_CHECK_(check_ptr(stack), "error", ERROR_REPORTS, return, err_code, EINVAL);
+    _LOG_FAIL_CHECK_(stack->_watched, "error", ERROR_REPORTS, return, err_code, ENOENT);
+
+    stack_scanner_unregister(stack, err_code);
+    stack->_watched = false;
+}
+
+void stack_watch_idle(Stack* const stack, trim_function_t* trim, int* const err_code) {
+    _LOG_FAIL_CHECK_(!stack_status(stack), "error", ERROR_REPORTS, return, err_code, EINVAL);
+    _LOG_FAIL_CHECK_(!stack->_trim, "error", ERROR_REPORTS, return, err_code, EALREADY);
+
+    int register_status = 0;
+    stack_trimmer_register((TrimTarget){ .stack = stack, .trim = trim, .seq = stack->_seq }, &register_status);
+    _LOG_FAIL_CHECK_(register_status == 0, "error", ERROR_REPORTS, return, err_code, register_status);
+
+    __atomic_store_n(&stack->_trim, STACK_TRIM_FREE, __ATOMIC_RELEASE);
+}
+
+void stack_unwatch_idle(Stack* const stack, int* const err_code) {
+    _LOG_FAIL_CHECK_(check_ptr(stack), "error", ERROR_REPORTS, return, err_code, EINVAL);
+    _LOG_FAIL_CHECK_(stack->_trim, "error", ERROR_REPORTS, return, err_code, ENOENT);
+
+    //* The trimmer does not look at the stack after it is unregistered, so the lock can be dropped.
+    stack_trimmer_unregister(stack, err_code);
+    __atomic_store_n(&stack->_trim, STACK_TRIM_OFF, __ATOMIC_RELEASE);
+}
+
+void stack_trim(Stack* const stack, const size_t headroom, int* const err_code) {
+    TRACE_SCOPE("stack_trim");
+
+    _LOG_FAIL_CHECK_(!_stack_inline_status(stack), "error", ERROR_REPORTS, return, err_code, EINVAL);
+    _LOG_FAIL_CHECK_(!stack->_batch && !stack->_reserved && !stack->_marks, 
+                     "error", ERROR_REPORTS, return, err_code, EBUSY);
+
+    size_t new_capacity = stack->size + headroom;
+    if (!new_capacity) new_capacity = 1;
+
+    if (new_capacity < stack->capacity) _stack_change_size(stack, new_capacity, err_code);
+
+    if (stack->_aggregates && stack->capacity < stack->_aggregate_capacity)
+        _stack_aggregate_resize(stack, stack->capacity, err_code);
 }
 
 void _stack_dump(Stack* const stack, int importance, const char* function, const size_t line, const char* file) {
+    TRACE_SCOPE("_stack_dump");
+
     _log_printf(importance, "dump", " ----- Stack dump in function %s of file %s (%ld): ----- \n", function, file, line);
 
     stack_report_t status = stack_status(stack);
@@ -140,8 +712,39 @@ void _stack_dump(Stack* const stack, int importance, const char* function, const
     ON_CANARY(_log_printf(importance, "dump", "\t\tRight canary = \"%6s\"\n", stack->_canary_right));
     _log_printf(importance, "dump", "\t\tCapacity     = %ld\n", stack->capacity);
     _log_printf(importance, "dump", "\t\tSize         = %ld\n", stack->size);
+    if (stack->_mapped) 
+        _log_printf(importance, "dump", "\t\tMapped       = %ld bytes\n", stack->_mapped);
+    _log_printf(importance, "dump", "\t\tCharged      = %ld bytes to group %d (group: %ld of %ld, process: %ld of %ld)\n",
+                stack->_charged, stack->_group, stack_budget_usage(stack->_group), stack_budget_limit(stack->_group),
+                stack_budget_usage(), stack_budget_limit());
+    if (stack->_prefix) 
+        _log_printf(importance, "dump", "\t\tShared       = %ld (elements in frozen segments below the buffer)\n", 
+                    stack->_prefix->depth);
+    if (stack->_packed) {
+        size_t packed_count = 0, packed_bytes = 0;
+        for (const StackSegment* segment = stack->_prefix; segment; segment = segment->parent) {
+            if (!segment->packed) continue;
+            packed_count += segment->size;
+            packed_bytes += segment->packed;
+        }
+        _log_printf(importance, "dump", "\t\tPacked       = %ld elements in %ld bytes\n", packed_count, packed_bytes);
+    }
+    if (stack->_aggregates) {
+        StackAggregate base = {};
+        const StackAggregate* top = check_ptr(stack->_aggregates) ? _stack_aggregate_top(stack, &base) : NULL;
+        if (top)
+            _log_printf(importance, "dump", "\t\tAggregates   = min %lld, max %lld, sum %lld\n", 
+                        (long long)top->min, (long long)top->max, (long long)top->sum);
+        else
+            _log_printf(importance, "dump", "\t\tAggregates   = tracked at %p for %ld elements, none available\n", 
+                        stack->_aggregates, stack->_aggregate_capacity);
+    }
     _log_printf(importance, "dump", "\t\tBuffer       = %p\n", stack->buffer);
-    _log_printf(importance, "dump", "\t\t\t[----] = \"%6s\"\n", stack->buffer);
+    if (stack->_external) 
+        _log_printf(importance, "dump", "\t\tBuffer was provided by the caller (%s), it has no canaries.\n", 
+                    stack->_owned ? "owned" : "wrapped");
+    else
+        _log_printf(importance, "dump", "\t\t\t[----] = \"%6s\"\n", stack->buffer);
 
     int limit = stack->capacity < STACK_DUMP_MAX_LINES ? 
                 stack->capacity : STACK_DUMP_MAX_LINES;
@@ -150,89 +753,1057 @@ void _stack_dump(Stack* const stack, int importance, const char* function, const
 
     for (int elem_id = 0; elem_id < limit; ++elem_id) {
         stack_content_t* elem_start = _stack_content(stack) + elem_id;
-        char biteline[STACK_BITES_PER_LINE * 9 + 1];
+        char biteline[STACK_DUMP_MAX_BITES * 7 + 1] = "";
         size_t end_index = 0;
 
-        for (int bite_id = 0; bite_id < STACK_BITES_PER_LINE; ++bite_id) {
-            end_index += sprintf(biteline + end_index, "0x%02X ", *((char*)elem_start + bite_id) & 0xff);
-        }
-        for (int bite_id = 0; bite_id < STACK_BITES_PER_LINE; ++bite_id) {
-            char bite = *((char*)elem_start + bite_id);
-            end_index += sprintf(biteline + end_index, "%c ", isprint(bite) ? bite : '.');
-        }
+        end_index += dump_format_hex(biteline + end_index, elem_start, STACK_BITES_PER_LINE, true);
+        end_index += dump_format_ascii(biteline + end_index, elem_start, STACK_BITES_PER_LINE, true);
 
-        biteline[sizeof(biteline) - 1] = '\0';
+        biteline[end_index] = '\0';
 
         _log_printf(importance, "dump", "\t\t\t[%04d] = (%-6s) at %p: %s\n", elem_id,
             *elem_start == STACK_CONTENT_POISON ? "POISON" : "VALUE", _stack_content(stack) + elem_id, biteline);
     }
 
-    _log_printf(importance, "dump", "\t\t\t[####] = \"%6s\"\n", 
-                (char*)(_stack_content(stack) + stack->capacity));
+    if (!stack->_external)
+        _log_printf(importance, "dump", "\t\t\t[####] = \"%6s\"\n", 
+                    (char*)(_stack_content(stack) + stack->capacity));
     ON_HASH(_log_printf(importance, "dump", "\t\tHash      = %ld\n", stack->_hash));
     ON_HASH(_log_printf(importance, "dump", "\t\tEst. hash = %ld\n", _stack_hash(stack)));
-}
-
-void _stack_change_size(Stack* const stack, const size_t new_size, int* const err_code) {
-    _LOG_FAIL_CHECK_(!stack_status(stack), "error", ERROR_REPORTS, return, err_code, EINVAL);
 
-    char* new_buffer = _stack_alloc_space(new_size, err_code);
-    _LOG_FAIL_CHECK_(new_buffer, "error", ERROR_REPORTS, return, err_code, ENOMEM);
+    //* Each block is compared with its own checksum to tell where exactly the buffer was damaged.
+    ON_HASH(if (check_ptr(stack->buffer) && check_ptr(stack->_blocks) && stack->_hash != _stack_hash(stack)) {
+        size_t length = _stack_buffer_length(stack);
+        size_t corrupt_count = 0;
 
-    size_t copy_size = new_size < stack->capacity ? new_size : stack->capacity;
-    memcpy(new_buffer, stack->buffer, copy_size * sizeof(stack_content_t) + ((char*)_stack_content(stack) - stack->buffer));
+        for (size_t block_start = 0, block = 0; block_start < length; block_start += STACK_HASH_BLOCK, ++block) {
+            size_t block_end = block_start + STACK_HASH_BLOCK < length ? block_start + STACK_HASH_BLOCK : length;
+            if (block >= stack->_block_count || 
+                stack->_blocks[block] == get_hash_part(stack->buffer + block_start, stack->buffer + block_end)) continue;
 
-    free(stack->buffer);
-    stack->buffer = new_buffer;
-    stack->capacity = new_size;
+            size_t offset = _stack_buffer_offset(stack);
+            size_t first_element = block_start > offset ? (block_start - offset) / sizeof(stack_content_t) : 0;
+            size_t last_element = block_end - offset > stack->capacity * sizeof(stack_content_t) ? stack->capacity : 
+                                  (block_end - offset + sizeof(stack_content_t) - 1) / sizeof(stack_content_t);
 
-    ON_HASH(stack->_hash = _stack_hash(stack));
+            _log_printf(importance, "dump", "\t\tBlock %ld (bytes %ld-%ld, elements %ld-%ld) is corrupt.\n", block, 
+                        block_start, block_end - 1, first_element, last_element - 1);
+            ++corrupt_count;
+        }
 
-    
-    _LOG_FAIL_CHECK_(!stack_status(stack), "error", ERROR_REPORTS, {
-        log_printf(ERROR_REPORTS, "error", "Stack %p was invalid after size change.\n", stack);
-        stack_dump(stack, ERROR_REPORTS);
-        return;
-    }, err_code, EAGAIN);
+        if (!corrupt_count) 
+            _log_printf(importance, "dump", "\t\tAll blocks match their checksums, stack header is corrupt.\n");
+    })
 }
 
-char* _stack_alloc_space(const size_t count, int* const err_code) {
-    size_t prefix_size = sizeof(stack_canary_t) + 
-        (alignof(stack_content_t) - sizeof(stack_canary_t) % alignof(stack_content_t)) % sizeof(stack_content_t);
-    size_t buffer_size = prefix_size * 2 + sizeof(stack_content_t) * count;
-                                    /* ^-- two canaries */
+void stack_dump_stream(const Stack* const stack, StackDumpStream* const stream, const int mode, int* const err_code) {
+    StackDumpSource source = {};
 
-    char* buffer = (char*)calloc(buffer_size, sizeof(char));
-    _LOG_FAIL_CHECK_(buffer, "error", ERROR_REPORTS, return NULL, err_code, ENOMEM);
+    source.address = stack;
+    source.status = stack_status(stack);
+    source.element_size = sizeof(stack_content_t);
+    source.poison = &STACK_CONTENT_POISON;
 
-    strncpy(buffer,                             STACK_CANARY_VALUE, sizeof(stack_canary_t));
-    strncpy(buffer + buffer_size - prefix_size, STACK_CANARY_VALUE, sizeof(stack_canary_t));
+    stack_content_t* gathered = NULL;
 
-    stack_content_t* beginning = (stack_content_t*)(buffer + prefix_size);
-    for (size_t id = 0; id < count; ++id) {
-        *(beginning + id) = STACK_CONTENT_POISON;
+    if (!(source.status & (STACK_NULL | STACK_NULL_CONTENT))) {
+        source.content = (const char*)_stack_content(stack);
+        source.size = stack->size;
+        source.capacity = stack->capacity;
+        ON_HASH(source.hash = stack->_hash);
+
+        //* Capacity is not trusted once the size ran past it or the cell behind the buffer was overwritten.
+        if (source.status & (STACK_BIG_SIZE | STACK_BR_CANARY_FAIL) && !stack->_external)
+            source.capacity = _stack_readable_capacity(stack);
+
+        if (stack->_prefix) gathered = _stack_dump_gather(stack, &source);
     }
 
-    return buffer;
+    dump_stream_write(stream, &source, mode, err_code);
+
+    free(gathered);
 }
 
-stack_content_t* _stack_content(const Stack* const stack) {
-    size_t prefix_size = sizeof(stack_canary_t) + 
-        (alignof(stack_content_t) - sizeof(stack_canary_t) % alignof(stack_content_t)) % sizeof(stack_content_t);
-    return (stack_content_t*)(stack->buffer + prefix_size);
+stack_content_t* _stack_dump_gather(const Stack* const stack, StackDumpSource* const source) {
+    //* Segment headers are not hashed, so they are checked against each other before anything is read.
+    if (_stack_prefix_status(stack)) return NULL;
+    for (const StackSegment* segment = stack->_prefix; segment; segment = segment->parent) {
+        if (segment->size > segment->capacity || 
+            segment->depth != segment->size + (segment->parent ? segment->parent->depth : 0)) return NULL;
+    }
+
+    size_t depth = stack->_prefix->depth;
+    stack_content_t* gathered = (stack_content_t*) calloc(depth + source->capacity, sizeof(*gathered));
+    if (!gathered) return NULL;
+
+    StackChunk chunk;
+    while (_stack_next_chunk(stack, &chunk)) {
+        if (!chunk.segment) continue;
+        memcpy(gathered + chunk.segment->depth - chunk.count, chunk.values, chunk.count * sizeof(*gathered));
+    }
+
+    memcpy(gathered + depth, source->content, source->capacity * sizeof(*gathered));
+
+    source->content = (const char*)gathered;
+    source->size += depth;
+    source->capacity += depth;
+
+    return gathered;
+}
+
+size_t _stack_readable_capacity(const Stack* const stack) {
+    size_t frame = _stack_prefix_size() * 2;
+    size_t length = stack->_mapped ? stack->_mapped : stack->_charged;
+    size_t readable = length > frame ? (length - frame) / sizeof(stack_content_t) : 0;
+
+    return readable < stack->capacity ? readable : stack->capacity;
+}
+
+void _stack_change_size(Stack* const stack, const size_t new_size, int* const err_code) {
+    TRACE_SCOPE("_stack_change_size");
+
+    _LOG_FAIL_CHECK_(!_stack_inline_status(stack), "error", ERROR_REPORTS, return, err_code, EINVAL);
+
+    //* Big buffers are mapped, so they can be resized in place without copying.
+    size_t new_length = _stack_prefix_size() * 2 + new_size * sizeof(stack_content_t);
+    if (new_length >= (stack->_mapped ? STACK_UNMAP_THRESHOLD : STACK_MMAP_THRESHOLD)) {
+        _stack_remap(stack, new_size, err_code);
+
+        _LOG_FAIL_CHECK_(!_stack_inline_status(stack), "error", ERROR_REPORTS, {
+            log_printf(ERROR_REPORTS, "error", "Stack %p was invalid after size change.\n", stack);
+            stack_dump(stack, ERROR_REPORTS);
+            return;
+        }, err_code, EAGAIN);
+        return;
+    }
+
+    size_t old_charge = stack->_charged;
+    _LOG_FAIL_CHECK_(_stack_charge(stack, new_length), "error", ERROR_REPORTS, return, err_code, MEMORY_BUDGET_ERROR);
+
+    char* new_buffer = _stack_alloc_space(new_size, err_code);
+    _LOG_FAIL_CHECK_(new_buffer, "error", ERROR_REPORTS, {
+        _stack_charge(stack, old_charge, true);
+        return;
+    }, err_code, ENOMEM);
+
+    size_t copy_size = new_size < stack->capacity ? new_size : stack->capacity;
+    memcpy(new_buffer + _stack_prefix_size(), _stack_content(stack), copy_size * sizeof(stack_content_t));
+
+    char* old_buffer = stack->buffer;
+    size_t old_mapped = stack->_mapped;
+    bool old_owned = stack->_owned;
+
+    _stack_write_begin(stack);
+
+    stack->buffer = new_buffer;
+    stack->capacity = new_size;
+    stack->_mapped = 0;
+    stack->_external = false;
+    stack->_owned = true;
+    ++stack->_resizes;
+
+    ON_HASH(_stack_rehash(stack));
+
+    _stack_write_end(stack);
+
+    if (old_owned) _stack_free_space(stack, old_buffer, old_mapped);
+}
+
+void _stack_remap(Stack* const stack, const size_t new_size, int* const err_code) {
+    size_t prefix_size = _stack_prefix_size();
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    size_t used_length = (prefix_size * 2 + new_size * sizeof(stack_content_t) + page_size - 1) / page_size * page_size;
+
+    char* old_buffer = stack->buffer;
+    size_t old_mapped = stack->_mapped;
+    bool old_owned = stack->_owned;
+
+    char* new_buffer = old_buffer;
+    size_t new_mapped = old_mapped;
+    size_t valid_count = new_size < stack->capacity ? new_size : stack->capacity;
+
+    //* Only the pages in use are charged, the reserved tail of the mapping is not backed by memory.
+    size_t old_charge = stack->_charged;
+    _LOG_FAIL_CHECK_(_stack_charge(stack, used_length), "error", ERROR_REPORTS, return, err_code, MEMORY_BUDGET_ERROR);
+
+    if (!old_mapped) {
+        new_buffer = (char*)mmap(NULL, used_length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        _LOG_FAIL_CHECK_(new_buffer != MAP_FAILED, "error", ERROR_REPORTS, {
+            _stack_charge(stack, old_charge, true);
+            return;
+        }, err_code, ENOMEM);
+
+        strncpy(new_buffer, STACK_CANARY_VALUE, sizeof(stack_canary_t));
+        memcpy(new_buffer + prefix_size, _stack_content(stack), valid_count * sizeof(stack_content_t));
+        new_mapped = used_length;
+    }
+
+    if (stack->_watched) stack_scanner_lock(stack);
+
+    _stack_write_begin(stack);
+
+    //* Mapping may move, so the scanner must not look at the stack until the buffer pointer is updated.
+    if (used_length > new_mapped) {
+        new_buffer = (char*)mremap(old_buffer, old_mapped, used_length, MREMAP_MAYMOVE);
+        if (new_buffer != MAP_FAILED) {
+            stack->buffer = new_buffer;
+            new_mapped = used_length;
+        }
+    }
+
+    if (stack->_watched) stack_scanner_unlock();
+
+    _LOG_FAIL_CHECK_(new_buffer != MAP_FAILED, "error", ERROR_REPORTS, {
+        _stack_write_end(stack);
+        _stack_charge(stack, old_charge, true);
+        return;
+    }, err_code, ENOMEM);
+
+    //* Released pages read as zeroes, so cells above the old capacity are poisoned again.
+    stack_content_t* content = (stack_content_t*)(new_buffer + prefix_size);
+    for (size_t index = valid_count; index < new_size; ++index) {
+        content[index] = STACK_CONTENT_POISON;
+    }
+    strncpy((char*)(content + new_size), STACK_CANARY_VALUE, sizeof(stack_canary_t));
+
+    //* Pages after the right canary are returned to the system, but stay reserved for the future growth.
+    if (used_length < new_mapped) madvise(new_buffer + used_length, new_mapped - used_length, STACK_MADVISE_ADVICE);
+
+    stack->buffer = new_buffer;
+    stack->capacity = new_size;
+    stack->_mapped = new_mapped;
+    stack->_external = false;
+    stack->_owned = true;
+    ++stack->_resizes;
+
+    ON_HASH(_stack_rehash(stack));
+
+    _stack_write_end(stack);
+
+    if (!old_mapped && old_owned) _stack_free_space(stack, old_buffer);
+
+    _LOG_FAIL_CHECK_(!_stack_inline_status(stack), "error", ERROR_REPORTS, {
+        log_printf(ERROR_REPORTS, "error", "Stack %p was invalid after size change.\n", stack);
+        stack_dump(stack, ERROR_REPORTS);
+        return;
+    }, err_code, EAGAIN);
+}
+
+char* _stack_alloc_space(const size_t count, int* const err_code) {
+    size_t prefix_size = _stack_prefix_size();
+    size_t buffer_size = prefix_size * 2 + sizeof(stack_content_t) * count;
+                                    /* ^-- two canaries */
+
+    char* buffer = (char*)calloc(buffer_size, sizeof(char));
+    _LOG_FAIL_CHECK_(buffer, "error", ERROR_REPORTS, return NULL, err_code, ENOMEM);
+
+    strncpy(buffer,                             STACK_CANARY_VALUE, sizeof(stack_canary_t));
+    strncpy(buffer + buffer_size - prefix_size, STACK_CANARY_VALUE, sizeof(stack_canary_t));
+
+    stack_content_t* beginning = (stack_content_t*)(buffer + prefix_size);
+    for (size_t id = 0; id < count; ++id) {
+        *(beginning + id) = STACK_CONTENT_POISON;
+    }
+
+    return buffer;
+}
+
+bool _stack_charge(Stack* const stack, const size_t bytes, const bool force) {
+    if (bytes > stack->_charged && !stack_budget_acquire(stack->_group, bytes - stack->_charged, force)) return false;
+    if (bytes < stack->_charged) stack_budget_release(stack->_group, stack->_charged - bytes);
+
+    stack->_charged = bytes;
+    return true;
+}
+
+void stack_set_budget_group(Stack* const stack, const int group, int* const err_code) {
+    _LOG_FAIL_CHECK_(check_ptr(stack), "error", ERROR_REPORTS, return, err_code, EFAULT);
+    _LOG_FAIL_CHECK_(0 <= group && group < STACK_BUDGET_GROUP_COUNT, "error", ERROR_REPORTS, return, err_code, EINVAL);
+
+    //* Memory that is already allocated moves to the new group even if it does not fit into its limit.
+    size_t charged = stack->_charged;
+    _stack_charge(stack, 0);
+    stack->_group = group;
+    _stack_charge(stack, charged, true);
+}
+
+void _stack_free_space(const Stack* const stack, char* const buffer, const size_t mapped) {
+    if (stack->_watched) stack_scanner_lock(stack);
+
+    if (mapped) munmap(buffer, mapped);
+    else        free(buffer);
+
+    if (stack->_watched) stack_scanner_unlock();
+}
+
+void stack_memory_usage(const Stack* const stack, size_t* const resident, size_t* const reserved, 
+                        int* const err_code) {
+    _LOG_FAIL_CHECK_(check_ptr(stack) && resident && reserved, "error", ERROR_REPORTS, return, err_code, EFAULT);
+
+    *reserved = stack->buffer ? _stack_buffer_length(stack) : 0;
+    *resident = *reserved;
+
+    if (stack->_mapped) {
+        size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+        size_t page_count = stack->_mapped / page_size;
+
+        unsigned char* pages = (unsigned char*)calloc(page_count, sizeof(*pages));
+        _LOG_FAIL_CHECK_(pages, "error", ERROR_REPORTS, return, err_code, ENOMEM);
+
+        *reserved = stack->_mapped;
+        *resident = 0;
+        if (!mincore(stack->buffer, stack->_mapped, pages)) {
+            for (size_t page = 0; page < page_count; ++page) {
+                if (pages[page] & 1) *resident += page_size;
+            }
+        }
+
+        free(pages);
+    }
+
+    ON_HASH({
+        *reserved += stack->_block_count * sizeof(stack_hash_t);
+        *resident += stack->_block_count * sizeof(stack_hash_t);
+    })
+
+    //* Segments shared with forks are counted by each of them.
+    for (const StackSegment* segment = stack->_prefix; segment; segment = segment->parent) {
+        *reserved += segment->mapped ? segment->mapped : _stack_segment_length(segment);
+        *resident += _stack_segment_length(segment);
+    }
+}
+
+void _stack_freeze(Stack* const stack, int* const err_code) {
+    //* Segments are always framed by canaries, so a buffer provided by the caller is copied first.
+    if (stack->_external) {
+        int copy_status = 0;
+        _stack_change_size(stack, stack->capacity, &copy_status);
+        _LOG_FAIL_CHECK_(copy_status == 0, "error", ERROR_REPORTS, return, err_code, copy_status);
+    }
+
+    StackSegment* segment = (StackSegment*) calloc(1, sizeof(*segment));
+    char* buffer = _stack_alloc_space(STACK_FORK_CAPACITY, err_code);
+    _LOG_FAIL_CHECK_(segment && buffer, "error", ERROR_REPORTS, {
+        free(segment);
+        free(buffer);
+        return;
+    }, err_code, ENOMEM);
+
+    *segment = (StackSegment){
+        .buffer = stack->buffer,
+        .size = stack->size,
+        .capacity = stack->capacity,
+        .depth = stack_size(stack),
+        .mapped = stack->_mapped,
+        .group = stack->_group,
+        .charged = stack->_charged,
+        .hash = 0,
+        .refs = 1,
+        .parent = stack->_prefix,
+    };
+    //* Block checksums of the stack already describe the buffer, so it is not rehashed.
+    ON_HASH(segment->hash = stack->_blocks ? stack->_digest : _stack_segment_hash(segment));
+    if (stack->_aggregates) segment->aggregate = stack->_aggregates[stack->size - 1];
+
+    //* The old buffer becomes the segment, so freezing does not copy elements.
+    _stack_write_begin(stack);
+
+    stack->buffer = buffer;
+    stack->size = 0;
+    stack->capacity = STACK_FORK_CAPACITY;
+    stack->_prefix = segment;
+    stack->_mapped = 0;
+
+    ON_HASH(_stack_rehash(stack));
+
+    _stack_write_end(stack);
+
+    //* The frozen buffer is charged to the segment now.
+    stack->_charged = 0;
+    _stack_charge(stack, _stack_buffer_length(stack), true);
+}
+
+void _stack_unshare(Stack* const stack, int* const err_code) {
+    StackSegment* segment = stack->_prefix;
+
+    //* Segments are not rechecked by each operation, so the one becoming the live buffer is verified now.
+    _LOG_FAIL_CHECK_(!_stack_segment_status(segment), "error", ERROR_REPORTS, return, err_code, EINVAL);
+
+    //* Aggregates of the segment elements are recalculated, the room for them is made before anything is changed.
+    if (stack->_aggregates) {
+        int aggregate_status = 0;
+        _stack_aggregate_fit(stack, segment->size, &aggregate_status);
+        _LOG_FAIL_CHECK_(aggregate_status == 0, "error", ERROR_REPORTS, return, err_code, aggregate_status);
+    }
+
+    size_t buffer_size = _stack_prefix_size() * 2 + segment->capacity * sizeof(stack_content_t);
+
+    //* Nobody else can take a new reference to the segment if this stack holds the only one.
+    //* Compressed segment is decoded into a new buffer, so it can not be stolen.
+    bool owned = !segment->packed && __atomic_load_n(&segment->refs, __ATOMIC_ACQUIRE) == 1;
+
+    char* new_buffer = segment->buffer;
+    size_t new_capacity = segment->capacity;
+    if (segment->packed) {
+        new_capacity = segment->size * STACK_BUFFER_INCREASE;
+        buffer_size = _stack_prefix_size() * 2 + new_capacity * sizeof(stack_content_t);
+
+        new_buffer = _stack_unpack_segment(segment, new_capacity, err_code);
+        _LOG_FAIL_CHECK_(new_buffer, "error", ERROR_REPORTS, return, err_code, ENOMEM);
+
+        if (segment->parent) __atomic_add_fetch(&segment->parent->refs, 1, __ATOMIC_RELAXED);
+    } else if (!owned) {
+        new_buffer = (char*)calloc(buffer_size, sizeof(char));
+        _LOG_FAIL_CHECK_(new_buffer, "error", ERROR_REPORTS, return, err_code, ENOMEM);
+        memcpy(new_buffer, segment->buffer, buffer_size);
+
+        if (segment->parent) __atomic_add_fetch(&segment->parent->refs, 1, __ATOMIC_RELAXED);
+    }
+
+    char* old_buffer = stack->buffer;
+    bool old_owned = stack->_owned;
+    size_t old_mapped = stack->_mapped;
+    size_t new_charge = owned ? segment->charged : buffer_size;
+
+    _stack_write_begin(stack);
+
+    stack->buffer = new_buffer;
+    stack->size = segment->size;
+    stack->capacity = new_capacity;
+    stack->_prefix = segment->parent;
+    stack->_external = false;
+    stack->_owned = true;
+    stack->_mapped = owned ? segment->mapped : 0;
+
+    ON_HASH(_stack_rehash(stack));
+
+    if (stack->_aggregates) _stack_aggregate_write(stack, 0, _stack_content(stack), stack->size);
+
+    _stack_write_end(stack);
+
+    if (old_owned) _stack_free_space(stack, old_buffer, old_mapped);
+
+    //* Stolen buffer keeps its charge, the copy is charged even if it exceeds the budget, because pop can not fail.
+    if (owned) stack_budget_release(segment->group, segment->charged);
+    _stack_charge(stack, new_charge, true);
+
+    if (owned) {
+        stack_scanner_lock();
+        free(segment);
+        stack_scanner_unlock();
+    } else {
+        _stack_release_segment(segment);
+    }
+}
+
+void _stack_release_segment(StackSegment* segment) {
+    while (segment && __atomic_sub_fetch(&segment->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        StackSegment* parent = segment->parent;
+
+        //* Segment can be shared with watched stacks, so it is freed under the scanner lock.
+        stack_scanner_lock();
+        if (segment->mapped) munmap(segment->buffer, segment->mapped);
+        else                 free(segment->buffer);
+        stack_budget_release(segment->group, segment->charged);
+        free(segment);
+        stack_scanner_unlock();
+
+        segment = parent;
+    }
+}
+
+void _stack_pack(Stack* const stack, int* const err_code) {
+    ON_INTEGER({
+        size_t prefix_size = _stack_prefix_size();
+        stack_content_t* content = _stack_content(stack);
+
+        StackSegment* segment = (StackSegment*) calloc(1, sizeof(*segment));
+        char* buffer = (char*) calloc(prefix_size * 2 + intpack_bound(STACK_PACK_BLOCK), sizeof(char));
+        _LOG_FAIL_CHECK_(segment && buffer, "error", ERROR_REPORTS, {
+            free(segment);
+            free(buffer);
+            return;
+        }, err_code, ENOMEM);
+
+        size_t packed = intpack_encode(content, STACK_PACK_BLOCK, (unsigned char*)buffer + prefix_size);
+        size_t length = prefix_size * 2 + packed;
+
+        char* fitted_buffer = (char*) realloc(buffer, length);
+        if (fitted_buffer) buffer = fitted_buffer;
+
+        strncpy(buffer,                         STACK_CANARY_VALUE, sizeof(stack_canary_t));
+        strncpy(buffer + prefix_size + packed, STACK_CANARY_VALUE, sizeof(stack_canary_t));
+
+        *segment = (StackSegment){
+            .buffer = buffer,
+            .size = STACK_PACK_BLOCK,
+            .capacity = STACK_PACK_BLOCK,
+            .depth = STACK_PACK_BLOCK + (stack->_prefix ? stack->_prefix->depth : 0),
+            .mapped = 0,
+            .group = stack->_group,
+            .charged = length,
+            .packed = packed,
+            .top = content[STACK_PACK_BLOCK - 1],
+            .hash = 0,
+            .refs = 1,
+            .parent = stack->_prefix,
+        };
+        ON_HASH(segment->hash = _stack_segment_hash(segment));
+        if (stack->_aggregates) segment->aggregate = stack->_aggregates[STACK_PACK_BLOCK - 1];
+
+        //* Compressed block is smaller than the memory it replaces, so it does not need the budget check.
+        stack_budget_acquire(stack->_group, length, true);
+
+        _stack_write_begin(stack);
+
+        memmove(content, content + STACK_PACK_BLOCK, (stack->size - STACK_PACK_BLOCK) * sizeof(stack_content_t));
+        for (size_t index = stack->size - STACK_PACK_BLOCK; index < stack->size; ++index) {
+            content[index] = STACK_CONTENT_POISON;
+        }
+        //* Aggregates are running from the bottom of the stack, so the ones left in the buffer stay valid.
+        if (stack->_aggregates)
+            memmove(stack->_aggregates, stack->_aggregates + STACK_PACK_BLOCK,
+                    (stack->size - STACK_PACK_BLOCK) * sizeof(*stack->_aggregates));
+
+        stack->size -= STACK_PACK_BLOCK;
+        stack->_prefix = segment;
+
+        ON_HASH(_stack_rehash(stack));
+
+        _stack_write_end(stack);
+    })
+}
+
+char* _stack_unpack_segment(const StackSegment* const segment, const size_t capacity, int* const err_code) {
+    char* buffer = _stack_alloc_space(capacity, err_code);
+    _LOG_FAIL_CHECK_(buffer, "error", ERROR_REPORTS, return NULL, err_code, ENOMEM);
+
+    ON_INTEGER(intpack_decode((const unsigned char*)segment->buffer + _stack_prefix_size(), segment->size,
+                              (stack_content_t*)(buffer + _stack_prefix_size()));)
+
+    return buffer;
+}
+
+void stack_set_packed(Stack* const stack, const bool enabled, int* const err_code) {
+    _LOG_FAIL_CHECK_(!stack_status(stack), "error", ERROR_REPORTS, return, err_code, EINVAL);
+#ifndef STACK_INTEGER_CONTENT
+    _LOG_FAIL_CHECK_(!enabled, "error", ERROR_REPORTS, return, err_code, ENOTSUP);
+#endif
+
+    _stack_write_begin(stack);
+    stack->_packed = enabled;
+    ON_HASH(_stack_update_header_hash(stack));
+    _stack_write_end(stack);
+}
+
+void stack_track_aggregates(Stack* const stack, const bool enabled, int* const err_code) {
+    _LOG_FAIL_CHECK_(!stack_status(stack), "error", ERROR_REPORTS, return, err_code, EINVAL);
+#ifndef STACK_INTEGER_CONTENT
+    _LOG_FAIL_CHECK_(!enabled, "error", ERROR_REPORTS, return, err_code, ENOTSUP);
+#endif
+
+    if (!enabled) {
+        if (stack->_aggregates) _stack_drop_aggregates(stack);
+        return;
+    }
+
+    _LOG_FAIL_CHECK_(!stack->_aggregates, "error", ERROR_REPORTS, return, err_code, EALREADY);
+
+    //* Aggregates are accumulated as the elements arrive, so tracking has to start on an empty stack.
+    _LOG_FAIL_CHECK_(!stack_size(stack) && !stack->_reserved, "error", ERROR_REPORTS, return, err_code, EBUSY);
+
+    _stack_aggregate_resize(stack, stack->capacity ? stack->capacity : 1, err_code);
+}
+
+StackAggregate stack_aggregate(const Stack* const stack, int* const err_code) {
+    _LOG_FAIL_CHECK_(!_stack_inline_status(stack), "error", ERROR_REPORTS, return StackAggregate{}, err_code, EINVAL);
+    _LOG_FAIL_CHECK_(stack->_aggregates, "error", ERROR_REPORTS, return StackAggregate{}, err_code, ENOENT);
+
+    StackAggregate base = {};
+    const StackAggregate* top = _stack_aggregate_top(stack, &base);
+    _LOG_FAIL_CHECK_(top, "error", ERROR_REPORTS, return StackAggregate{}, err_code, ENXIO);
+
+    return *top;
+}
+
+intptr_t stack_find(const Stack* const stack, const stack_content_t value, int* const err_code) {
+    _LOG_FAIL_CHECK_(!_stack_inline_status(stack), "error", ERROR_REPORTS, return -1, err_code, EINVAL);
+#ifndef STACK_INTEGER_CONTENT
+    _LOG_FAIL_CHECK_(false, "error", ERROR_REPORTS, return -1, err_code, ENOTSUP);
+#endif
+
+    ON_INTEGER({
+        StackChunk chunk;
+        while (_stack_next_chunk(stack, &chunk)) {
+            size_t index = vecscan_find_last(chunk.values, chunk.count, value);
+            if (index < chunk.count) return (intptr_t)(chunk.above + chunk.count - 1 - index);
+        }
+    })
+
+    return -1;
+}
+
+uintptr_t stack_count(const Stack* const stack, const stack_content_t value, int* const err_code) {
+    _LOG_FAIL_CHECK_(!_stack_inline_status(stack), "error", ERROR_REPORTS, return 0, err_code, EINVAL);
+#ifndef STACK_INTEGER_CONTENT
+    _LOG_FAIL_CHECK_(false, "error", ERROR_REPORTS, return 0, err_code, ENOTSUP);
+#endif
+
+    uintptr_t count = 0;
+
+    ON_INTEGER({
+        StackChunk chunk;
+        while (_stack_next_chunk(stack, &chunk)) count += vecscan_count(chunk.values, chunk.count, value);
+    })
+
+    return count;
+}
+
+StackAggregate stack_reduce(const Stack* const stack, int* const err_code) {
+    _LOG_FAIL_CHECK_(!_stack_inline_status(stack), "error", ERROR_REPORTS, return StackAggregate{}, err_code, EINVAL);
+#ifndef STACK_INTEGER_CONTENT
+    _LOG_FAIL_CHECK_(false, "error", ERROR_REPORTS, return StackAggregate{}, err_code, ENOTSUP);
+#endif
+    _LOG_FAIL_CHECK_(stack_size(stack), "error", ERROR_REPORTS, return StackAggregate{}, err_code, ENXIO);
+
+    StackAggregate aggregate = {};
+
+    ON_INTEGER({
+        uint64_t sum = 0;
+
+        StackChunk chunk;
+        while (_stack_next_chunk(stack, &chunk)) {
+            stack_content_t min = vecscan_min(chunk.values, chunk.count);
+            stack_content_t max = vecscan_max(chunk.values, chunk.count);
+
+            if (!chunk.above || min < aggregate.min) aggregate.min = min;
+            if (!chunk.above || max > aggregate.max) aggregate.max = max;
+            sum += (uint64_t)vecscan_sum(chunk.values, chunk.count);
+        }
+
+        aggregate.sum = (stack_content_t)sum;
+    })
+
+    return aggregate;
+}
+
+stack_hash_t stack_content_hash(const Stack* const stack, int* const err_code) {
+    _LOG_FAIL_CHECK_(!_stack_inline_status(stack), "error", ERROR_REPORTS, return 0, err_code, EINVAL);
+
+    //* Chunks go from the top down, so each chunk is put in front of the elements hashed before it.
+    stack_hash_t part = 0;
+    size_t length = 0;
+
+    StackChunk chunk;
+    while (_stack_next_chunk(stack, &chunk)) {
+        part += get_hash_part(chunk.values, chunk.values + chunk.count) * get_hash_power(length);
+        length += chunk.count * sizeof(*chunk.values);
+    }
+
+    return HASH_SEED * get_hash_power(length) + part;
+}
+
+bool _stack_next_chunk(const Stack* const stack, StackChunk* const chunk) {
+    const StackSegment* segment = stack->_prefix;
+
+    if (chunk->started) {
+        chunk->above += chunk->count;
+        if (chunk->segment) segment = chunk->segment->parent;
+    } else {
+        chunk->started = true;
+
+        if (stack->size) {
+            chunk->values = _stack_content(stack);
+            chunk->count = stack->size;
+            return true;
+        }
+    }
+
+    while (segment && !segment->size) segment = segment->parent;
+    if (!segment) return false;
+
+    chunk->segment = segment;
+    chunk->count = segment->size;
+    chunk->values = (const stack_content_t*)(segment->buffer + _stack_prefix_size());
+
+    ON_INTEGER(if (segment->packed) {
+        intpack_decode((const unsigned char*)segment->buffer + _stack_prefix_size(), segment->size, chunk->decoded);
+        chunk->values = chunk->decoded;
+    })
+
+    return true;
+}
+
+void _stack_aggregate_resize(Stack* const stack, const size_t capacity, int* const err_code) {
+    StackAggregate* aggregates = (StackAggregate*) calloc(capacity, sizeof(*aggregates));
+    _LOG_FAIL_CHECK_(aggregates, "error", ERROR_REPORTS, return, err_code, ENOMEM);
+
+    StackAggregate* old_aggregates = stack->_aggregates;
+    size_t kept = stack->size < capacity ? stack->size : capacity;
+    if (old_aggregates) memcpy(aggregates, old_aggregates, kept * sizeof(*aggregates));
+
+    _stack_write_begin(stack);
+    stack->_aggregates = aggregates;
+    stack->_aggregate_capacity = capacity;
+    ON_HASH(_stack_update_header_hash(stack));
+    _stack_write_end(stack);
+
+    //* Scanner may still be checking a snapshot that points to the old array.
+    _stack_free_space(stack, (char*)old_aggregates);
+}
+
+void _stack_aggregate_fit(Stack* const stack, const size_t count, int* const err_code) {
+    if (count <= stack->_aggregate_capacity) return;
+
+    size_t new_capacity = stack->_aggregate_capacity * STACK_BUFFER_INCREASE + 1;
+    if (new_capacity < count) new_capacity = count;
+
+    _stack_aggregate_resize(stack, new_capacity, err_code);
+}
+
+StackAggregate _stack_aggregate_next(const StackAggregate* const below, const stack_content_t value) {
+    StackAggregate next = { .min = value, .max = value, .sum = value };
+
+    ON_INTEGER(if (below) {
+        if (below->min < value) next.min = below->min;
+        if (below->max > value) next.max = below->max;
+
+        //* Sum wraps around on overflow instead of causing undefined behaviour.
+        next.sum = (stack_content_t)((unsigned long long)below->sum + (unsigned long long)value);
+    })
+
+    return next;
+}
+
+bool _stack_aggregate_base(const Stack* const stack, StackAggregate* const base) {
+    const StackSegment* segment = stack->_prefix;
+    if (!segment || !segment->depth) return false;
+
+    *base = segment->aggregate;
+    return true;
+}
+
+const StackAggregate* _stack_aggregate_top(const Stack* const stack, StackAggregate* const base) {
+    if (stack->size) return stack->size <= stack->_aggregate_capacity ? stack->_aggregates + stack->size - 1 : NULL;
+    return _stack_aggregate_base(stack, base) ? base : NULL;
+}
+
+void _stack_aggregate_write(Stack* const stack, const size_t first, const stack_content_t* const values, 
+                            const size_t count) {
+    StackAggregate base = {};
+    const StackAggregate* below = first ? stack->_aggregates + first - 1 : 
+                                          (_stack_aggregate_base(stack, &base) ? &base : NULL);
+
+    for (size_t index = 0; index < count; ++index) {
+        stack->_aggregates[first + index] = _stack_aggregate_next(below, values[index]);
+        below = stack->_aggregates + first + index;
+    }
+}
+
+bool _stack_aggregate_match(const Stack* const stack) {
+    if (stack->_aggregate_capacity < stack->size || !check_ptr(stack->_aggregates)) return false;
+
+    StackAggregate base = {};
+    const StackAggregate* below = _stack_aggregate_base(stack, &base) ? &base : NULL;
+    const stack_content_t* content = _stack_content(stack);
+
+    for (size_t index = 0; index < stack->size; ++index) {
+        StackAggregate expected = _stack_aggregate_next(below, content[index]);
+        below = stack->_aggregates + index;
+
+        if (memcmp(&expected, below, sizeof(expected))) return false;
+    }
+
+    return true;
+}
+
+void _stack_drop_aggregates(Stack* const stack) {
+    StackAggregate* aggregates = stack->_aggregates;
+
+    _stack_write_begin(stack);
+    stack->_aggregates = NULL;
+    stack->_aggregate_capacity = 0;
+    ON_HASH(_stack_update_header_hash(stack));
+    _stack_write_end(stack);
+
+    _stack_free_space(stack, (char*)aggregates);
+}
+
+size_t _stack_segment_length(const StackSegment* const segment) {
+    return _stack_prefix_size() * 2 + (segment->packed ? segment->packed : segment->capacity * sizeof(stack_content_t));
+}
+
+stack_hash_t _stack_segment_hash(const StackSegment* const segment) {
+    return _stack_hash_blocks(segment->buffer, _stack_segment_length(segment), NULL);
+}
+
+stack_report_t _stack_segment_status(const StackSegment* const segment) {
+    stack_report_t status = 0;
+
+    if (!check_ptr(segment) || !check_ptr(segment->buffer)) return STACK_NULL_CONTENT;
+
+    ON_CANARY({
+        if (!stack_check_canary(segment->buffer)) status |= STACK_BL_CANARY_FAIL;
+        if (!stack_check_canary(segment->buffer + _stack_segment_length(segment) - _stack_prefix_size()))
+            status |= STACK_BR_CANARY_FAIL;
+    })
+
+    ON_HASH(if (segment->hash != _stack_segment_hash(segment)) status |= STACK_HASH_FAILURE);
+
+    return status;
+}
+
+stack_report_t _stack_prefix_status(const Stack* const stack) {
+    stack_report_t status = 0;
+
+    for (const StackSegment* segment = stack->_prefix; segment; segment = segment->parent) {
+        stack_report_t segment_status = _stack_segment_status(segment);
+        status |= segment_status;
+        if (segment_status & STACK_NULL_CONTENT) break;
+    }
+
+    return status;
+}
+
+stack_report_t _stack_inline_status(const Stack* const stack) {
+    if (stack && (!stack->_inline_checks || stack->_batch)) return 0;
+    return _stack_status(stack, false);
+}
+
+void _stack_write_begin(Stack* const stack) {
+    //* Open batch is one long write section.
+    if (stack->_batch) return;
+
+    __atomic_store_n(&stack->_seq, stack->_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void _stack_write_end(Stack* const stack) {
+    if (stack->_batch) return;
+
+    __atomic_store_n(&stack->_seq, stack->_seq + 1, __ATOMIC_RELEASE);
 }
 
-stack_hash_t _stack_hash(const Stack* const stack) {
-    const char* stack_end = (const char*)(&stack->capacity + 1);
-    ON_CANARY(stack_end -= alignof(stack_canary_t));
-    ON_HASH(stack_end -= alignof(stack_hash_t));
-    hash_t hash = get_hash(stack, stack_end);
-    if (check_ptr(stack->buffer)) {
-        hash += get_hash(stack->buffer, (char*)(_stack_content(stack) + stack->capacity) + 
-                                        ((char*)_stack_content(stack) - stack->buffer));
+bool _stack_access_begin(Stack* const stack) {
+    if (!stack || !__atomic_load_n(&stack->_trim, __ATOMIC_RELAXED)) return false;
+
+    for (;;) {
+        unsigned char state = STACK_TRIM_FREE;
+        if (__atomic_compare_exchange_n(&stack->_trim, &state, STACK_TRIM_BUSY, false,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) return true;
+        if (state == STACK_TRIM_OFF) return false;
+
+        //* Trimmer holds the lock for one resize at most.
+        sched_yield();
+    }
+}
+
+void _stack_access_end(Stack* const stack) {
+    //* Stack may have been removed from the trimmer during the operation, then the lock is already dropped.
+    unsigned char state = STACK_TRIM_BUSY;
+    __atomic_compare_exchange_n(&stack->_trim, &state, STACK_TRIM_FREE, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+size_t _stack_trim_target(TrimTarget* const target, const TrimmerConfig* const config, const long long now) {
+    Stack* stack = (Stack*)target->stack;
+
+    unsigned char state = STACK_TRIM_FREE;
+    if (!__atomic_compare_exchange_n(&stack->_trim, &state, STACK_TRIM_BUSY, false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        target->accessed = now;
+        return 0;
+    }
+
+    size_t freed = 0;
+
+    //* Counter is odd while a batch is open.
+    if (!target->accessed || stack->_seq != target->seq || stack->_seq % 2) {
+        target->seq = stack->_seq;
+        target->accessed = now;
+    } else if (now - target->accessed >= (long long)config->idle_ms * 1000000 && stack->_owned &&
+               !stack->_reserved && !stack->_marks) {
+        size_t headroom = (size_t)((double)stack->size * config->headroom);
+        if (headroom < config->min_headroom) headroom = config->min_headroom;
+
+        size_t charged = stack->_charged;
+
+        if (stack->size + headroom < stack->capacity) {
+            int trim_status = 0;
+            stack_trim(stack, headroom, &trim_status);
+
+            if (stack->_charged < charged) freed = charged - stack->_charged;
+
+            //* Trimming is not a sign of use.
+            target->seq = stack->_seq;
+        }
+    }
+
+    __atomic_store_n(&stack->_trim, STACK_TRIM_FREE, __ATOMIC_RELEASE);
+    return freed;
+}
+
+stack_content_t* _stack_content(const Stack* const stack) {
+    return (stack_content_t*)(stack->buffer + _stack_buffer_offset(stack));
+}
+
+stack_hash_t _stack_hash(const Stack* const stack, const bool check_buffer) {
+    TRACE_SCOPE("_stack_hash");
+
+    hash_t hash = _stack_header_hash(stack);
+    if (check_buffer ? check_ptr(stack->buffer) : stack->buffer != NULL) {
+        hash += _stack_hash_blocks(stack->buffer, _stack_buffer_length(stack), NULL);
     }
     return hash;
 }
 
+stack_hash_t _stack_header_hash(const Stack* const stack) {
+    //* Fields are copied, so the hash does not depend on their order and on padding between them.
+    const uintptr_t fields[] = {
+        (uintptr_t)stack->buffer, stack->size, stack->capacity, stack->_inline_checks, stack->_packed, stack->_owned,
+        stack->_mapped, stack->_external, (uintptr_t)stack->_prefix, (uintptr_t)stack->_aggregates,
+        stack->_aggregate_capacity,
+    };
+    return get_hash(fields, fields + sizeof(fields) / sizeof(*fields));
+}
+
+#ifndef NHASH
+
+void _stack_rehash(Stack* const stack) {
+    TRACE_SCOPE("_stack_rehash");
+
+    //* Cells modified earlier in the batch are covered by the new hash.
+    stack->_dirty_first = stack->_dirty_last = 0;
+
+    size_t block_count = (_stack_buffer_length(stack) + STACK_HASH_BLOCK - 1) / STACK_HASH_BLOCK;
+
+    //* Checksums of a shrunk buffer are moved into a smaller array, so they do not keep the memory of the big one.
+    if (stack->_block_count < block_count || 
+        stack->_block_count > block_count * STACK_BUFFER_INCREASE * STACK_BUFFER_INCREASE) {
+        //* Without block checksums the stack falls back to rehashing the whole buffer on each modification.
+        stack_hash_t* blocks = (stack_hash_t*)calloc(block_count, sizeof(*blocks));
+
+        _stack_free_space(stack, (char*)stack->_blocks);
+        stack->_blocks = blocks;
+        stack->_block_count = blocks ? block_count : 0;
+    }
+
+    if (!stack->_blocks) {
+        stack->_hash = _stack_hash(stack, false);
+        return;
+    }
+
+    stack->_digest = _stack_hash_blocks(stack->buffer, _stack_buffer_length(stack), stack->_blocks);
+    stack->_hash = _stack_header_hash(stack) + stack->_digest;
+}
+
+void _stack_update_hash(Stack* const stack, const size_t first, const size_t last) {
+    if (stack->_batch) {
+        bool clean = stack->_dirty_first >= stack->_dirty_last;
+        if (clean || first < stack->_dirty_first) stack->_dirty_first = first;
+        if (clean || last > stack->_dirty_last)   stack->_dirty_last = last;
+        return;
+    }
+
+    if (!stack->_blocks) {
+        stack->_hash = _stack_hash(stack, false);
+        return;
+    }
+
+    size_t length = _stack_buffer_length(stack);
+    size_t offset = _stack_buffer_offset(stack);
+    size_t end_block = (offset + last * sizeof(stack_content_t) + STACK_HASH_BLOCK - 1) / STACK_HASH_BLOCK;
+
+    //* Checksum of a block ending at byte e is multiplied by HASH_MULTIPLIER^(length - e) in the buffer hash.
+    for (size_t block = (offset + first * sizeof(stack_content_t)) / STACK_HASH_BLOCK; block < end_block; ++block) {
+        size_t block_end = (block + 1) * STACK_HASH_BLOCK < length ? (block + 1) * STACK_HASH_BLOCK : length;
+        stack_hash_t checksum = get_hash_part(stack->buffer + block * STACK_HASH_BLOCK, stack->buffer + block_end);
+
+        stack->_digest += (checksum - stack->_blocks[block]) * get_hash_power(length - block_end);
+        stack->_blocks[block] = checksum;
+    }
+
+    stack->_hash = _stack_header_hash(stack) + stack->_digest;
+}
+
+void _stack_update_header_hash(Stack* const stack) {
+    //* Digest of an open batch lags behind the buffer, it is brought up to date when the batch is closed.
+    if (!stack->_blocks) stack->_hash = _stack_hash(stack, false);
+    else                 stack->_hash = _stack_header_hash(stack) + stack->_digest;
+}
+
+#endif
+
+stack_hash_t _stack_hash_blocks(const char* buffer, const size_t length, stack_hash_t* const blocks) {
+    StackHashTask tasks[STACK_HASH_MAX_THREADS] = {};
+
+    long task_count = 1;
+    if (length >= STACK_PARALLEL_HASH_MIN) {
+        task_count = sysconf(_SC_NPROCESSORS_ONLN);
+        if (task_count < 1) task_count = 1;
+        if (task_count > STACK_HASH_MAX_THREADS) task_count = STACK_HASH_MAX_THREADS;
+    }
+
+    //* Tasks get whole blocks, so each block checksum is calculated by exactly one thread.
+    size_t block_count = (length + STACK_HASH_BLOCK - 1) / STACK_HASH_BLOCK;
+    size_t task_blocks = (block_count + (size_t)task_count - 1) / (size_t)task_count;
+
+    for (long task_id = 0; task_id < task_count; ++task_id) {
+        size_t start = (size_t)task_id * task_blocks * STACK_HASH_BLOCK;
+        size_t end = start + task_blocks * STACK_HASH_BLOCK;
+        if (start > length) start = length;
+        if (end > length) end = length;
+
+        tasks[task_id] = (StackHashTask){
+            .start = buffer + start,
+            .end = buffer + end,
+            .blocks = blocks ? blocks + start / STACK_HASH_BLOCK : NULL,
+        };
+
+        //* The last task is done by the calling thread.
+        if (task_id + 1 < task_count) {
+            tasks[task_id].started = !pthread_create(&tasks[task_id].thread, NULL, _stack_hash_task, tasks + task_id);
+        }
+        if (!tasks[task_id].started) _stack_hash_task(tasks + task_id);
+    }
+
+    stack_hash_t hash = HASH_SEED;
+    for (long task_id = 0; task_id < task_count; ++task_id) {
+        if (tasks[task_id].started) pthread_join(tasks[task_id].thread, NULL);
+        hash = hash * get_hash_power((size_t)(tasks[task_id].end - tasks[task_id].start)) + tasks[task_id].part;
+    }
+
+    return hash;
+}
+
+void* _stack_hash_task(void* argument) {
+    StackHashTask* task = (StackHashTask*)argument;
+    stack_hash_t block_power = get_hash_power(STACK_HASH_BLOCK);
+
+    task->part = 0;
+    for (const char* block = task->start; block < task->end; block += STACK_HASH_BLOCK) {
+        const char* block_end = task->end - block < STACK_HASH_BLOCK ? task->end : block + STACK_HASH_BLOCK;
+        stack_hash_t part = get_hash_part(block, block_end);
+
+        if (task->blocks) task->blocks[(block - task->start) / STACK_HASH_BLOCK] = part;
+        task->part = task->part * (block_end - block == STACK_HASH_BLOCK ? block_power : 
+                                   get_hash_power((size_t)(block_end - block))) + part;
+    }
+
+    return NULL;
+}
+
+size_t _stack_buffer_length(const Stack* const stack) {
+    return _stack_buffer_offset(stack) * 2 + stack->capacity * sizeof(stack_content_t);
+}
+
+size_t _stack_buffer_offset(const Stack* const stack) {
+    return stack->_external ? 0 : _stack_prefix_size();
+}
+
+size_t _stack_prefix_size() {
+    return sizeof(stack_canary_t) + 
+        (alignof(stack_content_t) - sizeof(stack_canary_t) % alignof(stack_content_t)) % sizeof(stack_content_t);
+}
+
 #endif
 
@@ -53,6 +53,10 @@ void edit_int(const int argc, void** argv, const char* argument) {
     *(int*)argv[0] = atoi(argument);
 }
 
+void edit_flag(const int argc, void** argv, const char* argument) {
+    *(bool*)argv[0] = true;
+}
+
 void edit_string(const int argc, void** argv, const char* argument) {
     strcpy(*(char**)argv, argument);
 }
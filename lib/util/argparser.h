@@ -63,6 +63,15 @@ void parse_args(const int argc, const char** argv, const int actions_count, cons
  */
 void edit_int(const int argc, void** argv, const char* argument);
 
+/**
+ * @brief Set boolean flag (first pointer) to true.
+ * 
+ * @param argc number of arguments
+ * @param argv pointers to arguments (1-st element should be bool*)
+ * @param argument ignored
+ */
+void edit_flag(const int argc, void** argv, const char* argument);
+
 /**
  * @brief Set string value to the value of the argument.
  * 
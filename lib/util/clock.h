@@ -0,0 +1,30 @@
+/**
+ * @file clock.h
+ * @author Ilya Kudryashov (kudriashov.it@phystech.edu)
+ * @brief Reading of system clocks in nanoseconds.
+ * @version 0.1
+ * @date 2022-10-18
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * @brief Get time of the clock in nanoseconds.
+ *
+ * @param clock_id clock to read (CLOCK_THREAD_CPUTIME_ID for processor time of the thread)
+ * @return uint64_t
+ */
+static inline uint64_t clock_ns(const clockid_t clock_id = CLOCK_MONOTONIC) {
+    struct timespec time = {};
+    clock_gettime(clock_id, &time);
+    return (uint64_t)time.tv_sec * 1000000000 + (uint64_t)time.tv_nsec;
+}
+
+#endif
\ No newline at end of file
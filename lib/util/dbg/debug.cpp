@@ -23,10 +23,29 @@ bool check_ptr(const void* ptr) {
 }
 
 hash_t get_hash(const void* start, const void* end) {
-    hash_t hash = 0xDEADBABEDEAD;
+    hash_t hash = HASH_SEED;
     for (const char* ptr = (const char*)start; ptr < (const char*)end; ++ptr) {
-        hash *= 0xC0FEBABEDEAD;
+        hash *= HASH_MULTIPLIER;
         hash += *ptr;
     }
     return hash;
+}
+
+hash_t get_hash_part(const void* start, const void* end) {
+    hash_t hash = 0;
+    for (const char* ptr = (const char*)start; ptr < (const char*)end; ++ptr) {
+        hash *= HASH_MULTIPLIER;
+        hash += *ptr;
+    }
+    return hash;
+}
+
+hash_t get_hash_power(size_t exponent) {
+    hash_t power = 1;
+    hash_t base = HASH_MULTIPLIER;
+    for (; exponent; exponent >>= 1) {
+        if (exponent & 1) power *= base;
+        base *= base;
+    }
+    return power;
 }
\ No newline at end of file
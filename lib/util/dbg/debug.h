@@ -21,6 +21,9 @@
 
 typedef unsigned long long hash_t;
 
+static const hash_t HASH_SEED = 0xDEADBABEDEAD;
+static const hash_t HASH_MULTIPLIER = 0xC0FEBABEDEAD;
+
 /**
  * @brief List of error types to put into errno.
  */
@@ -28,6 +31,7 @@ enum ERRORS {
     INPUT_ERROR = -1,
     NULLPTR_ERROR = -2,
     FILE_ERROR = -3,
+    MEMORY_BUDGET_ERROR = -4,
 };
 
 /**
@@ -80,4 +84,23 @@ bool check_ptr(const void* ptr);
  */
 hash_t get_hash(const void* start, const void* end);
 
+/**
+ * @brief Calculate hash value of the part of a buffer without the seed.
+ * get_hash() of the buffer is HASH_SEED * get_hash_power(length) + get_hash_part() of it,
+ * hash of two adjacent parts is get_hash_part(left) * get_hash_power(right length) + get_hash_part(right).
+ * 
+ * @param start pointer to the start of the part
+ * @param end pointer to the end of the part
+ * @return hash_t 
+ */
+hash_t get_hash_part(const void* start, const void* end);
+
+/**
+ * @brief Calculate HASH_MULTIPLIER to the specified power.
+ * 
+ * @param exponent 
+ * @return hash_t 
+ */
+hash_t get_hash_power(size_t exponent);
+
 #endif
\ No newline at end of file
@@ -1,76 +1,406 @@
 #include "logger.h"
 
 #include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
 #include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "debug.h"
 
-static FILE* logfile = NULL;
+static const size_t LOG_LINE_SIZE = 1024;
+static const uint64_t LOG_CONTROL_MAGIC = 0xd1b54a32d192ed03;
+static const size_t LOG_CONTROL_ALIGNMENT = 64;
+
+/**
+ * @brief Shared state of the mapped segment, kept in the file right after its text.
+ * 
+ * @param magic LOG_CONTROL_MAGIC once the segment is set up
+ * @param length number of bytes reserved by all processes writing into the segment
+ */
+struct LogControl {
+    uint64_t magic;
+    size_t length;
+};
+
+/**
+ * @brief Memory-mapped log segment.
+ * 
+ * @param name name of the current segment file
+ * @param descriptor descriptor of the file
+ * @param data mapping of the file
+ * @param control control block at the end of the mapping
+ * @param length number of bytes written through stdio
+ * @param capacity size of the segment text (size to rotate the file written through stdio at, 0 if it is not rotated)
+ * @param segment_size size of the segment to rotate at
+ * @param segment_count number of segments to keep
+ * @param device device of the mapped file
+ * @param inode inode of the mapped file, used to tell if another process has rotated it
+ */
+struct LogSink {
+    char* name = NULL;
+    int descriptor = -1;
+    char* data = NULL;
+    LogControl* control = NULL;
+    size_t length = 0;
+    size_t capacity = 0;
+    size_t segment_size = LOG_SEGMENT_SIZE;
+    unsigned int segment_count = LOG_SEGMENT_COUNT;
+    dev_t device = 0;
+    ino_t inode = 0;
+};
+
+static LogSink sink = {};
+static FILE* logfile = NULL;  // Used instead of the sink if the log file can not be mapped.
 static unsigned int log_threshold = 0;
+static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 /**
- * @brief Prints out log line prefix (time and tag).
+ * @brief Prints out log line prefix (time and tag) into the buffer.
  * 
- * @param tag (optional) prefix tag
- * @param importance (optional) message importance
+ * @param buffer buffer to print into
+ * @param size size of the buffer
+ * @param tag prefix tag
+ * @return int length of the prefix
  */
-static void log_prefix(const char* tag = "status", const unsigned int importance = ABSOLUTE_IMPORTANCE);
+static int log_prefix(char* const buffer, const size_t size, const char* tag);
 
 /**
- * @brief Returns currently opened log file by given importance.
+ * @brief Append the line to the log, rotating the segment if it does not fit.
  * 
- * @param importance (optional) importance of the message file will be used for.
+ * @param prefix line prefix
+ * @param prefix_length length of the prefix
+ * @param message line text
+ * @param message_length length of the text
+ */
+static void log_write(const char* prefix, size_t prefix_length, const char* message, size_t message_length);
+
+/**
+ * @brief Open and map current segment file.
+ * Segment already mapped by other processes (or left by a crashed one) is continued from its control block.
  * 
- * @return FILE* log file
+ * @return true if the segment was mapped
  */
-static FILE* log_file(const unsigned int importance = ABSOLUTE_IMPORTANCE);
+static bool log_map_segment();
 
-void log_init(const char* filename, const unsigned int threshold, int* error_code) {
+/**
+ * @brief Unmap current segment and cut the control block and the unused tail off if no other process has it mapped.
+ * 
+ * @return true if the file was closed successfully
+ */
+static bool log_unmap_segment();
+
+/**
+ * @brief Open current segment file through stdio if it can not be mapped.
+ * Lines are appended with O_APPEND, so they do not overwrite lines of other processes.
+ * 
+ */
+static void log_open_file();
+
+/**
+ * @brief Close full segment, shift segment files and start the new one.
+ * If another process has already rotated the mapped segment, the new one is opened without shifting the files.
+ * 
+ */
+static void log_rotate();
+
+/**
+ * @brief Lock or unlock the segment file, so processes do not set up, rotate or cut it at once.
+ * 
+ * @param locked true to lock the segment, false to unlock it
+ */
+static void log_lock_segment(const bool locked);
+
+/**
+ * @brief Check if the mapped segment is still the current segment file.
+ * 
+ * @return true if the segment was not rotated by another process
+ */
+static bool log_segment_current();
+
+/**
+ * @brief Copy log bytes into the mapped segment, cutting them at its end.
+ * 
+ * @param offset position to copy the bytes to
+ * @param data bytes to copy
+ * @param length number of bytes
+ * @return size_t position after the copied bytes
+ */
+static inline size_t log_append(const size_t offset, const char* data, const size_t length);
+
+void log_init(const char* filename, const unsigned int threshold, int* error_code,
+              const size_t segment_size, const unsigned int segment_count) {
     log_threshold = threshold;
 
-    if ((logfile = fopen(filename, "a"))) {
-        setvbuf(logfile, NULL, _IONBF, 1);
+    int saved_errno = errno;
+
+    sink.name = strdup(filename);
+    sink.segment_size = segment_size ? segment_size : LOG_SEGMENT_SIZE;
+    sink.segment_count = segment_count ? segment_count : 1;
+
+    //* Special files (terminals, pipes) can not be mapped, so they are written through stdio.
+    if (sink.name && !log_map_segment()) log_open_file();
+
+    errno = saved_errno;
+
+    if (sink.data || logfile) {
         log_printf(ABSOLUTE_IMPORTANCE, "open", "Log file %s was opened.\n", filename);
         return;
     }
 
+    free(sink.name);
+    sink.name = NULL;
     if (error_code) *error_code = FILE_ERROR;
 }
 
-static void log_prefix(const char* tag, const unsigned int importance) {
-    if (!log_file()) return;
-    time_t rawtime;
-    struct tm * timeinfo;
+static int log_prefix(char* const buffer, const size_t size, const char* tag) {
+    time_t rawtime = time(NULL);
+    struct tm timeinfo = {};
+    localtime_r(&rawtime, &timeinfo);
 
-    time(&rawtime);
-    timeinfo = localtime (&rawtime);
-    char* pc_timestamp = asctime(timeinfo);
-    pc_timestamp[strlen(pc_timestamp) - 1] = '\0';
+    char timestamp[32] = "";
+    asctime_r(&timeinfo, timestamp);
+    timestamp[strlen(timestamp) - 1] = '\0';
 
-    fprintf(log_file(importance), "%-20s [%s]:  ", pc_timestamp, tag);
+    int length = snprintf(buffer, size, "%-20s [%s]:  ", timestamp, tag);
+    return length < (int)size ? length : (int)size - 1;
 }
 
 void _log_printf(const unsigned int importance, const char* tag, const char* format, ...) {
+    if (importance < log_threshold) return;
+
+    char prefix[LOG_LINE_SIZE] = "";
+    int prefix_length = log_prefix(prefix, sizeof(prefix), tag);
+
     va_list args;
     va_start(args, format);
+    va_list args_copy;
+    va_copy(args_copy, args);
 
-    if (importance >= log_threshold && logfile) {
-        log_prefix(tag, importance);
-        vfprintf(log_file(importance), format, args);
-        fflush(log_file(importance));
+    //* Most lines fit into the buffer on the stack, longer ones are formatted again into the heap.
+    char line[LOG_LINE_SIZE] = "";
+    char* message = line;
+    int length = vsnprintf(line, sizeof(line), format, args);
+
+    if (length >= (int)sizeof(line)) {
+        message = (char*)calloc((size_t)length + 1, sizeof(*message));
+        if (message) vsnprintf(message, (size_t)length + 1, format, args_copy);
+        else {
+            message = line;
+            length = (int)sizeof(line) - 1;
+        }
     }
 
+    va_end(args_copy);
     va_end(args);
+
+    if (length >= 0) log_write(prefix, (size_t)prefix_length, message, (size_t)length);
+
+    if (message != line) free(message);
 }
 
-static FILE* log_file(const unsigned int importance) {
-    return importance >= log_threshold ? logfile : NULL;
+static void log_write(const char* prefix, size_t prefix_length, const char* message, size_t message_length) {
+    size_t line_length = prefix_length + message_length;
+    int saved_errno = errno;
+
+    pthread_mutex_lock(&log_mutex);
+
+    //* Files written through stdio are rotated by their size too, so a failed mapping does not stop the rotation.
+    if (!sink.data && logfile && sink.capacity && sink.length && sink.length + line_length > sink.capacity)
+        log_rotate();
+
+    //* Processes sharing the segment reserve their lines with one atomic addition to the length in its control block,
+    //* the file is touched only when the segment is full.
+    while (sink.data) {
+        size_t offset = __atomic_fetch_add(&sink.control->length, line_length, __ATOMIC_RELAXED);
+
+        //* Line longer than the whole segment is cut.
+        if (offset < sink.capacity && (!offset || offset + line_length <= sink.capacity)) {
+            offset = log_append(offset, prefix, prefix_length);
+            log_append(offset, message, message_length);
+            break;
+        }
+
+        log_rotate();
+    }
+
+    if (!sink.data && logfile) {
+        fwrite(prefix, sizeof(*prefix), prefix_length, logfile);
+        fwrite(message, sizeof(*message), message_length, logfile);
+        sink.length += line_length;
+    }
+
+    pthread_mutex_unlock(&log_mutex);
+
+    errno = saved_errno;
+}
+
+static inline size_t log_append(const size_t offset, const char* data, const size_t length) {
+    size_t copied = length < sink.capacity - offset ? length : sink.capacity - offset;
+    memcpy(sink.data + offset, data, copied);
+    return offset + copied;
+}
+
+static bool log_map_segment() {
+    sink.descriptor = open(sink.name, O_RDWR | O_CREAT, 0644);
+    if (sink.descriptor < 0) return false;
+
+    //* Segment is set up under the file lock, so processes opening it at once agree on its control block.
+    log_lock_segment(true);
+
+    //* Each process holds a shared lock while the segment is mapped, so only the last one cuts the file.
+    struct stat info = {};
+    bool regular = !flock(sink.descriptor, LOCK_SH) && !fstat(sink.descriptor, &info) && S_ISREG(info.st_mode);
+    size_t file_size = (size_t)info.st_size;
+
+    LogControl control = {};
+    bool shared = regular && file_size >= sizeof(control) &&
+                  (file_size - sizeof(control)) % LOG_CONTROL_ALIGNMENT == 0 &&
+                  pread(sink.descriptor, &control, sizeof(control), (off_t)(file_size - sizeof(control))) ==
+                  (ssize_t)sizeof(control) && control.magic == LOG_CONTROL_MAGIC;
+
+    size_t capacity = file_size > sink.segment_size ? file_size : sink.segment_size;
+    if (shared) capacity = file_size - sizeof(control);
+    else        capacity = (capacity + LOG_CONTROL_ALIGNMENT - 1) / LOG_CONTROL_ALIGNMENT * LOG_CONTROL_ALIGNMENT;
+
+    //* Blocks are allocated in advance, so a full disk does not turn writes into the mapping into SIGBUS.
+    if (!regular || posix_fallocate(sink.descriptor, 0, (off_t)(capacity + sizeof(control))) ||
+        (sink.data = (char*)mmap(NULL, capacity + sizeof(control), PROT_READ | PROT_WRITE, MAP_SHARED,
+                                 sink.descriptor, 0)) == MAP_FAILED) {
+        if (regular && !shared && !flock(sink.descriptor, LOCK_EX | LOCK_NB))
+            ftruncate(sink.descriptor, (off_t)file_size);
+        close(sink.descriptor);
+        sink.descriptor = -1;
+        sink.data = NULL;
+        return false;
+    }
+
+    sink.capacity = capacity;
+    sink.control = (LogControl*)(sink.data + capacity);
+
+    if (!shared) {
+        //* Zero tail left by an interrupted write is reused.
+        size_t length = file_size;
+        while (length && !sink.data[length - 1]) --length;
+
+        sink.control->length = length;
+        sink.control->magic = LOG_CONTROL_MAGIC;
+    }
+
+    log_lock_segment(false);
+
+    sink.device = info.st_dev;
+    sink.inode = info.st_ino;
+
+    return true;
+}
+
+static bool log_unmap_segment() {
+    //* Other processes may still write into the segment, so it is cut only by the last one.
+    log_lock_segment(true);
+    bool last = !flock(sink.descriptor, LOCK_EX | LOCK_NB);
+
+    size_t length = __atomic_load_n(&sink.control->length, __ATOMIC_ACQUIRE);
+    if (length > sink.capacity) length = sink.capacity;
+
+    //* Lines reserved past the end of a full segment leave zeros after the last written one.
+    while (length && !sink.data[length - 1]) --length;
+
+    bool status = !munmap(sink.data, sink.capacity + sizeof(*sink.control));
+    if (last) status = !ftruncate(sink.descriptor, (off_t)length) && status;
+    status = !close(sink.descriptor) && status;
+
+    sink.data = NULL;
+    sink.control = NULL;
+    sink.descriptor = -1;
+    sink.capacity = 0;
+
+    return status;
+}
+
+static void log_open_file() {
+    logfile = fopen(sink.name, "a");
+    if (!logfile) return;
+
+    setvbuf(logfile, NULL, _IONBF, 1);
+
+    //* Special files (terminals, pipes) are never rotated.
+    struct stat info = {};
+    bool regular = !fstat(fileno(logfile), &info) && S_ISREG(info.st_mode);
+    sink.length = regular ? (size_t)info.st_size : 0;
+    sink.capacity = regular ? sink.segment_size : 0;
+}
+
+static void log_rotate() {
+    //* Files are shifted by the first process to find the segment full, the others only open the new one.
+    if (sink.data) log_lock_segment(true);
+
+    if (!sink.data || log_segment_current()) {
+        const size_t name_size = strlen(sink.name) + 16;
+        char* older = (char*)calloc(name_size, sizeof(*older));
+        char* newer = (char*)calloc(name_size, sizeof(*newer));
+
+        if (older && newer) {
+            //* Segment i is renamed to i + 1, replacing the oldest one.
+            for (unsigned int index = sink.segment_count - 1; index > 0; --index) {
+                snprintf(older, name_size, "%s.%u", sink.name, index);
+                if (index > 1) snprintf(newer, name_size, "%s.%u", sink.name, index - 1);
+                else           snprintf(newer, name_size, "%s", sink.name);
+                rename(newer, older);
+            }
+        }
+
+        free(older);
+        free(newer);
+
+        //* Current name is freed even if it could not be shifted, so the new segment always starts empty.
+        unlink(sink.name);
+    }
+
+    if (sink.data) log_lock_segment(false);
+
+    if (sink.data) log_unmap_segment();
+
+    if (logfile) fclose(logfile);
+    logfile = NULL;
+
+    if (!log_map_segment()) log_open_file();
+}
+
+static void log_lock_segment(const bool locked) {
+    struct flock lock = {};
+    lock.l_type = locked ? F_WRLCK : F_UNLCK;
+    lock.l_whence = SEEK_SET;
+
+    while (fcntl(sink.descriptor, F_SETLKW, &lock) && errno == EINTR) {}
+}
+
+static bool log_segment_current() {
+    struct stat info = {};
+    return !stat(sink.name, &info) && info.st_dev == sink.device && info.st_ino == sink.inode;
 }
 
 void log_close(int* error_code) {
-    if (!log_file()) return;
+    if (!sink.data && !logfile) return;
     log_printf(ABSOLUTE_IMPORTANCE, "close", "Closing log file.\n\n");
-    if (!fclose(logfile)) {
-        if (error_code) *error_code = FILE_ERROR;
-    }
+
+    pthread_mutex_lock(&log_mutex);
+
+    bool status = true;
+    if (sink.data) status = log_unmap_segment();
+    if (logfile) status = !fclose(logfile) && status;
+    logfile = NULL;
+
+    free(sink.name);
+    sink.name = NULL;
+
+    pthread_mutex_unlock(&log_mutex);
+
+    if (!status && error_code) *error_code = FILE_ERROR;
 }
\ No newline at end of file
@@ -13,6 +13,17 @@
 #define LOGGER_H
 
 #include <stdio.h>
+#include <stddef.h>
+
+//* Size of one preallocated log segment in bytes.
+#ifndef LOG_SEGMENT_SIZE
+#define LOG_SEGMENT_SIZE (16 << 20)
+#endif
+
+//* Number of log segments kept on disk (the current one and LOG_SEGMENT_COUNT - 1 rotated ones).
+#ifndef LOG_SEGMENT_COUNT
+#define LOG_SEGMENT_COUNT 4
+#endif
 
 enum IMPORTANCES {
     DATA_UPDATES = 0,
@@ -64,12 +75,20 @@ enum IMPORTANCES {
 
 /**
  * @brief Open log file or creates empty one.
+ * Regular files are preallocated and mapped into memory, so lines are copied without write() calls
+ * and stay in the file even if the program crashes. When the segment is full it is renamed to
+ * filename.1 (older segments are shifted to filename.2, ... and the oldest one is removed).
+ * Several processes may log into the same file: each line is reserved by an atomic addition to the length
+ * kept in a control block after the text of the segment.
  * 
  * @param filename (optional) log file name
  * @param threshold (optional) value, below which porgramm would print log lines into dummy file.
  * @param error_code (optional) variable to put function execution code in
+ * @param segment_size (optional) size of one log segment in bytes
+ * @param segment_count (optional) number of segments to keep
  */
-void log_init(const char* filename = "log", const unsigned int threshold = 0, int* error_code = NULL);
+void log_init(const char* filename = "log", const unsigned int threshold = 0, int* error_code = NULL,
+              const size_t segment_size = LOG_SEGMENT_SIZE, const unsigned int segment_count = LOG_SEGMENT_COUNT);
 
 /**
  * @brief Print line to logs with automatic prefix.
@@ -82,7 +101,7 @@ void log_init(const char* filename = "log", const unsigned int threshold = 0, in
 void _log_printf(const unsigned int importance, const char* tag, const char* format, ...);
 
 /**
- * @brief Close opened log file.
+ * @brief Close opened log file, cutting the unused preallocated tail off.
  * 
  * @param error_code (optional) variable to put function execution code in
  */
@@ -0,0 +1,233 @@
+#include "tracer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "debug.h"
+#include "../clock.h"
+
+/**
+ * @brief Recorded event.
+ *
+ * @param name name of the event
+ * @param time time since the start of tracing in nanoseconds
+ * @param phase 'B' for beginning and 'E' for end of the event
+ */
+struct TraceEvent {
+    const char* name;
+    uint64_t time;
+    char phase;
+};
+
+/**
+ * @brief Block of the per-thread event buffer.
+ *
+ * @param events recorded events
+ * @param count number of recorded events
+ * @param next next block of the same thread
+ */
+struct TraceBlock {
+    TraceEvent events[TRACE_BLOCK_SIZE];
+    size_t count;
+    TraceBlock* next;
+};
+
+/**
+ * @brief Events of one thread.
+ *
+ * @param thread_id id of the thread in the trace
+ * @param generation number of the trace the events were recorded for
+ * @param first first block of events
+ * @param last block events are being added to
+ * @param next buffer of the next thread
+ */
+struct TraceBuffer {
+    int thread_id;
+    unsigned generation;
+    TraceBlock* first;
+    TraceBlock* last;
+    TraceBuffer* next;
+};
+
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static TraceBuffer* trace_buffers = NULL;
+static int trace_thread_count = 0;
+static unsigned trace_generation = 0;
+
+static bool trace_active = false;
+static uint64_t trace_start_time = 0;
+static char* trace_filename = NULL;
+
+static __thread TraceBuffer* thread_buffer = NULL;
+
+/**
+ * @brief Get buffer of the current thread, registering it on the first call.
+ *
+ * @return TraceBuffer* (NULL if it could not be allocated)
+ */
+static TraceBuffer* trace_thread_buffer();
+
+/**
+ * @brief Empty buffer of the current thread if it holds events of the previous trace.
+ *
+ * @param buffer buffer of the current thread
+ */
+static void trace_renew_buffer(TraceBuffer* buffer);
+
+/**
+ * @brief Append event to the buffer of the current thread.
+ *
+ * @param name name of the event
+ * @param phase phase of the event
+ */
+static inline void trace_record(const char* name, const char phase);
+
+/**
+ * @brief Write events that threads recorded for the current trace into the file.
+ *
+ * @param output file to write into
+ */
+static void trace_write(FILE* output);
+
+void trace_start(const char* filename, int* const err_code) {
+    _LOG_FAIL_CHECK_(filename, "error", ERROR_REPORTS, return, err_code, EFAULT);
+
+    pthread_mutex_lock(&trace_mutex);
+
+    free(trace_filename);
+    trace_filename = strdup(filename);
+    bool started = trace_filename != NULL;
+
+    __atomic_store_n(&trace_start_time, clock_ns(), __ATOMIC_RELAXED);
+    __atomic_store_n(&trace_generation, trace_generation + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&trace_active, started, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(&trace_mutex);
+
+    _LOG_FAIL_CHECK_(started, "error", ERROR_REPORTS, return, err_code, ENOMEM);
+}
+
+void trace_stop(int* const err_code) {
+    pthread_mutex_lock(&trace_mutex);
+
+    if (!trace_active) {
+        pthread_mutex_unlock(&trace_mutex);
+        return;
+    }
+
+    __atomic_store_n(&trace_active, false, __ATOMIC_RELEASE);
+
+    FILE* output = fopen(trace_filename, "w");
+    if (output) {
+        trace_write(output);
+        fclose(output);
+    }
+
+    pthread_mutex_unlock(&trace_mutex);
+
+    _LOG_FAIL_CHECK_(output, "error", ERROR_REPORTS, return, err_code, FILE_ERROR);
+}
+
+void trace_end_program() {
+    trace_stop();
+}
+
+void trace_begin(const char* name) {
+    if (__atomic_load_n(&trace_active, __ATOMIC_ACQUIRE)) trace_record(name, 'B');
+}
+
+void trace_end(const char* name) {
+    if (__atomic_load_n(&trace_active, __ATOMIC_ACQUIRE)) trace_record(name, 'E');
+}
+
+static TraceBuffer* trace_thread_buffer() {
+    if (thread_buffer) return thread_buffer;
+
+    TraceBuffer* buffer = (TraceBuffer*)calloc(1, sizeof(*buffer));
+    if (!buffer) return NULL;
+
+    //* Buffers are never freed, so threads that exit before trace_stop() keep their events.
+    pthread_mutex_lock(&trace_mutex);
+    buffer->thread_id = ++trace_thread_count;
+    buffer->generation = trace_generation;
+    buffer->next = trace_buffers;
+    trace_buffers = buffer;
+    pthread_mutex_unlock(&trace_mutex);
+
+    return thread_buffer = buffer;
+}
+
+static inline void trace_record(const char* name, const char phase) {
+    TraceBuffer* buffer = trace_thread_buffer();
+    if (!buffer) return;
+
+    if (buffer->generation != __atomic_load_n(&trace_generation, __ATOMIC_ACQUIRE)) trace_renew_buffer(buffer);
+
+    TraceBlock* block = buffer->last;
+    if (block && block->count == TRACE_BLOCK_SIZE && block->next) {
+        //* Blocks emptied by trace_renew_buffer() are filled again before new ones are allocated.
+        block = buffer->last = block->next;
+    } else if (!block || block->count == TRACE_BLOCK_SIZE) {
+        TraceBlock* new_block = (TraceBlock*)calloc(1, sizeof(*new_block));
+        if (!new_block) return;
+
+        pthread_mutex_lock(&trace_mutex);
+        if (block) block->next = new_block;
+        else       buffer->first = new_block;
+        buffer->last = new_block;
+        pthread_mutex_unlock(&trace_mutex);
+
+        block = new_block;
+    }
+
+    block->events[block->count] = (TraceEvent){
+        .name = name,
+        .time = clock_ns() - __atomic_load_n(&trace_start_time, __ATOMIC_RELAXED),
+        .phase = phase,
+    };
+
+    __atomic_store_n(&block->count, block->count + 1, __ATOMIC_RELEASE);
+}
+
+static void trace_renew_buffer(TraceBuffer* buffer) {
+    //* Only the owner thread empties its blocks, and the lock keeps trace_write() from reading them meanwhile.
+    pthread_mutex_lock(&trace_mutex);
+
+    for (TraceBlock* block = buffer->first; block; block = block->next)
+        __atomic_store_n(&block->count, 0, __ATOMIC_RELEASE);
+
+    buffer->last = buffer->first;
+    buffer->generation = trace_generation;
+
+    pthread_mutex_unlock(&trace_mutex);
+}
+
+static void trace_write(FILE* output) {
+    int process_id = (int)getpid();
+    bool first_event = true;
+
+    fprintf(output, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+
+    for (TraceBuffer* buffer = trace_buffers; buffer; buffer = buffer->next) {
+        //* Threads that recorded nothing since trace_start() still hold events of an earlier trace.
+        if (buffer->generation != trace_generation) continue;
+
+        for (TraceBlock* block = buffer->first; block; block = block->next) {
+            size_t count = __atomic_load_n(&block->count, __ATOMIC_ACQUIRE);
+
+            for (size_t index = 0; index < count; ++index) {
+                const TraceEvent* event = block->events + index;
+                fprintf(output, "%s{\"name\": \"%s\", \"ph\": \"%c\", \"ts\": %.3lf, \"pid\": %d, \"tid\": %d}",
+                        first_event ? "" : ",\n", event->name, event->phase, (double)event->time / 1000.0,
+                        process_id, buffer->thread_id);
+                first_event = false;
+            }
+        }
+    }
+
+    fprintf(output, "\n]}\n");
+}
\ No newline at end of file
@@ -0,0 +1,95 @@
+/**
+ * @file tracer.h
+ * @author Ilya Kudryashov (kudriashov.it@phystech.edu)
+ * @brief Timeline of traced operations in Chrome trace-event format.
+ * Tracing is compiled only if TRACE is defined, otherwise all macros expand to nothing.
+ * @version 0.1
+ * @date 2022-10-14
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef TRACE
+#define ON_TRACE(...) __VA_ARGS__
+#else
+#define ON_TRACE(...)
+#endif
+
+//* Number of events in one block of the per-thread buffer.
+#ifndef TRACE_BLOCK_SIZE
+#define TRACE_BLOCK_SIZE 4096
+#endif
+
+/**
+ * @brief Start recording events.
+ *
+ * @param filename name of the JSON file events are written into by trace_stop()
+ * @param err_code variable to use as errno
+ */
+void trace_start(const char* filename, int* const err_code = NULL);
+
+/**
+ * @brief Stop recording and write all recorded events into the file.
+ * Events that traced threads record while the file is written are lost.
+ *
+ * @param err_code variable to use as errno
+ */
+void trace_stop(int* const err_code = NULL);
+
+/**
+ * @brief Stop tracing at exit (for atexit()).
+ */
+void trace_end_program();
+
+/**
+ * @brief Record beginning of the event in the current thread.
+ *
+ * @param name name of the event (must stay valid until trace_stop())
+ */
+void trace_begin(const char* name);
+
+/**
+ * @brief Record end of the event in the current thread.
+ *
+ * @param name name of the event
+ */
+void trace_end(const char* name);
+
+/**
+ * @brief Event spanning the lifetime of the object.
+ *
+ * @param name name of the event
+ */
+struct TraceScope {
+    const char* name;
+    explicit TraceScope(const char* scope_name) : name(scope_name) { trace_begin(name); }
+    ~TraceScope() { trace_end(name); }
+};
+
+#define _TRACE_CONCAT(left, right) left##right
+#define _TRACE_SCOPE_NAME(line) _TRACE_CONCAT(_trace_scope_, line)
+
+#ifdef TRACE
+/**
+ * @brief Trace the rest of the enclosing block as one event.
+ *
+ * @param name name of the event
+ */
+#define TRACE_SCOPE(name) TraceScope _TRACE_SCOPE_NAME(__LINE__)(name)
+#else
+/**
+ * @brief (DISABLED) Trace the rest of the enclosing block as one event.
+ *
+ * @param name name of the event
+ */
+#define TRACE_SCOPE(name) do {} while (0)
+#endif
+
+#endif
\ No newline at end of file
@@ -0,0 +1,76 @@
+#include "histogram.h"
+
+/**
+ * @brief Get index of the bucket the value belongs to.
+ *
+ * @param value
+ * @return int
+ */
+static inline int bucket_index(const uint64_t value);
+
+/**
+ * @brief Get biggest value that belongs to the bucket.
+ *
+ * @param index index of the bucket
+ * @return uint64_t
+ */
+static inline uint64_t bucket_upper_bound(const int index);
+
+void histogram_record(Histogram* const histogram, const uint64_t value) {
+    ++histogram->counts[bucket_index(value)];
+    ++histogram->total;
+    histogram->sum += value;
+    if (value < histogram->min) histogram->min = value;
+    if (value > histogram->max) histogram->max = value;
+}
+
+void histogram_merge(Histogram* const destination, const Histogram* const source) {
+    for (int index = 0; index < HISTOGRAM_BUCKET_COUNT; ++index) {
+        destination->counts[index] += source->counts[index];
+    }
+    destination->total += source->total;
+    destination->sum += source->sum;
+    if (source->min < destination->min) destination->min = source->min;
+    if (source->max > destination->max) destination->max = source->max;
+}
+
+uint64_t histogram_percentile(const Histogram* const histogram, const double percentile) {
+    if (!histogram->total) return 0;
+
+    uint64_t rank = (uint64_t)(percentile / 100.0 * (double)histogram->total);
+    if (rank >= histogram->total) rank = histogram->total - 1;
+
+    uint64_t passed = 0;
+    for (int index = 0; index < HISTOGRAM_BUCKET_COUNT; ++index) {
+        passed += histogram->counts[index];
+        if (passed > rank) {
+            uint64_t bound = bucket_upper_bound(index);
+            return bound < histogram->max ? bound : histogram->max;
+        }
+    }
+
+    return histogram->max;
+}
+
+double histogram_mean(const Histogram* const histogram) {
+    if (!histogram->total) return 0;
+    return (double)histogram->sum / (double)histogram->total;
+}
+
+static inline int bucket_index(const uint64_t value) {
+    if (value < (uint64_t)HISTOGRAM_SUB_COUNT) return (int)value;
+
+    //* Values in [2^k, 2^(k+1)) are split into HISTOGRAM_SUB_COUNT buckets of equal width.
+    int exponent = 63 - __builtin_clzll(value);
+    int shift = exponent - HISTOGRAM_SUB_BITS;
+    int sub_index = (int)(value >> shift) - HISTOGRAM_SUB_COUNT;
+    return (shift + 1) * HISTOGRAM_SUB_COUNT + sub_index;
+}
+
+static inline uint64_t bucket_upper_bound(const int index) {
+    if (index < HISTOGRAM_SUB_COUNT) return (uint64_t)index;
+
+    int shift = index / HISTOGRAM_SUB_COUNT - 1;
+    uint64_t sub_index = (uint64_t)(index % HISTOGRAM_SUB_COUNT) + HISTOGRAM_SUB_COUNT;
+    return ((sub_index + 1) << shift) - 1;
+}
\ No newline at end of file
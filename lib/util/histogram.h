@@ -0,0 +1,73 @@
+/**
+ * @file histogram.h
+ * @author Ilya Kudryashov (kudriashov.it@phystech.edu)
+ * @brief Log-linear latency histogram with bounded relative error.
+ * @version 0.1
+ * @date 2022-10-12
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <cstddef>
+#include <cstdint>
+
+//* Each power of two is split into 2^HISTOGRAM_SUB_BITS buckets, so values are recorded with ~1.5% precision.
+static const int HISTOGRAM_SUB_BITS = 6;
+static const int HISTOGRAM_SUB_COUNT = 1 << HISTOGRAM_SUB_BITS;
+static const int HISTOGRAM_BUCKET_COUNT = (64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_COUNT;
+
+/**
+ * @brief Histogram of non-negative integer values.
+ *
+ * @param counts number of values in each bucket
+ * @param total number of recorded values
+ * @param sum sum of recorded values
+ * @param min smallest recorded value
+ * @param max biggest recorded value
+ */
+struct Histogram {
+    uint64_t counts[HISTOGRAM_BUCKET_COUNT] = {};
+    uint64_t total = 0;
+    uint64_t sum = 0;
+    uint64_t min = UINT64_MAX;
+    uint64_t max = 0;
+};
+
+/**
+ * @brief Add value to the histogram.
+ *
+ * @param histogram
+ * @param value
+ */
+void histogram_record(Histogram* const histogram, const uint64_t value);
+
+/**
+ * @brief Add all values of one histogram to another.
+ *
+ * @param destination histogram to add values to
+ * @param source histogram to take values from
+ */
+void histogram_merge(Histogram* const destination, const Histogram* const source);
+
+/**
+ * @brief Get value below which the specified percentage of recorded values lies.
+ *
+ * @param histogram
+ * @param percentile percentage in range [0, 100]
+ * @return uint64_t upper bound of the bucket containing the percentile
+ */
+uint64_t histogram_percentile(const Histogram* const histogram, const double percentile);
+
+/**
+ * @brief Get mean of recorded values.
+ *
+ * @param histogram
+ * @return double
+ */
+double histogram_mean(const Histogram* const histogram);
+
+#endif
\ No newline at end of file
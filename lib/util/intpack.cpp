@@ -0,0 +1,68 @@
+#include "intpack.h"
+
+#include <string.h>
+
+size_t intpack_bound(const size_t count) {
+    //* Varint of the first value, width of deltas and deltas themselves (plus slack for 8-byte stores).
+    return INTPACK_VARINT_MAX + 1 + count * sizeof(uint64_t) + sizeof(uint64_t);
+}
+
+size_t intpack_encode(const long long* values, const size_t count, unsigned char* output) {
+    if (!count) return 0;
+
+    size_t length = intpack_put_varint(intpack_zigzag(values[0]), output);
+
+    uint64_t deltas_or = 0;
+    for (size_t index = 1; index < count; ++index) {
+        deltas_or |= intpack_zigzag((long long)((uint64_t)values[index] - (uint64_t)values[index - 1]));
+    }
+
+    unsigned int width = deltas_or ? 64 - (unsigned int)__builtin_clzll(deltas_or) : 0;
+    output[length++] = (unsigned char)width;
+    if (!width) return length;
+
+    //* Deltas are appended to the little-endian bit accumulator and flushed byte by byte.
+    unsigned __int128 accumulator = 0;
+    unsigned int bits = 0;
+    for (size_t index = 1; index < count; ++index) {
+        uint64_t delta = intpack_zigzag((long long)((uint64_t)values[index] - (uint64_t)values[index - 1]));
+        accumulator |= (unsigned __int128)delta << bits;
+        bits += width;
+        while (bits >= 8) {
+            output[length++] = (unsigned char)accumulator;
+            accumulator >>= 8;
+            bits -= 8;
+        }
+    }
+    if (bits) output[length++] = (unsigned char)accumulator;
+
+    return length;
+}
+
+void intpack_decode(const unsigned char* input, const size_t count, long long* values) {
+    if (!count) return;
+
+    uint64_t base = 0;
+    input += intpack_get_varint(input, INTPACK_VARINT_MAX, &base);
+
+    uint64_t value = (uint64_t)intpack_unzigzag(base);
+    values[0] = (long long)value;
+
+    unsigned int width = *input++;
+    uint64_t mask = width == 64 ? UINT64_MAX : ((uint64_t)1 << width) - 1;
+
+    unsigned __int128 accumulator = 0;
+    unsigned int bits = 0;
+    for (size_t index = 1; index < count; ++index) {
+        while (bits < width) {
+            accumulator |= (unsigned __int128)*input++ << bits;
+            bits += 8;
+        }
+
+        value += (uint64_t)intpack_unzigzag((uint64_t)accumulator & mask);
+        values[index] = (long long)value;
+
+        accumulator >>= width;
+        bits -= width;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,103 @@
+/**
+ * @file intpack.h
+ * @author Ilya Kudryashov (kudriashov.it@phystech.edu)
+ * @brief Compact encoding of integer blocks (zigzag deltas packed with the width of the biggest one).
+ * @version 0.1
+ * @date 2022-10-15
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef INTPACK_H
+#define INTPACK_H
+
+#include <cstddef>
+#include <cstdint>
+
+//* Maximum length of a 64-bit number in LEB128 encoding.
+static const size_t INTPACK_VARINT_MAX = 10;
+
+/**
+ * @brief Get maximum number of bytes the block can be encoded into.
+ *
+ * @param count number of values in the block
+ * @return size_t
+ */
+size_t intpack_bound(const size_t count);
+
+/**
+ * @brief Encode block of values.
+ * Small and nearly monotonic values take a few bits each.
+ *
+ * @param values values to encode
+ * @param count number of values
+ * @param output buffer of at least intpack_bound(count) bytes
+ * @return size_t number of written bytes
+ */
+size_t intpack_encode(const long long* values, const size_t count, unsigned char* output);
+
+/**
+ * @brief Decode block of values.
+ *
+ * @param input encoded block
+ * @param count number of values in the block
+ * @param values array to put values into
+ */
+void intpack_decode(const unsigned char* input, const size_t count, long long* values);
+
+/**
+ * @brief Map signed value to unsigned so that values close to zero get small codes.
+ *
+ * @param value
+ * @return uint64_t
+ */
+static inline uint64_t intpack_zigzag(const long long value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+/**
+ * @brief Inverse of intpack_zigzag().
+ *
+ * @param code
+ * @return long long
+ */
+static inline long long intpack_unzigzag(const uint64_t code) {
+    return (long long)((code >> 1) ^ (~(code & 1) + 1));
+}
+
+/**
+ * @brief Write number in LEB128 encoding.
+ *
+ * @param value number to write
+ * @param output buffer of at least INTPACK_VARINT_MAX bytes
+ * @return size_t number of written bytes
+ */
+static inline size_t intpack_put_varint(uint64_t value, unsigned char* output) {
+    size_t length = 0;
+    while (value >= 0x80) {
+        output[length++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    output[length++] = (unsigned char)value;
+    return length;
+}
+
+/**
+ * @brief Read number in LEB128 encoding.
+ *
+ * @param input encoded number
+ * @param length number of available bytes
+ * @param value variable to put the number into
+ * @return size_t number of read bytes (0 if the number is incomplete or too long)
+ */
+static inline size_t intpack_get_varint(const unsigned char* input, const size_t length, uint64_t* const value) {
+    *value = 0;
+    for (size_t index = 0; index < length && index < INTPACK_VARINT_MAX; ++index) {
+        *value |= (uint64_t)(input[index] & 0x7F) << (7 * index);
+        if (!(input[index] & 0x80)) return index + 1;
+    }
+    return 0;
+}
+
+#endif
\ No newline at end of file
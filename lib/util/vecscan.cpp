@@ -0,0 +1,235 @@
+#include "vecscan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define VECSCAN_X86
+#include <immintrin.h>
+#endif
+
+/**
+ * @brief Set of kernels for one instruction set.
+ *
+ * @param isa name of the instruction set
+ */
+struct VecscanKernels {
+    const char* isa;
+    size_t (*find_last)(const long long* values, const size_t count, const long long value);
+    size_t (*count)(const long long* values, const size_t count, const long long value);
+    long long (*sum)(const long long* values, const size_t count);
+    long long (*min)(const long long* values, const size_t count);
+    long long (*max)(const long long* values, const size_t count);
+};
+
+/**
+ * @brief Get kernels for the processor the program runs on, they are chosen on the first call.
+ *
+ * @return const VecscanKernels*
+ */
+static const VecscanKernels* vecscan_kernels();
+
+static size_t find_last_scalar(const long long* values, const size_t count, const long long value);
+static size_t count_scalar(const long long* values, const size_t count, const long long value);
+static long long sum_scalar(const long long* values, const size_t count);
+static long long min_scalar(const long long* values, const size_t count);
+static long long max_scalar(const long long* values, const size_t count);
+
+static const VecscanKernels VECSCAN_SCALAR = {
+    "scalar", find_last_scalar, count_scalar, sum_scalar, min_scalar, max_scalar,
+};
+
+#ifdef VECSCAN_X86
+
+__attribute__((target("avx2"))) static size_t find_last_avx2(const long long* values, const size_t count,
+                                                              const long long value);
+__attribute__((target("avx2"))) static size_t count_avx2(const long long* values, const size_t count,
+                                                          const long long value);
+__attribute__((target("avx2"))) static long long sum_avx2(const long long* values, const size_t count);
+__attribute__((target("avx2"))) static long long min_avx2(const long long* values, const size_t count);
+__attribute__((target("avx2"))) static long long max_avx2(const long long* values, const size_t count);
+
+static const VecscanKernels VECSCAN_AVX2 = {
+    "avx2", find_last_avx2, count_avx2, sum_avx2, min_avx2, max_avx2,
+};
+
+#endif
+
+size_t vecscan_find_last(const long long* values, const size_t count, const long long value) {
+    return vecscan_kernels()->find_last(values, count, value);
+}
+
+size_t vecscan_count(const long long* values, const size_t count, const long long value) {
+    return vecscan_kernels()->count(values, count, value);
+}
+
+long long vecscan_sum(const long long* values, const size_t count) {
+    return vecscan_kernels()->sum(values, count);
+}
+
+long long vecscan_min(const long long* values, const size_t count) {
+    return vecscan_kernels()->min(values, count);
+}
+
+long long vecscan_max(const long long* values, const size_t count) {
+    return vecscan_kernels()->max(values, count);
+}
+
+const char* vecscan_isa() {
+    return vecscan_kernels()->isa;
+}
+
+static const VecscanKernels* vecscan_kernels() {
+#ifdef VECSCAN_X86
+    //* Initialization of a local static is done once even if several threads get here at the same time.
+    static const VecscanKernels* kernels = (__builtin_cpu_init(), __builtin_cpu_supports("avx2")) ?
+                                           &VECSCAN_AVX2 : &VECSCAN_SCALAR;
+    return kernels;
+#else
+    return &VECSCAN_SCALAR;
+#endif
+}
+
+static size_t find_last_scalar(const long long* values, const size_t count, const long long value) {
+    for (size_t index = count; index > 0; --index) {
+        if (values[index - 1] == value) return index - 1;
+    }
+    return count;
+}
+
+static size_t count_scalar(const long long* values, const size_t count, const long long value) {
+    size_t matches = 0;
+    for (size_t index = 0; index < count; ++index) matches += values[index] == value;
+    return matches;
+}
+
+static long long sum_scalar(const long long* values, const size_t count) {
+    //* Unsigned arithmetic wraps around without undefined behaviour.
+    uint64_t sum = 0;
+    for (size_t index = 0; index < count; ++index) sum += (uint64_t)values[index];
+    return (long long)sum;
+}
+
+static long long min_scalar(const long long* values, const size_t count) {
+    long long min = values[0];
+    for (size_t index = 1; index < count; ++index) if (values[index] < min) min = values[index];
+    return min;
+}
+
+static long long max_scalar(const long long* values, const size_t count) {
+    long long max = values[0];
+    for (size_t index = 1; index < count; ++index) if (values[index] > max) max = values[index];
+    return max;
+}
+
+#ifdef VECSCAN_X86
+
+//* AVX2 kernels process two vectors of four values per iteration, leftovers are handled by the scalar kernels.
+
+__attribute__((target("avx2"))) static size_t find_last_avx2(const long long* values, const size_t count,
+                                                              const long long value) {
+    const __m256i needle = _mm256_set1_epi64x(value);
+
+    //* Search goes from the end, so the leftovers at the end are checked first.
+    size_t end = count - count % 8;
+    size_t tail = find_last_scalar(values + end, count - end, value);
+    if (tail != count - end) return end + tail;
+
+    for (; end; end -= 8) {
+        __m256i low = _mm256_loadu_si256((const __m256i*)(values + end - 8));
+        __m256i high = _mm256_loadu_si256((const __m256i*)(values + end - 4));
+
+        int low_mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(low, needle)));
+        int high_mask = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(high, needle)));
+
+        unsigned int mask = (unsigned int)low_mask | (unsigned int)high_mask << 4;
+        if (mask) return end - 8 + (size_t)(31 - __builtin_clz(mask));
+    }
+
+    return count;
+}
+
+__attribute__((target("avx2"))) static size_t count_avx2(const long long* values, const size_t count,
+                                                          const long long value) {
+    const __m256i needle = _mm256_set1_epi64x(value);
+    __m256i low_matches = _mm256_setzero_si256(), high_matches = _mm256_setzero_si256();
+
+    size_t index = 0;
+    for (; index + 8 <= count; index += 8) {
+        //* Equal lanes are all ones, which is -1, so subtracting the mask counts them.
+        low_matches = _mm256_sub_epi64(low_matches, _mm256_cmpeq_epi64(
+                                       _mm256_loadu_si256((const __m256i*)(values + index)), needle));
+        high_matches = _mm256_sub_epi64(high_matches, _mm256_cmpeq_epi64(
+                                        _mm256_loadu_si256((const __m256i*)(values + index + 4)), needle));
+    }
+
+    long long lanes[4] = {};
+    _mm256_storeu_si256((__m256i*)lanes, _mm256_add_epi64(low_matches, high_matches));
+
+    return (size_t)(lanes[0] + lanes[1] + lanes[2] + lanes[3]) + count_scalar(values + index, count - index, value);
+}
+
+__attribute__((target("avx2"))) static long long sum_avx2(const long long* values, const size_t count) {
+    __m256i low_sum = _mm256_setzero_si256(), high_sum = _mm256_setzero_si256();
+
+    size_t index = 0;
+    for (; index + 8 <= count; index += 8) {
+        low_sum = _mm256_add_epi64(low_sum, _mm256_loadu_si256((const __m256i*)(values + index)));
+        high_sum = _mm256_add_epi64(high_sum, _mm256_loadu_si256((const __m256i*)(values + index + 4)));
+    }
+
+    long long lanes[4] = {};
+    _mm256_storeu_si256((__m256i*)lanes, _mm256_add_epi64(low_sum, high_sum));
+
+    return (long long)((uint64_t)sum_scalar(lanes, 4) + (uint64_t)sum_scalar(values + index, count - index));
+}
+
+__attribute__((target("avx2"))) static long long min_avx2(const long long* values, const size_t count) {
+    if (count < 8) return min_scalar(values, count);
+
+    //* AVX2 has no 64-bit minimum, so it is made of a comparison and a blend.
+    __m256i low_min = _mm256_loadu_si256((const __m256i*)values);
+    __m256i high_min = _mm256_loadu_si256((const __m256i*)(values + 4));
+
+    size_t index = 8;
+    for (; index + 8 <= count; index += 8) {
+        __m256i low = _mm256_loadu_si256((const __m256i*)(values + index));
+        __m256i high = _mm256_loadu_si256((const __m256i*)(values + index + 4));
+        low_min = _mm256_blendv_epi8(low_min, low, _mm256_cmpgt_epi64(low_min, low));
+        high_min = _mm256_blendv_epi8(high_min, high, _mm256_cmpgt_epi64(high_min, high));
+    }
+
+    long long lanes[4] = {};
+    _mm256_storeu_si256((__m256i*)lanes, _mm256_blendv_epi8(low_min, high_min, _mm256_cmpgt_epi64(low_min, high_min)));
+
+    long long min = min_scalar(lanes, 4);
+    if (index < count) {
+        long long tail = min_scalar(values + index, count - index);
+        if (tail < min) min = tail;
+    }
+    return min;
+}
+
+__attribute__((target("avx2"))) static long long max_avx2(const long long* values, const size_t count) {
+    if (count < 8) return max_scalar(values, count);
+
+    __m256i low_max = _mm256_loadu_si256((const __m256i*)values);
+    __m256i high_max = _mm256_loadu_si256((const __m256i*)(values + 4));
+
+    size_t index = 8;
+    for (; index + 8 <= count; index += 8) {
+        __m256i low = _mm256_loadu_si256((const __m256i*)(values + index));
+        __m256i high = _mm256_loadu_si256((const __m256i*)(values + index + 4));
+        low_max = _mm256_blendv_epi8(low_max, low, _mm256_cmpgt_epi64(low, low_max));
+        high_max = _mm256_blendv_epi8(high_max, high, _mm256_cmpgt_epi64(high, high_max));
+    }
+
+    long long lanes[4] = {};
+    _mm256_storeu_si256((__m256i*)lanes, _mm256_blendv_epi8(low_max, high_max, _mm256_cmpgt_epi64(high_max, low_max)));
+
+    long long max = max_scalar(lanes, 4);
+    if (index < count) {
+        long long tail = max_scalar(values + index, count - index);
+        if (tail > max) max = tail;
+    }
+    return max;
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,73 @@
+/**
+ * @file vecscan.h
+ * @author Ilya Kudryashov (kudriashov.it@phystech.edu)
+ * @brief Search and reduction kernels over arrays of long integers.
+ * AVX2 versions are selected at runtime if the processor supports them, scalar versions are used otherwise.
+ * @version 0.1
+ * @date 2022-10-16
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#ifndef VECSCAN_H
+#define VECSCAN_H
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief Find the last occurrence of the value.
+ *
+ * @param values array to search in
+ * @param count number of values
+ * @param value value to find
+ * @return index of the last occurrence or count if there is none
+ */
+size_t vecscan_find_last(const long long* values, const size_t count, const long long value);
+
+/**
+ * @brief Count occurrences of the value.
+ *
+ * @param values array to search in
+ * @param count number of values
+ * @param value value to count
+ * @return size_t
+ */
+size_t vecscan_count(const long long* values, const size_t count, const long long value);
+
+/**
+ * @brief Calculate sum of the values (wraps around on overflow).
+ *
+ * @param values
+ * @param count
+ * @return long long
+ */
+long long vecscan_sum(const long long* values, const size_t count);
+
+/**
+ * @brief Find the smallest value.
+ *
+ * @param values
+ * @param count number of values (at least 1)
+ * @return long long
+ */
+long long vecscan_min(const long long* values, const size_t count);
+
+/**
+ * @brief Find the biggest value.
+ *
+ * @param values
+ * @param count number of values (at least 1)
+ * @return long long
+ */
+long long vecscan_max(const long long* values, const size_t count);
+
+/**
+ * @brief Get name of the kernel set in use ("avx2" or "scalar").
+ *
+ * @return const char*
+ */
+const char* vecscan_isa();
+
+#endif
\ No newline at end of file
@@ -16,9 +16,13 @@
 #include <ctype.h>
 
 #include "lib/util/dbg/debug.h"
+#include "lib/util/dbg/tracer.h"
 #include "lib/util/argparser.h"
 
 #include "lib/ll_stack.h"
+#include "lib/stackoplog.h"
+#include "lib/stack_vm.h"
+#include "lib/loadgen.h"
 
 /**
  * @brief Print a bunch of owls.
@@ -68,12 +72,31 @@ void print_commands();
  */
 void execute_user_command(LLStack stack, bool* const runtime_status, const char command, int* const err_code = NULL);
 
+/**
+ * @brief Assemble and execute stack machine program.
+ * 
+ * @param filename name of the file with program text
+ * @return int program exit code
+ */
+int run_program(const char* filename);
+
 // Ignore everything less or equaly important as status reports.
 static int log_threshold = STATUS_REPORTS + 1;
 
 static const int NUMBER_OF_OWLS = 10;
 
-static const int NUMBER_OF_TAGS = 2;
+#define STACK_DUMP_FILE "stack_dump.log"
+#define TRACE_FILE "stack_trace.json"
+
+static const size_t PROGRAM_NAME_LENGTH = 4096;
+static char program_name[PROGRAM_NAME_LENGTH] = "";
+static char oplog_name[PROGRAM_NAME_LENGTH] = "";
+static char replica_name[PROGRAM_NAME_LENGTH] = "";
+
+static bool load_mode = false;
+static LoadConfig load_config = {};
+
+static const int NUMBER_OF_TAGS = 14;
 static const struct ActionTag LINE_TAGS[NUMBER_OF_TAGS] = {
     {
         .name = {'O', "owl"}, 
@@ -94,6 +117,119 @@ static const struct ActionTag LINE_TAGS[NUMBER_OF_TAGS] = {
         .description = "sets log threshold to the specified number.\n"
                         "\tDoes not check if integer was specified."
     },
+    {
+        .name = {'R', ""}, 
+        .action = {
+            .parameters = (void*[]) {program_name},
+            .parameters_length = 1, 
+            .function = edit_string,
+        },
+        .description = "runs stack machine program from the specified file (-Rprogram.asm) instead of the console."
+    },
+    {
+        .name = {'W', ""}, 
+        .action = {
+            .parameters = (void*[]) {oplog_name},
+            .parameters_length = 1, 
+            .function = edit_string,
+        },
+        .description = "records every stack operation into the specified file (-Wstack_ops.bin).\n"
+                        "\tThe log can be replayed by the replay program."
+    },
+    {
+        .name = {'M', ""}, 
+        .action = {
+            .parameters = (void*[]) {replica_name},
+            .parameters_length = 1, 
+            .function = edit_string,
+        },
+        .description = "streams every stack operation to the hot standby listening on the Unix socket (-Mstack.sock).\n"
+                        "\tStart the standby first with the -A flag of the replay program."
+    },
+    {
+        .name = {'L', "load"}, 
+        .action = {
+            .parameters = (void*[]) {&load_mode},
+            .parameters_length = 1, 
+            .function = edit_flag,
+        },
+        .description = "runs synthetic workload instead of the console and prints throughput and latencies."
+    },
+    {
+        .name = {'T', ""}, 
+        .action = {
+            .parameters = (void*[]) {&load_config.threads},
+            .parameters_length = 1, 
+            .function = edit_int,
+        },
+        .description = "sets number of workload threads (-T4)."
+    },
+    {
+        .name = {'N', ""}, 
+        .action = {
+            .parameters = (void*[]) {&load_config.operations},
+            .parameters_length = 1, 
+            .function = edit_int,
+        },
+        .description = "sets number of operations each workload thread performs (-N1000000)."
+    },
+    {
+        .name = {'P', ""}, 
+        .action = {
+            .parameters = (void*[]) {&load_config.push_percent},
+            .parameters_length = 1, 
+            .function = edit_int,
+        },
+        .description = "sets percentage of pushes in the workload (-P50)."
+    },
+    {
+        .name = {'G', ""}, 
+        .action = {
+            .parameters = (void*[]) {&load_config.pull_percent},
+            .parameters_length = 1, 
+            .function = edit_int,
+        },
+        .description = "sets percentage of reads of the last element in the workload (-G10).\n"
+                        "\tThe rest of operations are pops."
+    },
+    {
+        .name = {'K', ""}, 
+        .action = {
+            .parameters = (void*[]) {&load_config.stacks},
+            .parameters_length = 1, 
+            .function = edit_int,
+        },
+        .description = "sets number of stacks shared by workload threads (-K1).\n"
+                        "\t0 (default) gives each thread its own stack."
+    },
+    {
+        .name = {'D', ""}, 
+        .action = {
+            .parameters = (void*[]) {&load_config.distribution},
+            .parameters_length = 1, 
+            .function = edit_int,
+        },
+        .description = "sets distribution of pushed values (0 - sequential, 1 - uniform, 2 - small)."
+    },
+    {
+        .name = {'C', ""}, 
+        .action = {
+            .parameters = (void*[]) {&load_config.integrity},
+            .parameters_length = 1, 
+            .function = edit_int,
+        },
+        .description = "sets integrity level of the workload (0 - no checks, 1 - background scanner, 2 - inline checks).\n"
+                        "\tAll levels are compared by default."
+    },
+    {
+        .name = {'F', "combine"}, 
+        .action = {
+            .parameters = (void*[]) {&load_config.combining},
+            .parameters_length = 1, 
+            .function = edit_flag,
+        },
+        .description = "shares workload stacks through flat combining instead of a mutex (use with -K)."
+    },
 };
 
 int main(const int argc, const char** argv) {
@@ -101,8 +237,28 @@ int main(const int argc, const char** argv) {
 
     parse_args(argc, argv, NUMBER_OF_TAGS, LINE_TAGS);
     log_init("program_log.log", log_threshold, &errno);
+
+    ON_TRACE(trace_start(TRACE_FILE, &errno));
+    ON_TRACE(atexit(trace_end_program));
+
+    if (*replica_name) {
+        stack_oplog_connect(replica_name, &errno);
+        atexit(stack_oplog_end_program);
+    } else if (*oplog_name) {
+        stack_oplog_start(oplog_name, &errno);
+        atexit(stack_oplog_end_program);
+    }
+
     print_label();
 
+    if (*program_name) return run_program(program_name);
+
+    if (load_mode) {
+        int load_status = 0;
+        load_run(&load_config, stdout, &load_status);
+        return load_status ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
     const size_t RQ_PREFIX_SIZE = 512;
     char request_prefix[RQ_PREFIX_SIZE] = "";
     strncat(request_prefix, argv[0], sizeof(request_prefix) - 2);
@@ -122,7 +278,7 @@ int main(const int argc, const char** argv) {
     bool program_alive = true;
     while (program_alive) {
 
-        execute_user_command(stack, &program_alive, read_command(request_prefix, "HQPRGD"), &errno);
+        execute_user_command(stack, &program_alive, read_command(request_prefix, "HQPRGDFS"), &errno);
 
         log_printf(STATUS_REPORTS, "status", "Stack status check started...\n");
 
@@ -133,6 +289,8 @@ int main(const int argc, const char** argv) {
             return EXIT_FAILURE;
         }, &errno, EINVAL);
 
+        ll_stack_checkpoint(stack, &errno);
+
         log_printf(STATUS_REPORTS, "status", "Tick ended successfully.\n");
         ll_stack_dump(stack, STATUS_REPORTS);
     }
@@ -142,6 +300,25 @@ int main(const int argc, const char** argv) {
     return EXIT_SUCCESS;
 }
 
+int run_program(const char* filename) {
+    VMProgram program = {};
+    vm_assemble_file(filename, &program, &errno);
+    if (!program.code) {
+        printf("Failed to assemble program %s.\n", filename);
+        return EXIT_FAILURE;
+    }
+
+    LLStack stack = ll_stack_ctor(4, &errno);
+    vm_status_t status = vm_run(&program, stack, VM_FAST);
+    printf("%s\n", VM_STATUS_DESCR[status]);
+
+    ll_stack_checkpoint(stack, &errno);
+    ll_stack_dtor(stack);
+    vm_program_dtor(&program);
+
+    return status == VM_OK ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
 // Офигенно, ничего не менять.
 // Дополнил сову, сорри.
 void print_owl(const int argc, void** argv, const char* argument) {
@@ -206,7 +383,9 @@ void print_commands() {
             "P - push element to the stack\n"
             "R - remove last element of the stack\n"
             "G - get last element in the stack\n"
-            "D - dump stack information to logs\n");
+            "D - dump stack information to logs\n"
+            "F - dump the whole stack to " STACK_DUMP_FILE "\n"
+            "S - search the stack for a value\n");
 }
 
 void execute_user_command(LLStack stack, bool* const runtime_status, const char command, int* const err_code) {
@@ -246,6 +425,27 @@ void execute_user_command(LLStack stack, bool* const runtime_status, const char
             printf("Stack was dumped into logs.\n");
             break;
 
+        case 'F': {
+            StackDumpStream stream = {};
+            dump_stream_open(&stream, STACK_DUMP_FILE, &errno);
+            ll_stack_dump_stream(stack, &stream, STACK_DUMP_TEXT, &errno);
+            dump_stream_close(&stream, &errno);
+            printf("Stack was dumped into " STACK_DUMP_FILE ".\n");
+            break;
+        }
+
+        case 'S': {
+            read_ld("Value to search for -> ", &argument);
+            intptr_t depth = ll_stack_find(stack, argument, &errno);
+            if (depth < 0) {
+                printf("Value is not in the stack.\n");
+                break;
+            }
+            printf("Value is %ld elements below the top, %lu occurrences in total.\n",
+                   (long int)depth, (unsigned long)ll_stack_count(stack, argument, &errno));
+            break;
+        }
+
         default:
             puts("Failed to read command.");
             log_printf(WARNINGS, "warning", "Failed to identify command %c.\n", command);
@@ -0,0 +1,139 @@
+/**
+ * @file replayer.cpp
+ * @author Ilya Kudryashov (kudriashov.it@phystech.edu)
+ * @brief Program for replaying operation logs recorded with the -W flag of the main program
+ * and for following the main program started with -M as its hot standby.
+ * @version 0.1
+ * @date 2022-10-15
+ * 
+ * @copyright Copyright (c) 2022
+ * 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "lib/util/dbg/debug.h"
+#include "lib/util/argparser.h"
+
+#include "lib/ll_stack.h"
+#include "lib/stackoplog.h"
+#include "lib/stackreplay.h"
+
+// Ignore everything less or equaly important as status reports.
+static int log_threshold = STATUS_REPORTS + 1;
+
+static const size_t OPLOG_NAME_LENGTH = 4096;
+static char oplog_name[OPLOG_NAME_LENGTH] = "";
+static char socket_name[OPLOG_NAME_LENGTH] = "";
+
+static bool timed_mode = false;
+static bool unchecked_mode = false;
+
+/**
+ * @brief Follow the leader streaming its operations into the socket and take its stacks over when it exits.
+ * 
+ * @param config replay settings
+ * @param socket_name path of the socket
+ * @return int program exit code
+ */
+int follow_leader(const ReplayConfig* const config, const char* socket_name);
+
+static const int NUMBER_OF_TAGS = 5;
+static const struct ActionTag LINE_TAGS[NUMBER_OF_TAGS] = {
+    {
+        .name = {'I', ""}, 
+        .action = {
+            .parameters = (void*[]) {&log_threshold},
+            .parameters_length = 1, 
+            .function = edit_int,
+        },
+        .description = "sets log threshold to the specified number.\n"
+                        "\tDoes not check if integer was specified."
+    },
+    {
+        .name = {'F', ""}, 
+        .action = {
+            .parameters = (void*[]) {oplog_name},
+            .parameters_length = 1, 
+            .function = edit_string,
+        },
+        .description = "replays operation log from the specified file (-Fstack_ops.bin)."
+    },
+    {
+        .name = {'A', ""}, 
+        .action = {
+            .parameters = (void*[]) {socket_name},
+            .parameters_length = 1, 
+            .function = edit_string,
+        },
+        .description = "waits for the main program started with the same -M socket (-Astack.sock) and follows it,\n"
+                        "\ttaking its stacks over when it exits."
+    },
+    {
+        .name = {'S', "timed"}, 
+        .action = {
+            .parameters = (void*[]) {&timed_mode},
+            .parameters_length = 1, 
+            .function = edit_flag,
+        },
+        .description = "keeps original intervals between operations instead of running at full speed."
+    },
+    {
+        .name = {'U', "unchecked"}, 
+        .action = {
+            .parameters = (void*[]) {&unchecked_mode},
+            .parameters_length = 1, 
+            .function = edit_flag,
+        },
+        .description = "disables inline checks of the replayed stacks."
+    },
+};
+
+int main(const int argc, const char** argv) {
+    atexit(log_end_program);
+
+    parse_args(argc, argv, NUMBER_OF_TAGS, LINE_TAGS);
+    log_init("replay_log.log", log_threshold, &errno);
+
+    if (!*oplog_name && !*socket_name) {
+        printf("Specify operation log to replay with -F or socket to follow with -A (see --help).\n");
+        return EXIT_FAILURE;
+    }
+
+    ReplayConfig config = {};
+    config.filename = oplog_name;
+    config.timed = timed_mode;
+    config.inline_checks = !unchecked_mode;
+
+    if (*socket_name) return follow_leader(&config, socket_name);
+
+    int replay_status = 0;
+    replay_run(&config, stdout, &replay_status);
+
+    return replay_status ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int follow_leader(const ReplayConfig* const config, const char* socket_name) {
+    int accept_status = 0;
+    int input = stack_oplog_accept(socket_name, &accept_status);
+    if (input < 0) {
+        printf("Failed to wait for the leader on %s.\n", socket_name);
+        return EXIT_FAILURE;
+    }
+
+    printf("Leader connected, following it.\n");
+
+    ReplicaStack* stacks = NULL;
+    int follow_status = 0;
+    size_t count = replay_follow(config, input, &stacks, stdout, &follow_status);
+
+    for (size_t index = 0; index < count; ++index) {
+        printf("Stack %u: %lu elements, content hash %llx.\n", stacks[index].handle,
+               (unsigned long)ll_stack_size(stacks[index].stack), ll_stack_content_hash(stacks[index].stack));
+        ll_stack_dtor(stacks[index].stack);
+    }
+    free(stacks);
+
+    return follow_status ? EXIT_FAILURE : EXIT_SUCCESS;
+}
\ No newline at end of file
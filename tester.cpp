@@ -0,0 +1,285 @@
+/**
+ * @file tester.cpp
+ * @author Ilya Kudryashov (kudriashov.it@phystech.edu)
+ * @brief Tests of the scanning kernels, of the integer packing and of the operation log encoding (make test).
+ * @version 0.1
+ * @date 2022-10-19
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <climits>
+
+#include "lib/util/dbg/debug.h"
+
+#include "lib/util/intpack.h"
+#include "lib/stackoplog.h"
+
+//* Kernels of both instruction sets are static, so the scanner is compiled into the tests instead of being linked.
+#include "lib/util/vecscan.cpp"
+
+static const unsigned int TEST_SEED = 20221019;
+static const size_t TEST_ROUNDS = 2000;
+static const size_t TEST_MAX_LENGTH = 300;
+
+static const char TEST_OPLOG_NAME[] = "test_ops.bin";
+
+/**
+ * @brief Test function.
+ *
+ * @return size_t number of failed checks
+ */
+typedef size_t test_function_t();
+
+/**
+ * @brief Compare AVX2 kernels with the scalar ones on random arrays of random lengths and alignments.
+ *
+ * @return size_t number of failed checks
+ */
+static size_t test_vecscan();
+
+/**
+ * @brief Encode and decode random blocks, zigzag codes and varints.
+ *
+ * @return size_t number of failed checks
+ */
+static size_t test_intpack();
+
+/**
+ * @brief Write random operations into the operation log and read them back.
+ *
+ * @return size_t number of failed checks
+ */
+static size_t test_oplog();
+
+/**
+ * @brief Get random value, mostly small ones so that neighbours are close, sometimes extreme ones.
+ *
+ * @param range range of small values
+ * @return long long
+ */
+static long long test_random_value(const long long range);
+
+/**
+ * @brief Print failed check.
+ *
+ * @param failures counter of failed checks
+ * @param test name of the test
+ * @param description what did not match
+ * @param round round of the test the check failed in
+ */
+static void test_fail(size_t* const failures, const char* test, const char* description, const size_t round);
+
+static const int NUMBER_OF_TESTS = 3;
+static const struct {
+    const char* name;
+    test_function_t* function;
+} TESTS[NUMBER_OF_TESTS] = {
+    {"vecscan", test_vecscan},
+    {"intpack", test_intpack},
+    {"oplog", test_oplog},
+};
+
+int main() {
+    atexit(log_end_program);
+    log_init("test_log.log", STATUS_REPORTS + 1, &errno);
+
+    srand(TEST_SEED);
+
+    size_t failed_tests = 0;
+    for (int test_id = 0; test_id < NUMBER_OF_TESTS; ++test_id) {
+        size_t failures = TESTS[test_id].function();
+        printf("%-8s %s", TESTS[test_id].name, failures ? "FAILED" : "OK");
+        if (failures) printf(" (%lu checks)", (unsigned long)failures);
+        printf("\n");
+
+        failed_tests += failures != 0;
+    }
+
+    return failed_tests ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static size_t test_vecscan() {
+    size_t failures = 0;
+
+#ifdef VECSCAN_X86
+    __builtin_cpu_init();
+    if (!__builtin_cpu_supports("avx2")) {
+        printf("vecscan  processor does not support AVX2, only the dispatcher is checked.\n");
+    }
+    const VecscanKernels* vector = __builtin_cpu_supports("avx2") ? &VECSCAN_AVX2 : vecscan_kernels();
+#else
+    const VecscanKernels* vector = vecscan_kernels();
+#endif
+
+    //* Arrays start at random offsets, so the vector loops meet unaligned heads and tails of all lengths.
+    long long values[TEST_MAX_LENGTH + 4] = {};
+
+    for (size_t round = 0; round < TEST_ROUNDS; ++round) {
+        size_t offset = (size_t)rand() % 4;
+        size_t count = (size_t)rand() % TEST_MAX_LENGTH;
+        long long range = rand() % 2 ? 4 : LLONG_MAX;
+
+        for (size_t index = 0; index < count; ++index) values[offset + index] = test_random_value(range);
+        const long long* array = values + offset;
+
+        long long needle = count && rand() % 2 ? array[(size_t)rand() % count] : test_random_value(range);
+
+        if (vector->find_last(array, count, needle) != find_last_scalar(array, count, needle))
+            test_fail(&failures, "vecscan", "find_last", round);
+        if (vector->count(array, count, needle) != count_scalar(array, count, needle))
+            test_fail(&failures, "vecscan", "count", round);
+        if (vector->sum(array, count) != sum_scalar(array, count))
+            test_fail(&failures, "vecscan", "sum", round);
+
+        if (vecscan_find_last(array, count, needle) != find_last_scalar(array, count, needle) ||
+            vecscan_count(array, count, needle) != count_scalar(array, count, needle) ||
+            vecscan_sum(array, count) != sum_scalar(array, count))
+            test_fail(&failures, "vecscan", "dispatched kernels", round);
+
+        if (!count) continue;
+
+        if (vector->min(array, count) != min_scalar(array, count))
+            test_fail(&failures, "vecscan", "min", round);
+        if (vector->max(array, count) != max_scalar(array, count))
+            test_fail(&failures, "vecscan", "max", round);
+    }
+
+    return failures;
+}
+
+static size_t test_intpack() {
+    size_t failures = 0;
+
+    static const long long EDGES[] = {0, 1, -1, 63, -64, 64, 127, 128, LLONG_MAX, LLONG_MIN, LLONG_MAX - 1,
+                                      LLONG_MIN + 1};
+    for (size_t edge_id = 0; edge_id < sizeof(EDGES) / sizeof(*EDGES); ++edge_id) {
+        if (intpack_unzigzag(intpack_zigzag(EDGES[edge_id])) != EDGES[edge_id])
+            test_fail(&failures, "intpack", "zigzag", edge_id);
+
+        unsigned char varint[INTPACK_VARINT_MAX] = {};
+        uint64_t code = intpack_zigzag(EDGES[edge_id]);
+        size_t length = intpack_put_varint(code, varint);
+
+        uint64_t decoded = 0;
+        if (intpack_get_varint(varint, length, &decoded) != length || decoded != code)
+            test_fail(&failures, "intpack", "varint", edge_id);
+        if (intpack_get_varint(varint, length - 1, &decoded) != 0)
+            test_fail(&failures, "intpack", "truncated varint", edge_id);
+    }
+
+    long long values[TEST_MAX_LENGTH] = {};
+    long long decoded[TEST_MAX_LENGTH] = {};
+    unsigned char encoded[TEST_MAX_LENGTH * sizeof(uint64_t) + INTPACK_VARINT_MAX + 1 + sizeof(uint64_t)] = {};
+
+    for (size_t round = 0; round < TEST_ROUNDS; ++round) {
+        size_t count = (size_t)rand() % TEST_MAX_LENGTH;
+        long long range = rand() % 2 ? 1 << (rand() % 20) : LLONG_MAX;
+
+        //* Blocks of a stack are usually runs of close values, so neighbours are kept close in most blocks.
+        long long start = test_random_value(LLONG_MAX);
+        for (size_t index = 0; index < count; ++index)
+            values[index] = (long long)((uint64_t)(index ? values[index - 1] : start) +
+                                        (uint64_t)test_random_value(range));
+
+        size_t length = intpack_encode(values, count, encoded);
+        if (length > intpack_bound(count)) test_fail(&failures, "intpack", "bound", round);
+
+        memset(decoded, 0, sizeof(decoded));
+        intpack_decode(encoded, count, decoded);
+        if (memcmp(values, decoded, count * sizeof(*values))) test_fail(&failures, "intpack", "block", round);
+    }
+
+    return failures;
+}
+
+static size_t test_oplog() {
+    size_t failures = 0;
+
+    StackOp written[TEST_ROUNDS] = {};
+    long long values[TEST_ROUNDS][4] = {};
+    unsigned int handles[4] = {};
+
+    int oplog_status = 0;
+    stack_oplog_start(TEST_OPLOG_NAME, &oplog_status);
+    if (oplog_status) {
+        test_fail(&failures, "oplog", "start", 0);
+        return failures;
+    }
+
+    for (size_t round = 0; round < TEST_ROUNDS; ++round) {
+        StackOp* op = written + round;
+        unsigned int* handle = handles + rand() % 4;
+
+        op->op = rand() % STACK_OP_COUNT;
+        //* Operations that have no argument in STACK_OPS are logged without it.
+        bool has_argument = op->op != STACK_OP_DTOR && op->op != STACK_OP_POP && op->op != STACK_OP_PULL &&
+                            op->op != STACK_OP_MARK && op->op != STACK_OP_RELEASE;
+        op->argument = has_argument ? test_random_value(rand() % 2 ? 100 : LLONG_MAX) : 0;
+
+        if (op->op == STACK_OP_PUBLISH || op->op == STACK_OP_ADOPT) {
+            op->argument = rand() % 5;
+            for (long long index = 0; index < op->argument; ++index)
+                values[round][index] = test_random_value(LLONG_MAX);
+            op->values = values[round];
+        }
+
+        stack_oplog_record(op->op, handle, op->argument, op->values);
+        op->handle = *handle;
+    }
+
+    stack_oplog_stop(&oplog_status);
+    if (oplog_status) test_fail(&failures, "oplog", "stop", 0);
+
+    StackOplogReader reader = {};
+    stack_oplog_open(&reader, TEST_OPLOG_NAME, &oplog_status);
+    if (oplog_status) {
+        test_fail(&failures, "oplog", "open", 0);
+        return failures;
+    }
+
+    uint64_t time = 0;
+    StackOp read = {};
+    for (size_t round = 0; round < TEST_ROUNDS; ++round) {
+        if (!stack_oplog_next(&reader, &read)) {
+            test_fail(&failures, "oplog", "log ended early", round);
+            break;
+        }
+
+        const StackOp* op = written + round;
+        if (read.op != op->op || read.handle != op->handle || read.argument != op->argument)
+            test_fail(&failures, "oplog", "operation", round);
+        if (op->argument > 0 && op->values && memcmp(read.values, op->values, (size_t)op->argument * sizeof(*op->values)))
+            test_fail(&failures, "oplog", "values", round);
+        if (read.time < time) test_fail(&failures, "oplog", "time", round);
+        time = read.time;
+    }
+
+    if (stack_oplog_next(&reader, &read)) test_fail(&failures, "oplog", "operations after the end", TEST_ROUNDS);
+
+    stack_oplog_close(&reader);
+    remove(TEST_OPLOG_NAME);
+
+    return failures;
+}
+
+static long long test_random_value(const long long range) {
+    switch (rand() % 16) {
+        case 0:  return LLONG_MIN;
+        case 1:  return LLONG_MAX;
+        default: break;
+    }
+
+    uint64_t bits = ((uint64_t)rand() << 42) ^ ((uint64_t)rand() << 21) ^ (uint64_t)rand();
+    if (range == LLONG_MAX) return (long long)bits;
+    return (long long)(bits % (uint64_t)(2 * range + 1)) - range;
+}
+
+static void test_fail(size_t* const failures, const char* test, const char* description, const size_t round) {
+    if (*failures < 10) printf("%-8s %s does not match in round %lu.\n", test, description, (unsigned long)round);
+    ++*failures;
+}
\ No newline at end of file